@@ -6,6 +6,10 @@
 #include "../lib/zxtape/tzx_compat/macos/tzx_compat_macos_os_headers.h"
 #endif  // __ZX_TAPE_MACOS__
 
+#ifdef __ZX_TAPE_LINUX__
+#include "../lib/zxtape/tzx_compat/linux/tzx_compat_linux_os_headers.h"
+#endif  // __ZX_TAPE_LINUX__
+
 #ifdef __ZX_TAPE_CIRCLE__
 #include "../lib/zxtape/tzx_compat/circle/tzx_compat_circle_os_headers.h"
 #endif  // __ZX_TAPE_CIRCLE__
@@ -17,16 +21,25 @@ extern bool TZX_pauseOn;     // Pause state
 extern char TZX_fileName[];  // Current filename
 extern size_t TZX_filesize;  // Current file size
 extern void TZX_stopFile();
+extern void TZX_underrun();  // Call when the output ran out of data to play
+extern void TZX_refill(unsigned int nBufferLen);  // Call from the producer thread to buffer up to nBufferLen periods
+extern void TZX_timerLate(unsigned long long nLateNs);  // Call from the timer handler with how late it ran
+extern void TZX_overflow();  // Call when a period is dropped because the output buffer is full
+extern void TZX_outputPull(unsigned int nSamples, unsigned int nBufferCount,
+                           unsigned int nBufferCapacity);  // Call from the output with each pull (and the fill before)
 
 // TZX Compat APIs
 void TZXCompat_create(void);
 void TZXCompat_destroy(void);
 void TZXCompat_start(void);
 void TZXCompat_stop(void);
+void TZXCompat_poll(void);  // Deliver notifications the output deferred (e.g. the end of the tape), from zxtape_run()
 
 void TZXCompat_timerInitialize(void);
-void TZXCompat_timerStart(unsigned long periodUs);
+void TZXCompat_timerStartAt(unsigned long long deadlineNs);  // Arm the timer for an absolute deadline (getTickNs())
 void TZXCompat_timerStop(void);
+void TZXCompat_producerStart(unsigned int nLowWatermarkPercent, unsigned int nHighWatermarkPercent);
+void TZXCompat_producerStop(void);
 extern void TZXCompat_waveOrBuffer(bool bBuffer, unsigned int nBufferLen,
                                    unsigned long nBufferPeriodUs);  // Function to call on Timer interrupt
 
@@ -34,6 +47,7 @@ void TZXCompat_setAudioLow(void);   // Set the GPIO output pin low
 void TZXCompat_setAudioHigh(void);  // Set the GPIO output pin high
 
 unsigned int TZXCompat_getTickMs(void);
+unsigned long long TZXCompat_getTickNs(void);  // Monotonic time in nanoseconds
 void TZXCompat_delay(unsigned long time);
 void TZXCompat_noInterrupts(void);  // Disable interrupts
 void TZXCompat_interrupts(void);    // Enable interrupts
@@ -0,0 +1,38 @@
+#ifndef _tzx_compat_impl_linux_h_
+#define _tzx_compat_impl_linux_h_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum _TZX_LINUX_SINK_T {
+  TZX_LINUX_SINK_NULL = 0,    // Discard the output (timing only)
+  TZX_LINUX_SINK_WAV = 1,     // 8-bit unsigned mono WAV file (pSinkPath)
+  TZX_LINUX_SINK_RAW = 2,     // 8-bit unsigned mono raw samples to a file (pSinkPath)
+  TZX_LINUX_SINK_STDOUT = 3,  // 8-bit unsigned mono raw samples to stdout (e.g. | aplay -f U8 -r 44100)
+} TZX_LINUX_SINK_T;
+
+typedef struct _TZX_LINUX_CONFIG_T {
+  TZX_LINUX_SINK_T sink;      // Where the output samples are written
+  const char *pSinkPath;      // Path of the output file (WAV / raw sinks)
+  unsigned int nSampleRate;   // Output sample rate (Hz)
+  unsigned int nIntervalMs;   // Period of the output thread (ms)
+  int nRealtimePriority;      // SCHED_FIFO priority of the output threads (0 = normal scheduling)
+  int nCpu;                   // CPU to pin the output threads to (-1 = no pinning)
+  unsigned char bLockMemory;  // Lock all process memory (mlockall) to avoid page faults on the output threads
+} TZX_LINUX_CONFIG_T;
+
+typedef struct _TZX_LINUX_STATS_T {
+  unsigned long long nSamplesWritten;  // Samples written to the sink
+} TZX_LINUX_STATS_T;
+
+/* Exported functions */
+void TZXCompatLinux_getDefaultConfig(TZX_LINUX_CONFIG_T *pConfig);
+void TZXCompatLinux_configure(const TZX_LINUX_CONFIG_T *pConfig);  // Call before zxtape_init()
+void TZXCompatLinux_getStats(TZX_LINUX_STATS_T *pStats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // _tzx_compat_impl_linux_h_
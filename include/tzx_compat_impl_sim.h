@@ -0,0 +1,45 @@
+#ifndef _tzx_compat_impl_sim_h_
+#define _tzx_compat_impl_sim_h_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Called with each interval of output samples (8-bit unsigned mono)
+ */
+typedef void (*TZX_SIM_SAMPLES_CALLBACK_T)(const unsigned char *pSamples, unsigned int nCount, void *pUserData);
+
+/**
+ * Called with each period buffered for output (level and length)
+ */
+typedef void (*TZX_SIM_PULSE_CALLBACK_T)(unsigned char nLevel, unsigned long nPeriodUs, void *pUserData);
+
+typedef struct _TZX_SIM_CONFIG_T {
+  unsigned int nSampleRate;               // Output sample rate (Hz)
+  unsigned int nIntervalMs;               // Period of the simulated audio pull (ms)
+  unsigned long long nStartTimeNs;        // Virtual clock at start
+  unsigned char bLog;                     // Write log messages to stderr
+  TZX_SIM_SAMPLES_CALLBACK_T pfnSamples;  // Optional, observe the output samples
+  TZX_SIM_PULSE_CALLBACK_T pfnPulse;      // Optional, observe the buffered periods
+  void *pUserData;                        // User data passed to the callbacks
+} TZX_SIM_CONFIG_T;
+
+typedef struct _TZX_SIM_STATS_T {
+  unsigned long long nSamplesWritten;  // Samples output
+  unsigned long nTimerFires;           // Times the output timer fired
+  unsigned long nRefills;              // Times the producer refilled the output buffer
+} TZX_SIM_STATS_T;
+
+/* Exported functions */
+void TZXCompatSim_getDefaultConfig(TZX_SIM_CONFIG_T *pConfig);
+void TZXCompatSim_configure(const TZX_SIM_CONFIG_T *pConfig);  // Call before zxtape_init()
+void TZXCompatSim_advance(unsigned long long nDurationNs);     // Advance the virtual clock, running due deadlines
+unsigned long long TZXCompatSim_getTimeNs(void);
+void TZXCompatSim_getStats(TZX_SIM_STATS_T *pStats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // _tzx_compat_impl_sim_h_
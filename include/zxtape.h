@@ -60,16 +60,110 @@ typedef struct _ZXTAPE_STATUS_T {
   const char *pFilename;
   u32 nTrackCount;
   u32 nLength;
+  u64 nTimerLateNs;     // How late the output timer last ran compared to its deadline (nanoseconds)
+  u64 nTimerMaxLateNs;  // How late the output timer ran at worst since playback started (nanoseconds)
 } ZXTAPE_STATUS_T;
 
 typedef struct _ZXTAPE_HANDLE_T {
   u32 nInstanceId;
 } ZXTAPE_HANDLE_T;
 
+#define ZXTAPE_INDEX_NONE 0xFFFFFFFF  // Block / section index is not known
+
+#define ZXTAPE_RENDER_LEVEL_HIGH 0x3FFF    // zxtape_render() value of a high output
+#define ZXTAPE_RENDER_LEVEL_LOW (-0x3FFF)  // zxtape_render() value of a low output
+
+#define ZXTAPE_EAR_CLOCK_HZ 3500000               // Default zxtape_earAt() T-states per second (48K Spectrum)
+#define ZXTAPE_TSTATE_NONE 0xFFFFFFFFFFFFFFFFull  // No T-state (e.g. no next edge)
+
+#define ZXTAPE_EDGE_BATCH_LENGTH 64  // Default (and maximum 4x) edges per zxtape_setEdgeScheduler() batch
+
+typedef enum _ZXTAPE_EVENT_TYPE_T {
+  ZXTAPE_EVENT_BLOCK_START = 0,    // A new block started (nBlockIndex, nBlockId, nValue = file offset)
+  ZXTAPE_EVENT_SECTION_START = 1,  // A new section started (nSectionIndex, nBlockIndex)
+  ZXTAPE_EVENT_STOP_TAPE = 2,      // A 'Stop the tape' block was reached (nValue = 1 if only in 48K mode)
+  ZXTAPE_EVENT_PAUSE = 3,          // A pause (silence) started (nValue = pause length in ms)
+  ZXTAPE_EVENT_END_OF_DATA = 4,    // The end of the tape data was reached
+  ZXTAPE_EVENT_UNDERRUN = 5,       // The output ran out of data to play
+} ZXTAPE_EVENT_TYPE_T;
+
+typedef struct _ZXTAPE_PULSE_T {
+  u8 nLevel;      // Output level for the period
+  u32 nPeriodUs;  // Length of the period (microseconds)
+} ZXTAPE_PULSE_T;
+
+typedef struct _ZXTAPE_PULSE_RECORD_T {
+  u8 nLevel;             // Output level (0 or 1)
+  u32 nDurationTstates;  // Length of the pulse (T-states at the EAR clock, see zxtape_setEarClock())
+  u32 nBlockIndex;       // Index of the block the pulse belongs to (ZXTAPE_INDEX_NONE if unknown)
+} ZXTAPE_PULSE_RECORD_T;
+
+typedef struct _ZXTAPE_BLOCK_DATA_T {
+  u8 nBlockId;          // TZX ID of the block (0xFE for TAP file blocks)
+  u32 nOffset;          // File offset of the payload (the flag byte)
+  u32 nLength;          // Length of the payload (flag, data and checksum bytes)
+  const u8 *pData;      // Payload (in the tape buffer, or the caller's buffer), or NULL if not read
+  u8 nFlag;             // First byte of the payload (0x00 header, 0xFF data for ROM blocks)
+  u8 nChecksum;         // Last byte of the payload
+  bool bChecksumValid;  // The payload XORs to 0 (the ROM checksum), only set when the payload was read
+  u8 nUsedBits;         // Bits used in the last byte (8 unless the block says otherwise)
+  u16 nPauseMs;         // Pause after the block (ms)
+} ZXTAPE_BLOCK_DATA_T;
+
+typedef struct _ZXTAPE_EVENT_T {
+  ZXTAPE_EVENT_TYPE_T type;
+  u32 nTickMs;        // Host time the event was raised (TZXCompat_getTickMs())
+  u64 nTapeTimeUs;    // Position of the event on the tape output timeline (us from start of playback)
+  u32 nBlockIndex;    // Index of the current block (ZXTAPE_INDEX_NONE if unknown)
+  u32 nSectionIndex;  // Index of the current section (ZXTAPE_INDEX_NONE if unknown)
+  u8 nBlockId;        // TZX ID of the current block (0xFE for TAP file blocks)
+  u32 nValue;         // Event specific value
+} ZXTAPE_EVENT_T;
+
+/**
+ * Output sink, receives the tape signal as batches of pulses in order (see zxtape_setSink()). The built-in sinks are
+ * in zxtape_sink.h.
+ */
+typedef struct _ZXTAPE_SINK_T {
+  void (*write)(void *pContext, const ZXTAPE_PULSE_T *pPulses, unsigned nCount);  // Write a batch of pulses
+  void (*end)(void *pContext);  // Playback stopped (optional, may be NULL)
+  void *pContext;               // Passed to the functions
+} ZXTAPE_SINK_T;
+
+typedef struct _ZXTAPE_EDGE_T {
+  u64 nTimeNs;  // When to set the level (absolute, on the TZXCompat_getTickNs() clock)
+  u8 nLevel;    // Level to set (0 or 1)
+} ZXTAPE_EDGE_T;
+
+/**
+ * Edge scheduler, hands the platform the tape signal as edges at absolute times (see zxtape_setEdgeScheduler()), e.g.
+ * for a DMA fed PWM / GPIO or a hardware timer compare queue, so the platform only needs to wake once per batch.
+ */
+typedef struct _ZXTAPE_EDGE_SCHEDULER_T {
+  unsigned (*space)(void *pContext);  // Number of edges the platform can queue now
+  void (*schedule)(void *pContext, const ZXTAPE_EDGE_T *pEdges, unsigned nCount);  // Queue a batch of edges
+  void (*end)(void *pContext);  // Playback stopped, no more edges (those queued still play) (optional, may be NULL)
+  void *pContext;               // Passed to the functions
+  unsigned nBatchEdges;         // Edges per batch (0 for the default, ZXTAPE_EDGE_BATCH_LENGTH)
+  unsigned nLeadUs;             // Time from scheduling the first edge to playing it (after starting, or a gap)
+} ZXTAPE_EDGE_SCHEDULER_T;
+
+/**
+ * Event callback, called from zxtape_dispatchEvents() on the thread of the host's choosing
+ */
+typedef void (*ZXTAPE_EVENT_CALLBACK_T)(ZXTAPE_HANDLE_T *pInstance, const ZXTAPE_EVENT_T *pEvent, void *pUserData);
+
+/**
+ * Event notification, called from the thread raising the event (possibly a real-time thread) when an event is
+ * queued. Must not block; typically used to wake the host thread which calls zxtape_dispatchEvents().
+ */
+typedef void (*ZXTAPE_EVENT_NOTIFY_T)(ZXTAPE_HANDLE_T *pInstance, void *pUserData);
+
 /* Exported functions */
 ZXTAPE_HANDLE_T *zxtape_create();
 void zxtape_destroy(ZXTAPE_HANDLE_T *pInstance);
 void zxtape_init(ZXTAPE_HANDLE_T *pInstance);
+void zxtape_status(ZXTAPE_HANDLE_T *pInstance, ZXTAPE_STATUS_T *pStatus);
 bool zxtape_loadFile(ZXTAPE_HANDLE_T *pInstance, const char *pFilename);
 void zxtape_loadBuffer(ZXTAPE_HANDLE_T *pInstance, const char *pFilename, const unsigned char *pTapeBuffer,
                        unsigned long nTapeBufferLen);
@@ -83,6 +177,25 @@ bool zxtape_isStarted(ZXTAPE_HANDLE_T *pInstance);
 bool zxtape_isPlaying(ZXTAPE_HANDLE_T *pInstance);
 bool zxtape_isPaused(ZXTAPE_HANDLE_T *pInstance);
 void zxtape_run(ZXTAPE_HANDLE_T *pInstance, unsigned nIntervalMs);
+void zxtape_setEventCallback(ZXTAPE_HANDLE_T *pInstance, ZXTAPE_EVENT_CALLBACK_T pfnCallback,
+                             ZXTAPE_EVENT_NOTIFY_T pfnNotify, void *pUserData);
+unsigned zxtape_dispatchEvents(ZXTAPE_HANDLE_T *pInstance);
+void zxtape_setProducer(ZXTAPE_HANDLE_T *pInstance, bool bEnable, unsigned nLowWatermarkPercent,
+                        unsigned nHighWatermarkPercent);
+void zxtape_setRenderMode(ZXTAPE_HANDLE_T *pInstance, bool bEnable);
+void zxtape_render(ZXTAPE_HANDLE_T *pInstance, i16 *pOut, unsigned nFrames, unsigned nSampleRate);
+void zxtape_renderBits(ZXTAPE_HANDLE_T *pInstance, u32 *pOut, unsigned nWords, unsigned nBitRate);
+void zxtape_setEarClock(ZXTAPE_HANDLE_T *pInstance, unsigned nClockHz);
+u8 zxtape_earAt(ZXTAPE_HANDLE_T *pInstance, u64 nTstate);
+u64 zxtape_nextEdge(ZXTAPE_HANDLE_T *pInstance);
+u32 zxtape_getBlockCount(ZXTAPE_HANDLE_T *pInstance);
+bool zxtape_getBlockData(ZXTAPE_HANDLE_T *pInstance, u32 nBlockIndex, ZXTAPE_BLOCK_DATA_T *pData, u8 *pBuffer,
+                         u32 nBufferLen);
+void zxtape_setStartBlock(ZXTAPE_HANDLE_T *pInstance, u32 nBlockIndex);
+void zxtape_setSink(ZXTAPE_HANDLE_T *pInstance, const ZXTAPE_SINK_T *pSink);
+u64 zxtape_writeSink(ZXTAPE_HANDLE_T *pInstance, u64 nMaxUs);
+void zxtape_setEdgeScheduler(ZXTAPE_HANDLE_T *pInstance, const ZXTAPE_EDGE_SCHEDULER_T *pScheduler);
+unsigned zxtape_readPulses(ZXTAPE_HANDLE_T *pInstance, ZXTAPE_PULSE_RECORD_T *pRecords, unsigned nMaxRecords);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,31 @@
+#ifndef _zxtape_convert_h_
+#define _zxtape_convert_h_
+
+#include "zxtape.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef __ZX_TAPE_CIRCLE__
+
+/**
+ * Tape conversion results (see zxtape_convertToWav())
+ */
+typedef struct _ZXTAPE_CONVERT_STATS_T {
+  u32 nShards;   // Parts the tape was split into (1 if it was rendered serially)
+  u32 nWorkers;  // Worker threads used (0 if the tape was rendered serially in the calling thread)
+  u64 nSamples;  // Samples written
+} ZXTAPE_CONVERT_STATS_T;
+
+/* Exported functions */
+bool zxtape_convertToWav(const char *pFilename, const u8 *pTape, u32 nTapeLen, const char *pWavFilename,
+                         u32 nSampleRate, u32 nWorkers, ZXTAPE_CONVERT_STATS_T *pStats);
+
+#endif  // __ZX_TAPE_CIRCLE__
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // _zxtape_convert_h_
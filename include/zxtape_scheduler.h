@@ -0,0 +1,47 @@
+#ifndef _zxtape_scheduler_h_
+#define _zxtape_scheduler_h_
+
+#include "zxtape.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef __ZX_TAPE_CIRCLE__
+
+#define ZXTAPE_SCHEDULER_LEAD_US 200000  // Default tape written ahead of real time (see zxtape_scheduleInstance())
+#define ZXTAPE_SCHEDULER_MAX_THREADS 16  // Most threads in a scheduler pool
+
+/**
+ * Scheduler, feeds the sinks of many instances in real time from a small pool of threads (see
+ * zxtape_createScheduler())
+ *
+ * Deadlines are on the monotonic clock. Generation is serialised under the global engine lock whatever the number of
+ * threads: only sink writes run in parallel, and each switch between instances saves and restores the engine state
+ * (about 1.5 KB each way). More threads keep instances on time while a slow sink blocks, they do not add throughput.
+ */
+typedef struct _ZXTAPE_SCHEDULER_HANDLE_T {
+  u32 nThreads;  // Threads in the pool
+} ZXTAPE_SCHEDULER_HANDLE_T;
+
+typedef struct _ZXTAPE_SCHEDULER_STATS_T {
+  u32 nInstances;  // Instances scheduled
+  u64 nServices;   // Times an instance was topped up
+  u64 nLate;       // Times an instance was topped up after its sink ran dry (its timeline restarted from then)
+  u64 nMaxLateNs;  // Latest an instance was topped up after its deadline (nanoseconds)
+} ZXTAPE_SCHEDULER_STATS_T;
+
+/* Exported functions */
+ZXTAPE_SCHEDULER_HANDLE_T *zxtape_createScheduler(u32 nThreads);
+void zxtape_destroyScheduler(ZXTAPE_SCHEDULER_HANDLE_T *pScheduler);
+bool zxtape_scheduleInstance(ZXTAPE_SCHEDULER_HANDLE_T *pScheduler, ZXTAPE_HANDLE_T *pInstance, u32 nLeadUs);
+void zxtape_unscheduleInstance(ZXTAPE_SCHEDULER_HANDLE_T *pScheduler, ZXTAPE_HANDLE_T *pInstance);
+void zxtape_getSchedulerStats(ZXTAPE_SCHEDULER_HANDLE_T *pScheduler, ZXTAPE_SCHEDULER_STATS_T *pStats);
+
+#endif  // __ZX_TAPE_CIRCLE__
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // _zxtape_scheduler_h_
@@ -0,0 +1,129 @@
+#ifndef _zxtape_server_h_
+#define _zxtape_server_h_
+
+#include "zxtape.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef __ZX_TAPE_CIRCLE__
+
+#define ZXTAPE_SERVER_MAX_CLIENTS 64                  // Most connections at once
+#define ZXTAPE_SERVER_MAX_SESSIONS 1024               // Most sessions at once (all connections)
+#define ZXTAPE_SERVER_MAX_PAYLOAD (16 * 1024 * 1024)  // Longest message payload (bytes)
+#define ZXTAPE_SERVER_NAME_LEN 64                     // Length of the name fields (NUL padded)
+#define ZXTAPE_SERVER_SHM_PREFIX "/zxtaped."          // Prefix of the shared memory objects the server creates
+
+//
+// Tape server protocol (see zxtape_createServer())
+//
+// Messages are sent both ways over a Unix domain stream socket, each a ZXTAPE_SERVER_MESSAGE_T header then nLength
+// bytes of payload. All fields are native endian. A client may send any number of requests without waiting for the
+// replies (pipelining); each request gets exactly one reply, in the order the requests were sent, with the same type
+// and tag. The server also pushes messages (ZXTAPE_SERVER_FLAG_PUSH) for the sessions the connection opened: an event
+// message for each tape event, and a status message each time playback stops. A session is closed when the connection
+// which opened it closes.
+//
+
+typedef enum _ZXTAPE_SERVER_MSG_T {
+  ZXTAPE_SERVER_MSG_OPEN = 1,    // Open a session (ZXTAPE_SERVER_OPEN_T), the reply has its nSessionId
+  ZXTAPE_SERVER_MSG_CLOSE = 2,   // Close a session
+  ZXTAPE_SERVER_MSG_LOAD = 3,    // Load a tape (ZXTAPE_SERVER_LOAD_T, then the contents of the TZX or TAP file)
+  ZXTAPE_SERVER_MSG_PLAY = 4,    // Play from the start, or continue if paused
+  ZXTAPE_SERVER_MSG_PAUSE = 5,   // Pause if playing
+  ZXTAPE_SERVER_MSG_STOP = 6,    // Stop (and rewind)
+  ZXTAPE_SERVER_MSG_SEEK = 7,    // Play from a block (u32 block index), if playing, else when next played
+  ZXTAPE_SERVER_MSG_STATUS = 8,  // Get the status (the reply and pushes are a ZXTAPE_SERVER_STATUS_T)
+  ZXTAPE_SERVER_MSG_EVENT = 9,   // Tape event (push only, ZXTAPE_SERVER_EVENT_T)
+} ZXTAPE_SERVER_MSG_T;
+
+typedef enum _ZXTAPE_SERVER_RESULT_T {
+  ZXTAPE_SERVER_RESULT_OK = 0,
+  ZXTAPE_SERVER_RESULT_BAD_REQUEST = 1,  // Unknown type, or the payload is the wrong length
+  ZXTAPE_SERVER_RESULT_NO_SESSION = 2,   // No such session open on this connection
+  ZXTAPE_SERVER_RESULT_NO_TAPE = 3,      // No tape loaded
+  ZXTAPE_SERVER_RESULT_FAILED = 4,       // The session or its output could not be created
+  ZXTAPE_SERVER_RESULT_TOO_MANY = 5,     // ZXTAPE_SERVER_MAX_SESSIONS are open
+  ZXTAPE_SERVER_RESULT_IN_USE = 6,       // The shared memory name is used by another session
+} ZXTAPE_SERVER_RESULT_T;
+
+#define ZXTAPE_SERVER_FLAG_REPLY 0x01  // Message is a reply to a request
+#define ZXTAPE_SERVER_FLAG_PUSH 0x02   // Message was pushed by the server
+
+/**
+ * Message header (16 bytes)
+ */
+typedef struct _ZXTAPE_SERVER_MESSAGE_T {
+  u32 nLength;     // Bytes of payload following the header
+  u16 nType;       // ZXTAPE_SERVER_MSG_T
+  u8 nFlags;       // ZXTAPE_SERVER_FLAG_* (0 in requests)
+  u8 nResult;      // ZXTAPE_SERVER_RESULT_T (replies, else 0)
+  u32 nTag;        // Chosen by the client, returned in the reply (0 in pushes)
+  u32 nSessionId;  // Session (0 for none, OPEN requests)
+} ZXTAPE_SERVER_MESSAGE_T;
+
+/**
+ * OPEN request payload (80 bytes). The session plays in real time to a shared memory sink (see zxtape_shm.h) if
+ * shmName is given, else only counts what it plays. The server creates the object ZXTAPE_SERVER_SHM_PREFIX followed by
+ * shmName (e.g. "/zxtaped.deck1"), which must not exist, and removes it when the session closes.
+ */
+typedef struct _ZXTAPE_SERVER_OPEN_T {
+  u32 nLeadUs;                           // Tape written ahead of real time (0 for ZXTAPE_SCHEDULER_LEAD_US)
+  u32 nPulseLength;                      // Shared memory pulse ring length (pulses, power of 2)
+  u32 nPcmLength;                        // Shared memory PCM ring length (samples, power of 2, 0 for no PCM)
+  u32 nSampleRate;                       // Shared memory PCM sample rate (Hz)
+  char shmName[ZXTAPE_SERVER_NAME_LEN];  // Shared memory name (no '/'), or empty for no output
+} ZXTAPE_SERVER_OPEN_T;
+
+/**
+ * LOAD request payload header (64 bytes), followed by the file contents
+ */
+typedef struct _ZXTAPE_SERVER_LOAD_T {
+  char name[ZXTAPE_SERVER_NAME_LEN];  // File name, for its type (".tzx" or ".tap")
+} ZXTAPE_SERVER_LOAD_T;
+
+/**
+ * STATUS reply and push payload (32 bytes)
+ */
+typedef struct _ZXTAPE_SERVER_STATUS_T {
+  u8 bLoaded;       // A tape is loaded
+  u8 bStarted;      // Playing or paused
+  u8 bPaused;       // Paused
+  u8 reserved;      // 0
+  u32 nBlockCount;  // Blocks in the tape
+  u32 nBlockIndex;  // Block playing (ZXTAPE_INDEX_NONE if none)
+  u32 nEnds;        // Times playback stopped
+  u64 nPulses;      // Pulses played since the session opened
+  u64 nTimeUs;      // Tape played since the session opened (us)
+} ZXTAPE_SERVER_STATUS_T;
+
+/**
+ * EVENT push payload (24 bytes), as ZXTAPE_EVENT_T
+ */
+typedef struct _ZXTAPE_SERVER_EVENT_T {
+  u32 nType;          // ZXTAPE_EVENT_TYPE_T
+  u32 nBlockIndex;    // Index of the current block (ZXTAPE_INDEX_NONE if unknown)
+  u32 nSectionIndex;  // Index of the current section (ZXTAPE_INDEX_NONE if unknown)
+  u32 nValue;         // Event specific value
+  u64 nTapeTimeUs;    // Position of the event on the tape output timeline (us from start of playback)
+} ZXTAPE_SERVER_EVENT_T;
+
+/**
+ * Tape server (see zxtape_createServer())
+ */
+typedef struct _ZXTAPE_SERVER_HANDLE_T {
+  u32 nWorkers;  // Threads playing the sessions
+} ZXTAPE_SERVER_HANDLE_T;
+
+/* Exported functions */
+ZXTAPE_SERVER_HANDLE_T *zxtape_createServer(const char *pSocketPath, u32 nWorkers);
+void zxtape_destroyServer(ZXTAPE_SERVER_HANDLE_T *pServer);
+
+#endif  // __ZX_TAPE_CIRCLE__
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // _zxtape_server_h_
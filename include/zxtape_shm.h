@@ -0,0 +1,107 @@
+#ifndef _zxtape_shm_h_
+#define _zxtape_shm_h_
+
+#include "zxtape.h"
+#include "zxtape_sink.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef __ZX_TAPE_CIRCLE__
+
+#define ZXTAPE_SHM_MAGIC 0x4D53585A  // "ZXSM" (little endian)
+#define ZXTAPE_SHM_VERSION 1         // Version of the layout
+#define ZXTAPE_SHM_MAX_NAME_LEN 63   // Longest shared memory object name
+
+//
+// Shared memory output, for consumers in other processes (see zxtape_openShmSink())
+//
+// Layout of the shared memory object (all fields native endian, 32-bit, naturally aligned):
+//
+//   0  ZXTAPE_SHM_HEADER_T (64 bytes)
+//   pulses.nOffset  Pulse ring: pulses.nLength u32 records, the level (ZXTAPE_SINK_RECORD_LEVEL) and length
+//                   (ZXTAPE_SINK_RECORD_PERIOD), as the fan-out sink
+//   pcm.nOffset     PCM ring: pcm.nLength i16 samples, mono (ZXTAPE_RENDER_LEVEL_LOW to ZXTAPE_RENDER_LEVEL_HIGH), as
+//                   zxtape_render() at nSampleRate. Absent if pcm.nLength is 0.
+//
+// There is one writer, the sink, and any number of readers, which only write nWaiters. Indexes are free-running and
+// wrap; record i of a ring is at (i & (nLength - 1)). The writer never waits for the readers. To write records it:
+//   1. stores nClaimIndex = nWriteIndex + count, then a release fence
+//   2. stores the records
+//   3. stores nWriteIndex = nClaimIndex (release), then increments nSequence (release), and wakes any waiters
+// To read records from its own index, a reader:
+//   1. loads nWriteIndex (acquire); if more than nLength ahead, the reader fell behind, and skips to nWriteIndex -
+//      nLength
+//   2. copies the records up to nWriteIndex, then an acquire fence
+//   3. loads nClaimIndex; any records copied before nClaimIndex - nLength may have been overwritten while copied, so
+//      are skipped, and the read tried again
+// To wait for more, a reader loads nSequence, checks there is nothing to read, increments nWaiters, waits while
+// nSequence is unchanged (a futex on Linux, shared between processes, else polling), and decrements nWaiters.
+//
+
+/**
+ * Ring in the shared memory object
+ */
+typedef struct _ZXTAPE_SHM_RING_T {
+  u32 nOffset;      // Bytes from the start of the object to the records
+  u32 nLength;      // Records (power of 2, 0 if absent)
+  u32 nClaimIndex;  // Records the writer has started to write
+  u32 nWriteIndex;  // Records written
+} ZXTAPE_SHM_RING_T;
+
+/**
+ * Header at the start of the shared memory object (64 bytes)
+ */
+typedef struct _ZXTAPE_SHM_HEADER_T {
+  u32 nMagic;                // ZXTAPE_SHM_MAGIC (stored last, once the rest of the header is valid)
+  u32 nVersion;              // ZXTAPE_SHM_VERSION
+  u32 nSize;                 // Size of the object (bytes)
+  u32 nSampleRate;           // PCM sample rate (Hz)
+  u32 nEnds;                 // Times playback stopped (incremented with nSequence)
+  u32 nSequence;             // Incremented each time anything is written (the futex word)
+  u32 nWaiters;              // Readers waiting on nSequence
+  u32 reserved;              // 0
+  ZXTAPE_SHM_RING_T pulses;  // Pulse ring
+  ZXTAPE_SHM_RING_T pcm;     // PCM ring
+} ZXTAPE_SHM_HEADER_T;
+
+/**
+ * Shared memory sink (writer)
+ */
+typedef struct _ZXTAPE_SINK_SHM_T {
+  ZXTAPE_SINK_T sink;
+  ZXTAPE_SHM_HEADER_T *pHeader;  // Mapped object
+  ZXTAPE_SINK_PCM_T pcm;         // Part sample so far
+  char name[ZXTAPE_SHM_MAX_NAME_LEN + 1];
+} ZXTAPE_SINK_SHM_T;
+
+/**
+ * Shared memory reader (any process, one thread per reader)
+ */
+typedef struct _ZXTAPE_SHM_READER_T {
+  ZXTAPE_SHM_HEADER_T *pHeader;  // Mapped object
+  u32 nPulseIndex;               // Next pulse to read
+  u32 nPcmIndex;                 // Next sample to read
+  u32 nSequence;                 // nSequence when the reader last woke (see zxtape_waitShmReader())
+  u64 nPulsesDropped;            // Pulses missed because the reader fell more than the ring behind
+  u64 nSamplesDropped;           // Samples missed because the reader fell more than the ring behind
+} ZXTAPE_SHM_READER_T;
+
+/* Exported functions */
+bool zxtape_openShmSink(ZXTAPE_SINK_SHM_T *pShm, const char *pName, u32 nPulseLength, u32 nPcmLength,
+                        u32 nSampleRate);
+void zxtape_closeShmSink(ZXTAPE_SINK_SHM_T *pShm);
+bool zxtape_openShmReader(ZXTAPE_SHM_READER_T *pReader, const char *pName);
+void zxtape_closeShmReader(ZXTAPE_SHM_READER_T *pReader);
+u32 zxtape_readShmPulses(ZXTAPE_SHM_READER_T *pReader, ZXTAPE_PULSE_T *pOut, u32 nMax);
+u32 zxtape_readShmPcm(ZXTAPE_SHM_READER_T *pReader, i16 *pOut, u32 nMax);
+bool zxtape_waitShmReader(ZXTAPE_SHM_READER_T *pReader, u32 nTimeoutUs);
+
+#endif  // __ZX_TAPE_CIRCLE__
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // _zxtape_shm_h_
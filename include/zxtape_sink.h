@@ -0,0 +1,141 @@
+#ifndef _zxtape_sink_h_
+#define _zxtape_sink_h_
+
+#include "zxtape.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define ZXTAPE_SINK_WAV_BUFFER_LENGTH 4096                        // Samples buffered before writing to the WAV file
+#define ZXTAPE_SINK_PCM_GAIN_UNITY 256                            // PCM gain of 1
+#define ZXTAPE_SINK_FANOUT_GAIN_UNITY ZXTAPE_SINK_PCM_GAIN_UNITY  // Fan-out reader gain of 1
+#define ZXTAPE_SINK_RECORD_LEVEL 0x80000000                       // Pulse record (fan-out, shm): level is high
+#define ZXTAPE_SINK_RECORD_PERIOD 0x7FFFFFFF                      // Pulse record: length of the pulse (us)
+
+//
+// Built-in output sinks (see zxtape_setSink()). Each embeds its ZXTAPE_SINK_T, so pass &x.sink to zxtape_setSink().
+//
+// There is no GPIO sink: device output (the pin or audio of the compatibility layer implementation, outside render
+// mode) is not routed through a sink. A sink gets batches of pulses as fast as they are generated, ahead of the time
+// they play, whereas the device path sets the level at the time of each edge, from the implementation's timer
+// (TZXCompat_setAudioLow() / TZXCompat_setAudioHigh()), and pulls from the implementation's own buffer. To drive a pin
+// from batches in render mode, queue them as timed edges with an edge scheduler (see zxtape_setEdgeScheduler()).
+//
+
+/**
+ * Counting sink: no output, only totals (e.g. for benchmarks)
+ */
+typedef struct _ZXTAPE_SINK_COUNT_T {
+  ZXTAPE_SINK_T sink;
+  u64 nBatches;  // Batches written
+  u64 nPulses;   // Pulses written
+  u64 nTimeUs;   // Total length of the pulses (us)
+  u64 nHighUs;   // Total length of the pulses at the high level (us)
+  u32 nEnds;     // Times playback stopped
+} ZXTAPE_SINK_COUNT_T;
+
+/**
+ * Pulse list sink: every pulse, in an array which grows as required
+ */
+typedef struct _ZXTAPE_SINK_LIST_T {
+  ZXTAPE_SINK_T sink;
+  ZXTAPE_PULSE_T *pPulses;
+  u32 nCount;
+  u32 nCapacity;
+} ZXTAPE_SINK_LIST_T;
+
+/**
+ * Pulse to PCM conversion (mono 16-bit, ZXTAPE_RENDER_LEVEL_LOW to ZXTAPE_RENDER_LEVEL_HIGH at unity gain), as
+ * zxtape_render()
+ */
+typedef struct _ZXTAPE_SINK_PCM_T {
+  u32 nSampleRate;
+  u32 nGain;            // ZXTAPE_SINK_PCM_GAIN_UNITY is 1 (the samples are clipped)
+  u64 nFilled;          // Part of the current sample so far (us * nSampleRate)
+  u64 nHigh;            // Part of the current sample at the high level (us * nSampleRate)
+  u64 nPulseRemaining;  // Rest of the pulse being converted (us * nSampleRate)
+  bool bPulseHigh;      // Level of the pulse being converted
+} ZXTAPE_SINK_PCM_T;
+
+/**
+ * PCM ring sink: samples for a consumer on another thread (single producer, single consumer). Samples which do not
+ * fit are dropped and counted.
+ */
+typedef struct _ZXTAPE_SINK_RING_T {
+  ZXTAPE_SINK_T sink;
+  ZXTAPE_SINK_PCM_T pcm;
+  i16 *pSamples;
+  u32 nLength;  // Power of 2
+  u32 nWriteIndex;
+  u32 nReadIndex;
+  u64 nDropped;  // Samples dropped because the ring was full
+} ZXTAPE_SINK_RING_T;
+
+/**
+ * Fan-out sink: the pulses of one instance broadcast to any number of readers, through a ring the readers only read.
+ * Each reader has its own cursor, format, sample rate and gain (see zxtape_initFanoutReader()). The writer never waits
+ * for the readers: a reader which falls more than the ring behind skips to the oldest pulse still in it, and counts the
+ * pulses it missed.
+ */
+typedef struct _ZXTAPE_SINK_FANOUT_T {
+  ZXTAPE_SINK_T sink;
+  u32 *pRecords;    // Pulses, packed as the level (ZXTAPE_SINK_RECORD_LEVEL) and length (ZXTAPE_SINK_RECORD_PERIOD)
+  u32 nLength;      // Power of 2
+  u32 nClaimIndex;  // Pulses the writer has started to write (published before the records are overwritten)
+  u32 nWriteIndex;  // Pulses written (published after)
+  u32 nEnds;        // Times playback stopped
+} ZXTAPE_SINK_FANOUT_T;
+
+typedef enum _ZXTAPE_SINK_FANOUT_FORMAT_T {
+  ZXTAPE_SINK_FANOUT_FORMAT_PULSES = 0,  // ZXTAPE_PULSE_T, as written to the sink
+  ZXTAPE_SINK_FANOUT_FORMAT_S16 = 1,     // Mono signed 16-bit PCM (i16), as zxtape_render() at unity gain
+  ZXTAPE_SINK_FANOUT_FORMAT_U8 = 2,      // Mono unsigned 8-bit PCM (u8, 0x80 is silence)
+} ZXTAPE_SINK_FANOUT_FORMAT_T;
+
+/**
+ * Fan-out reader: one consumer of a fan-out sink (may be on another thread, one thread per reader)
+ */
+typedef struct _ZXTAPE_SINK_FANOUT_READER_T {
+  ZXTAPE_SINK_FANOUT_T *pFanout;
+  ZXTAPE_SINK_FANOUT_FORMAT_T format;
+  ZXTAPE_SINK_PCM_T pcm;  // Conversion, with the part sample and pulse so far, and the gain (PCM formats)
+  u32 nReadIndex;         // Next pulse to read
+  u64 nDropped;           // Pulses missed because the reader fell more than the ring behind
+} ZXTAPE_SINK_FANOUT_READER_T;
+
+#ifndef __ZX_TAPE_CIRCLE__
+/**
+ * WAV file sink: mono 16-bit PCM. The header is completed each time playback stops, and when closed.
+ */
+typedef struct _ZXTAPE_SINK_WAV_T {
+  ZXTAPE_SINK_T sink;
+  ZXTAPE_SINK_PCM_T pcm;
+  void *pFile;  // FILE *
+  u64 nSamples;
+  i16 buffer[ZXTAPE_SINK_WAV_BUFFER_LENGTH];
+  u32 nBuffered;
+  bool bError;  // A write failed
+} ZXTAPE_SINK_WAV_T;
+#endif  // __ZX_TAPE_CIRCLE__
+
+/* Exported functions */
+void zxtape_initCountSink(ZXTAPE_SINK_COUNT_T *pCount);
+void zxtape_initListSink(ZXTAPE_SINK_LIST_T *pList);
+void zxtape_freeListSink(ZXTAPE_SINK_LIST_T *pList);
+void zxtape_initRingSink(ZXTAPE_SINK_RING_T *pRing, i16 *pSamples, u32 nLength, u32 nSampleRate);
+u32 zxtape_readRingSink(ZXTAPE_SINK_RING_T *pRing, i16 *pOut, u32 nMaxSamples);
+void zxtape_initFanoutSink(ZXTAPE_SINK_FANOUT_T *pFanout, u32 *pRecords, u32 nLength);
+void zxtape_initFanoutReader(ZXTAPE_SINK_FANOUT_READER_T *pReader, ZXTAPE_SINK_FANOUT_T *pFanout,
+                             ZXTAPE_SINK_FANOUT_FORMAT_T format, u32 nSampleRate, u32 nGain);
+u32 zxtape_readFanoutReader(ZXTAPE_SINK_FANOUT_READER_T *pReader, void *pOut, u32 nMax);
+#ifndef __ZX_TAPE_CIRCLE__
+bool zxtape_openWavSink(ZXTAPE_SINK_WAV_T *pWav, const char *pFilename, u32 nSampleRate);
+bool zxtape_closeWavSink(ZXTAPE_SINK_WAV_T *pWav);
+#endif  // __ZX_TAPE_CIRCLE__
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // _zxtape_sink_h_
@@ -0,0 +1,61 @@
+#ifndef _zxtape_stats_h_
+#define _zxtape_stats_h_
+
+#include "zxtape.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define ZXTAPE_STATS_FILL_BUCKETS 101     // Buffer fill histogram buckets (one per percent, 0% to 100%)
+#define ZXTAPE_STATS_DURATION_BUCKETS 24  // Duration histogram buckets (below 1us, then doubling, the last unbounded)
+#define ZXTAPE_STATS_LATE_NS 1000000      // Timer wakeups later than this are counted as late (1ms)
+
+/**
+ * Runtime statistics (for the process, as the output of the compatibility layer is shared by the instances)
+ *
+ * Duration histogram bucket 0 counts durations below 1us, bucket i (1 to ZXTAPE_STATS_DURATION_BUCKETS - 2) those
+ * below 2^i us, and the last bucket the rest.
+ */
+typedef struct _ZXTAPE_STATS_T {
+  // Output buffer
+  u64 nUnderruns;                                // Times the output ran out of data while playing
+  u64 nOverflows;                                // Periods dropped because the output buffer was full
+  u64 nOutputPulls;                              // Times the output pulled samples from the buffer
+  u64 nSamples;                                  // Samples output
+  u32 nFillMinPercent;                           // Buffer fill at a pull: lowest (0 if no pulls)
+  u32 nFillMaxPercent;                           // Buffer fill at a pull: highest
+  u32 nFillP50Percent;                           // Buffer fill at a pull: median
+  u32 nFillP90Percent;                           // Buffer fill at a pull: 90th percentile
+  u32 nFillP99Percent;                           // Buffer fill at a pull: 99th percentile
+  u64 fillHistogram[ZXTAPE_STATS_FILL_BUCKETS];  // Pulls by buffer fill (percent)
+
+  // Producer
+  u64 nRefills;                                        // Refill steps of the output buffer by the producer
+  u64 nRefillMaxNs;                                    // Longest refill
+  u64 refillHistogram[ZXTAPE_STATS_DURATION_BUCKETS];  // Refills by duration
+
+  // Generation
+  u64 nPulses;     // Periods generated (to the output, or in render mode)
+  u64 nBytesRead;  // Tape file bytes read
+
+  // Timer
+  u64 nTimerWakeups;      // Times the output timer handler ran
+  u64 nLateTimerWakeups;  // Times it ran more than ZXTAPE_STATS_LATE_NS after its deadline
+  u64 nTimerMaxLateNs;    // Latest it ran after its deadline
+
+  // File I/O
+  u64 nFileReads;  // Reads from a file (not from a buffer)
+  u64 nIoStallNs;  // Time waiting for reads from a file
+} ZXTAPE_STATS_T;
+
+/* Exported functions */
+void zxtape_getStats(ZXTAPE_STATS_T *pStats);
+void zxtape_resetStats(void);
+unsigned zxtape_formatStats(const ZXTAPE_STATS_T *pStats, char *pBuffer, unsigned nLength);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // _zxtape_stats_h_
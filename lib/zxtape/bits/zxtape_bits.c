@@ -0,0 +1,114 @@
+#include "zxtape_bits.h"
+
+#include "../tzx_compat/tzx_compat.h"
+
+//
+// Pulse to packed bitstream renderer
+//
+// Each bit is the level at its middle, so an edge is rounded to the nearest bit. Positions are held in integer units of
+// us * bit rate (as the PCM renderer), and the rounding is carried from pulse to pulse, so nothing drifts over a long
+// tape. A pulse is written as a run of identical bits, with whole words filled in one store.
+//
+
+/* Forward declarations */
+static void fillBits(u32 *pOut, u32 nPos, u32 nCount, u8 nLevel);
+
+/**
+ * Initialize (reset) a renderer. The output is held low until the first pulse.
+ *
+ * @param pBits Renderer to initialize
+ */
+void zxtapeBits_initialize(ZXTAPE_BITS_T *pBits) {
+  assert(pBits != NULL);
+
+  pBits->nBitRate = 0;
+  pBits->nOffset = ZXTAPE_RENDER_SAMPLE_UNITS / 2;
+  pBits->nRunBits = 0;
+  pBits->nLevel = 0;
+}
+
+/**
+ * Render words of packed 1-bit samples, pulling pulses as required
+ *
+ * Bits are packed from the most significant bit of each word (bit 31 is the first sample). Once there are no more
+ * pulses the current level is held for the rest of the words.
+ *
+ * @param pBits Renderer
+ * @param pOut Buffer for the words
+ * @param nWords Number of words to render
+ * @param nBitRate Bit rate (Hz). May change between calls; the current position is carried over.
+ * @param pfnNextPulse Function to get the next pulse
+ * @param pContext Context passed to pfnNextPulse
+ */
+void zxtapeBits_render(ZXTAPE_BITS_T *pBits, u32 *pOut, u32 nWords, u32 nBitRate,
+                       ZXTAPE_RENDER_NEXT_PULSE_T pfnNextPulse, void *pContext) {
+  assert(pBits != NULL);
+  assert(pOut != NULL || nWords == 0);
+  assert(nBitRate > 0);
+
+  // Rescale the current position if the bit rate changed
+  if (pBits->nBitRate != nBitRate) {
+    if (pBits->nBitRate != 0) {
+      pBits->nOffset = pBits->nOffset * nBitRate / pBits->nBitRate;
+      pBits->nRunBits = pBits->nRunBits * nBitRate / pBits->nBitRate;
+    }
+    pBits->nBitRate = nBitRate;
+  }
+
+  u32 nTotal = nWords * 32;
+  u32 nPos = 0;
+  bool bMore = true;
+  while (nPos < nTotal) {
+    if (pBits->nRunBits == 0) {
+      // Get the next pulse, or hold the level if there are none
+      ZXTAPE_PULSE_T pulse;
+      if (!bMore || !pfnNextPulse(pContext, &pulse)) {
+        bMore = false;
+        fillBits(pOut, nPos, nTotal - nPos, pBits->nLevel);
+        break;
+      }
+
+      // The bits with their middle inside the pulse (none if it is shorter than the gap to the next middle)
+      u64 nUnits = (u64)pulse.nPeriodUs * nBitRate;
+      if (nUnits <= pBits->nOffset) {
+        pBits->nOffset -= nUnits;
+        continue;
+      }
+      u64 n = (nUnits - pBits->nOffset + ZXTAPE_RENDER_SAMPLE_UNITS - 1) / ZXTAPE_RENDER_SAMPLE_UNITS;
+      pBits->nOffset = pBits->nOffset + n * ZXTAPE_RENDER_SAMPLE_UNITS - nUnits;
+      pBits->nRunBits = n;
+      pBits->nLevel = pulse.nLevel;
+    }
+
+    u32 n = pBits->nRunBits < nTotal - nPos ? (u32)pBits->nRunBits : nTotal - nPos;
+    fillBits(pOut, nPos, n, pBits->nLevel);
+    pBits->nRunBits -= n;
+    nPos += n;
+  }
+}
+
+/**
+ * Write a run of identical bits, whole words at a time where possible
+ */
+static void fillBits(u32 *pOut, u32 nPos, u32 nCount, u8 nLevel) {
+  u32 *p = &pOut[nPos / 32];
+  u32 nShift = nPos % 32;
+  u32 fill = nLevel ? 0xFFFFFFFF : 0;
+
+  // Rest of a partly written word
+  if (nShift != 0) {
+    u32 nHead = 32 - nShift;
+    u32 mask = 0xFFFFFFFF >> nShift;
+    if (nCount < nHead) mask &= ~(0xFFFFFFFF >> (nShift + nCount));
+    *p = (*p & ~mask) | (fill & mask);
+    if (nCount <= nHead) return;
+    p++;
+    nCount -= nHead;
+  }
+
+  // Whole words
+  for (; nCount >= 32; nCount -= 32) *p++ = fill;
+
+  // Start of a word
+  if (nCount > 0) *p = fill & ~(0xFFFFFFFF >> nCount);
+}
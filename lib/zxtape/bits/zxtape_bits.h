@@ -0,0 +1,19 @@
+#ifndef _zxtape_bits_h_
+#define _zxtape_bits_h_
+
+#include "../../../include/zxtape.h"
+#include "../render/zxtape_render.h"
+
+typedef struct _ZXTAPE_BITS_T {
+  u32 nBitRate;   // Bit rate the current position is held in (0 = none)
+  u64 nOffset;    // From the end of the last pulse to the middle of the next bit (us * nBitRate)
+  u64 nRunBits;   // Bits of the current pulse still to write
+  u8 nLevel;      // Level of the current pulse (held when there are no more pulses)
+} ZXTAPE_BITS_T;
+
+/* Exported functions */
+void zxtapeBits_initialize(ZXTAPE_BITS_T *pBits);
+void zxtapeBits_render(ZXTAPE_BITS_T *pBits, u32 *pOut, u32 nWords, u32 nBitRate,
+                       ZXTAPE_RENDER_NEXT_PULSE_T pfnNextPulse, void *pContext);
+
+#endif  // _zxtape_bits_h_
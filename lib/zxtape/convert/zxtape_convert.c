@@ -0,0 +1,485 @@
+#include "../../../include/zxtape_convert.h"
+
+#ifndef __ZX_TAPE_CIRCLE__
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "../../../include/zxtape_sink.h"
+#include "../render/zxtape_render.h"
+#include "../sink/zxtape_sink.h"
+#include "../tzx_compat/tzx_compat.h"
+
+//
+// Tape to WAV conversion, rendered in parallel
+//
+// The tape is split into shards at block boundaries, and the shards are rendered by worker threads, each shard by an
+// instance of its own. A shard only starts at a block after a pause (ending a data block, or a pause block): there the
+// output is low and the next pulse does not toggle it, whatever came before, so a shard plays exactly as it does
+// within the whole tape (see zxtape_setStartBlock()). Rendering is in two passes, the workers taking shards from a
+// queue as they become free in each:
+//  1. The workers generate the pulses of their shards (kept with the shard), and the length of each. The engine runs
+//     one instance at a time (see zxtape_create()), swapping the engine state of the shard's instance in for each
+//     batch of pulses read, so generation is serialised.
+//  2. Once every length is known, the start of each shard on the timeline is the sum of those before it, and the
+//     workers convert the pulses to samples at exactly that position (us * sample rate, as the WAV sink), writing
+//     whole samples straight into the file, in parallel. Samples split between shards are posted as parts, summed
+//     once the workers are done.
+// The file is byte for byte the one the WAV sink writes playing the tape. Tapes with blocks which change the block
+// order or carry state from block to block (loops, jumps, calls, 'Stop the tape', direct recordings etc) are rendered
+// serially.
+//
+
+#define ZXTAPE_CONVERT_SHARDS_PER_WORKER 4  // Shards per worker (so workers finishing early take more)
+#define ZXTAPE_CONVERT_MAX_SHARDS 1024
+#define ZXTAPE_CONVERT_BATCH_RECORDS 1024  // Records per zxtape_readPulses() call
+#define ZXTAPE_CONVERT_WRITE_SAMPLES 8192  // Samples written to the file at a time by a worker
+#define ZXTAPE_CONVERT_BYTE_US 5860        // Rough length of a data byte (standard speed), to balance the shards
+
+typedef struct _ZXTAPE_CONVERT_PART_T {
+  u64 nIndex;  // Sample
+  u64 nHigh;   // Part of the sample at the high level in the shard (us * sample rate)
+} ZXTAPE_CONVERT_PART_T;
+
+typedef struct _ZXTAPE_CONVERT_SHARD_T {
+  u32 nFirstBlock;                 // First block of the shard
+  u32 nEndBlock;                   // Block after the shard (the block count for the last shard)
+  ZXTAPE_PULSE_T *pPulses;         // Pulses of the shard (pass 1)
+  u32 nCount;                      // Number of pulses
+  u64 nTimeUs;                     // Length of the shard (pass 1)
+  u64 nStartUnits;                 // Start of the shard on the timeline (us * sample rate, set between the passes)
+  ZXTAPE_CONVERT_PART_T parts[2];  // Samples shared with other shards (pass 2)
+  u32 nParts;
+} ZXTAPE_CONVERT_SHARD_T;
+
+struct _ZXTAPE_CONVERT_T;
+
+typedef bool (*ZXTAPE_CONVERT_PASS_T)(const struct _ZXTAPE_CONVERT_T *pConvert, ZXTAPE_CONVERT_SHARD_T *pShard);
+
+typedef struct _ZXTAPE_CONVERT_T {
+  const char *pFilename;
+  const u8 *pTape;  // Tape buffer, or NULL to load pFilename
+  u32 nTapeLen;
+  u32 nSampleRate;
+  int nFile;  // WAV file (parallel rendering)
+  ZXTAPE_CONVERT_SHARD_T *pShards;
+  u32 nShards;
+  ZXTAPE_CONVERT_PASS_T pfnPass;  // Run by the workers on each shard they take (see runWorkers())
+  u32 nNextShard;                 // Next shard to take (workers)
+  bool bFailed;                   // A shard failed, so the workers stop taking shards (workers)
+} ZXTAPE_CONVERT_T;
+
+/* Forward declarations */
+static ZXTAPE_HANDLE_T *openSession(const ZXTAPE_CONVERT_T *pConvert, u32 nStartBlock, const ZXTAPE_SINK_T *pSink);
+static u32 planShards(const ZXTAPE_CONVERT_T *pConvert, ZXTAPE_CONVERT_SHARD_T *pShards, u32 nMaxShards);
+static bool isPulseOnlyBlock(u8 nBlockId);
+static bool convertSerial(const ZXTAPE_CONVERT_T *pConvert, const char *pWavFilename, u64 *pSamples);
+static bool convertParallel(ZXTAPE_CONVERT_T *pConvert, const char *pWavFilename, u32 nWorkers, u64 *pSamples);
+static bool runWorkers(ZXTAPE_CONVERT_T *pConvert, u32 nWorkers, ZXTAPE_CONVERT_PASS_T pfnPass);
+static void *runWorker(void *pArg);
+static bool generateShard(const ZXTAPE_CONVERT_T *pConvert, ZXTAPE_CONVERT_SHARD_T *pShard);
+static bool renderShard(const ZXTAPE_CONVERT_T *pConvert, ZXTAPE_CONVERT_SHARD_T *pShard);
+static bool writeSamples(int nFile, u64 nIndex, const i16 *pSamples, u32 nCount);
+static bool writeAll(int nFile, const void *pData, size_t nLen, off_t nOffset);
+
+/**
+ * Convert a tape to a WAV file (mono 16-bit PCM), rendering parts of it in parallel
+ *
+ * The file is the same as the WAV sink writes when the tape is played with it (see zxtape_openWavSink()), but
+ * rendered by up to nWorkers worker threads, each taking parts of the tape (split after blocks ending in a pause, and
+ * pause blocks) as it becomes free. Tapes which cannot be split are rendered serially. Each part is played by an
+ * instance of its own, so other instances and schedulers may run while converting.
+ *
+ * @param pFilename Name of the tape (the extension gives the format), loaded from the file if pTape is NULL
+ * @param pTape Tape buffer, or NULL
+ * @param nTapeLen Length of the tape buffer
+ * @param pWavFilename WAV file to create
+ * @param nSampleRate Sample rate (Hz)
+ * @param nWorkers Most worker threads (0 for one per CPU, 1 to render serially)
+ * @param pStats Conversion results (set on success, may be NULL)
+ * @return true if the whole file was written
+ */
+bool zxtape_convertToWav(const char *pFilename, const u8 *pTape, u32 nTapeLen, const char *pWavFilename,
+                         u32 nSampleRate, u32 nWorkers, ZXTAPE_CONVERT_STATS_T *pStats) {
+  assert(pFilename != NULL);
+  assert(pWavFilename != NULL);
+  assert(nSampleRate > 0);
+
+  if (nWorkers == 0) {
+    long nCpus = sysconf(_SC_NPROCESSORS_ONLN);
+    nWorkers = nCpus > 0 ? (u32)nCpus : 1;
+  }
+  u32 nMaxShards = nWorkers * ZXTAPE_CONVERT_SHARDS_PER_WORKER;
+  if (nMaxShards > ZXTAPE_CONVERT_MAX_SHARDS) nMaxShards = ZXTAPE_CONVERT_MAX_SHARDS;
+
+  ZXTAPE_CONVERT_T convert;
+  memset(&convert, 0, sizeof(convert));
+  convert.pFilename = pFilename;
+  convert.pTape = pTape;
+  convert.nTapeLen = nTapeLen;
+  convert.nSampleRate = nSampleRate;
+  convert.nFile = -1;
+  convert.pShards = (ZXTAPE_CONVERT_SHARD_T *)calloc(nMaxShards, sizeof(ZXTAPE_CONVERT_SHARD_T));
+  if (convert.pShards == NULL) return false;
+
+  convert.nShards = nWorkers > 1 ? planShards(&convert, convert.pShards, nMaxShards) : 1;
+  if (nWorkers > convert.nShards) nWorkers = convert.nShards;
+
+  u64 nSamples = 0;
+  bool res;
+  if (convert.nShards > 1) {
+    res = convertParallel(&convert, pWavFilename, nWorkers, &nSamples);
+  } else {
+    nWorkers = 0;
+    res = convertSerial(&convert, pWavFilename, &nSamples);
+  }
+
+  if (res && pStats != NULL) {
+    pStats->nShards = convert.nShards > 1 ? convert.nShards : 1;
+    pStats->nWorkers = nWorkers;
+    pStats->nSamples = nSamples;
+  }
+  for (u32 i = 0; i < convert.nShards; i++) free(convert.pShards[i].pPulses);
+  free(convert.pShards);
+
+  return res;
+}
+
+/**
+ * Create an instance playing the tape in render mode from a block (pulse times in us), or NULL if it fails to load
+ */
+static ZXTAPE_HANDLE_T *openSession(const ZXTAPE_CONVERT_T *pConvert, u32 nStartBlock, const ZXTAPE_SINK_T *pSink) {
+  ZXTAPE_HANDLE_T *pZxTape = zxtape_create();
+  zxtape_init(pZxTape);
+  zxtape_setRenderMode(pZxTape, true);
+  zxtape_setEarClock(pZxTape, 1000000);
+  if (pSink != NULL) zxtape_setSink(pZxTape, pSink);
+
+  if (pConvert->pTape != NULL) {
+    zxtape_loadBuffer(pZxTape, pConvert->pFilename, pConvert->pTape, pConvert->nTapeLen);
+  } else if (!zxtape_loadFile(pZxTape, pConvert->pFilename)) {
+    zxtape_destroy(pZxTape);
+    return NULL;
+  }
+
+  zxtape_setStartBlock(pZxTape, nStartBlock);
+  zxtape_playPause(pZxTape);
+
+  return pZxTape;
+}
+
+/**
+ * Split the tape into shards of about the same length, only after data blocks ending in a pause and pause blocks.
+ * Returns the number of shards (1 if the tape cannot be split, 0 if it cannot be loaded).
+ */
+static u32 planShards(const ZXTAPE_CONVERT_T *pConvert, ZXTAPE_CONVERT_SHARD_T *pShards, u32 nMaxShards) {
+  ZXTAPE_HANDLE_T *pZxTape = openSession(pConvert, 0, NULL);
+  if (pZxTape == NULL) return 0;
+
+  u32 nBlocks = zxtape_getBlockCount(pZxTape);
+  u64 *pBlockUs = (u64 *)malloc((nBlocks + 1) * sizeof(u64));  // Rough length of each block, 0 if not after a pause
+  bool *pSplit = (bool *)calloc(nBlocks + 1, sizeof(bool));    // The tape may be split before the block
+  u64 nTotalUs = 0;
+  bool bSplittable = nBlocks > 1 && pBlockUs != NULL && pSplit != NULL;
+
+  for (u32 i = 0; i < nBlocks && bSplittable; i++) {
+    ZXTAPE_BLOCK_DATA_T data;
+    if (zxtape_getBlockData(pZxTape, i, &data, NULL, 0)) {
+      pBlockUs[i] = (u64)data.nLength * ZXTAPE_CONVERT_BYTE_US + (u64)data.nPauseMs * 1000;
+      pSplit[i + 1] = data.nPauseMs > 0;
+    } else if (data.nBlockId == 0x20 && data.nPauseMs > 0) {
+      // Pause block (not 'Stop the tape')
+      pBlockUs[i] = (u64)data.nPauseMs * 1000;
+      pSplit[i + 1] = true;
+    } else {
+      pBlockUs[i] = 0;
+      bSplittable = isPulseOnlyBlock(data.nBlockId);
+    }
+    nTotalUs += pBlockUs[i];
+  }
+  zxtape_destroy(pZxTape);
+
+  // Cut the tape after each share of the total (at the next place it may be split)
+  u32 nShards = 0;
+  pShards[0].nFirstBlock = 0;
+  if (bSplittable) {
+    u64 nShareUs = nTotalUs / nMaxShards;
+    u64 nShardUs = 0;
+    for (u32 i = 0; i < nBlocks; i++) {
+      if (i > 0 && pSplit[i] && nShardUs >= nShareUs && nShards + 1 < nMaxShards) {
+        pShards[nShards++].nEndBlock = i;
+        pShards[nShards].nFirstBlock = i;
+        nShardUs = 0;
+      }
+      nShardUs += pBlockUs[i];
+    }
+  }
+  pShards[nShards++].nEndBlock = nBlocks;
+
+  free(pBlockUs);
+  free(pSplit);
+
+  return nShards;
+}
+
+/**
+ * Check if a (non data) block only outputs pulses, or nothing, and plays the same wherever playback started
+ */
+static bool isPulseOnlyBlock(u8 nBlockId) {
+  switch (nBlockId) {
+    case 0x12:  // Pure tone
+    case 0x13:  // Pulse sequence
+    case 0x21:  // Group start
+    case 0x22:  // Group end
+    case 0x30:  // Text description
+    case 0x31:  // Message
+    case 0x32:  // Archive info
+    case 0x33:  // Hardware type
+    case 0x35:  // Custom info
+      return true;
+
+    default:
+      return false;
+  }
+}
+
+/**
+ * Play the whole tape to a WAV file sink
+ */
+static bool convertSerial(const ZXTAPE_CONVERT_T *pConvert, const char *pWavFilename, u64 *pSamples) {
+  ZXTAPE_SINK_WAV_T *pWav = (ZXTAPE_SINK_WAV_T *)malloc(sizeof(ZXTAPE_SINK_WAV_T));
+  if (pWav == NULL) return false;
+
+  bool res = zxtape_openWavSink(pWav, pWavFilename, pConvert->nSampleRate);
+  ZXTAPE_HANDLE_T *pZxTape = res ? openSession(pConvert, 0, &pWav->sink) : NULL;
+  if (pZxTape != NULL) {
+    // (started by the first run)
+    zxtape_run(pZxTape, 0);
+    while (zxtape_isStarted(pZxTape)) zxtape_run(pZxTape, 0);
+    zxtape_destroy(pZxTape);
+  } else {
+    res = false;
+  }
+
+  if (!zxtape_closeWavSink(pWav)) res = false;
+  *pSamples = pWav->nSamples;
+  free(pWav);
+
+  return res;
+}
+
+/**
+ * Render the shards in worker threads, and complete the file
+ */
+static bool convertParallel(ZXTAPE_CONVERT_T *pConvert, const char *pWavFilename, u32 nWorkers, u64 *pSamples) {
+  pConvert->nFile = open(pWavFilename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (pConvert->nFile < 0) {
+    zxtape_log_error("Failed to create WAV file: %s", pWavFilename);
+    return false;
+  }
+
+  // Pass 1 (all the shard lengths), then place the shards on the timeline, and pass 2
+  bool res = runWorkers(pConvert, nWorkers, generateShard);
+  u64 nUnits = 0;
+  for (u32 i = 0; i < pConvert->nShards && res; i++) {
+    ZXTAPE_CONVERT_SHARD_T *pShard = &pConvert->pShards[i];
+    pShard->nStartUnits = nUnits;
+    nUnits += pShard->nTimeUs * pConvert->nSampleRate;
+  }
+  if (res) res = runWorkers(pConvert, nWorkers, renderShard);
+
+  // Samples shared between shards (in order), then the header
+  u64 nSamples = (nUnits + ZXTAPE_RENDER_SAMPLE_UNITS - 1) / ZXTAPE_RENDER_SAMPLE_UNITS;
+  bool bPart = false;
+  ZXTAPE_CONVERT_PART_T part = {0, 0};
+  for (u32 i = 0; i < pConvert->nShards && res; i++) {
+    ZXTAPE_CONVERT_SHARD_T *pShard = &pConvert->pShards[i];
+    for (u32 j = 0; j < pShard->nParts && res; j++) {
+      if (bPart && pShard->parts[j].nIndex == part.nIndex) {
+        part.nHigh += pShard->parts[j].nHigh;
+        continue;
+      }
+      if (bPart) {
+        i16 sample = zxtapeSink_pcmSample(part.nHigh, ZXTAPE_SINK_PCM_GAIN_UNITY);
+        res = writeSamples(pConvert->nFile, part.nIndex, &sample, 1);
+      }
+      part = pShard->parts[j];
+      bPart = true;
+    }
+  }
+  if (bPart && res) {
+    i16 sample = zxtapeSink_pcmSample(part.nHigh, ZXTAPE_SINK_PCM_GAIN_UNITY);
+    res = writeSamples(pConvert->nFile, part.nIndex, &sample, 1);
+  }
+
+  u8 header[ZXTAPE_SINK_WAV_HEADER_LENGTH];
+  zxtapeSink_formatWavHeader(header, pConvert->nSampleRate, 16, nSamples);
+  if (res) res = writeAll(pConvert->nFile, header, sizeof(header), 0);
+  if (close(pConvert->nFile) != 0) res = false;
+  pConvert->nFile = -1;
+
+  if (!res) zxtape_log_error("Failed to convert to WAV file: %s", pWavFilename);
+  *pSamples = nSamples;
+
+  return res;
+}
+
+/**
+ * Run a pass over every shard in worker threads, until they are all done. Returns false if a shard failed (or no
+ * worker could be started).
+ */
+static bool runWorkers(ZXTAPE_CONVERT_T *pConvert, u32 nWorkers, ZXTAPE_CONVERT_PASS_T pfnPass) {
+  pthread_t threads[ZXTAPE_CONVERT_MAX_SHARDS];
+  u32 nStarted = 0;
+
+  pConvert->pfnPass = pfnPass;
+  pConvert->nNextShard = 0;
+  for (; nStarted < nWorkers; nStarted++) {
+    if (pthread_create(&threads[nStarted], NULL, runWorker, pConvert) != 0) break;
+  }
+  for (u32 i = 0; i < nStarted; i++) pthread_join(threads[i], NULL);
+
+  return nStarted > 0 && !pConvert->bFailed;
+}
+
+/**
+ * Worker thread: run the pass on shards from the queue until it is empty (or a shard failed)
+ */
+static void *runWorker(void *pArg) {
+  ZXTAPE_CONVERT_T *pConvert = (ZXTAPE_CONVERT_T *)pArg;
+
+  while (!__atomic_load_n(&pConvert->bFailed, __ATOMIC_RELAXED)) {
+    u32 nShard = __atomic_fetch_add(&pConvert->nNextShard, 1, __ATOMIC_RELAXED);
+    if (nShard >= pConvert->nShards) break;
+
+    if (!pConvert->pfnPass(pConvert, &pConvert->pShards[nShard])) {
+      __atomic_store_n(&pConvert->bFailed, true, __ATOMIC_RELAXED);
+    }
+  }
+
+  return NULL;
+}
+
+/**
+ * Generate and keep the pulses of a shard, and its length
+ */
+static bool generateShard(const ZXTAPE_CONVERT_T *pConvert, ZXTAPE_CONVERT_SHARD_T *pShard) {
+  ZXTAPE_PULSE_RECORD_T records[ZXTAPE_CONVERT_BATCH_RECORDS];
+  u32 nCapacity = 0;
+  u64 nTimeUs = 0;
+
+  ZXTAPE_HANDLE_T *pZxTape = openSession(pConvert, pShard->nFirstBlock, NULL);
+  if (pZxTape == NULL) return false;
+
+  bool bEnd = false;
+  while (!bEnd) {
+    unsigned n = zxtape_readPulses(pZxTape, records, ZXTAPE_CONVERT_BATCH_RECORDS);
+    if (n == 0 && !zxtape_isStarted(pZxTape)) break;
+
+    // Grow the pulses as required (doubling, so the cost per pulse is constant)
+    if (pShard->nCount + n > nCapacity) {
+      nCapacity = nCapacity ? nCapacity * 2 : 64 * 1024;
+      ZXTAPE_PULSE_T *pNew = (ZXTAPE_PULSE_T *)realloc(pShard->pPulses, nCapacity * sizeof(ZXTAPE_PULSE_T));
+      if (pNew == NULL) {
+        zxtape_destroy(pZxTape);
+        return false;
+      }
+      pShard->pPulses = pNew;
+    }
+
+    for (unsigned i = 0; i < n; i++) {
+      if (records[i].nBlockIndex != ZXTAPE_INDEX_NONE && records[i].nBlockIndex >= pShard->nEndBlock) {
+        bEnd = true;
+        break;
+      }
+      ZXTAPE_PULSE_T *pPulse = &pShard->pPulses[pShard->nCount++];
+      pPulse->nLevel = records[i].nLevel;
+      pPulse->nPeriodUs = records[i].nDurationTstates;
+      nTimeUs += pPulse->nPeriodUs;
+    }
+  }
+  zxtape_destroy(pZxTape);
+
+  pShard->nTimeUs = nTimeUs;
+
+  return true;
+}
+
+/**
+ * Convert the pulses of a shard to samples (as the WAV sink), writing the whole samples to the file and posting the
+ * parts of samples shared with the shards either side
+ */
+static bool renderShard(const ZXTAPE_CONVERT_T *pConvert, ZXTAPE_CONVERT_SHARD_T *pShard) {
+  i16 samples[ZXTAPE_CONVERT_WRITE_SAMPLES];
+  ZXTAPE_SINK_PCM_T pcm;
+  u64 nIndex = pShard->nStartUnits / ZXTAPE_RENDER_SAMPLE_UNITS;  // Sample of samples[0]
+  const ZXTAPE_PULSE_T *pPulses = pShard->pPulses;
+  u32 nCount = pShard->nCount;
+  u32 nTaken;
+
+  zxtapeSink_initPcm(&pcm, pConvert->nSampleRate, ZXTAPE_SINK_PCM_GAIN_UNITY);
+  pcm.nFilled = pShard->nStartUnits % ZXTAPE_RENDER_SAMPLE_UNITS;
+  pShard->nParts = 0;
+
+  // The first sample is shared with the shard before, if it started there (completed, but not output)
+  if (pcm.nFilled > 0) {
+    zxtapeSink_pcmConvert(&pcm, pPulses, nCount, samples, 0, &nTaken);
+    pPulses += nTaken;
+    nCount -= nTaken;
+    if (pcm.nFilled == ZXTAPE_RENDER_SAMPLE_UNITS) {
+      pShard->parts[pShard->nParts].nIndex = nIndex++;
+      pShard->parts[pShard->nParts++].nHigh = pcm.nHigh;
+      pcm.nFilled = 0;
+      pcm.nHigh = 0;
+    }
+  }
+
+  u32 nSamples;
+  do {
+    nSamples = zxtapeSink_pcmConvert(&pcm, pPulses, nCount, samples, ZXTAPE_CONVERT_WRITE_SAMPLES, &nTaken);
+    pPulses += nTaken;
+    nCount -= nTaken;
+    if (nSamples > 0 && !writeSamples(pConvert->nFile, nIndex, samples, nSamples)) return false;
+    nIndex += nSamples;
+  } while (nSamples == ZXTAPE_CONVERT_WRITE_SAMPLES);
+
+  // The last sample is shared with the shard after (or is the last part sample of the tape)
+  if (pcm.nFilled > 0) {
+    pShard->parts[pShard->nParts].nIndex = nIndex;
+    pShard->parts[pShard->nParts++].nHigh = pcm.nHigh;
+  }
+
+  return true;
+}
+
+/**
+ * Write samples at their place in the WAV file (little endian)
+ */
+static bool writeSamples(int nFile, u64 nIndex, const i16 *pSamples, u32 nCount) {
+  u8 data[ZXTAPE_CONVERT_WRITE_SAMPLES * 2];
+
+  assert(nCount <= ZXTAPE_CONVERT_WRITE_SAMPLES);
+  for (u32 i = 0; i < nCount; i++) {
+    data[i * 2] = (u8)((u16)pSamples[i] & 0xFF);
+    data[i * 2 + 1] = (u8)((u16)pSamples[i] >> 8);
+  }
+
+  return writeAll(nFile, data, nCount * 2, (off_t)(ZXTAPE_SINK_WAV_HEADER_LENGTH + nIndex * 2));
+}
+
+static bool writeAll(int nFile, const void *pData, size_t nLen, off_t nOffset) {
+  const u8 *p = (const u8 *)pData;
+
+  while (nLen > 0) {
+    ssize_t n = pwrite(nFile, p, nLen, nOffset);
+    if (n <= 0) return false;
+    p += n;
+    nLen -= (size_t)n;
+    nOffset += n;
+  }
+
+  return true;
+}
+
+#endif  // __ZX_TAPE_CIRCLE__
@@ -0,0 +1,154 @@
+#include "zxtape_ear.h"
+
+#include "../tzx_compat/tzx_compat.h"
+
+//
+// EAR level cursor
+//
+// Maps the pulses onto the T-state timeline of an emulated CPU. Consecutive pulses at the same level are merged into
+// runs, so the cursor only ever holds the current run and the first pulse of the next one. Queries with increasing
+// T-states move the cursor forward one run at a time, so the cost is amortised O(1) per query however the queries are
+// spaced, and a long pause costs the same as a single pulse.
+//
+// The tape starts at the T-state of the first query. When the pulses stop (tape stopped, paused or ended) the level
+// is held; if they start again, they continue from the later of the end of the last pulse and the next query.
+//
+
+/* Forward declarations */
+static void extendRun(ZXTAPE_EAR_T *pEar, ZXTAPE_RENDER_NEXT_PULSE_T pfnNextPulse, void *pContext);
+static void restartSegment(ZXTAPE_EAR_T *pEar, u64 nTstate, ZXTAPE_RENDER_NEXT_PULSE_T pfnNextPulse,
+                           void *pContext);
+static u64 segmentEnd(ZXTAPE_EAR_T *pEar);
+
+/**
+ * Initialize (reset) an EAR cursor. The level is low until the first pulse.
+ *
+ * @param pEar Cursor to initialize
+ * @param nClockHz T-states per second
+ */
+void zxtapeEar_initialize(ZXTAPE_EAR_T *pEar, u32 nClockHz) {
+  assert(pEar != NULL);
+  assert(nClockHz > 0);
+
+  pEar->nClockHz = nClockHz;
+  pEar->bStarted = false;
+  pEar->nLastTstate = 0;
+  pEar->nBaseTstate = 0;
+  pEar->nSegmentUs = 0;
+  pEar->nRunEnd = ZXTAPE_TSTATE_NONE;
+  pEar->nLevel = 0;
+  pEar->bPending = false;
+}
+
+/**
+ * Get the level at a T-state, moving the cursor forward
+ *
+ * Queries before the last query return the level of the current run.
+ *
+ * @param pEar Cursor
+ * @param nTstate T-state
+ * @param pfnNextPulse Function to get the next pulse
+ * @param pContext Context passed to pfnNextPulse
+ * @return u8 Level (0 or 1)
+ */
+u8 zxtapeEar_levelAt(ZXTAPE_EAR_T *pEar, u64 nTstate, ZXTAPE_RENDER_NEXT_PULSE_T pfnNextPulse, void *pContext) {
+  if (!pEar->bStarted) {
+    pEar->bStarted = true;
+    restartSegment(pEar, nTstate, pfnNextPulse, pContext);
+  }
+  if (nTstate > pEar->nLastTstate) pEar->nLastTstate = nTstate;
+
+  while (1) {
+    if (pEar->nRunEnd == ZXTAPE_TSTATE_NONE) {
+      // No more pulses so far: hold the level until the last pulse has played, then try to continue from here
+      if (nTstate < segmentEnd(pEar)) break;
+      restartSegment(pEar, nTstate, pfnNextPulse, pContext);
+      if (pEar->nRunEnd == ZXTAPE_TSTATE_NONE) break;
+    }
+    if (nTstate < pEar->nRunEnd) break;
+
+    // Move to the next run
+    pEar->nLevel = pEar->pending.nLevel;
+    extendRun(pEar, pfnNextPulse, pContext);
+  }
+
+  return pEar->nLevel;
+}
+
+/**
+ * Get the T-state of the next edge after the last query
+ *
+ * @param pEar Cursor
+ * @param pfnNextPulse Function to get the next pulse
+ * @param pContext Context passed to pfnNextPulse
+ * @return u64 T-state of the next edge, or ZXTAPE_TSTATE_NONE if there is none (stopped, paused or ended)
+ */
+u64 zxtapeEar_nextEdge(ZXTAPE_EAR_T *pEar, ZXTAPE_RENDER_NEXT_PULSE_T pfnNextPulse, void *pContext) {
+  if (!pEar->bStarted) return ZXTAPE_TSTATE_NONE;
+
+  // Make sure the cursor is on the run containing the last query, and try to continue if the pulses stopped
+  zxtapeEar_levelAt(pEar, pEar->nLastTstate, pfnNextPulse, pContext);
+  if (pEar->nRunEnd == ZXTAPE_TSTATE_NONE) {
+    restartSegment(pEar, pEar->nLastTstate, pfnNextPulse, pContext);
+  }
+
+  return pEar->nRunEnd;
+}
+
+/**
+ * Check if the pulses have stopped, and the last of them has been played by a T-state
+ *
+ * @param pEar Cursor
+ * @param nTstate T-state
+ * @return true if there are no more pulses after nTstate
+ */
+bool zxtapeEar_isPastEnd(ZXTAPE_EAR_T *pEar, u64 nTstate) {
+  return pEar->bStarted && pEar->nRunEnd == ZXTAPE_TSTATE_NONE && nTstate >= segmentEnd(pEar);
+}
+
+//
+// Private functions
+//
+
+/**
+ * Extend the current run with following pulses at the same level, and find where it ends
+ */
+static void extendRun(ZXTAPE_EAR_T *pEar, ZXTAPE_RENDER_NEXT_PULSE_T pfnNextPulse, void *pContext) {
+  while (1) {
+    if (!pEar->bPending) {
+      if (!pfnNextPulse(pContext, &pEar->pending)) {
+        pEar->nRunEnd = ZXTAPE_TSTATE_NONE;
+        return;
+      }
+      pEar->bPending = true;
+    }
+
+    // An edge, so the run ends here
+    if (pEar->pending.nLevel != pEar->nLevel) {
+      pEar->nRunEnd = segmentEnd(pEar);
+      return;
+    }
+
+    pEar->nSegmentUs += pEar->pending.nPeriodUs;
+    pEar->bPending = false;
+  }
+}
+
+/**
+ * Start a new segment of pulses (at the later of nTstate and the end of the last pulse)
+ */
+static void restartSegment(ZXTAPE_EAR_T *pEar, u64 nTstate, ZXTAPE_RENDER_NEXT_PULSE_T pfnNextPulse,
+                           void *pContext) {
+  u64 nEnd = segmentEnd(pEar);
+
+  pEar->nBaseTstate = nTstate > nEnd ? nTstate : nEnd;
+  pEar->nSegmentUs = 0;
+  extendRun(pEar, pfnNextPulse, pContext);
+}
+
+/**
+ * T-state at the end of the pulses in the current segment
+ */
+static u64 segmentEnd(ZXTAPE_EAR_T *pEar) {
+  return pEar->nBaseTstate + pEar->nSegmentUs * pEar->nClockHz / 1000000;
+}
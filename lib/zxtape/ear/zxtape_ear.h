@@ -0,0 +1,25 @@
+#ifndef _zxtape_ear_h_
+#define _zxtape_ear_h_
+
+#include "../../../include/zxtape.h"
+#include "../render/zxtape_render.h"
+
+typedef struct _ZXTAPE_EAR_T {
+  u32 nClockHz;            // T-states per second
+  bool bStarted;           // The position of the tape on the T-state timeline is known
+  u64 nLastTstate;         // T-state of the last query
+  u64 nBaseTstate;         // T-state the current segment (of continuous pulses) started at
+  u64 nSegmentUs;          // Length of the segment up to the end of the current run (microseconds)
+  u64 nRunEnd;             // T-state of the next edge (ZXTAPE_TSTATE_NONE if there are no more pulses yet)
+  u8 nLevel;               // Level of the current run (of pulses at the same level)
+  bool bPending;           // Set if pending holds the first pulse of the next run
+  ZXTAPE_PULSE_T pending;  // First pulse of the next run
+} ZXTAPE_EAR_T;
+
+/* Exported functions */
+void zxtapeEar_initialize(ZXTAPE_EAR_T *pEar, u32 nClockHz);
+u8 zxtapeEar_levelAt(ZXTAPE_EAR_T *pEar, u64 nTstate, ZXTAPE_RENDER_NEXT_PULSE_T pfnNextPulse, void *pContext);
+u64 zxtapeEar_nextEdge(ZXTAPE_EAR_T *pEar, ZXTAPE_RENDER_NEXT_PULSE_T pfnNextPulse, void *pContext);
+bool zxtapeEar_isPastEnd(ZXTAPE_EAR_T *pEar, u64 nTstate);
+
+#endif  // _zxtape_ear_h_
@@ -0,0 +1,102 @@
+#include "zxtape_event.h"
+
+#include "../tzx_compat/tzx_compat.h"
+
+//
+// Bounded lock-free event queue
+//
+// Events may be pushed from any thread (the TZX loop, the timer, or the audio thread), so the queue is a bounded
+// multi-producer queue where each slot carries a sequence number (D. Vyukov). Pushing never blocks and never
+// allocates; if the queue is full the event is dropped and counted.
+//
+
+/**
+ * Initialize an event queue
+ *
+ * @param pQueue Queue to initialize
+ */
+void zxtapeEvent_initialize(ZXTAPE_EVENT_QUEUE_T *pQueue) {
+  assert(pQueue != NULL);
+
+  for (u32 i = 0; i < ZXTAPE_EVENT_QUEUE_LENGTH; i++) {
+    pQueue->slots[i].nSequence = i;
+  }
+  pQueue->nWriteIndex = 0;
+  pQueue->nReadIndex = 0;
+  pQueue->nDropped = 0;
+}
+
+/**
+ * Push an event onto the queue
+ *
+ * @param pQueue Queue
+ * @param pEvent Event to copy into the queue
+ * @return true if the event was queued, false if the queue was full
+ */
+bool zxtapeEvent_push(ZXTAPE_EVENT_QUEUE_T *pQueue, const ZXTAPE_EVENT_T *pEvent) {
+  ZXTAPE_EVENT_SLOT_T *pSlot;
+  u32 pos = __atomic_load_n(&pQueue->nWriteIndex, __ATOMIC_RELAXED);
+
+  while (1) {
+    pSlot = &pQueue->slots[pos & ZXTAPE_EVENT_QUEUE_MASK];
+    u32 seq = __atomic_load_n(&pSlot->nSequence, __ATOMIC_ACQUIRE);
+    i32 diff = (i32)(seq - pos);
+
+    if (diff == 0) {
+      // Slot is free, try to claim it
+      if (__atomic_compare_exchange_n(&pQueue->nWriteIndex, &pos, pos + 1, true, __ATOMIC_RELAXED,
+                                      __ATOMIC_RELAXED)) {
+        break;
+      }
+    } else if (diff < 0) {
+      // Queue is full
+      __atomic_fetch_add(&pQueue->nDropped, 1, __ATOMIC_RELAXED);
+      return false;
+    } else {
+      // Another producer claimed the slot, retry
+      pos = __atomic_load_n(&pQueue->nWriteIndex, __ATOMIC_RELAXED);
+    }
+  }
+
+  pSlot->event = *pEvent;
+  __atomic_store_n(&pSlot->nSequence, pos + 1, __ATOMIC_RELEASE);
+
+  return true;
+}
+
+/**
+ * Pop an event from the queue
+ *
+ * @param pQueue Queue
+ * @param pEvent Event to copy out of the queue
+ * @return true if an event was returned, false if the queue was empty
+ */
+bool zxtapeEvent_pop(ZXTAPE_EVENT_QUEUE_T *pQueue, ZXTAPE_EVENT_T *pEvent) {
+  ZXTAPE_EVENT_SLOT_T *pSlot;
+  u32 pos = __atomic_load_n(&pQueue->nReadIndex, __ATOMIC_RELAXED);
+
+  while (1) {
+    pSlot = &pQueue->slots[pos & ZXTAPE_EVENT_QUEUE_MASK];
+    u32 seq = __atomic_load_n(&pSlot->nSequence, __ATOMIC_ACQUIRE);
+    i32 diff = (i32)(seq - (pos + 1));
+
+    if (diff == 0) {
+      // Slot is filled, try to claim it
+      if (__atomic_compare_exchange_n(&pQueue->nReadIndex, &pos, pos + 1, true, __ATOMIC_RELAXED,
+                                      __ATOMIC_RELAXED)) {
+        break;
+      }
+    } else if (diff < 0) {
+      // Queue is empty
+      return false;
+    } else {
+      // Another consumer claimed the slot, retry
+      pos = __atomic_load_n(&pQueue->nReadIndex, __ATOMIC_RELAXED);
+    }
+  }
+
+  *pEvent = pSlot->event;
+  __atomic_store_n(&pSlot->nSequence, pos + ZXTAPE_EVENT_QUEUE_LENGTH, __ATOMIC_RELEASE);
+
+  return true;
+}
@@ -0,0 +1,26 @@
+#ifndef _zxtape_event_h_
+#define _zxtape_event_h_
+
+#include "../../../include/zxtape.h"
+
+#define ZXTAPE_EVENT_QUEUE_LENGTH 64  // Must be a power of 2
+#define ZXTAPE_EVENT_QUEUE_MASK (ZXTAPE_EVENT_QUEUE_LENGTH - 1)
+
+typedef struct _ZXTAPE_EVENT_SLOT_T {
+  u32 nSequence;
+  ZXTAPE_EVENT_T event;
+} ZXTAPE_EVENT_SLOT_T;
+
+typedef struct _ZXTAPE_EVENT_QUEUE_T {
+  ZXTAPE_EVENT_SLOT_T slots[ZXTAPE_EVENT_QUEUE_LENGTH];
+  u32 nWriteIndex;
+  u32 nReadIndex;
+  u32 nDropped;  // Events dropped because the queue was full
+} ZXTAPE_EVENT_QUEUE_T;
+
+/* Exported functions */
+void zxtapeEvent_initialize(ZXTAPE_EVENT_QUEUE_T *pQueue);
+bool zxtapeEvent_push(ZXTAPE_EVENT_QUEUE_T *pQueue, const ZXTAPE_EVENT_T *pEvent);
+bool zxtapeEvent_pop(ZXTAPE_EVENT_QUEUE_T *pQueue, ZXTAPE_EVENT_T *pEvent);
+
+#endif  // _zxtape_event_h_
@@ -1,6 +1,7 @@
 
 #include "zxtape_file_api_buffer.h"
 
+#include "../stats/zxtape_stats.h"
 #include "../tzx_compat/tzx_compat.h"
 
 //
@@ -8,9 +9,7 @@
 //
 
 /* Local global variables */
-static const u8 *g_pBuffer = NULL;  // Pointer to buffer
-static u64 g_nBufferSize = 0;       // Buffer size
-static u64 g_nSeekIndex = 0;        // Current file seek position
+static ZXTAPE_FILE_API_BUFFER_STATE_T g_state = {NULL, 0, 0};
 
 /* Forward declarations */
 static bool open(TZX_FILETYPE *dir, u32 index, TZX_oflag_t oflag);
@@ -25,20 +24,28 @@ void zxtapeFileApiBuffer_initialize(TZX_FILETYPE *pFileType, const u8 *pBuffer,
   pFileType->seekSet = seekSet;
 
   // Set the buffer pointer
-  g_pBuffer = pBuffer;
-  assert(g_pBuffer != NULL);  // Ensure memory was allocated
+  g_state.pBuffer = pBuffer;
+  assert(g_state.pBuffer != NULL);  // Ensure memory was allocated
 
   // Set the buffer size and seek index
-  g_nBufferSize = nBufferSize;
-  g_nSeekIndex = 0;
+  g_state.nBufferSize = nBufferSize;
+  g_state.nSeekIndex = 0;
+}
+
+void zxtapeFileApiBuffer_saveState(ZXTAPE_FILE_API_BUFFER_STATE_T *pState) {
+  *pState = g_state;
+}
+
+void zxtapeFileApiBuffer_restoreState(const ZXTAPE_FILE_API_BUFFER_STATE_T *pState) {
+  g_state = *pState;
 }
 
 static bool open(TZX_FILETYPE *dir, u32 index, TZX_oflag_t oflag) {
   zxtape_log_debug("open");
 
-  g_nSeekIndex = 0;
+  g_state.nSeekIndex = 0;
 
-  zxtape_log_debug("filesize: %d", g_nBufferSize);
+  zxtape_log_debug("filesize: %d", g_state.nBufferSize);
 
   return true;
 }
@@ -46,22 +53,23 @@ static bool open(TZX_FILETYPE *dir, u32 index, TZX_oflag_t oflag) {
 static void close() {
   zxtape_log_debug("close");
 
-  g_nSeekIndex = 0;
+  g_state.nSeekIndex = 0;
 }
 
 static int read(void *buf, unsigned long count) {
   // zxtape_log_debug("read(%lu)", count);
 
-  if (g_nSeekIndex + count > g_nBufferSize) {
-    count = g_nBufferSize - g_nSeekIndex;
+  if (g_state.nSeekIndex + count > g_state.nBufferSize) {
+    count = g_state.nBufferSize - g_state.nSeekIndex;
   }
 
   // for (unsigned long i = 0; i < count; i++) {
-  //   zxtape_log_debug("%02x ", *(pFile + g_nSeekIndex + i));
+  //   zxtape_log_debug("%02x ", *(pFile + g_state.nSeekIndex + i));
   // }
 
-  memcpy(buf, g_pBuffer + g_nSeekIndex, count);
-  g_nSeekIndex += count;
+  memcpy(buf, g_state.pBuffer + g_state.nSeekIndex, count);
+  g_state.nSeekIndex += count;
+  zxtapeStats_countBytesRead(count);
 
   return count;
 }
@@ -69,9 +77,9 @@ static int read(void *buf, unsigned long count) {
 static bool seekSet(u64 pos) {
   // zxtape_log_debug("seekSet(%lu)", pos);
 
-  if (pos >= g_nBufferSize) return false;
+  if (pos >= g_state.nBufferSize) return false;
 
-  g_nSeekIndex = pos;
+  g_state.nSeekIndex = pos;
 
   return true;
 }
\ No newline at end of file
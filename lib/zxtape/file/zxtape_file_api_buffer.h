@@ -4,6 +4,17 @@
 
 #include "../tzx_compat/tzx_compat.h"
 
+/**
+ * Buffer being read (saved and restored by controller instances sharing the file API)
+ */
+typedef struct _ZXTAPE_FILE_API_BUFFER_STATE_T {
+  const u8 *pBuffer;  // Pointer to buffer
+  u64 nBufferSize;    // Buffer size
+  u64 nSeekIndex;     // Current file seek position
+} ZXTAPE_FILE_API_BUFFER_STATE_T;
+
 void zxtapeFileApiBuffer_initialize(TZX_FILETYPE *pFileType, const u8 *pBuffer, u64 nBufferSize);
+void zxtapeFileApiBuffer_saveState(ZXTAPE_FILE_API_BUFFER_STATE_T *pState);
+void zxtapeFileApiBuffer_restoreState(const ZXTAPE_FILE_API_BUFFER_STATE_T *pState);
 
 #endif  // _zxtape_file_api_buffer_h_
\ No newline at end of file
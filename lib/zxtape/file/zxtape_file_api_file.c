@@ -2,6 +2,10 @@
 #include "zxtape_file_api_file.h"
 
 #include "../../../include/tzx_compat_impl.h"
+#include "../stats/zxtape_stats.h"
+
+/* Forward declarations */
+static int read(void *buf, unsigned long count);
 
 //
 // File API, platform specific
@@ -11,6 +15,18 @@ void zxtapeFileApiFile_initialize(TZX_FILETYPE *pFileType) {
   // Implementation is in tzx_compat_<platform>.c
   pFileType->open = (bool (*)(struct _TZX_FILETYPE *, u32, TZX_oflag_t))TZXCompat_fileOpen;
   pFileType->close = TZXCompat_fileClose;
-  pFileType->read = TZXCompat_fileRead;
+  pFileType->read = read;
   pFileType->seekSet = TZXCompat_fileSeekSet;
 }
+
+/**
+ * Read through the implementation, recording the time waiting for it
+ */
+static int read(void *buf, unsigned long count) {
+  unsigned long long nStartNs = TZXCompat_getTickNs();
+  int nRead = TZXCompat_fileRead(buf, count);
+
+  zxtapeStats_recordFileRead(nRead > 0 ? nRead : 0, TZXCompat_getTickNs() - nStartNs);
+
+  return nRead;
+}
@@ -7,7 +7,14 @@
 #define PROGNAME_LENGTH 11                 // 10 + 1 for the terminator
 #define STANDARD_STRING_BUFFER_LENGTH 256  // 255 + 1 for the terminator
 
+typedef struct _ZXTAPE_INFO_SOURCE_T {
+  const byte *pTape;      // The tape in memory, or NULL to read it from TZX_entry
+  unsigned long nLength;  // Length of the tape
+  const char *pFilename;  // Name of the tape (the file type of tapes without a header is from the extension)
+} ZXTAPE_INFO_SOURCE_T;
+
 /* Forward declarations */
+static int loadInfo(ZXTAPE_INFO_T *pInfo);
 static bool processTZX(unsigned long *pos, ZXTAPE_INFO_T *pInfo);
 static bool processTAP(unsigned long *pos, ZXTAPE_INFO_T *pInfo);
 static bool processStandardSpeedDataBlock(unsigned long *pos, ZXTAPE_INFO_T *pInfo, bool isTzx, bool *pIsProgramHeader);
@@ -31,6 +38,7 @@ static bool processHardwareTypeBlock(unsigned long *pos, ZXTAPE_INFO_T *pInfo);
 static bool processCustomInfoBlock(unsigned long *pos, ZXTAPE_INFO_T *pInfo);
 static bool readHeader(unsigned long *pos, ZXTAPE_FILETYPE_T *pFileType);
 static bool checkForTap(char *filename);
+static unsigned long readAt(unsigned long pos, byte *pBuffer, unsigned long length);
 static bool readByte(unsigned long *pos, byte *pValue);
 static bool readBytes(unsigned long *pos, byte *pBuffer, unsigned long length);
 static bool readWord(unsigned long *pos, word *pValue);
@@ -44,21 +52,251 @@ static void createTapeSectionIfRequired(ZXTAPE_INFO_T *pInfo, byte id, unsigned
 static void createTapeSectionInfo(ZXTAPE_INFO_T *pInfo, byte id, unsigned int offset);
 static void destroyTapeSectionInfos(ZXTAPE_INFO_T *pInfo);
 static void stripNonPlayableSectionInfos(ZXTAPE_INFO_T *pInfo);
+static void addBlockOffset(ZXTAPE_INFO_T *pInfo, unsigned long offset);
 
 /* Imported variables */
 extern const char TZXTape[];
 
-/* Local variables */
+/* Local variables (only used while reading a tape, the callers serialise the reads) */
 static char m_pNameBuffer[STANDARD_STRING_BUFFER_LENGTH];
-static ZXTAPE_INFO_T m_info;
+static ZXTAPE_INFO_SOURCE_T m_source;  // Tape being read
+
+/**
+ * Load the info of the current tape file / buffer into pInfo (zeroed before the first load, and kept between loads
+ * until zxtapeInfo_freeInfo())
+ */
+int zxtapeInfo_loadInfo(ZXTAPE_INFO_T *pInfo) {
+  m_source.pTape = NULL;
+  m_source.nLength = TZX_filesize;
+  m_source.pFilename = TZX_fileName;
+  TZX_entry.close();
+  TZX_entry.open(&TZX_dir, 0, 0);
+
+  return loadInfo(pInfo);
+}
+
+/**
+ * Load the info of a tape in memory into pInfo (as zxtapeInfo_loadInfo())
+ *
+ * Reads neither the current tape nor the TZX library, so can be called outside the engine (see zxtape_loadBuffer()).
+ *
+ * @param pInfo Tape info
+ * @param pFilename Name of the tape
+ * @param pTape The whole tape file
+ * @param nLength Length of the tape
+ * @return int 0 on success, -1 if the tape could not be read
+ */
+int zxtapeInfo_loadInfoBuffer(ZXTAPE_INFO_T *pInfo, const char *pFilename, const u8 *pTape, unsigned long nLength) {
+  m_source.pTape = pTape;
+  m_source.nLength = nLength;
+  m_source.pFilename = pFilename;
+
+  return loadInfo(pInfo);
+}
+
+/**
+ * Free the memory held by the info (it can be loaded again)
+ */
+void zxtapeInfo_freeInfo(ZXTAPE_INFO_T *pInfo) {
+  destroyTapeSectionInfos(pInfo);
+  free(pInfo->pBlockOffsets);
+  pInfo->pBlockOffsets = NULL;
+  pInfo->blockOffsetsCapacity = 0;
+  pInfo->blockCount = 0;
+}
+
+void zxtapeInfo_printInfo(ZXTAPE_INFO_T *pInfo) {
+  zxtape_log_debug("====== Tape Info ======");
+  zxtape_log_debug("Filetype: %u", pInfo->filetype);
+  zxtape_log_debug("Section Count: %u", pInfo->sectionCount);
+  zxtape_log_debug("Block Count: %u", pInfo->blockCount);
+  ZXTAPE_SECTION_INFO_T *pSection = pInfo->pSections;
+  while (pSection != NULL) {
+    zxtape_log_debug("-- Section %02u --", pSection->index);
+    zxtape_log_debug("Id: %02x", pSection->id);
+    zxtape_log_debug("Start Block Index: %u", pSection->blockIndex);
+    zxtape_log_debug("Block Count: %u", pSection->blockCount);
+    zxtape_log_debug("Playable Block Count: %u", pSection->playableBlockCount);
+    zxtape_log_debug("Name: %s", pSection->pName);
+    zxtape_log_debug("Program Header: %u", pSection->hasProgramHeader);
+    zxtape_log_debug("Group: %u", pSection->hasGroup);
+    zxtape_log_debug("Description: %u", pSection->hasDescription);
+    zxtape_log_debug("Stop Tape: %u", pSection->hasStopTape);
+    zxtape_log_debug("Stop Tape (48K): %u", pSection->hasStopTape48K);
+    zxtape_log_debug("Offset/Length: %u,%u", pSection->offset, pSection->length);
+    pSection = pSection->pNext;
+  }
+
+  zxtape_log_debug("==== End Tape Info ====");
+}
+
+/**
+ * Find the index of the block starting at a file offset
+ *
+ * @param pInfo Tape info
+ * @param offset File offset of the start of the block (the ID byte for TZX files)
+ * @return int Block index, or -1 if no block starts at the offset
+ */
+int zxtapeInfo_findBlockIndex(ZXTAPE_INFO_T *pInfo, unsigned long offset) {
+  if (pInfo == NULL || pInfo->pBlockOffsets == NULL) return -1;
+
+  // Block offsets are in file order, so binary search
+  unsigned int lo = 0;
+  unsigned int hi = pInfo->blockCount;
+  while (lo < hi) {
+    unsigned int mid = lo + (hi - lo) / 2;
+    if (pInfo->pBlockOffsets[mid] < offset) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+
+  if (lo < pInfo->blockCount && pInfo->pBlockOffsets[lo] == offset) return (int)lo;
+
+  return -1;
+}
+
+/**
+ * Find the section which starts with a block
+ *
+ * @param pInfo Tape info
+ * @param blockIndex Index of the block
+ * @return ZXTAPE_SECTION_INFO_T* The section starting at the block, or NULL if the block does not start a section
+ */
+ZXTAPE_SECTION_INFO_T *zxtapeInfo_findSectionStart(ZXTAPE_INFO_T *pInfo, unsigned int blockIndex) {
+  if (pInfo == NULL) return NULL;
+
+  ZXTAPE_SECTION_INFO_T *pSection = pInfo->pSections;
+  while (pSection != NULL) {
+    if (pSection->blockIndex == blockIndex) return pSection;
+    if (pSection->blockIndex > blockIndex) break;
+    pSection = pSection->pNext;
+  }
+
+  return NULL;
+}
+
+/**
+ * Get the payload of a data block (TZX ID10 / ID11 / ID14, or a TAP file block) directly from the file
+ *
+ * Only the block header is parsed; no pulses are generated. When the tape is in memory (pTape) the payload is not
+ * copied. Otherwise it is read into pBuffer if it fits; if not, everything but the payload (and checksum check) is
+ * returned, so the caller can retry with a large enough buffer.
+ *
+ * @param pInfo Tape info
+ * @param blockIndex Index of the block
+ * @param pTape The whole tape file in memory, or NULL to read the payload from the file
+ * @param pData Block data (set on success)
+ * @param pBuffer Buffer for the payload (not used if pTape is set, may be NULL)
+ * @param nBufferLen Length of pBuffer
+ * @return bool true if the block is a data block, false if not (or it could not be read)
+ */
+bool zxtapeInfo_getBlockData(ZXTAPE_INFO_T *pInfo, unsigned int blockIndex, const u8 *pTape,
+                             ZXTAPE_BLOCK_DATA_T *pData, u8 *pBuffer, u32 nBufferLen) {
+  if (pInfo == NULL || pInfo->pBlockOffsets == NULL || blockIndex >= pInfo->blockCount) return false;
+
+  m_source.pTape = pTape;
+  m_source.nLength = TZX_filesize;
+  m_source.pFilename = TZX_fileName;
+
+  unsigned long pos = pInfo->pBlockOffsets[blockIndex];
+  byte id = TAP;
+  byte usedBits = 8;
+  word pause = 0;
+  word wordLength = 0;
+  unsigned long length = 0;
+  byte skip[12];
+
+  memset(pData, 0, sizeof(ZXTAPE_BLOCK_DATA_T));
+
+  if (pInfo->filetype == ZXTAPE_FILETYPE_TAP) {
+    // Length of data that follow
+    if (!readWord(&pos, &wordLength)) return false;
+    length = wordLength;
+    pause = PAUSELENGTH;
+  } else if (pInfo->filetype == ZXTAPE_FILETYPE_TZX) {
+    if (!readByte(&pos, &id)) return false;
+
+    switch (id) {
+      // Standard Speed Data Block
+      case ID10:
+        if (!readWord(&pos, &pause)) return false;
+        if (!readWord(&pos, &wordLength)) return false;
+        length = wordLength;
+        break;
+
+      // Turbo Speed Data Block (skip the pilot, sync, bit and pilot tone lengths)
+      case ID11:
+        if (!readBytes(&pos, skip, 12)) return false;
+        if (!readByte(&pos, &usedBits)) return false;
+        if (!readWord(&pos, &pause)) return false;
+        if (!readLong(&pos, &length)) return false;
+        break;
+
+      // Pure Data Block (skip the bit lengths)
+      case ID14:
+        if (!readBytes(&pos, skip, 4)) return false;
+        if (!readByte(&pos, &usedBits)) return false;
+        if (!readWord(&pos, &pause)) return false;
+        if (!readLong(&pos, &length)) return false;
+        break;
+
+      // Pause or 'Stop the tape' (0) block (only the ID and the pause are set)
+      case ID20:
+        if (!readWord(&pos, &pause)) return false;
+        pData->nBlockId = id;
+        pData->nPauseMs = pause;
+        return false;
+
+      // Not a data block (only the ID is set)
+      default:
+        pData->nBlockId = id;
+        return false;
+    }
+  } else {
+    return false;
+  }
+
+  if (length == 0 || pos + length > m_source.nLength) return false;
+
+  pData->nBlockId = id;
+  pData->nOffset = pos;
+  pData->nLength = length;
+  pData->nUsedBits = usedBits;
+  pData->nPauseMs = pause;
+
+  // Get the payload (in place if the tape is in memory)
+  if (pTape != NULL) {
+    pData->pData = pTape + pos;
+  } else if (pBuffer != NULL && nBufferLen >= length) {
+    unsigned long readPos = pos;
+    if (!readBytes(&readPos, pBuffer, length)) return false;
+    pData->pData = pBuffer;
+  }
+
+  if (pData->pData != NULL) {
+    byte checksum = 0;
+    for (unsigned long i = 0; i < length; i++) checksum ^= pData->pData[i];
+    pData->nFlag = pData->pData[0];
+    pData->nChecksum = pData->pData[length - 1];
+    pData->bChecksumValid = (checksum == 0);
+  } else {
+    unsigned long lastPos = pos + length - 1;
+    if (!readByte(&pos, &pData->nFlag)) return false;
+    if (!readByte(&lastPos, &pData->nChecksum)) return false;
+  }
+
+  return true;
+}
 
-int zxtapeInfo_loadInfo(ZXTAPE_INFO_T **ppInfo) {
+/**
+ * Load the info of the tape being read (see m_source)
+ */
+static int loadInfo(ZXTAPE_INFO_T *pInfo) {
   bool result = false;
-  ZXTAPE_FILETYPE_T fileType;
 
   // Initialize the info structure
-  *ppInfo = &m_info;
-  ZXTAPE_INFO_T *pInfo = *ppInfo;
   pInfo->filetype = ZXTAPE_FILETYPE_UNKNOWN;
   pInfo->sectionCount = 0;
   pInfo->blockCount = 0;
@@ -68,8 +306,6 @@ int zxtapeInfo_loadInfo(ZXTAPE_INFO_T **ppInfo) {
   memset(m_pNameBuffer, 0, sizeof(m_pNameBuffer));
 
   // Load the info from the tape file / buffer
-  TZX_entry.close();
-  TZX_entry.open(&TZX_dir, 0, 0);
   unsigned long pos = 0;
 
   // Read the file header
@@ -100,31 +336,6 @@ int zxtapeInfo_loadInfo(ZXTAPE_INFO_T **ppInfo) {
   return 0;
 }
 
-void zxtapeInfo_printInfo(ZXTAPE_INFO_T *pInfo) {
-  zxtape_log_debug("====== Tape Info ======");
-  zxtape_log_debug("Filetype: %u", pInfo->filetype);
-  zxtape_log_debug("Section Count: %u", pInfo->sectionCount);
-  zxtape_log_debug("Block Count: %u", pInfo->blockCount);
-  ZXTAPE_SECTION_INFO_T *pSection = pInfo->pSections;
-  while (pSection != NULL) {
-    zxtape_log_debug("-- Section %02u --", pSection->index);
-    zxtape_log_debug("Id: %02x", pSection->id);
-    zxtape_log_debug("Start Block Index: %u", pSection->blockIndex);
-    zxtape_log_debug("Block Count: %u", pSection->blockCount);
-    zxtape_log_debug("Playable Block Count: %u", pSection->playableBlockCount);
-    zxtape_log_debug("Name: %s", pSection->pName);
-    zxtape_log_debug("Program Header: %u", pSection->hasProgramHeader);
-    zxtape_log_debug("Group: %u", pSection->hasGroup);
-    zxtape_log_debug("Description: %u", pSection->hasDescription);
-    zxtape_log_debug("Stop Tape: %u", pSection->hasStopTape);
-    zxtape_log_debug("Stop Tape (48K): %u", pSection->hasStopTape48K);
-    zxtape_log_debug("Offset/Length: %u,%u", pSection->offset, pSection->length);
-    pSection = pSection->pNext;
-  }
-
-  zxtape_log_debug("==== End Tape Info ====");
-}
-
 static bool processTZX(unsigned long *pos, ZXTAPE_INFO_T *pInfo) {
   unsigned long startBlockPos = *pos;
   pInfo->blockCount = 0;
@@ -134,7 +345,7 @@ static bool processTZX(unsigned long *pos, ZXTAPE_INFO_T *pInfo) {
   // Process the TZX file
   while (1) {
     // Check for end of file
-    if (*pos >= TZX_filesize) break;
+    if (*pos >= m_source.nLength) break;
 
     byte id = 0;
     byte byteValue = 0;
@@ -302,10 +513,11 @@ static bool processTZX(unsigned long *pos, ZXTAPE_INFO_T *pInfo) {
     printBlockInfo(pInfo->blockCount, id, startBlockPos, length, NULL);
 
     // Info
+    addBlockOffset(pInfo, startBlockPos);
     pInfo->blockCount++;
   }
 
-  zxtape_log_debug("Filesize: %u, TZX data size: %u", TZX_filesize, *pos);
+  zxtape_log_debug("Filesize: %u, TZX data size: %u", m_source.nLength, *pos);
 
   zxtape_log_debug("==== End TZX Info ====");
 
@@ -320,7 +532,7 @@ static bool processTAP(unsigned long *pos, ZXTAPE_INFO_T *pInfo) {
 
   // Process the TAP file
   while (1) {
-    if (*pos >= TZX_filesize) break;
+    if (*pos >= m_source.nLength) break;
 
     bool isProgramHeader = false;
     startBlockPos = *pos;
@@ -341,10 +553,11 @@ static bool processTAP(unsigned long *pos, ZXTAPE_INFO_T *pInfo) {
     printBlockInfo(pInfo->blockCount, ID10, startBlockPos, length, NULL);
 
     // Info
+    addBlockOffset(pInfo, startBlockPos);
     pInfo->blockCount++;
   }
 
-  zxtape_log_debug("Filesize: %u, TZX data size: %u", TZX_filesize, *pos);
+  zxtape_log_debug("Filesize: %u, TZX data size: %u", m_source.nLength, *pos);
 
   zxtape_log_debug("==== End TAP Info ====");
 
@@ -354,19 +567,20 @@ static bool processTAP(unsigned long *pos, ZXTAPE_INFO_T *pInfo) {
 static bool readHeader(unsigned long *pos, ZXTAPE_FILETYPE_T *pFileType) {
   char tzxHeader[11];
 
-  TZX_entry.seekSet(0);
   memset(tzxHeader, 0, sizeof(tzxHeader));
-  int i = TZX_entry.read(tzxHeader, 10);
+  int i = readAt(0, (byte *)tzxHeader, 10);
   if (memcmp_P(tzxHeader, TZXTape, 7) != 0) {
-    // If not a TZX file, check for TAP file
-    bool isTap = checkForTap(TZX_fileName);
+    // If not a TZX file, check for TAP file (on a copy of the name, as checking changes it)
+    char filename[ZX_TAPE_MAX_FILENAME_LEN + 1];
+    strncpy(filename, m_source.pFilename, ZX_TAPE_MAX_FILENAME_LEN);
+    filename[ZX_TAPE_MAX_FILENAME_LEN] = '\0';
+    bool isTap = checkForTap(filename);
     if (isTap) {
       *pFileType = ZXTAPE_FILETYPE_TAP;
     } else {
       *pFileType = ZXTAPE_FILETYPE_UNKNOWN;
     }
     *pos = 0;
-    TZX_entry.seekSet(0);
     return true;
   }
 
@@ -374,8 +588,6 @@ static bool readHeader(unsigned long *pos, ZXTAPE_FILETYPE_T *pFileType) {
   *pFileType = ZXTAPE_FILETYPE_TZX;
   *pos = i;
 
-  TZX_entry.seekSet(i);
-
   return true;
 }
 
@@ -412,10 +624,10 @@ static bool processStandardSpeedDataBlock(unsigned long *pos, ZXTAPE_INFO_T *pIn
       // Probably a standard program header, extract the program name
       if (m_pNameBuffer[0] == 0) {
         if (!readString(pos, m_pNameBuffer, PROGNAME_LENGTH, true, true)) return false;
-        printf("Program Name: %s\n", m_pNameBuffer);
+        zxtape_log_debug("Program Name: %s", m_pNameBuffer);
       } else {
         if (!readString(pos, pNameBuffer, PROGNAME_LENGTH, true, true)) return false;
-        printf("Program Name: %s\n", pNameBuffer);
+        zxtape_log_debug("Program Name: %s", pNameBuffer);
       }
 
       *pIsProgramHeader = true;
@@ -599,7 +811,7 @@ static bool processGroupStartBlock(unsigned long *pos, ZXTAPE_INFO_T *pInfo) {
 
   // Process data
   if (!readString(pos, m_pNameBuffer, length, true, true)) return false;
-  printf("Group Name: %s\n", m_pNameBuffer);
+  zxtape_log_debug("Group Name: %s", m_pNameBuffer);
 
   // Skip Remaining Data
   *pos = end;
@@ -654,7 +866,7 @@ static bool processTextDescriptionBlock(unsigned long *pos, ZXTAPE_INFO_T *pInfo
 
   // Process data
   if (!readString(pos, m_pNameBuffer, length, true, true)) return false;
-  printf("Description: %s\n", m_pNameBuffer);
+  zxtape_log_debug("Description: %s", m_pNameBuffer);
 
   // Skip Remaining Data
   *pos = end;
@@ -674,7 +886,7 @@ static bool processMessageBlock(unsigned long *pos, ZXTAPE_INFO_T *pInfo) {
 
   // Process data
   if (!readString(pos, m_pNameBuffer, length, true, true)) return false;
-  printf("Message: %s\n", m_pNameBuffer);
+  zxtape_log_debug("Message: %s", m_pNameBuffer);
 
   // Skip Remaining Data
   *pos = end;
@@ -757,14 +969,26 @@ static bool processCustomInfoBlock(unsigned long *pos, ZXTAPE_INFO_T *pInfo) {
 //   }
 // }
 
+/**
+ * Read from the tape being read (in memory, or from TZX_entry)
+ *
+ * @return unsigned long Number of bytes read (fewer than length at the end of the tape)
+ */
+static unsigned long readAt(unsigned long pos, byte *pBuffer, unsigned long length) {
+  if (m_source.pTape == NULL) return TZX_entry.seekSet(pos) ? TZX_entry.read(pBuffer, length) : 0;
+
+  if (pos >= m_source.nLength) return 0;
+  if (length > m_source.nLength - pos) length = m_source.nLength - pos;
+  memcpy(pBuffer, m_source.pTape + pos, length);
+
+  return length;
+}
+
 static bool readByte(unsigned long *pos, byte *pValue) {
   // Read a byte from the file, and move file position on one if successful
   byte out[1];
-  int i = 0;
-  if (TZX_entry.seekSet(*pos)) {
-    i = TZX_entry.read(out, 1);
-    if (i == 1) *pos += 1;
-  }
+  int i = readAt(*pos, out, 1);
+  if (i == 1) *pos += 1;
   *pValue = out[0];
 
   return (i == 1);
@@ -773,11 +997,8 @@ static bool readByte(unsigned long *pos, byte *pValue) {
 static bool readBytes(unsigned long *pos, byte *pBuffer, unsigned long length) {
   // Read a set of bytes from the file into a buffer and move file position on the number of bytes read
   byte *out = pBuffer;
-  int i = 0;
-  if (TZX_entry.seekSet(*pos)) {
-    i = TZX_entry.read(out, length);
-    if (i == length) *pos += length;
-  }
+  int i = readAt(*pos, out, length);
+  if (i == length) *pos += length;
 
   return (i == length);
 }
@@ -785,11 +1006,8 @@ static bool readBytes(unsigned long *pos, byte *pBuffer, unsigned long length) {
 static bool readWord(unsigned long *pos, word *pValue) {
   // Read 2 bytes from the file, and move file position on two if successful
   byte out[2];
-  int i = 0;
-  if (TZX_entry.seekSet(*pos)) {
-    i = TZX_entry.read(out, 2);
-    if (i == 2) *pos += 2;
-  }
+  int i = readAt(*pos, out, 2);
+  if (i == 2) *pos += 2;
   *pValue = TZX_word(out[1], out[0]);
 
   return (i == 2);
@@ -798,11 +1016,8 @@ static bool readWord(unsigned long *pos, word *pValue) {
 static bool readLong(unsigned long *pos, unsigned long *pValue) {
   // Read 3 bytes from the file, and move file position on three if successful
   byte out[3];
-  int i = 0;
-  if (TZX_entry.seekSet(*pos)) {
-    i = TZX_entry.read(out, 3);
-    if (i == 3) *pos += 3;
-  }
+  int i = readAt(*pos, out, 3);
+  if (i == 3) *pos += 3;
   *pValue = ((unsigned long)TZX_word(out[2], out[1]) << 8) | out[0];
 
   return (i == 3);
@@ -811,11 +1026,8 @@ static bool readLong(unsigned long *pos, unsigned long *pValue) {
 static bool readDword(unsigned long *pos, unsigned long *pValue) {
   // Read 4 bytes from the file, and move file position on four if successful
   byte out[4];
-  int i = 0;
-  if (TZX_entry.seekSet(*pos)) {
-    i = TZX_entry.read(out, 4);
-    if (i == 4) *pos += 4;
-  }
+  int i = readAt(*pos, out, 4);
+  if (i == 4) *pos += 4;
   *pValue = ((unsigned long)TZX_word(out[3], out[2]) << 16) | TZX_word(out[1], out[0]);
 
   return (i == 4);
@@ -947,9 +1159,23 @@ static void destroyTapeSectionInfos(ZXTAPE_INFO_T *pInfo) {
     pSection = pNext;
   }
   pInfo->pSections = 0;
+  pInfo->pCurrentSection = 0;
   pInfo->sectionCount = 0;
 }
 
+static void addBlockOffset(ZXTAPE_INFO_T *pInfo, unsigned long offset) {
+  // Grow the block offset table as required (the table is kept between loads)
+  if (pInfo->blockCount >= pInfo->blockOffsetsCapacity) {
+    unsigned int capacity = pInfo->blockOffsetsCapacity ? pInfo->blockOffsetsCapacity * 2 : 64;
+    unsigned int *pOffsets = (unsigned int *)realloc(pInfo->pBlockOffsets, capacity * sizeof(unsigned int));
+    assert(pOffsets != NULL);
+    pInfo->pBlockOffsets = pOffsets;
+    pInfo->blockOffsetsCapacity = capacity;
+  }
+
+  pInfo->pBlockOffsets[pInfo->blockCount] = offset;
+}
+
 static void stripNonPlayableSectionInfos(ZXTAPE_INFO_T *pInfo) {
   ZXTAPE_SECTION_INFO_T *pSection = pInfo->pSections;
   ZXTAPE_SECTION_INFO_T *pPrevSection = NULL;
@@ -3,6 +3,8 @@
 #ifndef _zx_tape_info_h_
 #define _zx_tape_info_h_
 
+#include "../../../include/zxtape.h"
+
 #define ZXTAPE_INFO_STRING_BUFFER_LENGTH 256  // 255 + 1 for the terminator
 
 typedef enum _ZXTAPE_FILETYPE_T {
@@ -32,12 +34,20 @@ typedef struct _ZXTAPE_INFO_T {
   ZXTAPE_FILETYPE_T filetype;
   unsigned int sectionCount;
   unsigned int blockCount;
+  unsigned int *pBlockOffsets;  // File offset of each block (blockCount entries)
+  unsigned int blockOffsetsCapacity;
   ZXTAPE_SECTION_INFO_T *pSections;
   ZXTAPE_SECTION_INFO_T *pCurrentSection;
 } ZXTAPE_INFO_T;
 
 /* Exported functions */
-int zxtapeInfo_loadInfo(ZXTAPE_INFO_T **ppInfo);
+int zxtapeInfo_loadInfo(ZXTAPE_INFO_T *pInfo);
+int zxtapeInfo_loadInfoBuffer(ZXTAPE_INFO_T *pInfo, const char *pFilename, const u8 *pTape, unsigned long nLength);
+void zxtapeInfo_freeInfo(ZXTAPE_INFO_T *pInfo);
 void zxtapeInfo_printInfo(ZXTAPE_INFO_T *pInfo);
+int zxtapeInfo_findBlockIndex(ZXTAPE_INFO_T *pInfo, unsigned long offset);
+ZXTAPE_SECTION_INFO_T *zxtapeInfo_findSectionStart(ZXTAPE_INFO_T *pInfo, unsigned int blockIndex);
+bool zxtapeInfo_getBlockData(ZXTAPE_INFO_T *pInfo, unsigned int blockIndex, const u8 *pTape,
+                             ZXTAPE_BLOCK_DATA_T *pData, u8 *pBuffer, u32 nBufferLen);
 
 #endif  // _zx_tape_info_h_
@@ -0,0 +1,80 @@
+#include "zxtape_render.h"
+
+#include "../tzx_compat/tzx_compat.h"
+
+//
+// Pulse to PCM renderer
+//
+// Pulses are pulled on demand and rendered straight into the caller's buffer. Positions are held in integer units of
+// us * sample rate, so pulse edges keep their exact phase within a sample, and nothing drifts over a long tape. Each
+// sample is the average level over its length, so an edge part way through a sample gives an intermediate value.
+//
+
+/**
+ * Initialize (reset) a renderer. The output is held low until the first pulse.
+ *
+ * @param pRender Renderer to initialize
+ */
+void zxtapeRender_initialize(ZXTAPE_RENDER_T *pRender) {
+  assert(pRender != NULL);
+
+  pRender->nSampleRate = 0;
+  pRender->nPulseRemaining = 0;
+  pRender->nLevel = 0;
+}
+
+/**
+ * Render frames of mono PCM, pulling pulses as required
+ *
+ * Once there are no more pulses the current level is held for the rest of the frames.
+ *
+ * @param pRender Renderer
+ * @param pOut Buffer for the frames
+ * @param nFrames Number of frames to render
+ * @param nSampleRate Sample rate (Hz). May change between calls; the current pulse position is carried over.
+ * @param pfnNextPulse Function to get the next pulse
+ * @param pContext Context passed to pfnNextPulse
+ */
+void zxtapeRender_render(ZXTAPE_RENDER_T *pRender, i16 *pOut, u32 nFrames, u32 nSampleRate,
+                         ZXTAPE_RENDER_NEXT_PULSE_T pfnNextPulse, void *pContext) {
+  assert(pRender != NULL);
+  assert(pOut != NULL || nFrames == 0);
+  assert(nSampleRate > 0);
+
+  // Rescale the rest of the current pulse if the sample rate changed
+  if (pRender->nSampleRate != nSampleRate) {
+    if (pRender->nSampleRate != 0) {
+      pRender->nPulseRemaining = pRender->nPulseRemaining * nSampleRate / pRender->nSampleRate;
+    }
+    pRender->nSampleRate = nSampleRate;
+  }
+
+  bool bMore = true;
+  for (u32 i = 0; i < nFrames; i++) {
+    u64 nSampleRemaining = ZXTAPE_RENDER_SAMPLE_UNITS;
+    u64 nHigh = 0;  // Time high within this sample
+
+    while (nSampleRemaining > 0) {
+      if (pRender->nPulseRemaining == 0) {
+        // Get the next pulse, or hold the level if there are none
+        ZXTAPE_PULSE_T pulse;
+        if (!bMore || !pfnNextPulse(pContext, &pulse)) {
+          bMore = false;
+          if (pRender->nLevel) nHigh += nSampleRemaining;
+          break;
+        }
+        pRender->nLevel = pulse.nLevel;
+        pRender->nPulseRemaining = (u64)pulse.nPeriodUs * nSampleRate;
+        continue;
+      }
+
+      u64 n = pRender->nPulseRemaining < nSampleRemaining ? pRender->nPulseRemaining : nSampleRemaining;
+      if (pRender->nLevel) nHigh += n;
+      pRender->nPulseRemaining -= n;
+      nSampleRemaining -= n;
+    }
+
+    pOut[i] = (i16)(ZXTAPE_RENDER_LEVEL_LOW +
+                    (i32)((ZXTAPE_RENDER_LEVEL_HIGH - ZXTAPE_RENDER_LEVEL_LOW) * nHigh / ZXTAPE_RENDER_SAMPLE_UNITS));
+  }
+}
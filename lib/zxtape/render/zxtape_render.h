@@ -0,0 +1,24 @@
+#ifndef _zxtape_render_h_
+#define _zxtape_render_h_
+
+#include "../../../include/zxtape.h"
+
+#define ZXTAPE_RENDER_SAMPLE_UNITS 1000000ull  // Length of one sample in pulse units (us * sample rate)
+
+/**
+ * Get the next pulse to render. Returns false if there are no more pulses (stopped, paused or ended).
+ */
+typedef bool (*ZXTAPE_RENDER_NEXT_PULSE_T)(void *pContext, ZXTAPE_PULSE_T *pPulse);
+
+typedef struct _ZXTAPE_RENDER_T {
+  u32 nSampleRate;      // Sample rate the current pulse position is held in (0 = none)
+  u64 nPulseRemaining;  // Rest of the current pulse (us * nSampleRate, so one sample is ZXTAPE_RENDER_SAMPLE_UNITS)
+  u8 nLevel;            // Level of the current pulse (held when there are no more pulses)
+} ZXTAPE_RENDER_T;
+
+/* Exported functions */
+void zxtapeRender_initialize(ZXTAPE_RENDER_T *pRender);
+void zxtapeRender_render(ZXTAPE_RENDER_T *pRender, i16 *pOut, u32 nFrames, u32 nSampleRate,
+                         ZXTAPE_RENDER_NEXT_PULSE_T pfnNextPulse, void *pContext);
+
+#endif  // _zxtape_render_h_
@@ -0,0 +1,411 @@
+#include "../../../include/zxtape_scheduler.h"
+
+#ifndef __ZX_TAPE_CIRCLE__
+
+#include <pthread.h>
+#include <time.h>
+
+#include "../tzx_compat/tzx_compat.h"
+
+//
+// Real-time scheduler for many instances
+//
+// Each instance plays to its own sink (see zxtape_setSink()). Rather than a thread per instance, a small pool of
+// threads tops up the sinks from a min-heap of deadlines: an instance is topped up to nLeadUs of tape ahead of real
+// time, and is due again when half of that is left. A thread sleeps until the earliest deadline, so the cost is the
+// tape generated, not the number of instances. Instances not playing are checked every
+// ZXTAPE_SCHEDULER_IDLE_POLL_US for play being pressed (controls are applied as they are topped up). Deadlines are on
+// the monotonic clock, whatever the compatibility layer implementation.
+//
+// The engine runs one instance at a time (see zxtape_create()), so generation is serialised whatever the number of
+// threads, but sinks are written outside it (see zxtape_writeSink()): more than one thread keeps the other instances
+// on time while a slow sink blocks.
+//
+
+#define ZXTAPE_SCHEDULER_IDLE_POLL_US 20000  // How often instances not playing are checked
+#define ZXTAPE_SCHEDULER_MIN_LEAD_US 1000    // Shortest lead
+#define ZXTAPE_SCHEDULER_INITIAL_CAPACITY 16
+
+typedef struct _ZXTAPE_SCHEDULER_ENTRY_T {
+  ZXTAPE_HANDLE_T *pInstance;
+  u32 nLeadUs;      // Tape to write ahead of real time
+  u64 nDeadlineNs;  // When to top up the sink next
+  u64 nStartNs;     // Clock time of the start of the instance's timeline (0 = not playing)
+  u64 nWrittenUs;   // Tape written since the timeline started
+  u32 nHeapIndex;   // Position in the heap (ZXTAPE_INDEX_NONE while being topped up)
+  bool bRemove;     // Remove once topped up (see zxtape_unscheduleInstance())
+} ZXTAPE_SCHEDULER_ENTRY_T;
+
+typedef struct _ZXTAPE_SCHEDULER_T {
+  ZXTAPE_SCHEDULER_HANDLE_T handle;
+  pthread_t threads[ZXTAPE_SCHEDULER_MAX_THREADS];
+  pthread_mutex_t mutex;
+  pthread_cond_t wake;      // The heap changed, or the scheduler is stopping
+  pthread_cond_t serviced;  // An instance was topped up
+  bool bStop;
+  ZXTAPE_SCHEDULER_ENTRY_T **ppEntries;  // Every instance scheduled
+  ZXTAPE_SCHEDULER_ENTRY_T **ppHeap;     // Instances not being topped up, earliest deadline first
+  u32 nCount;
+  u32 nHeapCount;
+  u32 nCapacity;
+  ZXTAPE_SCHEDULER_STATS_T stats;
+} ZXTAPE_SCHEDULER_T;
+
+/* Forward declarations */
+static void *workerThread(void *pArg);
+static bool topUp(ZXTAPE_SCHEDULER_ENTRY_T *pEntry, u64 nowNs);
+static void waitUntil(ZXTAPE_SCHEDULER_T *pScheduler, u64 nDeadlineNs);
+static u64 getTimeNs(void);
+static ZXTAPE_SCHEDULER_ENTRY_T *findEntry(ZXTAPE_SCHEDULER_T *pScheduler, ZXTAPE_HANDLE_T *pInstance, u32 *pIndex);
+static void heapPush(ZXTAPE_SCHEDULER_T *pScheduler, ZXTAPE_SCHEDULER_ENTRY_T *pEntry);
+static void heapRemove(ZXTAPE_SCHEDULER_T *pScheduler, u32 nIndex);
+static void heapSwap(ZXTAPE_SCHEDULER_T *pScheduler, u32 nIndex1, u32 nIndex2);
+static void heapUp(ZXTAPE_SCHEDULER_T *pScheduler, u32 nIndex);
+static void heapDown(ZXTAPE_SCHEDULER_T *pScheduler, u32 nIndex);
+
+/* Exported functions */
+
+/**
+ * Create a scheduler, with its pool of threads
+ *
+ * @param nThreads Threads in the pool (0 for 1, at most ZXTAPE_SCHEDULER_MAX_THREADS)
+ * @return ZXTAPE_SCHEDULER_HANDLE_T* Scheduler, or NULL if the threads could not be started
+ */
+ZXTAPE_SCHEDULER_HANDLE_T *zxtape_createScheduler(u32 nThreads) {
+  ZXTAPE_SCHEDULER_T *pScheduler = (ZXTAPE_SCHEDULER_T *)calloc(1, sizeof(ZXTAPE_SCHEDULER_T));
+  assert(pScheduler != NULL);
+
+  if (nThreads == 0) nThreads = 1;
+  if (nThreads > ZXTAPE_SCHEDULER_MAX_THREADS) nThreads = ZXTAPE_SCHEDULER_MAX_THREADS;
+
+  // Waits time out on the monotonic clock (see waitUntil())
+  pthread_condattr_t attr;
+  pthread_condattr_init(&attr);
+#ifndef __ZX_TAPE_MACOS__
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+#endif  // __ZX_TAPE_MACOS__
+  pthread_mutex_init(&pScheduler->mutex, NULL);
+  pthread_cond_init(&pScheduler->wake, &attr);
+  pthread_cond_init(&pScheduler->serviced, &attr);
+  pthread_condattr_destroy(&attr);
+
+  for (u32 i = 0; i < nThreads; i++) {
+    if (pthread_create(&pScheduler->threads[i], NULL, workerThread, pScheduler) != 0) {
+      zxtape_log_error("Failed to start scheduler thread");
+      zxtape_destroyScheduler(&pScheduler->handle);
+      return NULL;
+    }
+    pScheduler->handle.nThreads++;
+  }
+
+  return &pScheduler->handle;
+}
+
+/**
+ * Stop the threads of a scheduler, and free it. The instances are not destroyed (or stopped).
+ *
+ * @param pScheduler Scheduler
+ */
+void zxtape_destroyScheduler(ZXTAPE_SCHEDULER_HANDLE_T *pScheduler) {
+  assert(pScheduler != NULL);
+  ZXTAPE_SCHEDULER_T *pSched = (ZXTAPE_SCHEDULER_T *)pScheduler;
+
+  pthread_mutex_lock(&pSched->mutex);
+  pSched->bStop = true;
+  pthread_cond_broadcast(&pSched->wake);
+  pthread_mutex_unlock(&pSched->mutex);
+
+  for (u32 i = 0; i < pSched->handle.nThreads; i++) pthread_join(pSched->threads[i], NULL);
+
+  for (u32 i = 0; i < pSched->nCount; i++) free(pSched->ppEntries[i]);
+  free(pSched->ppEntries);
+  free(pSched->ppHeap);
+  pthread_cond_destroy(&pSched->serviced);
+  pthread_cond_destroy(&pSched->wake);
+  pthread_mutex_destroy(&pSched->mutex);
+  free(pSched);
+}
+
+/**
+ * Feed the sink of an instance in real time
+ *
+ * The instance must be in render mode with a sink (see zxtape_setSink()), and is then only driven by the scheduler:
+ * the host presses the controls, but does not call zxtape_run(). The sink is called from the scheduler's threads.
+ *
+ * @param pScheduler Scheduler
+ * @param pInstance Pointer to the ZxTape instance
+ * @param nLeadUs Tape written ahead of real time (us, 0 for the default, ZXTAPE_SCHEDULER_LEAD_US)
+ * @return true if scheduled, false if it already was
+ */
+bool zxtape_scheduleInstance(ZXTAPE_SCHEDULER_HANDLE_T *pScheduler, ZXTAPE_HANDLE_T *pInstance, u32 nLeadUs) {
+  assert(pScheduler != NULL && pInstance != NULL);
+  ZXTAPE_SCHEDULER_T *pSched = (ZXTAPE_SCHEDULER_T *)pScheduler;
+
+  if (nLeadUs == 0) nLeadUs = ZXTAPE_SCHEDULER_LEAD_US;
+  if (nLeadUs < ZXTAPE_SCHEDULER_MIN_LEAD_US) nLeadUs = ZXTAPE_SCHEDULER_MIN_LEAD_US;
+
+  pthread_mutex_lock(&pSched->mutex);
+
+  if (findEntry(pSched, pInstance, NULL) != NULL) {
+    pthread_mutex_unlock(&pSched->mutex);
+    return false;
+  }
+
+  // Grow the entry list and heap as required
+  if (pSched->nCount == pSched->nCapacity) {
+    u32 nCapacity = pSched->nCapacity ? pSched->nCapacity * 2 : ZXTAPE_SCHEDULER_INITIAL_CAPACITY;
+    size_t nSize = nCapacity * sizeof(ZXTAPE_SCHEDULER_ENTRY_T *);
+    pSched->ppEntries = (ZXTAPE_SCHEDULER_ENTRY_T **)realloc(pSched->ppEntries, nSize);
+    pSched->ppHeap = (ZXTAPE_SCHEDULER_ENTRY_T **)realloc(pSched->ppHeap, nSize);
+    assert(pSched->ppEntries != NULL && pSched->ppHeap != NULL);
+    pSched->nCapacity = nCapacity;
+  }
+
+  ZXTAPE_SCHEDULER_ENTRY_T *pEntry = (ZXTAPE_SCHEDULER_ENTRY_T *)calloc(1, sizeof(ZXTAPE_SCHEDULER_ENTRY_T));
+  assert(pEntry != NULL);
+  pEntry->pInstance = pInstance;
+  pEntry->nLeadUs = nLeadUs;
+  pEntry->nDeadlineNs = getTimeNs();
+
+  pSched->ppEntries[pSched->nCount++] = pEntry;
+  heapPush(pSched, pEntry);
+  pSched->stats.nInstances = pSched->nCount;
+
+  pthread_mutex_unlock(&pSched->mutex);
+
+  return true;
+}
+
+/**
+ * Stop feeding the sink of an instance (waits if it is being topped up, so the sink is not called after returning)
+ *
+ * @param pScheduler Scheduler
+ * @param pInstance Pointer to the ZxTape instance
+ */
+void zxtape_unscheduleInstance(ZXTAPE_SCHEDULER_HANDLE_T *pScheduler, ZXTAPE_HANDLE_T *pInstance) {
+  assert(pScheduler != NULL && pInstance != NULL);
+  ZXTAPE_SCHEDULER_T *pSched = (ZXTAPE_SCHEDULER_T *)pScheduler;
+  ZXTAPE_SCHEDULER_ENTRY_T *pEntry;
+  u32 nIndex;
+
+  pthread_mutex_lock(&pSched->mutex);
+
+  // Wait for the instance to be topped up (the thread puts it back in the heap)
+  while ((pEntry = findEntry(pSched, pInstance, &nIndex)) != NULL && pEntry->nHeapIndex == ZXTAPE_INDEX_NONE) {
+    pEntry->bRemove = true;
+    pthread_cond_wait(&pSched->serviced, &pSched->mutex);
+  }
+
+  if (pEntry != NULL) {
+    heapRemove(pSched, pEntry->nHeapIndex);
+    pSched->ppEntries[nIndex] = pSched->ppEntries[--pSched->nCount];
+    pSched->stats.nInstances = pSched->nCount;
+    free(pEntry);
+  }
+
+  pthread_mutex_unlock(&pSched->mutex);
+}
+
+/**
+ * Get the scheduler statistics
+ *
+ * @param pScheduler Scheduler
+ * @param pStats Statistics (set)
+ */
+void zxtape_getSchedulerStats(ZXTAPE_SCHEDULER_HANDLE_T *pScheduler, ZXTAPE_SCHEDULER_STATS_T *pStats) {
+  assert(pScheduler != NULL && pStats != NULL);
+  ZXTAPE_SCHEDULER_T *pSched = (ZXTAPE_SCHEDULER_T *)pScheduler;
+
+  pthread_mutex_lock(&pSched->mutex);
+  *pStats = pSched->stats;
+  pthread_mutex_unlock(&pSched->mutex);
+}
+
+//
+// Private functions
+//
+
+/**
+ * Pool thread: top up the instance with the earliest deadline once it is due
+ */
+static void *workerThread(void *pArg) {
+  ZXTAPE_SCHEDULER_T *pSched = (ZXTAPE_SCHEDULER_T *)pArg;
+
+  pthread_mutex_lock(&pSched->mutex);
+
+  while (!pSched->bStop) {
+    if (pSched->nHeapCount == 0) {
+      pthread_cond_wait(&pSched->wake, &pSched->mutex);
+      continue;
+    }
+
+    ZXTAPE_SCHEDULER_ENTRY_T *pEntry = pSched->ppHeap[0];
+    u64 nowNs = getTimeNs();
+    if (pEntry->nDeadlineNs > nowNs) {
+      waitUntil(pSched, pEntry->nDeadlineNs);
+      continue;
+    }
+
+    // Take the instance out of the heap while topping it up (without the lock, so other threads take the next)
+    heapRemove(pSched, 0);
+    u64 nLateNs = nowNs - pEntry->nDeadlineNs;
+    pthread_mutex_unlock(&pSched->mutex);
+
+    bool bLate = topUp(pEntry, nowNs);
+
+    pthread_mutex_lock(&pSched->mutex);
+    pSched->stats.nServices++;
+    if (bLate) pSched->stats.nLate++;
+    if (nLateNs > pSched->stats.nMaxLateNs) pSched->stats.nMaxLateNs = nLateNs;
+    heapPush(pSched, pEntry);
+    if (pEntry->bRemove) pthread_cond_broadcast(&pSched->serviced);
+  }
+
+  pthread_mutex_unlock(&pSched->mutex);
+
+  return NULL;
+}
+
+/**
+ * Write the tape due to an instance's sink, up to the lead, and set when it is due again
+ *
+ * @return true if the sink had run dry (the timeline was restarted)
+ */
+static bool topUp(ZXTAPE_SCHEDULER_ENTRY_T *pEntry, u64 nowNs) {
+  bool bLate = false;
+
+  // Start the timeline (playback started, or resumed)
+  if (pEntry->nStartNs == 0) {
+    pEntry->nStartNs = nowNs;
+    pEntry->nWrittenUs = 0;
+  }
+
+  // If the sink has run dry, the rest of the tape plays from now
+  u64 nPlayedUs = (nowNs - pEntry->nStartNs) / 1000;
+  if (nPlayedUs > pEntry->nWrittenUs) {
+    bLate = pEntry->nWrittenUs > 0;
+    pEntry->nStartNs = nowNs - pEntry->nWrittenUs * 1000;
+    nPlayedUs = pEntry->nWrittenUs;
+  }
+
+  u64 nWrittenUs = zxtape_writeSink(pEntry->pInstance, nPlayedUs + pEntry->nLeadUs - pEntry->nWrittenUs);
+  pEntry->nWrittenUs += nWrittenUs;
+
+  if (nWrittenUs == 0) {
+    // Stopped, paused or ended, so check again later
+    pEntry->nStartNs = 0;
+    pEntry->nDeadlineNs = nowNs + ZXTAPE_SCHEDULER_IDLE_POLL_US * 1000ull;
+  } else {
+    // Due again when half of the lead is left
+    u64 nHalfLeadUs = pEntry->nLeadUs / 2;
+    u64 nDueUs = pEntry->nWrittenUs > nHalfLeadUs ? pEntry->nWrittenUs - nHalfLeadUs : 0;
+    pEntry->nDeadlineNs = pEntry->nStartNs + nDueUs * 1000;
+  }
+
+  return bLate;
+}
+
+/**
+ * Wait for a deadline, or for the heap to change (with the lock held)
+ */
+static void waitUntil(ZXTAPE_SCHEDULER_T *pScheduler, u64 nDeadlineNs) {
+  struct timespec ts;
+
+#ifdef __ZX_TAPE_MACOS__
+  // No monotonic condition variables, but relative waits are not moved by wall clock changes either
+  u64 nNowNs = getTimeNs();
+  u64 nLeftNs = nDeadlineNs > nNowNs ? nDeadlineNs - nNowNs : 0;
+  ts.tv_sec = (time_t)(nLeftNs / 1000000000ull);
+  ts.tv_nsec = (long)(nLeftNs % 1000000000ull);
+  pthread_cond_timedwait_relative_np(&pScheduler->wake, &pScheduler->mutex, &ts);
+#else
+  ts.tv_sec = (time_t)(nDeadlineNs / 1000000000ull);
+  ts.tv_nsec = (long)(nDeadlineNs % 1000000000ull);
+  pthread_cond_timedwait(&pScheduler->wake, &pScheduler->mutex, &ts);
+#endif  // __ZX_TAPE_MACOS__
+}
+
+/**
+ * Get the monotonic clock, which wall clock changes do not move (nanoseconds)
+ */
+static u64 getTimeNs(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (u64)ts.tv_sec * 1000000000ull + (u64)ts.tv_nsec;
+}
+
+static ZXTAPE_SCHEDULER_ENTRY_T *findEntry(ZXTAPE_SCHEDULER_T *pScheduler, ZXTAPE_HANDLE_T *pInstance, u32 *pIndex) {
+  for (u32 i = 0; i < pScheduler->nCount; i++) {
+    if (pScheduler->ppEntries[i]->pInstance == pInstance) {
+      if (pIndex != NULL) *pIndex = i;
+      return pScheduler->ppEntries[i];
+    }
+  }
+
+  return NULL;
+}
+
+static void heapPush(ZXTAPE_SCHEDULER_T *pScheduler, ZXTAPE_SCHEDULER_ENTRY_T *pEntry) {
+  u32 nIndex = pScheduler->nHeapCount++;
+
+  pScheduler->ppHeap[nIndex] = pEntry;
+  pEntry->nHeapIndex = nIndex;
+  heapUp(pScheduler, nIndex);
+
+  // Wake a thread to wait for the (possibly) new earliest deadline
+  pthread_cond_signal(&pScheduler->wake);
+}
+
+static void heapRemove(ZXTAPE_SCHEDULER_T *pScheduler, u32 nIndex) {
+  u32 nLast = --pScheduler->nHeapCount;
+
+  pScheduler->ppHeap[nIndex]->nHeapIndex = ZXTAPE_INDEX_NONE;
+  if (nIndex == nLast) return;
+
+  pScheduler->ppHeap[nIndex] = pScheduler->ppHeap[nLast];
+  pScheduler->ppHeap[nIndex]->nHeapIndex = nIndex;
+  heapUp(pScheduler, nIndex);
+  heapDown(pScheduler, pScheduler->ppHeap[nIndex]->nHeapIndex);
+}
+
+static void heapSwap(ZXTAPE_SCHEDULER_T *pScheduler, u32 nIndex1, u32 nIndex2) {
+  ZXTAPE_SCHEDULER_ENTRY_T *pEntry = pScheduler->ppHeap[nIndex1];
+
+  pScheduler->ppHeap[nIndex1] = pScheduler->ppHeap[nIndex2];
+  pScheduler->ppHeap[nIndex2] = pEntry;
+  pScheduler->ppHeap[nIndex1]->nHeapIndex = nIndex1;
+  pScheduler->ppHeap[nIndex2]->nHeapIndex = nIndex2;
+}
+
+static void heapUp(ZXTAPE_SCHEDULER_T *pScheduler, u32 nIndex) {
+  ZXTAPE_SCHEDULER_ENTRY_T **ppHeap = pScheduler->ppHeap;
+
+  while (nIndex > 0) {
+    u32 nParent = (nIndex - 1) / 2;
+    if (ppHeap[nParent]->nDeadlineNs <= ppHeap[nIndex]->nDeadlineNs) break;
+    heapSwap(pScheduler, nParent, nIndex);
+    nIndex = nParent;
+  }
+}
+
+static void heapDown(ZXTAPE_SCHEDULER_T *pScheduler, u32 nIndex) {
+  ZXTAPE_SCHEDULER_ENTRY_T **ppHeap = pScheduler->ppHeap;
+
+  for (;;) {
+    u32 nSmallest = nIndex;
+    u32 nLeft = nIndex * 2 + 1;
+    u32 nRight = nLeft + 1;
+    if (nLeft < pScheduler->nHeapCount && ppHeap[nLeft]->nDeadlineNs < ppHeap[nSmallest]->nDeadlineNs) {
+      nSmallest = nLeft;
+    }
+    if (nRight < pScheduler->nHeapCount && ppHeap[nRight]->nDeadlineNs < ppHeap[nSmallest]->nDeadlineNs) {
+      nSmallest = nRight;
+    }
+    if (nSmallest == nIndex) break;
+    heapSwap(pScheduler, nIndex, nSmallest);
+    nIndex = nSmallest;
+  }
+}
+
+#endif  // __ZX_TAPE_CIRCLE__
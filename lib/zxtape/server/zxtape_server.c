@@ -0,0 +1,645 @@
+#include "../../../include/zxtape_server.h"
+
+#ifndef __ZX_TAPE_CIRCLE__
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "../../../include/zxtape_scheduler.h"
+#include "../../../include/zxtape_shm.h"
+#include "../tzx_compat/tzx_compat.h"
+
+//
+// Tape server
+//
+// Hosts many sessions (instances) for clients on a Unix domain socket (see zxtape_server.h for the protocol). One
+// thread owns the sockets and the sessions: it reads and answers the requests in order, and writes the pushes. The
+// sessions play in real time from a scheduler (see zxtape_createScheduler()), whose threads only touch a session's
+// counters and pending flags, and wake the server thread through a pipe, so no lock is held across the sockets.
+// Controls are applied as soon as they are requested, so a reply gives the state after the request.
+//
+
+#ifdef MSG_NOSIGNAL
+#define ZXTAPE_SERVER_SEND_FLAGS MSG_NOSIGNAL
+#else
+#define ZXTAPE_SERVER_SEND_FLAGS 0
+#endif
+
+#define ZXTAPE_SERVER_READ_LENGTH 65536              // Bytes read from a connection at a time
+#define ZXTAPE_SERVER_MAX_OUTPUT (16 * 1024 * 1024)  // Most output waiting for a connection, before it is closed
+#define ZXTAPE_SERVER_PULSE_LENGTH (1 << 16)         // Default shared memory pulse ring length
+#define ZXTAPE_SERVER_PENDING_EVENTS 0x01            // Session pending: events to dispatch
+#define ZXTAPE_SERVER_PENDING_STATUS 0x02            // Session pending: playback stopped, status to push
+
+struct _ZXTAPE_SERVER_T;
+
+typedef struct _ZXTAPE_SERVER_CLIENT_T {
+  int fd;  // -1 if the slot is free
+  u8 *pIn;
+  u32 nIn;
+  u32 nInCapacity;
+  u8 *pOut;
+  u32 nOut;
+  u32 nOutCapacity;
+} ZXTAPE_SERVER_CLIENT_T;
+
+typedef struct _ZXTAPE_SERVER_SESSION_T {
+  u32 nSessionId;
+  struct _ZXTAPE_SERVER_T *pServer;
+  ZXTAPE_SERVER_CLIENT_T *pClient;  // Connection which opened the session (gets its pushes)
+  ZXTAPE_HANDLE_T *pInstance;
+  ZXTAPE_SINK_T sink;     // Counts, and passes on to the shared memory sink (if any)
+  ZXTAPE_SINK_SHM_T shm;  // Output (if bShm)
+  bool bShm;
+  u8 *pTape;        // Copy of the tape loaded
+  u32 nBlockIndex;  // Block playing (from the events)
+  u64 nPulses;      // Pulses played (scheduler threads)
+  u64 nTimeUs;      // Tape played (scheduler threads)
+  u32 nEnds;        // Times playback stopped (scheduler threads)
+  u32 nPending;     // ZXTAPE_SERVER_PENDING_* (set by the scheduler threads, cleared by the server thread)
+  struct _ZXTAPE_SERVER_SESSION_T *pNext;
+} ZXTAPE_SERVER_SESSION_T;
+
+typedef struct _ZXTAPE_SERVER_T {
+  ZXTAPE_SERVER_HANDLE_T handle;
+  struct sockaddr_un address;
+  int listenFd;
+  int wakeFds[2];  // Pipe waking the server thread
+  pthread_t thread;
+  bool bStop;
+  ZXTAPE_SCHEDULER_HANDLE_T *pScheduler;
+  ZXTAPE_SERVER_CLIENT_T clients[ZXTAPE_SERVER_MAX_CLIENTS];
+  ZXTAPE_SERVER_SESSION_T *pSessions;
+  u32 nSessions;
+  u32 nNextSessionId;
+} ZXTAPE_SERVER_T;
+
+/* Forward declarations */
+static void freeServer(ZXTAPE_SERVER_T *pServer);
+static void *serverThread(void *pArg);
+static void acceptClient(ZXTAPE_SERVER_T *pServer);
+static bool readClient(ZXTAPE_SERVER_T *pServer, ZXTAPE_SERVER_CLIENT_T *pClient);
+static bool writeClient(ZXTAPE_SERVER_CLIENT_T *pClient);
+static void closeClient(ZXTAPE_SERVER_T *pServer, ZXTAPE_SERVER_CLIENT_T *pClient);
+static void handleRequest(ZXTAPE_SERVER_T *pServer, ZXTAPE_SERVER_CLIENT_T *pClient,
+                          const ZXTAPE_SERVER_MESSAGE_T *pRequest, const u8 *pPayload);
+static ZXTAPE_SERVER_RESULT_T handleSessionRequest(ZXTAPE_SERVER_SESSION_T *pSession,
+                                                   const ZXTAPE_SERVER_MESSAGE_T *pRequest, const u8 *pPayload);
+static void queueMessage(ZXTAPE_SERVER_CLIENT_T *pClient, u16 nType, u8 nFlags, u8 nResult, u32 nTag, u32 nSessionId,
+                         const void *pPayload, u32 nLength);
+static ZXTAPE_SERVER_SESSION_T *openSession(ZXTAPE_SERVER_T *pServer, ZXTAPE_SERVER_CLIENT_T *pClient,
+                                            const ZXTAPE_SERVER_OPEN_T *pOpen, ZXTAPE_SERVER_RESULT_T *pResult);
+static void closeSession(ZXTAPE_SERVER_T *pServer, ZXTAPE_SERVER_SESSION_T *pSession);
+static ZXTAPE_SERVER_SESSION_T *findSession(ZXTAPE_SERVER_T *pServer, ZXTAPE_SERVER_CLIENT_T *pClient, u32 nId);
+static void getStatus(ZXTAPE_SERVER_SESSION_T *pSession, ZXTAPE_SERVER_STATUS_T *pStatus);
+static void stopSession(ZXTAPE_SERVER_SESSION_T *pSession);
+static void servicePending(ZXTAPE_SERVER_T *pServer);
+static void sessionWrite(ZXTAPE_SERVER_SESSION_T *pSession, const ZXTAPE_PULSE_T *pPulses, unsigned nCount);
+static void sessionEnd(ZXTAPE_SERVER_SESSION_T *pSession);
+static void sessionEvent(ZXTAPE_HANDLE_T *pInstance, const ZXTAPE_EVENT_T *pEvent, void *pUserData);
+static void sessionNotify(ZXTAPE_HANDLE_T *pInstance, void *pUserData);
+static void wakeServer(ZXTAPE_SERVER_T *pServer);
+static void setNonBlocking(int fd);
+
+/* Exported functions */
+
+/**
+ * Create a tape server, listening on a Unix domain socket
+ *
+ * The socket file is replaced if it exists, and removed when the server is destroyed.
+ *
+ * @param pSocketPath Path of the socket
+ * @param nWorkers Threads playing the sessions (1 to ZXTAPE_SCHEDULER_MAX_THREADS)
+ * @return ZXTAPE_SERVER_HANDLE_T* The server, or NULL if the socket or the threads could not be created
+ */
+ZXTAPE_SERVER_HANDLE_T *zxtape_createServer(const char *pSocketPath, u32 nWorkers) {
+  assert(pSocketPath != NULL);
+
+  ZXTAPE_SERVER_T *pServer = (ZXTAPE_SERVER_T *)calloc(1, sizeof(ZXTAPE_SERVER_T));
+  assert(pServer != NULL);
+  pServer->listenFd = -1;
+  pServer->wakeFds[0] = pServer->wakeFds[1] = -1;
+  pServer->nNextSessionId = 1;
+  for (u32 i = 0; i < ZXTAPE_SERVER_MAX_CLIENTS; i++) pServer->clients[i].fd = -1;
+
+  if (strlen(pSocketPath) >= sizeof(pServer->address.sun_path)) {
+    zxtape_log_error("Server socket path too long: %s", pSocketPath);
+    free(pServer);
+    return NULL;
+  }
+  pServer->address.sun_family = AF_UNIX;
+  strcpy(pServer->address.sun_path, pSocketPath);
+
+  unlink(pSocketPath);
+  pServer->listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+  struct sockaddr *pAddress = (struct sockaddr *)&pServer->address;
+  if (pServer->listenFd < 0 || bind(pServer->listenFd, pAddress, sizeof(pServer->address)) != 0 ||
+      listen(pServer->listenFd, ZXTAPE_SERVER_MAX_CLIENTS) != 0 || pipe(pServer->wakeFds) != 0) {
+    zxtape_log_error("Failed to create the server socket: %s", pSocketPath);
+    freeServer(pServer);
+    return NULL;
+  }
+  setNonBlocking(pServer->listenFd);
+  setNonBlocking(pServer->wakeFds[0]);
+  setNonBlocking(pServer->wakeFds[1]);
+
+  pServer->pScheduler = zxtape_createScheduler(nWorkers);
+  if (pServer->pScheduler == NULL) {
+    zxtape_log_error("Failed to start the server workers: %s", pSocketPath);
+    freeServer(pServer);
+    return NULL;
+  }
+  pServer->handle.nWorkers = pServer->pScheduler->nThreads;
+  if (pthread_create(&pServer->thread, NULL, serverThread, pServer) != 0) {
+    zxtape_log_error("Failed to start the server thread: %s", pSocketPath);
+    freeServer(pServer);
+    return NULL;
+  }
+
+  return &pServer->handle;
+}
+
+/**
+ * Destroy a tape server, closing the connections and their sessions
+ *
+ * @param pServer Server
+ */
+void zxtape_destroyServer(ZXTAPE_SERVER_HANDLE_T *pServer) {
+  assert(pServer != NULL);
+  ZXTAPE_SERVER_T *pSrv = (ZXTAPE_SERVER_T *)pServer;
+
+  __atomic_store_n(&pSrv->bStop, true, __ATOMIC_RELEASE);
+  wakeServer(pSrv);
+  pthread_join(pSrv->thread, NULL);
+
+  for (u32 i = 0; i < ZXTAPE_SERVER_MAX_CLIENTS; i++) {
+    if (pSrv->clients[i].fd >= 0) closeClient(pSrv, &pSrv->clients[i]);
+  }
+  freeServer(pSrv);
+}
+
+/**
+ * Free a server (its thread stopped, or never started) with its scheduler, sockets and socket file
+ */
+static void freeServer(ZXTAPE_SERVER_T *pServer) {
+  if (pServer->pScheduler != NULL) zxtape_destroyScheduler(pServer->pScheduler);
+  if (pServer->listenFd >= 0) {
+    close(pServer->listenFd);
+    unlink(pServer->address.sun_path);
+  }
+  if (pServer->wakeFds[0] >= 0) close(pServer->wakeFds[0]);
+  if (pServer->wakeFds[1] >= 0) close(pServer->wakeFds[1]);
+  free(pServer);
+}
+
+//
+// Connections
+//
+
+static void *serverThread(void *pArg) {
+  ZXTAPE_SERVER_T *pServer = (ZXTAPE_SERVER_T *)pArg;
+  struct pollfd fds[2 + ZXTAPE_SERVER_MAX_CLIENTS];
+  ZXTAPE_SERVER_CLIENT_T *pClients[ZXTAPE_SERVER_MAX_CLIENTS];
+
+  while (!__atomic_load_n(&pServer->bStop, __ATOMIC_ACQUIRE)) {
+    nfds_t nFds = 0;
+    fds[nFds].fd = pServer->wakeFds[0];
+    fds[nFds++].events = POLLIN;
+    fds[nFds].fd = pServer->listenFd;
+    fds[nFds++].events = POLLIN;
+    u32 nClients = 0;
+    for (u32 i = 0; i < ZXTAPE_SERVER_MAX_CLIENTS; i++) {
+      ZXTAPE_SERVER_CLIENT_T *pClient = &pServer->clients[i];
+      if (pClient->fd < 0) continue;
+      pClients[nClients++] = pClient;
+      fds[nFds].fd = pClient->fd;
+      fds[nFds++].events = POLLIN | (pClient->nOut > 0 ? POLLOUT : 0);
+    }
+
+    if (poll(fds, nFds, -1) < 0) {
+      if (errno == EINTR) continue;
+      zxtape_log_error("Server poll failed");
+      break;
+    }
+
+    if (fds[0].revents & POLLIN) {
+      u8 drain[64];
+      while (read(pServer->wakeFds[0], drain, sizeof(drain)) > 0) {
+      }
+    }
+    servicePending(pServer);
+    if (fds[1].revents & POLLIN) acceptClient(pServer);
+
+    for (u32 i = 0; i < nClients; i++) {
+      ZXTAPE_SERVER_CLIENT_T *pClient = pClients[i];
+      short revents = fds[2 + i].revents;
+      bool bOk = true;
+      if (revents & (POLLIN | POLLHUP | POLLERR)) bOk = readClient(pServer, pClient);
+      if (bOk && pClient->nOut > 0) bOk = writeClient(pClient);
+      if (!bOk) closeClient(pServer, pClient);
+    }
+  }
+
+  return NULL;
+}
+
+static void acceptClient(ZXTAPE_SERVER_T *pServer) {
+  int fd = accept(pServer->listenFd, NULL, NULL);
+  if (fd < 0) return;
+
+  for (u32 i = 0; i < ZXTAPE_SERVER_MAX_CLIENTS; i++) {
+    ZXTAPE_SERVER_CLIENT_T *pClient = &pServer->clients[i];
+    if (pClient->fd >= 0) continue;
+
+    memset(pClient, 0, sizeof(ZXTAPE_SERVER_CLIENT_T));
+    pClient->fd = fd;
+    setNonBlocking(fd);
+#ifdef SO_NOSIGPIPE
+    int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+    return;
+  }
+
+  zxtape_log_warn("Server connection refused, too many connections");
+  close(fd);
+}
+
+/**
+ * Read what the client sent, and handle each complete request. Returns false if the connection should close.
+ */
+static bool readClient(ZXTAPE_SERVER_T *pServer, ZXTAPE_SERVER_CLIENT_T *pClient) {
+  if (pClient->nInCapacity - pClient->nIn < ZXTAPE_SERVER_READ_LENGTH) {
+    pClient->nInCapacity = pClient->nIn + ZXTAPE_SERVER_READ_LENGTH;
+    pClient->pIn = (u8 *)realloc(pClient->pIn, pClient->nInCapacity);
+    assert(pClient->pIn != NULL);
+  }
+
+  ssize_t nRead = read(pClient->fd, &pClient->pIn[pClient->nIn], ZXTAPE_SERVER_READ_LENGTH);
+  if (nRead == 0) return false;
+  if (nRead < 0) return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+  pClient->nIn += (u32)nRead;
+
+  // Handle the complete requests, in order
+  u32 nPos = 0;
+  while (pClient->nIn - nPos >= sizeof(ZXTAPE_SERVER_MESSAGE_T)) {
+    ZXTAPE_SERVER_MESSAGE_T request;
+    memcpy(&request, &pClient->pIn[nPos], sizeof(request));
+    if (request.nLength > ZXTAPE_SERVER_MAX_PAYLOAD) {
+      zxtape_log_warn("Server connection closed, message too long (%u bytes)", request.nLength);
+      return false;
+    }
+    if (pClient->nIn - nPos - sizeof(request) < request.nLength) break;
+
+    handleRequest(pServer, pClient, &request, &pClient->pIn[nPos + sizeof(request)]);
+    nPos += sizeof(request) + request.nLength;
+  }
+  memmove(pClient->pIn, &pClient->pIn[nPos], pClient->nIn - nPos);
+  pClient->nIn -= nPos;
+
+  return pClient->nOut <= ZXTAPE_SERVER_MAX_OUTPUT;
+}
+
+/**
+ * Write as much of the client's output as it will take. Returns false if the connection should close.
+ */
+static bool writeClient(ZXTAPE_SERVER_CLIENT_T *pClient) {
+  u32 nPos = 0;
+
+  while (nPos < pClient->nOut) {
+    ssize_t nWritten = send(pClient->fd, &pClient->pOut[nPos], pClient->nOut - nPos, ZXTAPE_SERVER_SEND_FLAGS);
+    if (nWritten < 0) {
+      if (errno == EINTR) continue;
+      if (errno != EAGAIN && errno != EWOULDBLOCK) return false;
+      break;
+    }
+    nPos += (u32)nWritten;
+  }
+  memmove(pClient->pOut, &pClient->pOut[nPos], pClient->nOut - nPos);
+  pClient->nOut -= nPos;
+
+  return pClient->nOut <= ZXTAPE_SERVER_MAX_OUTPUT;
+}
+
+static void closeClient(ZXTAPE_SERVER_T *pServer, ZXTAPE_SERVER_CLIENT_T *pClient) {
+  ZXTAPE_SERVER_SESSION_T **ppSession = &pServer->pSessions;
+
+  while (*ppSession != NULL) {
+    if ((*ppSession)->pClient == pClient) {
+      closeSession(pServer, *ppSession);
+    } else {
+      ppSession = &(*ppSession)->pNext;
+    }
+  }
+
+  close(pClient->fd);
+  free(pClient->pIn);
+  free(pClient->pOut);
+  memset(pClient, 0, sizeof(ZXTAPE_SERVER_CLIENT_T));
+  pClient->fd = -1;
+}
+
+static void queueMessage(ZXTAPE_SERVER_CLIENT_T *pClient, u16 nType, u8 nFlags, u8 nResult, u32 nTag, u32 nSessionId,
+                         const void *pPayload, u32 nLength) {
+  ZXTAPE_SERVER_MESSAGE_T message = {nLength, nType, nFlags, nResult, nTag, nSessionId};
+  u32 nSize = sizeof(message) + nLength;
+
+  if (pClient->nOutCapacity - pClient->nOut < nSize) {
+    u32 nCapacity = pClient->nOutCapacity ? pClient->nOutCapacity : 4096;
+    while (nCapacity - pClient->nOut < nSize) nCapacity *= 2;
+    pClient->pOut = (u8 *)realloc(pClient->pOut, nCapacity);
+    assert(pClient->pOut != NULL);
+    pClient->nOutCapacity = nCapacity;
+  }
+
+  memcpy(&pClient->pOut[pClient->nOut], &message, sizeof(message));
+  if (nLength > 0) memcpy(&pClient->pOut[pClient->nOut + sizeof(message)], pPayload, nLength);
+  pClient->nOut += nSize;
+}
+
+//
+// Requests
+//
+
+static void handleRequest(ZXTAPE_SERVER_T *pServer, ZXTAPE_SERVER_CLIENT_T *pClient,
+                          const ZXTAPE_SERVER_MESSAGE_T *pRequest, const u8 *pPayload) {
+  ZXTAPE_SERVER_RESULT_T result = ZXTAPE_SERVER_RESULT_OK;
+  ZXTAPE_SERVER_SESSION_T *pSession = NULL;
+  u32 nSessionId = pRequest->nSessionId;
+
+  if (pRequest->nType == ZXTAPE_SERVER_MSG_OPEN) {
+    ZXTAPE_SERVER_OPEN_T open;
+    if (pRequest->nLength == sizeof(open)) {
+      memcpy(&open, pPayload, sizeof(open));
+      pSession = openSession(pServer, pClient, &open, &result);
+    } else {
+      result = ZXTAPE_SERVER_RESULT_BAD_REQUEST;
+    }
+    nSessionId = pSession != NULL ? pSession->nSessionId : 0;
+  } else if ((pSession = findSession(pServer, pClient, nSessionId)) == NULL) {
+    result = ZXTAPE_SERVER_RESULT_NO_SESSION;
+  } else if (pRequest->nType == ZXTAPE_SERVER_MSG_CLOSE) {
+    closeSession(pServer, pSession);
+  } else if (pRequest->nType == ZXTAPE_SERVER_MSG_STATUS) {
+    ZXTAPE_SERVER_STATUS_T status;
+    getStatus(pSession, &status);
+    queueMessage(pClient, pRequest->nType, ZXTAPE_SERVER_FLAG_REPLY, (u8)result, pRequest->nTag, nSessionId, &status,
+                 sizeof(status));
+    return;
+  } else {
+    result = handleSessionRequest(pSession, pRequest, pPayload);
+  }
+
+  queueMessage(pClient, pRequest->nType, ZXTAPE_SERVER_FLAG_REPLY, (u8)result, pRequest->nTag, nSessionId, NULL, 0);
+}
+
+/**
+ * Handle a request which controls a session
+ */
+static ZXTAPE_SERVER_RESULT_T handleSessionRequest(ZXTAPE_SERVER_SESSION_T *pSession,
+                                                   const ZXTAPE_SERVER_MESSAGE_T *pRequest, const u8 *pPayload) {
+  ZXTAPE_HANDLE_T *pInstance = pSession->pInstance;
+
+  if (pRequest->nType == ZXTAPE_SERVER_MSG_LOAD) {
+    if (pRequest->nLength <= sizeof(ZXTAPE_SERVER_LOAD_T)) return ZXTAPE_SERVER_RESULT_BAD_REQUEST;
+    ZXTAPE_SERVER_LOAD_T load;
+    memcpy(&load, pPayload, sizeof(load));
+    if (load.name[ZXTAPE_SERVER_NAME_LEN - 1] != 0) return ZXTAPE_SERVER_RESULT_BAD_REQUEST;
+
+    // The tape is kept for as long as it is loaded
+    u32 nTapeLen = pRequest->nLength - (u32)sizeof(load);
+    u8 *pTape = (u8 *)malloc(nTapeLen);
+    assert(pTape != NULL);
+    memcpy(pTape, &pPayload[sizeof(load)], nTapeLen);
+    stopSession(pSession);
+    zxtape_loadBuffer(pInstance, load.name, pTape, nTapeLen);
+    free(pSession->pTape);
+    pSession->pTape = pTape;
+    pSession->nBlockIndex = ZXTAPE_INDEX_NONE;
+    return ZXTAPE_SERVER_RESULT_OK;
+  }
+
+  if (pRequest->nLength != (pRequest->nType == ZXTAPE_SERVER_MSG_SEEK ? sizeof(u32) : 0)) {
+    return ZXTAPE_SERVER_RESULT_BAD_REQUEST;
+  }
+  if (!zxtape_isLoaded(pInstance)) return ZXTAPE_SERVER_RESULT_NO_TAPE;
+
+  switch (pRequest->nType) {
+    case ZXTAPE_SERVER_MSG_PLAY:
+      if (!zxtape_isStarted(pInstance) || zxtape_isPaused(pInstance)) zxtape_playPause(pInstance);
+      break;
+    case ZXTAPE_SERVER_MSG_PAUSE:
+      if (zxtape_isPlaying(pInstance)) zxtape_playPause(pInstance);
+      break;
+    case ZXTAPE_SERVER_MSG_STOP:
+      stopSession(pSession);
+      break;
+    case ZXTAPE_SERVER_MSG_SEEK: {
+      u32 nBlockIndex;
+      memcpy(&nBlockIndex, pPayload, sizeof(nBlockIndex));
+      if (nBlockIndex >= zxtape_getBlockCount(pInstance)) return ZXTAPE_SERVER_RESULT_BAD_REQUEST;
+
+      // Play from the block if playing (restarting), else when next played
+      bool bPlaying = zxtape_isPlaying(pInstance);
+      stopSession(pSession);
+      zxtape_setStartBlock(pInstance, nBlockIndex);
+      if (bPlaying) zxtape_playPause(pInstance);
+      break;
+    }
+    default:
+      return ZXTAPE_SERVER_RESULT_BAD_REQUEST;
+  }
+
+  // Apply the controls now, rather than when the scheduler next tops up the session
+  zxtape_writeSink(pInstance, 0);
+
+  return ZXTAPE_SERVER_RESULT_OK;
+}
+
+//
+// Sessions
+//
+
+static ZXTAPE_SERVER_SESSION_T *openSession(ZXTAPE_SERVER_T *pServer, ZXTAPE_SERVER_CLIENT_T *pClient,
+                                            const ZXTAPE_SERVER_OPEN_T *pOpen, ZXTAPE_SERVER_RESULT_T *pResult) {
+  u32 nPulseLength = pOpen->nPulseLength ? pOpen->nPulseLength : ZXTAPE_SERVER_PULSE_LENGTH;
+  bool bShm = pOpen->shmName[0] != 0;
+
+  if (pServer->nSessions >= ZXTAPE_SERVER_MAX_SESSIONS) {
+    *pResult = ZXTAPE_SERVER_RESULT_TOO_MANY;
+    return NULL;
+  }
+  if (bShm && (pOpen->shmName[ZXTAPE_SERVER_NAME_LEN - 1] != 0 || (nPulseLength & (nPulseLength - 1)) != 0 ||
+               (pOpen->nPcmLength & (pOpen->nPcmLength - 1)) != 0 || (pOpen->nPcmLength && !pOpen->nSampleRate))) {
+    *pResult = ZXTAPE_SERVER_RESULT_BAD_REQUEST;
+    return NULL;
+  }
+
+  // The server names the object, so a client can only create (and remove) objects under its prefix
+  char shmName[ZXTAPE_SHM_MAX_NAME_LEN + 1];
+  if (bShm && (strchr(pOpen->shmName, '/') != NULL ||
+               snprintf(shmName, sizeof(shmName), "%s%s", ZXTAPE_SERVER_SHM_PREFIX, pOpen->shmName) >=
+                   (int)sizeof(shmName))) {
+    *pResult = ZXTAPE_SERVER_RESULT_BAD_REQUEST;
+    return NULL;
+  }
+  for (ZXTAPE_SERVER_SESSION_T *pOther = pServer->pSessions; bShm && pOther != NULL; pOther = pOther->pNext) {
+    if (pOther->bShm && strcmp(pOther->shm.name, shmName) == 0) {
+      *pResult = ZXTAPE_SERVER_RESULT_IN_USE;
+      return NULL;
+    }
+  }
+
+  ZXTAPE_SERVER_SESSION_T *pSession = (ZXTAPE_SERVER_SESSION_T *)calloc(1, sizeof(ZXTAPE_SERVER_SESSION_T));
+  assert(pSession != NULL);
+  pSession->pServer = pServer;
+  pSession->pClient = pClient;
+  pSession->nBlockIndex = ZXTAPE_INDEX_NONE;
+  pSession->sink.write = (void (*)(void *, const ZXTAPE_PULSE_T *, unsigned))sessionWrite;
+  pSession->sink.end = (void (*)(void *))sessionEnd;
+  pSession->sink.pContext = pSession;
+
+  if (bShm) {
+    pSession->bShm = zxtape_openShmSink(&pSession->shm, shmName, nPulseLength, pOpen->nPcmLength, pOpen->nSampleRate);
+  }
+  pSession->pInstance = zxtape_create();
+  if ((bShm && !pSession->bShm) || pSession->pInstance == NULL) {
+    if (pSession->bShm) zxtape_closeShmSink(&pSession->shm);
+    if (pSession->pInstance != NULL) zxtape_destroy(pSession->pInstance);
+    free(pSession);
+    *pResult = ZXTAPE_SERVER_RESULT_FAILED;
+    return NULL;
+  }
+  zxtape_init(pSession->pInstance);
+  zxtape_setSink(pSession->pInstance, &pSession->sink);
+  zxtape_setEventCallback(pSession->pInstance, sessionEvent, sessionNotify, pSession);
+  zxtape_scheduleInstance(pServer->pScheduler, pSession->pInstance, pOpen->nLeadUs);
+
+  pSession->nSessionId = pServer->nNextSessionId++;
+  if (pServer->nNextSessionId == 0) pServer->nNextSessionId = 1;
+  pSession->pNext = pServer->pSessions;
+  pServer->pSessions = pSession;
+  pServer->nSessions++;
+
+  return pSession;
+}
+
+static void closeSession(ZXTAPE_SERVER_T *pServer, ZXTAPE_SERVER_SESSION_T *pSession) {
+  ZXTAPE_SERVER_SESSION_T **ppSession = &pServer->pSessions;
+  while (*ppSession != pSession) ppSession = &(*ppSession)->pNext;
+  *ppSession = pSession->pNext;
+  pServer->nSessions--;
+
+  // Once unscheduled, the sink is no longer called
+  zxtape_unscheduleInstance(pServer->pScheduler, pSession->pInstance);
+  zxtape_destroy(pSession->pInstance);
+  if (pSession->bShm) zxtape_closeShmSink(&pSession->shm);
+  free(pSession->pTape);
+  free(pSession);
+}
+
+static ZXTAPE_SERVER_SESSION_T *findSession(ZXTAPE_SERVER_T *pServer, ZXTAPE_SERVER_CLIENT_T *pClient, u32 nId) {
+  for (ZXTAPE_SERVER_SESSION_T *pSession = pServer->pSessions; pSession != NULL; pSession = pSession->pNext) {
+    if (pSession->nSessionId == nId) return pSession->pClient == pClient ? pSession : NULL;
+  }
+
+  return NULL;
+}
+
+static void getStatus(ZXTAPE_SERVER_SESSION_T *pSession, ZXTAPE_SERVER_STATUS_T *pStatus) {
+  ZXTAPE_HANDLE_T *pInstance = pSession->pInstance;
+
+  memset(pStatus, 0, sizeof(ZXTAPE_SERVER_STATUS_T));
+  pStatus->bLoaded = zxtape_isLoaded(pInstance);
+  pStatus->bStarted = zxtape_isStarted(pInstance);
+  pStatus->bPaused = zxtape_isPaused(pInstance);
+  pStatus->nBlockCount = pStatus->bLoaded ? zxtape_getBlockCount(pInstance) : 0;
+  pStatus->nBlockIndex = pStatus->bStarted ? pSession->nBlockIndex : ZXTAPE_INDEX_NONE;
+  pStatus->nEnds = __atomic_load_n(&pSession->nEnds, __ATOMIC_ACQUIRE);
+  pStatus->nPulses = __atomic_load_n(&pSession->nPulses, __ATOMIC_RELAXED);
+  pStatus->nTimeUs = __atomic_load_n(&pSession->nTimeUs, __ATOMIC_RELAXED);
+}
+
+/**
+ * Stop the session now, if it is playing
+ */
+static void stopSession(ZXTAPE_SERVER_SESSION_T *pSession) {
+  if (!zxtape_isStarted(pSession->pInstance)) return;
+
+  zxtape_rewind(pSession->pInstance);
+  zxtape_writeSink(pSession->pInstance, 0);
+}
+
+/**
+ * Deliver the events, and status when playback stopped, of the sessions the scheduler flagged
+ */
+static void servicePending(ZXTAPE_SERVER_T *pServer) {
+  for (ZXTAPE_SERVER_SESSION_T *pSession = pServer->pSessions; pSession != NULL; pSession = pSession->pNext) {
+    u32 nPending = __atomic_exchange_n(&pSession->nPending, 0, __ATOMIC_ACQ_REL);
+    if (nPending == 0) continue;
+
+    if (nPending & ZXTAPE_SERVER_PENDING_EVENTS) zxtape_dispatchEvents(pSession->pInstance);
+    if (nPending & ZXTAPE_SERVER_PENDING_STATUS) {
+      ZXTAPE_SERVER_STATUS_T status;
+      getStatus(pSession, &status);
+      queueMessage(pSession->pClient, ZXTAPE_SERVER_MSG_STATUS, ZXTAPE_SERVER_FLAG_PUSH, ZXTAPE_SERVER_RESULT_OK, 0,
+                   pSession->nSessionId, &status, sizeof(status));
+    }
+  }
+}
+
+static void sessionWrite(ZXTAPE_SERVER_SESSION_T *pSession, const ZXTAPE_PULSE_T *pPulses, unsigned nCount) {
+  u64 nTimeUs = 0;
+  for (unsigned i = 0; i < nCount; i++) nTimeUs += pPulses[i].nPeriodUs;
+
+  if (pSession->bShm) pSession->shm.sink.write(pSession->shm.sink.pContext, pPulses, nCount);
+  __atomic_add_fetch(&pSession->nPulses, nCount, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&pSession->nTimeUs, nTimeUs, __ATOMIC_RELAXED);
+}
+
+static void sessionEnd(ZXTAPE_SERVER_SESSION_T *pSession) {
+  if (pSession->bShm) pSession->shm.sink.end(pSession->shm.sink.pContext);
+  __atomic_add_fetch(&pSession->nEnds, 1, __ATOMIC_RELEASE);
+  __atomic_or_fetch(&pSession->nPending, ZXTAPE_SERVER_PENDING_STATUS, __ATOMIC_RELEASE);
+  wakeServer(pSession->pServer);
+}
+
+/**
+ * Push an event to the session's connection (server thread, from zxtape_dispatchEvents())
+ */
+static void sessionEvent(ZXTAPE_HANDLE_T *pInstance, const ZXTAPE_EVENT_T *pEvent, void *pUserData) {
+  ZXTAPE_SERVER_SESSION_T *pSession = (ZXTAPE_SERVER_SESSION_T *)pUserData;
+  ZXTAPE_SERVER_EVENT_T event = {(u32)pEvent->type, pEvent->nBlockIndex, pEvent->nSectionIndex, pEvent->nValue,
+                                 pEvent->nTapeTimeUs};
+
+  if (pEvent->type == ZXTAPE_EVENT_BLOCK_START) pSession->nBlockIndex = pEvent->nBlockIndex;
+  queueMessage(pSession->pClient, ZXTAPE_SERVER_MSG_EVENT, ZXTAPE_SERVER_FLAG_PUSH, ZXTAPE_SERVER_RESULT_OK, 0,
+               pSession->nSessionId, &event, sizeof(event));
+}
+
+/**
+ * An event was queued (any thread)
+ */
+static void sessionNotify(ZXTAPE_HANDLE_T *pInstance, void *pUserData) {
+  ZXTAPE_SERVER_SESSION_T *pSession = (ZXTAPE_SERVER_SESSION_T *)pUserData;
+
+  __atomic_or_fetch(&pSession->nPending, ZXTAPE_SERVER_PENDING_EVENTS, __ATOMIC_RELEASE);
+  wakeServer(pSession->pServer);
+}
+
+static void wakeServer(ZXTAPE_SERVER_T *pServer) {
+  u8 wake = 1;
+  ssize_t nWritten = write(pServer->wakeFds[1], &wake, 1);
+  (void)nWritten;  // (a full pipe is already waking the server)
+}
+
+static void setNonBlocking(int fd) {
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+}
+
+#endif  // __ZX_TAPE_CIRCLE__
@@ -0,0 +1,410 @@
+#include "../../../include/zxtape_shm.h"
+
+#ifndef __ZX_TAPE_CIRCLE__
+
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __ZX_TAPE_LINUX__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
+#include "../render/zxtape_render.h"
+#include "../sink/zxtape_sink.h"
+#include "../tzx_compat/tzx_compat.h"
+
+//
+// Shared memory output
+//
+// The pulses, and the samples converted from them as the PCM sinks do, are written to rings in a POSIX shared memory
+// object, for readers in other processes to take without copying through the kernel (see zxtape_shm.h for the layout
+// and protocol). As the fan-out sink, the writer never waits for a reader, and a reader which falls behind skips what
+// was overwritten. Readers are woken through a futex on the sequence number, so only when there are waiters does
+// writing cost a system call.
+//
+
+#define ZXTAPE_SHM_CHUNK_LENGTH 256  // Records written or read at a time
+#define ZXTAPE_SHM_POLL_US 100       // Time between polls of the sequence number, where there is no futex
+
+/* Forward declarations */
+static void shmWrite(ZXTAPE_SINK_SHM_T *pShm, const ZXTAPE_PULSE_T *pPulses, unsigned nCount);
+static void shmEnd(ZXTAPE_SINK_SHM_T *pShm);
+static void shmWritePcm(ZXTAPE_SINK_SHM_T *pShm, const ZXTAPE_PULSE_T *pPulses, unsigned nCount);
+static void shmNotify(ZXTAPE_SHM_HEADER_T *pHeader);
+static void ringWrite(ZXTAPE_SHM_HEADER_T *pHeader, ZXTAPE_SHM_RING_T *pRing, const void *pRecords, u32 nCount);
+static u32 ringRead(ZXTAPE_SHM_HEADER_T *pHeader, ZXTAPE_SHM_RING_T *pRing, void *pOut, u32 nMax, u32 *pIndex,
+                    u64 *pDropped);
+static void ringSeqlock(ZXTAPE_SHM_HEADER_T *pHeader, ZXTAPE_SHM_RING_T *pRing, ZXTAPE_SINK_SEQLOCK_T *pSeqlock);
+static u32 ringRecordSize(const ZXTAPE_SHM_HEADER_T *pHeader, const ZXTAPE_SHM_RING_T *pRing);
+static bool ringValid(const ZXTAPE_SHM_HEADER_T *pHeader, const ZXTAPE_SHM_RING_T *pRing, bool bOptional);
+
+//
+// Writer
+//
+
+/**
+ * Open a shared memory sink, creating the shared memory object (it must not exist: an object left by someone else is
+ * never replaced or removed)
+ *
+ * @param pShm Sink to initialize
+ * @param pName Name of the shared memory object ("/name")
+ * @param nPulseLength Length of the pulse ring (records, power of 2)
+ * @param nPcmLength Length of the PCM ring (samples, power of 2, or 0 for no PCM)
+ * @param nSampleRate PCM sample rate (Hz)
+ * @return true if the object was created
+ */
+bool zxtape_openShmSink(ZXTAPE_SINK_SHM_T *pShm, const char *pName, u32 nPulseLength, u32 nPcmLength,
+                        u32 nSampleRate) {
+  assert(pShm != NULL);
+  assert(pName != NULL);
+  assert(nPulseLength > 0 && (nPulseLength & (nPulseLength - 1)) == 0);
+  assert((nPcmLength & (nPcmLength - 1)) == 0);
+  assert(nPcmLength == 0 || nSampleRate > 0);
+
+  memset(pShm, 0, sizeof(ZXTAPE_SINK_SHM_T));
+  pShm->sink.write = (void (*)(void *, const ZXTAPE_PULSE_T *, unsigned))shmWrite;
+  pShm->sink.end = (void (*)(void *))shmEnd;
+  pShm->sink.pContext = pShm;
+  if (nPcmLength > 0) zxtapeSink_initPcm(&pShm->pcm, nSampleRate, ZXTAPE_SINK_PCM_GAIN_UNITY);
+
+  if (strlen(pName) > ZXTAPE_SHM_MAX_NAME_LEN) {
+    zxtape_log_error("Shared memory name too long: %s", pName);
+    return false;
+  }
+  strcpy(pShm->name, pName);
+
+  u64 nPulseOffset = sizeof(ZXTAPE_SHM_HEADER_T);
+  u64 nPcmOffset = nPulseOffset + (u64)nPulseLength * sizeof(u32);
+  u64 nSize = nPcmOffset + (u64)nPcmLength * sizeof(i16);
+  if (nSize > 0xFFFFFFFF) {
+    zxtape_log_error("Shared memory too large: %s", pName);
+    return false;
+  }
+
+  // (only an object created here is removed, on failure or by zxtape_closeShmSink())
+  int fd = shm_open(pName, O_RDWR | O_CREAT | O_EXCL, 0600);
+  if (fd < 0) {
+    zxtape_log_error("Failed to create shared memory (it may exist): %s", pName);
+    return false;
+  }
+  void *pMapped = MAP_FAILED;
+  if (ftruncate(fd, (off_t)nSize) == 0) pMapped = mmap(NULL, nSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (pMapped == MAP_FAILED) {
+    zxtape_log_error("Failed to map shared memory: %s", pName);
+    shm_unlink(pName);
+    return false;
+  }
+
+  // (the object is zero filled)
+  ZXTAPE_SHM_HEADER_T *pHeader = (ZXTAPE_SHM_HEADER_T *)pMapped;
+  pHeader->nVersion = ZXTAPE_SHM_VERSION;
+  pHeader->nSize = (u32)nSize;
+  pHeader->nSampleRate = nSampleRate;
+  pHeader->pulses.nOffset = (u32)nPulseOffset;
+  pHeader->pulses.nLength = nPulseLength;
+  pHeader->pcm.nOffset = (u32)nPcmOffset;
+  pHeader->pcm.nLength = nPcmLength;
+  __atomic_store_n(&pHeader->nMagic, ZXTAPE_SHM_MAGIC, __ATOMIC_RELEASE);
+  pShm->pHeader = pHeader;
+
+  return true;
+}
+
+/**
+ * Close a shared memory sink, removing the object (readers keep their mappings until they close)
+ *
+ * @param pShm Sink
+ */
+void zxtape_closeShmSink(ZXTAPE_SINK_SHM_T *pShm) {
+  assert(pShm != NULL);
+
+  if (pShm->pHeader == NULL) return;
+
+  munmap(pShm->pHeader, pShm->pHeader->nSize);
+  shm_unlink(pShm->name);
+  pShm->pHeader = NULL;
+}
+
+static void shmWrite(ZXTAPE_SINK_SHM_T *pShm, const ZXTAPE_PULSE_T *pPulses, unsigned nCount) {
+  ZXTAPE_SHM_HEADER_T *pHeader = pShm->pHeader;
+  u32 records[ZXTAPE_SHM_CHUNK_LENGTH];
+
+  if (pHeader == NULL) return;
+
+  for (unsigned i = 0; i < nCount;) {
+    u32 n = nCount - i < ZXTAPE_SHM_CHUNK_LENGTH ? nCount - i : ZXTAPE_SHM_CHUNK_LENGTH;
+    zxtapeSink_packPulses(records, &pPulses[i], n);
+    ringWrite(pHeader, &pHeader->pulses, records, n);
+    i += n;
+  }
+  if (pHeader->pcm.nLength > 0) shmWritePcm(pShm, pPulses, nCount);
+
+  shmNotify(pHeader);
+}
+
+static void shmEnd(ZXTAPE_SINK_SHM_T *pShm) {
+  ZXTAPE_SHM_HEADER_T *pHeader = pShm->pHeader;
+
+  if (pHeader == NULL) return;
+
+  // Write out the last (part) sample, as if the level were low for the rest of it
+  i16 sample;
+  if (pHeader->pcm.nLength > 0 && zxtapeSink_pcmFlush(&pShm->pcm, &sample)) {
+    ringWrite(pHeader, &pHeader->pcm, &sample, 1);
+  }
+
+  __atomic_add_fetch(&pHeader->nEnds, 1, __ATOMIC_RELEASE);
+  shmNotify(pHeader);
+}
+
+/**
+ * Convert pulses to samples as the PCM sinks, writing each chunk of complete samples to the PCM ring
+ */
+static void shmWritePcm(ZXTAPE_SINK_SHM_T *pShm, const ZXTAPE_PULSE_T *pPulses, unsigned nCount) {
+  i16 samples[ZXTAPE_SHM_CHUNK_LENGTH];
+  u32 nSamples;
+
+  do {
+    u32 nTaken;
+    nSamples = zxtapeSink_pcmConvert(&pShm->pcm, pPulses, nCount, samples, ZXTAPE_SHM_CHUNK_LENGTH, &nTaken);
+    pPulses += nTaken;
+    nCount -= nTaken;
+    if (nSamples > 0) ringWrite(pShm->pHeader, &pShm->pHeader->pcm, samples, nSamples);
+  } while (nSamples == ZXTAPE_SHM_CHUNK_LENGTH);
+}
+
+/**
+ * Tell the readers something was written, waking any waiting
+ */
+static void shmNotify(ZXTAPE_SHM_HEADER_T *pHeader) {
+  __atomic_add_fetch(&pHeader->nSequence, 1, __ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&pHeader->nWaiters, __ATOMIC_SEQ_CST) == 0) return;
+
+#ifdef __ZX_TAPE_LINUX__
+  syscall(SYS_futex, &pHeader->nSequence, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+#endif
+}
+
+//
+// Readers
+//
+
+/**
+ * Open a reader of a shared memory sink (in any process). It reads from the next pulse and sample written.
+ *
+ * @param pReader Reader to initialize
+ * @param pName Name of the shared memory object ("/name")
+ * @return true if the object was opened
+ */
+bool zxtape_openShmReader(ZXTAPE_SHM_READER_T *pReader, const char *pName) {
+  assert(pReader != NULL);
+  assert(pName != NULL);
+
+  memset(pReader, 0, sizeof(ZXTAPE_SHM_READER_T));
+
+  int fd = shm_open(pName, O_RDWR, 0);
+  if (fd < 0) {
+    zxtape_log_error("Failed to open shared memory: %s", pName);
+    return false;
+  }
+  struct stat st;
+  void *pMapped = MAP_FAILED;
+  if (fstat(fd, &st) == 0 && (u64)st.st_size >= sizeof(ZXTAPE_SHM_HEADER_T)) {
+    pMapped = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  }
+  close(fd);
+  if (pMapped == MAP_FAILED) {
+    zxtape_log_error("Failed to map shared memory: %s", pName);
+    return false;
+  }
+
+  ZXTAPE_SHM_HEADER_T *pHeader = (ZXTAPE_SHM_HEADER_T *)pMapped;
+  if (__atomic_load_n(&pHeader->nMagic, __ATOMIC_ACQUIRE) != ZXTAPE_SHM_MAGIC ||
+      pHeader->nVersion != ZXTAPE_SHM_VERSION || pHeader->nSize != (u64)st.st_size) {
+    zxtape_log_error("Not a tape shared memory object: %s", pName);
+    munmap(pMapped, (size_t)st.st_size);
+    return false;
+  }
+
+  // The rings are only used if they are within the object (the writer may be in another, untrusted, process)
+  if (!ringValid(pHeader, &pHeader->pulses, false) || !ringValid(pHeader, &pHeader->pcm, true)) {
+    zxtape_log_error("Invalid rings in tape shared memory object: %s", pName);
+    munmap(pMapped, (size_t)st.st_size);
+    return false;
+  }
+
+  pReader->pHeader = pHeader;
+  pReader->nSequence = __atomic_load_n(&pHeader->nSequence, __ATOMIC_SEQ_CST);
+  pReader->nPulseIndex = __atomic_load_n(&pHeader->pulses.nWriteIndex, __ATOMIC_ACQUIRE);
+  pReader->nPcmIndex = __atomic_load_n(&pHeader->pcm.nWriteIndex, __ATOMIC_ACQUIRE);
+
+  return true;
+}
+
+/**
+ * Close a reader of a shared memory sink
+ *
+ * @param pReader Reader
+ */
+void zxtape_closeShmReader(ZXTAPE_SHM_READER_T *pReader) {
+  assert(pReader != NULL);
+
+  if (pReader->pHeader == NULL) return;
+
+  munmap(pReader->pHeader, pReader->pHeader->nSize);
+  pReader->pHeader = NULL;
+}
+
+/**
+ * Read pulses from a shared memory sink
+ *
+ * @param pReader Reader
+ * @param pOut Buffer for the pulses
+ * @param nMax Maximum number of pulses to read
+ * @return u32 Number of pulses read
+ */
+u32 zxtape_readShmPulses(ZXTAPE_SHM_READER_T *pReader, ZXTAPE_PULSE_T *pOut, u32 nMax) {
+  assert(pReader != NULL && pReader->pHeader != NULL);
+  assert(pOut != NULL || nMax == 0);
+  ZXTAPE_SHM_HEADER_T *pHeader = pReader->pHeader;
+  u32 records[ZXTAPE_SHM_CHUNK_LENGTH];
+  u32 nPulses = 0;
+
+  while (nPulses < nMax) {
+    u32 n = nMax - nPulses < ZXTAPE_SHM_CHUNK_LENGTH ? nMax - nPulses : ZXTAPE_SHM_CHUNK_LENGTH;
+    n = ringRead(pHeader, &pHeader->pulses, records, n, &pReader->nPulseIndex, &pReader->nPulsesDropped);
+    if (n == 0) break;
+
+    zxtapeSink_unpackPulses(&pOut[nPulses], records, n);
+    nPulses += n;
+  }
+
+  return nPulses;
+}
+
+/**
+ * Read samples from a shared memory sink
+ *
+ * @param pReader Reader
+ * @param pOut Buffer for the samples
+ * @param nMax Maximum number of samples to read
+ * @return u32 Number of samples read (0 if the sink has no PCM)
+ */
+u32 zxtape_readShmPcm(ZXTAPE_SHM_READER_T *pReader, i16 *pOut, u32 nMax) {
+  assert(pReader != NULL && pReader->pHeader != NULL);
+  assert(pOut != NULL || nMax == 0);
+  ZXTAPE_SHM_HEADER_T *pHeader = pReader->pHeader;
+  u32 nSamples = 0;
+
+  if (pHeader->pcm.nLength == 0) return 0;
+
+  while (nSamples < nMax) {
+    u32 n = ringRead(pHeader, &pHeader->pcm, &pOut[nSamples], nMax - nSamples, &pReader->nPcmIndex,
+                     &pReader->nSamplesDropped);
+    if (n == 0) break;
+    nSamples += n;
+  }
+
+  return nSamples;
+}
+
+/**
+ * Wait for anything to be written to a shared memory sink since the reader last woke (or was opened), including
+ * playback stopping (nEnds)
+ *
+ * Read until there is nothing more to read after each wake; anything written meanwhile wakes the next wait at once.
+ *
+ * @param pReader Reader
+ * @param nTimeoutUs Longest time to wait (us)
+ * @return true if anything was written, false if timed out
+ */
+bool zxtape_waitShmReader(ZXTAPE_SHM_READER_T *pReader, u32 nTimeoutUs) {
+  assert(pReader != NULL && pReader->pHeader != NULL);
+  ZXTAPE_SHM_HEADER_T *pHeader = pReader->pHeader;
+  u32 nSequence = pReader->nSequence;
+
+  if (__atomic_load_n(&pHeader->nSequence, __ATOMIC_SEQ_CST) == nSequence) {
+    __atomic_add_fetch(&pHeader->nWaiters, 1, __ATOMIC_SEQ_CST);
+#ifdef __ZX_TAPE_LINUX__
+    // (the kernel only waits while nSequence is unchanged, so a write since it was checked is not missed)
+    struct timespec timeout = {nTimeoutUs / 1000000, (long)(nTimeoutUs % 1000000) * 1000};
+    syscall(SYS_futex, &pHeader->nSequence, FUTEX_WAIT, nSequence, &timeout, NULL, 0);
+#else
+    struct timespec poll = {0, ZXTAPE_SHM_POLL_US * 1000};
+    for (u32 nWaitedUs = 0; nWaitedUs < nTimeoutUs; nWaitedUs += ZXTAPE_SHM_POLL_US) {
+      if (__atomic_load_n(&pHeader->nSequence, __ATOMIC_SEQ_CST) != nSequence) break;
+      nanosleep(&poll, NULL);
+    }
+#endif
+    __atomic_sub_fetch(&pHeader->nWaiters, 1, __ATOMIC_SEQ_CST);
+  }
+
+  pReader->nSequence = __atomic_load_n(&pHeader->nSequence, __ATOMIC_SEQ_CST);
+
+  return pReader->nSequence != nSequence;
+}
+
+//
+// Rings
+//
+
+/**
+ * Write records to a ring (writer side, see zxtape_shm.h)
+ */
+static void ringWrite(ZXTAPE_SHM_HEADER_T *pHeader, ZXTAPE_SHM_RING_T *pRing, const void *pRecords, u32 nCount) {
+  ZXTAPE_SINK_SEQLOCK_T seqlock;
+
+  ringSeqlock(pHeader, pRing, &seqlock);
+  zxtapeSink_seqlockWrite(&seqlock, pRecords, nCount);
+}
+
+/**
+ * Read records from a ring from the reader's index, skipping any the writer has overwritten (see zxtape_shm.h)
+ */
+static u32 ringRead(ZXTAPE_SHM_HEADER_T *pHeader, ZXTAPE_SHM_RING_T *pRing, void *pOut, u32 nMax, u32 *pIndex,
+                    u64 *pDropped) {
+  ZXTAPE_SINK_SEQLOCK_T seqlock;
+
+  ringSeqlock(pHeader, pRing, &seqlock);
+  u32 nCount = zxtapeSink_seqlockPeek(&seqlock, pOut, nMax, pIndex, pDropped);
+  *pIndex += nCount;
+
+  return nCount;
+}
+
+/**
+ * The ring as a seqlock ring (the protocol of zxtape_shm.h is that of the fan-out sink)
+ */
+static void ringSeqlock(ZXTAPE_SHM_HEADER_T *pHeader, ZXTAPE_SHM_RING_T *pRing, ZXTAPE_SINK_SEQLOCK_T *pSeqlock) {
+  pSeqlock->pRecords = (u8 *)pHeader + pRing->nOffset;
+  pSeqlock->nRecordSize = ringRecordSize(pHeader, pRing);
+  pSeqlock->nLength = pRing->nLength;
+  pSeqlock->pClaimIndex = &pRing->nClaimIndex;
+  pSeqlock->pWriteIndex = &pRing->nWriteIndex;
+}
+
+static u32 ringRecordSize(const ZXTAPE_SHM_HEADER_T *pHeader, const ZXTAPE_SHM_RING_T *pRing) {
+  return pRing == &pHeader->pulses ? sizeof(u32) : sizeof(i16);
+}
+
+/**
+ * Check a ring of a mapped object: a power of 2 records (or absent, if optional), aligned, after the header and
+ * within the object
+ */
+static bool ringValid(const ZXTAPE_SHM_HEADER_T *pHeader, const ZXTAPE_SHM_RING_T *pRing, bool bOptional) {
+  u32 nRecordSize = ringRecordSize(pHeader, pRing);
+  u32 nLength = pRing->nLength;
+
+  if (nLength == 0) return bOptional;
+  if ((nLength & (nLength - 1)) != 0) return false;
+  if (pRing->nOffset < sizeof(ZXTAPE_SHM_HEADER_T) || pRing->nOffset % nRecordSize != 0) return false;
+
+  return (u64)pRing->nOffset + (u64)nLength * nRecordSize <= pHeader->nSize;
+}
+
+#endif  // __ZX_TAPE_CIRCLE__
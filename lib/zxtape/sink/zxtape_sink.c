@@ -0,0 +1,740 @@
+#include "../../../include/zxtape_sink.h"
+
+#include "./zxtape_sink.h"
+#include "../render/zxtape_render.h"
+#include "../tzx_compat/tzx_compat.h"
+
+//
+// Built-in output sinks
+//
+// Sinks are given the pulses in batches by zxtape_run() (see zxtape_setSink()). The PCM sinks convert the pulses the
+// same way as zxtape_render(), but pushed rather than pulled: positions are held in units of us * sample rate, so
+// edges keep their exact phase, and each sample is the average level over its length.
+//
+
+#define ZXTAPE_SINK_PCM_CHUNK_LENGTH 256     // Samples converted at a time
+#define ZXTAPE_SINK_FANOUT_CHUNK_LENGTH 256  // Fan-out records written or read at a time
+
+/**
+ * Called with each chunk of converted samples
+ */
+typedef void (*ZXTAPE_SINK_PCM_OUTPUT_T)(void *pContext, const i16 *pSamples, u32 nCount);
+
+/* Forward declarations */
+static void countWrite(ZXTAPE_SINK_COUNT_T *pCount, const ZXTAPE_PULSE_T *pPulses, unsigned nCount);
+static void countEnd(ZXTAPE_SINK_COUNT_T *pCount);
+static void listWrite(ZXTAPE_SINK_LIST_T *pList, const ZXTAPE_PULSE_T *pPulses, unsigned nCount);
+static void ringWrite(ZXTAPE_SINK_RING_T *pRing, const ZXTAPE_PULSE_T *pPulses, unsigned nCount);
+static void ringOutput(ZXTAPE_SINK_RING_T *pRing, const i16 *pSamples, u32 nCount);
+static void fanoutWrite(ZXTAPE_SINK_FANOUT_T *pFanout, const ZXTAPE_PULSE_T *pPulses, unsigned nCount);
+static void fanoutEnd(ZXTAPE_SINK_FANOUT_T *pFanout);
+static u32 fanoutPeek(ZXTAPE_SINK_FANOUT_READER_T *pReader, u32 *pRecords, u32 nMax);
+static void fanoutRing(ZXTAPE_SINK_FANOUT_T *pFanout, ZXTAPE_SINK_SEQLOCK_T *pRing);
+static u32 fanoutReadPulses(ZXTAPE_SINK_FANOUT_READER_T *pReader, ZXTAPE_PULSE_T *pOut, u32 nMax);
+static u32 fanoutReadPcm(ZXTAPE_SINK_FANOUT_READER_T *pReader, void *pOut, u32 nMaxFrames);
+static void pcmWrite(ZXTAPE_SINK_PCM_T *pPcm, const ZXTAPE_PULSE_T *pPulses, unsigned nCount,
+                     ZXTAPE_SINK_PCM_OUTPUT_T pfnOutput, void *pContext);
+#ifndef __ZX_TAPE_CIRCLE__
+static void wavWrite(ZXTAPE_SINK_WAV_T *pWav, const ZXTAPE_PULSE_T *pPulses, unsigned nCount);
+static void wavEnd(ZXTAPE_SINK_WAV_T *pWav);
+static void wavOutput(ZXTAPE_SINK_WAV_T *pWav, const i16 *pSamples, u32 nCount);
+static void wavWriteBuffer(ZXTAPE_SINK_WAV_T *pWav);
+static void wavWriteHeader(ZXTAPE_SINK_WAV_T *pWav);
+#endif  // __ZX_TAPE_CIRCLE__
+
+//
+// Counting sink
+//
+
+/**
+ * Initialize a counting sink
+ *
+ * @param pCount Sink to initialize
+ */
+void zxtape_initCountSink(ZXTAPE_SINK_COUNT_T *pCount) {
+  assert(pCount != NULL);
+
+  memset(pCount, 0, sizeof(ZXTAPE_SINK_COUNT_T));
+  pCount->sink.write = (void (*)(void *, const ZXTAPE_PULSE_T *, unsigned))countWrite;
+  pCount->sink.end = (void (*)(void *))countEnd;
+  pCount->sink.pContext = pCount;
+}
+
+static void countWrite(ZXTAPE_SINK_COUNT_T *pCount, const ZXTAPE_PULSE_T *pPulses, unsigned nCount) {
+  u64 nTimeUs = 0;
+  u64 nHighUs = 0;
+
+  for (unsigned i = 0; i < nCount; i++) {
+    nTimeUs += pPulses[i].nPeriodUs;
+    if (pPulses[i].nLevel) nHighUs += pPulses[i].nPeriodUs;
+  }
+
+  pCount->nBatches++;
+  pCount->nPulses += nCount;
+  pCount->nTimeUs += nTimeUs;
+  pCount->nHighUs += nHighUs;
+}
+
+static void countEnd(ZXTAPE_SINK_COUNT_T *pCount) {
+  pCount->nEnds++;
+}
+
+//
+// Pulse list sink
+//
+
+/**
+ * Initialize a pulse list sink (empty)
+ *
+ * @param pList Sink to initialize
+ */
+void zxtape_initListSink(ZXTAPE_SINK_LIST_T *pList) {
+  assert(pList != NULL);
+
+  memset(pList, 0, sizeof(ZXTAPE_SINK_LIST_T));
+  pList->sink.write = (void (*)(void *, const ZXTAPE_PULSE_T *, unsigned))listWrite;
+  pList->sink.end = NULL;
+  pList->sink.pContext = pList;
+}
+
+/**
+ * Free the pulses of a pulse list sink (the sink is left empty, and may be used again)
+ *
+ * @param pList Sink
+ */
+void zxtape_freeListSink(ZXTAPE_SINK_LIST_T *pList) {
+  assert(pList != NULL);
+
+  free(pList->pPulses);
+  pList->pPulses = NULL;
+  pList->nCount = 0;
+  pList->nCapacity = 0;
+}
+
+static void listWrite(ZXTAPE_SINK_LIST_T *pList, const ZXTAPE_PULSE_T *pPulses, unsigned nCount) {
+  // Grow the list as required (doubling, so the cost per pulse is constant)
+  if (pList->nCount + nCount > pList->nCapacity) {
+    u32 nCapacity = pList->nCapacity ? pList->nCapacity : 1024;
+    while (nCapacity < pList->nCount + nCount) nCapacity *= 2;
+    ZXTAPE_PULSE_T *pNew = (ZXTAPE_PULSE_T *)realloc(pList->pPulses, nCapacity * sizeof(ZXTAPE_PULSE_T));
+    assert(pNew != NULL);
+    pList->pPulses = pNew;
+    pList->nCapacity = nCapacity;
+  }
+
+  memcpy(&pList->pPulses[pList->nCount], pPulses, nCount * sizeof(ZXTAPE_PULSE_T));
+  pList->nCount += nCount;
+}
+
+//
+// PCM ring sink
+//
+
+/**
+ * Initialize a PCM ring sink
+ *
+ * @param pRing Sink to initialize
+ * @param pSamples Ring buffer
+ * @param nLength Length of the ring buffer in samples (power of 2)
+ * @param nSampleRate Sample rate (Hz)
+ */
+void zxtape_initRingSink(ZXTAPE_SINK_RING_T *pRing, i16 *pSamples, u32 nLength, u32 nSampleRate) {
+  assert(pRing != NULL);
+  assert(pSamples != NULL);
+  assert(nLength > 0 && (nLength & (nLength - 1)) == 0);
+
+  memset(pRing, 0, sizeof(ZXTAPE_SINK_RING_T));
+  pRing->sink.write = (void (*)(void *, const ZXTAPE_PULSE_T *, unsigned))ringWrite;
+  pRing->sink.end = NULL;
+  pRing->sink.pContext = pRing;
+  zxtapeSink_initPcm(&pRing->pcm, nSampleRate, ZXTAPE_SINK_PCM_GAIN_UNITY);
+  pRing->pSamples = pSamples;
+  pRing->nLength = nLength;
+}
+
+/**
+ * Read samples from a PCM ring sink (consumer side, may be another thread)
+ *
+ * @param pRing Sink
+ * @param pOut Buffer for the samples
+ * @param nMaxSamples Maximum number of samples to read
+ * @return u32 Number of samples read
+ */
+u32 zxtape_readRingSink(ZXTAPE_SINK_RING_T *pRing, i16 *pOut, u32 nMaxSamples) {
+  u32 nRead = pRing->nReadIndex;
+  u32 nWrite = __atomic_load_n(&pRing->nWriteIndex, __ATOMIC_ACQUIRE);
+  u32 nCount = nWrite - nRead;
+  u32 nMask = pRing->nLength - 1;
+
+  if (nCount > nMaxSamples) nCount = nMaxSamples;
+  for (u32 i = 0; i < nCount; i++) pOut[i] = pRing->pSamples[(nRead + i) & nMask];
+
+  __atomic_store_n(&pRing->nReadIndex, nRead + nCount, __ATOMIC_RELEASE);
+
+  return nCount;
+}
+
+static void ringWrite(ZXTAPE_SINK_RING_T *pRing, const ZXTAPE_PULSE_T *pPulses, unsigned nCount) {
+  pcmWrite(&pRing->pcm, pPulses, nCount, (ZXTAPE_SINK_PCM_OUTPUT_T)ringOutput, pRing);
+}
+
+static void ringOutput(ZXTAPE_SINK_RING_T *pRing, const i16 *pSamples, u32 nCount) {
+  u32 nWrite = pRing->nWriteIndex;
+  u32 nRead = __atomic_load_n(&pRing->nReadIndex, __ATOMIC_ACQUIRE);
+  u32 nSpace = pRing->nLength - (nWrite - nRead);
+  u32 nMask = pRing->nLength - 1;
+
+  if (nCount > nSpace) {
+    pRing->nDropped += nCount - nSpace;
+    nCount = nSpace;
+  }
+  for (u32 i = 0; i < nCount; i++) pRing->pSamples[(nWrite + i) & nMask] = pSamples[i];
+
+  __atomic_store_n(&pRing->nWriteIndex, nWrite + nCount, __ATOMIC_RELEASE);
+}
+
+//
+// Fan-out sink
+//
+// The writer (the instance's sink) only ever writes the records and its indexes, and each reader only its own cursor,
+// so a slow reader never holds up the writer or the other readers (see the seqlock rings below).
+//
+
+/**
+ * Initialize a fan-out sink
+ *
+ * @param pFanout Sink to initialize
+ * @param pRecords Ring buffer, shared by the readers
+ * @param nLength Length of the ring buffer in pulses (power of 2)
+ */
+void zxtape_initFanoutSink(ZXTAPE_SINK_FANOUT_T *pFanout, u32 *pRecords, u32 nLength) {
+  assert(pFanout != NULL);
+  assert(pRecords != NULL);
+  assert(nLength > 0 && (nLength & (nLength - 1)) == 0);
+
+  memset(pFanout, 0, sizeof(ZXTAPE_SINK_FANOUT_T));
+  pFanout->sink.write = (void (*)(void *, const ZXTAPE_PULSE_T *, unsigned))fanoutWrite;
+  pFanout->sink.end = (void (*)(void *))fanoutEnd;
+  pFanout->sink.pContext = pFanout;
+  pFanout->pRecords = pRecords;
+  pFanout->nLength = nLength;
+}
+
+/**
+ * Initialize a reader of a fan-out sink. It reads from the next pulse written.
+ *
+ * @param pReader Reader to initialize
+ * @param pFanout Sink to read
+ * @param format Format to read
+ * @param nSampleRate Sample rate (Hz, PCM formats)
+ * @param nGain Gain (PCM formats, ZXTAPE_SINK_FANOUT_GAIN_UNITY is 1, the result is clipped)
+ */
+void zxtape_initFanoutReader(ZXTAPE_SINK_FANOUT_READER_T *pReader, ZXTAPE_SINK_FANOUT_T *pFanout,
+                             ZXTAPE_SINK_FANOUT_FORMAT_T format, u32 nSampleRate, u32 nGain) {
+  assert(pReader != NULL);
+  assert(pFanout != NULL);
+
+  memset(pReader, 0, sizeof(ZXTAPE_SINK_FANOUT_READER_T));
+  pReader->pFanout = pFanout;
+  pReader->format = format;
+  if (format != ZXTAPE_SINK_FANOUT_FORMAT_PULSES) zxtapeSink_initPcm(&pReader->pcm, nSampleRate, nGain);
+  pReader->nReadIndex = __atomic_load_n(&pFanout->nWriteIndex, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * Read from a fan-out sink (consumer side, may be another thread)
+ *
+ * PCM formats only return complete samples; the part sample at the end of the pulses so far is returned once more
+ * pulses are written.
+ *
+ * @param pReader Reader
+ * @param pOut Buffer for the pulses (ZXTAPE_PULSE_T) or frames (i16 or u8), as the reader's format
+ * @param nMax Maximum number of pulses or frames to read
+ * @return u32 Number of pulses or frames read
+ */
+u32 zxtape_readFanoutReader(ZXTAPE_SINK_FANOUT_READER_T *pReader, void *pOut, u32 nMax) {
+  assert(pReader != NULL);
+  assert(pOut != NULL || nMax == 0);
+
+  if (pReader->format == ZXTAPE_SINK_FANOUT_FORMAT_PULSES) {
+    return fanoutReadPulses(pReader, (ZXTAPE_PULSE_T *)pOut, nMax);
+  }
+
+  return fanoutReadPcm(pReader, pOut, nMax);
+}
+
+static void fanoutWrite(ZXTAPE_SINK_FANOUT_T *pFanout, const ZXTAPE_PULSE_T *pPulses, unsigned nCount) {
+  u32 records[ZXTAPE_SINK_FANOUT_CHUNK_LENGTH];
+  ZXTAPE_SINK_SEQLOCK_T ring;
+
+  fanoutRing(pFanout, &ring);
+  for (unsigned i = 0; i < nCount; i += ZXTAPE_SINK_FANOUT_CHUNK_LENGTH) {
+    u32 n = nCount - i < ZXTAPE_SINK_FANOUT_CHUNK_LENGTH ? nCount - i : ZXTAPE_SINK_FANOUT_CHUNK_LENGTH;
+    zxtapeSink_packPulses(records, &pPulses[i], n);
+    zxtapeSink_seqlockWrite(&ring, records, n);
+  }
+}
+
+static void fanoutEnd(ZXTAPE_SINK_FANOUT_T *pFanout) {
+  __atomic_add_fetch(&pFanout->nEnds, 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Copy the records from the reader's cursor (without moving it), skipping any the writer has overwritten
+ */
+static u32 fanoutPeek(ZXTAPE_SINK_FANOUT_READER_T *pReader, u32 *pRecords, u32 nMax) {
+  ZXTAPE_SINK_SEQLOCK_T ring;
+
+  fanoutRing(pReader->pFanout, &ring);
+
+  return zxtapeSink_seqlockPeek(&ring, pRecords, nMax, &pReader->nReadIndex, &pReader->nDropped);
+}
+
+static u32 fanoutReadPulses(ZXTAPE_SINK_FANOUT_READER_T *pReader, ZXTAPE_PULSE_T *pOut, u32 nMax) {
+  u32 records[ZXTAPE_SINK_FANOUT_CHUNK_LENGTH];
+  u32 nPulses = 0;
+
+  while (nPulses < nMax) {
+    u32 n = nMax - nPulses < ZXTAPE_SINK_FANOUT_CHUNK_LENGTH ? nMax - nPulses : ZXTAPE_SINK_FANOUT_CHUNK_LENGTH;
+    n = fanoutPeek(pReader, records, n);
+    if (n == 0) break;
+
+    zxtapeSink_unpackPulses(&pOut[nPulses], records, n);
+    pReader->nReadIndex += n;
+    nPulses += n;
+  }
+
+  return nPulses;
+}
+
+/**
+ * Convert pulses to frames as zxtape_render(), with the reader's gain and format, until out of frames or pulses
+ */
+static u32 fanoutReadPcm(ZXTAPE_SINK_FANOUT_READER_T *pReader, void *pOut, u32 nMaxFrames) {
+  u32 records[ZXTAPE_SINK_FANOUT_CHUNK_LENGTH];
+  ZXTAPE_PULSE_T pulses[ZXTAPE_SINK_FANOUT_CHUNK_LENGTH];
+  i16 samples[ZXTAPE_SINK_FANOUT_CHUNK_LENGTH];
+  u32 nFrames = 0;
+
+  while (nFrames < nMaxFrames) {
+    u32 nRecords = fanoutPeek(pReader, records, ZXTAPE_SINK_FANOUT_CHUNK_LENGTH);
+    zxtapeSink_unpackPulses(pulses, records, nRecords);
+
+    // Signed frames straight into the output, unsigned through samples
+    u32 nMax = nMaxFrames - nFrames;
+    i16 *pSamples = samples;
+    if (pReader->format == ZXTAPE_SINK_FANOUT_FORMAT_S16) {
+      pSamples = &((i16 *)pOut)[nFrames];
+    } else if (nMax > ZXTAPE_SINK_FANOUT_CHUNK_LENGTH) {
+      nMax = ZXTAPE_SINK_FANOUT_CHUNK_LENGTH;
+    }
+
+    // The cursor only moves past the pulses started, so none are lost at the end
+    u32 nTaken;
+    u32 n = zxtapeSink_pcmConvert(&pReader->pcm, pulses, nRecords, pSamples, nMax, &nTaken);
+    pReader->nReadIndex += nTaken;
+    if (pReader->format == ZXTAPE_SINK_FANOUT_FORMAT_U8) {
+      for (u32 i = 0; i < n; i++) ((u8 *)pOut)[nFrames + i] = (u8)((samples[i] + 0x8000) >> 8);
+    }
+    nFrames += n;
+
+    if (n == 0 && nTaken == 0) break;
+  }
+
+  return nFrames;
+}
+
+/**
+ * The fan-out sink's ring as a seqlock ring
+ */
+static void fanoutRing(ZXTAPE_SINK_FANOUT_T *pFanout, ZXTAPE_SINK_SEQLOCK_T *pRing) {
+  pRing->pRecords = pFanout->pRecords;
+  pRing->nRecordSize = sizeof(u32);
+  pRing->nLength = pFanout->nLength;
+  pRing->pClaimIndex = &pFanout->nClaimIndex;
+  pRing->pWriteIndex = &pFanout->nWriteIndex;
+}
+
+//
+// WAV file sink
+//
+
+#ifndef __ZX_TAPE_CIRCLE__
+
+/**
+ * Open a WAV file sink
+ *
+ * @param pWav Sink to initialize
+ * @param pFilename WAV file to create
+ * @param nSampleRate Sample rate (Hz)
+ * @return true if the file was created
+ */
+bool zxtape_openWavSink(ZXTAPE_SINK_WAV_T *pWav, const char *pFilename, u32 nSampleRate) {
+  assert(pWav != NULL);
+  assert(pFilename != NULL);
+
+  memset(pWav, 0, sizeof(ZXTAPE_SINK_WAV_T));
+  pWav->sink.write = (void (*)(void *, const ZXTAPE_PULSE_T *, unsigned))wavWrite;
+  pWav->sink.end = (void (*)(void *))wavEnd;
+  pWav->sink.pContext = pWav;
+  zxtapeSink_initPcm(&pWav->pcm, nSampleRate, ZXTAPE_SINK_PCM_GAIN_UNITY);
+
+  pWav->pFile = fopen(pFilename, "wb");
+  if (pWav->pFile == NULL) {
+    zxtape_log_error("Failed to create WAV file: %s", pFilename);
+    return false;
+  }
+
+  // Header for an empty file, completed when playback stops
+  wavWriteHeader(pWav);
+
+  return !pWav->bError;
+}
+
+/**
+ * Close a WAV file sink, completing the file
+ *
+ * @param pWav Sink
+ * @return true if the whole file was written
+ */
+bool zxtape_closeWavSink(ZXTAPE_SINK_WAV_T *pWav) {
+  assert(pWav != NULL);
+
+  if (pWav->pFile == NULL) return false;
+
+  wavEnd(pWav);
+  if (fclose((FILE *)pWav->pFile) != 0) pWav->bError = true;
+  pWav->pFile = NULL;
+
+  return !pWav->bError;
+}
+
+static void wavWrite(ZXTAPE_SINK_WAV_T *pWav, const ZXTAPE_PULSE_T *pPulses, unsigned nCount) {
+  pcmWrite(&pWav->pcm, pPulses, nCount, (ZXTAPE_SINK_PCM_OUTPUT_T)wavOutput, pWav);
+}
+
+static void wavEnd(ZXTAPE_SINK_WAV_T *pWav) {
+  // Write out the last (part) sample and the buffer, and complete the header
+  i16 sample;
+  if (zxtapeSink_pcmFlush(&pWav->pcm, &sample)) wavOutput(pWav, &sample, 1);
+  wavWriteBuffer(pWav);
+  wavWriteHeader(pWav);
+  fflush((FILE *)pWav->pFile);
+}
+
+static void wavOutput(ZXTAPE_SINK_WAV_T *pWav, const i16 *pSamples, u32 nCount) {
+  while (nCount > 0) {
+    u32 n = ZXTAPE_SINK_WAV_BUFFER_LENGTH - pWav->nBuffered;
+    if (n > nCount) n = nCount;
+
+    memcpy(&pWav->buffer[pWav->nBuffered], pSamples, n * sizeof(i16));
+    pWav->nBuffered += n;
+    pSamples += n;
+    nCount -= n;
+
+    if (pWav->nBuffered == ZXTAPE_SINK_WAV_BUFFER_LENGTH) wavWriteBuffer(pWav);
+  }
+}
+
+static void wavWriteBuffer(ZXTAPE_SINK_WAV_T *pWav) {
+  u8 data[ZXTAPE_SINK_WAV_BUFFER_LENGTH * 2];
+
+  if (pWav->nBuffered == 0) return;
+
+  // Samples are little endian
+  for (u32 i = 0; i < pWav->nBuffered; i++) {
+    data[i * 2] = (u8)((u16)pWav->buffer[i] & 0xFF);
+    data[i * 2 + 1] = (u8)((u16)pWav->buffer[i] >> 8);
+  }
+  if (fwrite(data, 2, pWav->nBuffered, (FILE *)pWav->pFile) != pWav->nBuffered) pWav->bError = true;
+
+  pWav->nSamples += pWav->nBuffered;
+  pWav->nBuffered = 0;
+}
+
+static void wavWriteHeader(ZXTAPE_SINK_WAV_T *pWav) {
+  u8 header[ZXTAPE_SINK_WAV_HEADER_LENGTH];
+  zxtapeSink_formatWavHeader(header, pWav->pcm.nSampleRate, 16, pWav->nSamples);
+
+  FILE *pFile = (FILE *)pWav->pFile;
+  long nEnd = ftell(pFile);
+  if (fseek(pFile, 0, SEEK_SET) != 0 || fwrite(header, 1, sizeof(header), pFile) != sizeof(header)) {
+    pWav->bError = true;
+  }
+  if (nEnd > ZXTAPE_SINK_WAV_HEADER_LENGTH) fseek(pFile, nEnd, SEEK_SET);
+}
+
+/**
+ * Format a WAV header (mono PCM)
+ *
+ * @param pHeader Header (ZXTAPE_SINK_WAV_HEADER_LENGTH bytes)
+ * @param nSampleRate Sample rate (Hz)
+ * @param nBits Bits per sample (8: unsigned, 16: signed)
+ * @param nSamples Number of samples in the file
+ */
+void zxtapeSink_formatWavHeader(u8 *pHeader, u32 nSampleRate, u32 nBits, u64 nSamples) {
+  u32 nBlockAlign = nBits / 8;
+  u32 nDataLen = (u32)(nSamples * nBlockAlign);
+  u32 nByteRate = nSampleRate * nBlockAlign;
+  const u32 fields[][2] = {
+      {0x46464952, 4},     // "RIFF"
+      {36 + nDataLen, 4},  // RIFF chunk length
+      {0x45564157, 4},     // "WAVE"
+      {0x20746D66, 4},     // "fmt "
+      {16, 4},             // fmt chunk length
+      {1, 2},              // PCM
+      {1, 2},              // Mono
+      {nSampleRate, 4},    // Sample rate
+      {nByteRate, 4},      // Byte rate
+      {nBlockAlign, 2},    // Block align
+      {nBits, 2},          // Bits per sample
+      {0x61746164, 4},     // "data"
+      {nDataLen, 4},       // data chunk length
+  };
+
+  u32 nPos = 0;
+  for (u32 i = 0; i < sizeof(fields) / sizeof(fields[0]); i++) {
+    for (u32 j = 0; j < fields[i][1]; j++) pHeader[nPos++] = (u8)(fields[i][0] >> (j * 8));
+  }
+}
+
+#endif  // __ZX_TAPE_CIRCLE__
+
+//
+// Pulse to PCM conversion
+//
+// The one conversion of pushed pulses to samples: used by the PCM sinks, the fan-out readers, the shared memory sink
+// and zxtape_convertToWav().
+//
+
+/**
+ * Initialize a pulse to PCM conversion
+ *
+ * @param pPcm Conversion to initialize
+ * @param nSampleRate Sample rate (Hz)
+ * @param nGain Gain (ZXTAPE_SINK_PCM_GAIN_UNITY is 1, the samples are clipped)
+ */
+void zxtapeSink_initPcm(ZXTAPE_SINK_PCM_T *pPcm, u32 nSampleRate, u32 nGain) {
+  assert(nSampleRate > 0);
+
+  memset(pPcm, 0, sizeof(ZXTAPE_SINK_PCM_T));
+  pPcm->nSampleRate = nSampleRate;
+  pPcm->nGain = nGain;
+}
+
+/**
+ * Convert pulses to samples, until nMax samples are output or the pulses run out
+ *
+ * A pulse is taken once started: the rest of it, and the last part sample, are carried over to the next call. A
+ * complete sample is held until there is room for it, so with nMax 0 the current sample is only completed (the part
+ * of it at the high level is then in nHigh).
+ *
+ * @param pPcm Conversion
+ * @param pPulses Pulses
+ * @param nCount Number of pulses
+ * @param pOut Buffer for the samples
+ * @param nMax Maximum number of samples to output
+ * @param pTaken Number of pulses taken (set)
+ * @return u32 Number of samples output
+ */
+u32 zxtapeSink_pcmConvert(ZXTAPE_SINK_PCM_T *pPcm, const ZXTAPE_PULSE_T *pPulses, u32 nCount, i16 *pOut, u32 nMax,
+                          u32 *pTaken) {
+  u32 nTaken = 0;
+  u32 nSamples = 0;
+
+  for (;;) {
+    if (pPcm->nFilled == ZXTAPE_RENDER_SAMPLE_UNITS) {
+      if (nSamples == nMax) break;
+      pOut[nSamples++] = zxtapeSink_pcmSample(pPcm->nHigh, pPcm->nGain);
+      pPcm->nFilled = 0;
+      pPcm->nHigh = 0;
+    }
+
+    if (pPcm->nPulseRemaining == 0) {
+      if (nTaken == nCount) break;
+      pPcm->nPulseRemaining = (u64)pPulses[nTaken].nPeriodUs * pPcm->nSampleRate;
+      pPcm->bPulseHigh = pPulses[nTaken++].nLevel != 0;
+      continue;
+    }
+
+    u64 n = ZXTAPE_RENDER_SAMPLE_UNITS - pPcm->nFilled;
+    if (n > pPcm->nPulseRemaining) n = pPcm->nPulseRemaining;
+    if (pPcm->bPulseHigh) pPcm->nHigh += n;
+    pPcm->nFilled += n;
+    pPcm->nPulseRemaining -= n;
+  }
+
+  *pTaken = nTaken;
+
+  return nSamples;
+}
+
+/**
+ * Take the last part sample (if any), as if the level were low for the rest of it
+ *
+ * @param pPcm Conversion (the rest of the pulse being converted is dropped)
+ * @param pSample Sample (set if there was a part sample)
+ * @return true if there was a part sample
+ */
+bool zxtapeSink_pcmFlush(ZXTAPE_SINK_PCM_T *pPcm, i16 *pSample) {
+  bool bPart = pPcm->nFilled > 0;
+
+  if (bPart) *pSample = zxtapeSink_pcmSample(pPcm->nHigh, pPcm->nGain);
+  pPcm->nFilled = 0;
+  pPcm->nHigh = 0;
+  pPcm->nPulseRemaining = 0;
+
+  return bPart;
+}
+
+/**
+ * Sample value for a sample high for nHigh of its length
+ *
+ * @param nHigh Part of the sample at the high level (us * sample rate, up to ZXTAPE_RENDER_SAMPLE_UNITS)
+ * @param nGain Gain (ZXTAPE_SINK_PCM_GAIN_UNITY is 1)
+ * @return i16 Sample value (clipped)
+ */
+i16 zxtapeSink_pcmSample(u64 nHigh, u32 nGain) {
+  i64 nSample = ZXTAPE_RENDER_LEVEL_LOW +
+                (i64)((ZXTAPE_RENDER_LEVEL_HIGH - ZXTAPE_RENDER_LEVEL_LOW) * nHigh / ZXTAPE_RENDER_SAMPLE_UNITS);
+
+  if (nGain != ZXTAPE_SINK_PCM_GAIN_UNITY) {
+    nSample = nSample * nGain / ZXTAPE_SINK_PCM_GAIN_UNITY;
+    if (nSample > 0x7FFF) nSample = 0x7FFF;
+    if (nSample < -0x8000) nSample = -0x8000;
+  }
+
+  return (i16)nSample;
+}
+
+/**
+ * Convert pulses to samples, outputting each chunk of complete samples
+ */
+static void pcmWrite(ZXTAPE_SINK_PCM_T *pPcm, const ZXTAPE_PULSE_T *pPulses, unsigned nCount,
+                     ZXTAPE_SINK_PCM_OUTPUT_T pfnOutput, void *pContext) {
+  i16 samples[ZXTAPE_SINK_PCM_CHUNK_LENGTH];
+  u32 nSamples;
+
+  do {
+    u32 nTaken;
+    nSamples = zxtapeSink_pcmConvert(pPcm, pPulses, nCount, samples, ZXTAPE_SINK_PCM_CHUNK_LENGTH, &nTaken);
+    pPulses += nTaken;
+    nCount -= nTaken;
+    if (nSamples > 0) pfnOutput(pContext, samples, nSamples);
+  } while (nSamples == ZXTAPE_SINK_PCM_CHUNK_LENGTH);
+}
+
+//
+// Seqlock rings (the fan-out sink, and the shared memory sink's rings)
+//
+// The writer publishes the claim index before it overwrites any record, so after copying records a reader can tell
+// which may have been overwritten by newer ones while it copied them (a seqlock, per record), and skips them. Pulses
+// are packed into a u32 record each (ZXTAPE_SINK_RECORD_LEVEL and ZXTAPE_SINK_RECORD_PERIOD).
+//
+
+/**
+ * Write records to a seqlock ring (writer side)
+ *
+ * @param pRing Ring
+ * @param pRecords Records (of the ring's record size)
+ * @param nCount Number of records
+ */
+void zxtapeSink_seqlockWrite(const ZXTAPE_SINK_SEQLOCK_T *pRing, const void *pRecords, u32 nCount) {
+  u32 nWrite = *pRing->pWriteIndex;
+  u32 nMask = pRing->nLength - 1;
+
+  // Claim the records before overwriting them
+  __atomic_store_n(pRing->pClaimIndex, nWrite + nCount, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+
+  if (pRing->nRecordSize == sizeof(u32)) {
+    for (u32 i = 0; i < nCount; i++) {
+      __atomic_store_n(&((u32 *)pRing->pRecords)[(nWrite + i) & nMask], ((const u32 *)pRecords)[i], __ATOMIC_RELAXED);
+    }
+  } else {
+    for (u32 i = 0; i < nCount; i++) {
+      __atomic_store_n(&((i16 *)pRing->pRecords)[(nWrite + i) & nMask], ((const i16 *)pRecords)[i], __ATOMIC_RELAXED);
+    }
+  }
+
+  __atomic_store_n(pRing->pWriteIndex, nWrite + nCount, __ATOMIC_RELEASE);
+}
+
+/**
+ * Copy records from a seqlock ring from a reader's index, without moving it past them. A reader which fell more than
+ * the ring behind, or whose records were overwritten while copied, is moved on to the oldest record.
+ *
+ * @param pRing Ring
+ * @param pOut Buffer for the records (of the ring's record size)
+ * @param nMax Maximum number of records to copy
+ * @param pIndex Reader's index (moved on past any records skipped)
+ * @param pDropped Records skipped by the reader (added to)
+ * @return u32 Number of records copied
+ */
+u32 zxtapeSink_seqlockPeek(const ZXTAPE_SINK_SEQLOCK_T *pRing, void *pOut, u32 nMax, u32 *pIndex, u64 *pDropped) {
+  u32 nLength = pRing->nLength;
+  u32 nMask = nLength - 1;
+
+  for (;;) {
+    u32 nRead = *pIndex;
+    u32 nWrite = __atomic_load_n(pRing->pWriteIndex, __ATOMIC_ACQUIRE);
+
+    // Fell more than the ring behind: skip to the oldest record
+    if (nWrite - nRead > nLength) {
+      *pDropped += nWrite - nLength - nRead;
+      *pIndex = nWrite - nLength;
+      continue;
+    }
+
+    u32 nCount = nWrite - nRead;
+    if (nCount > nMax) nCount = nMax;
+    if (pRing->nRecordSize == sizeof(u32)) {
+      for (u32 i = 0; i < nCount; i++) {
+        ((u32 *)pOut)[i] = __atomic_load_n(&((u32 *)pRing->pRecords)[(nRead + i) & nMask], __ATOMIC_RELAXED);
+      }
+    } else {
+      for (u32 i = 0; i < nCount; i++) {
+        ((i16 *)pOut)[i] = __atomic_load_n(&((i16 *)pRing->pRecords)[(nRead + i) & nMask], __ATOMIC_RELAXED);
+      }
+    }
+
+    // Records before the oldest the writer may have overwritten since are not the ones wanted
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    u32 nOldest = __atomic_load_n(pRing->pClaimIndex, __ATOMIC_RELAXED) - nLength;
+    if ((i32)(nOldest - nRead) > 0) {
+      *pDropped += nOldest - nRead;
+      *pIndex = nOldest;
+      continue;
+    }
+
+    return nCount;
+  }
+}
+
+/**
+ * Pack pulses into records (a period too long for a record is cut)
+ *
+ * @param pRecords Records (set)
+ * @param pPulses Pulses
+ * @param nCount Number of pulses
+ */
+void zxtapeSink_packPulses(u32 *pRecords, const ZXTAPE_PULSE_T *pPulses, u32 nCount) {
+  for (u32 i = 0; i < nCount; i++) {
+    u32 nPeriodUs = pPulses[i].nPeriodUs < ZXTAPE_SINK_RECORD_PERIOD ? pPulses[i].nPeriodUs : ZXTAPE_SINK_RECORD_PERIOD;
+    pRecords[i] = nPeriodUs | (pPulses[i].nLevel ? ZXTAPE_SINK_RECORD_LEVEL : 0);
+  }
+}
+
+/**
+ * Unpack pulses from records
+ *
+ * @param pPulses Pulses (set)
+ * @param pRecords Records
+ * @param nCount Number of records
+ */
+void zxtapeSink_unpackPulses(ZXTAPE_PULSE_T *pPulses, const u32 *pRecords, u32 nCount) {
+  for (u32 i = 0; i < nCount; i++) {
+    pPulses[i].nLevel = (pRecords[i] & ZXTAPE_SINK_RECORD_LEVEL) ? 1 : 0;
+    pPulses[i].nPeriodUs = pRecords[i] & ZXTAPE_SINK_RECORD_PERIOD;
+  }
+}
@@ -0,0 +1,35 @@
+#ifndef _zxtape_sink_internal_h_
+#define _zxtape_sink_internal_h_
+
+#include "../../../include/zxtape.h"
+#include "../../../include/zxtape_sink.h"
+
+#define ZXTAPE_SINK_WAV_HEADER_LENGTH 44
+
+/**
+ * Seqlock ring of records: one writer, which never waits, and any number of readers, each with its own index (see
+ * zxtapeSink_seqlockWrite())
+ */
+typedef struct _ZXTAPE_SINK_SEQLOCK_T {
+  void *pRecords;
+  u32 nRecordSize;   // sizeof(u32) or sizeof(i16)
+  u32 nLength;       // Records (power of 2)
+  u32 *pClaimIndex;  // Records the writer has started to write
+  u32 *pWriteIndex;  // Records written
+} ZXTAPE_SINK_SEQLOCK_T;
+
+/* Exported functions */
+void zxtapeSink_initPcm(ZXTAPE_SINK_PCM_T *pPcm, u32 nSampleRate, u32 nGain);
+u32 zxtapeSink_pcmConvert(ZXTAPE_SINK_PCM_T *pPcm, const ZXTAPE_PULSE_T *pPulses, u32 nCount, i16 *pOut, u32 nMax,
+                          u32 *pTaken);
+bool zxtapeSink_pcmFlush(ZXTAPE_SINK_PCM_T *pPcm, i16 *pSample);
+i16 zxtapeSink_pcmSample(u64 nHigh, u32 nGain);
+void zxtapeSink_seqlockWrite(const ZXTAPE_SINK_SEQLOCK_T *pRing, const void *pRecords, u32 nCount);
+u32 zxtapeSink_seqlockPeek(const ZXTAPE_SINK_SEQLOCK_T *pRing, void *pOut, u32 nMax, u32 *pIndex, u64 *pDropped);
+void zxtapeSink_packPulses(u32 *pRecords, const ZXTAPE_PULSE_T *pPulses, u32 nCount);
+void zxtapeSink_unpackPulses(ZXTAPE_PULSE_T *pPulses, const u32 *pRecords, u32 nCount);
+#ifndef __ZX_TAPE_CIRCLE__
+void zxtapeSink_formatWavHeader(u8 *pHeader, u32 nSampleRate, u32 nBits, u64 nSamples);
+#endif  // __ZX_TAPE_CIRCLE__
+
+#endif  // _zxtape_sink_internal_h_
@@ -0,0 +1,256 @@
+#include "../../../include/zxtape_stats.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "./zxtape_stats.h"
+
+//
+// Runtime statistics
+//
+// The counters are updated with relaxed atomics where the events happen (the TZX library, the compatibility layer
+// implementations' output and timer threads, and the file API), so recording costs a few uncontended increments and
+// never takes a lock. zxtape_getStats() reads each counter on its own, so a snapshot taken while playing may be
+// slightly inconsistent between counters (e.g. a pull counted but its samples not yet).
+//
+// The buffer fill percentiles, lowest and highest are found from the fill histogram (one bucket per percent) when the
+// statistics are read, so the output threads only increment one bucket per pull.
+//
+
+#define ZXTAPE_STATS_TEXT_LINE_LENGTH 96  // Longest line of the text export
+
+/* Forward declarations */
+static u32 fillPercentile(const u64 *pHistogram, u64 nCount, u32 nPercentile);
+static unsigned durationBucket(u64 nDurationNs);
+static void recordMax(u64 *pMax, u64 nValue);
+static unsigned formatLine(char *pBuffer, unsigned nLength, unsigned nPos, const char *pFormat, ...);
+
+/* Exported variables */
+ZXTAPE_STATS_COUNTERS_T zxtapeStats_counters;
+
+/* Exported functions */
+
+/**
+ * Get the runtime statistics (for the process)
+ *
+ * @param pStats Statistics (set)
+ */
+void zxtape_getStats(ZXTAPE_STATS_T *pStats) {
+  ZXTAPE_STATS_COUNTERS_T *pCounters = &zxtapeStats_counters;
+
+  memset(pStats, 0, sizeof(ZXTAPE_STATS_T));
+
+  pStats->nUnderruns = __atomic_load_n(&pCounters->nUnderruns, __ATOMIC_RELAXED);
+  pStats->nOverflows = __atomic_load_n(&pCounters->nOverflows, __ATOMIC_RELAXED);
+  pStats->nOutputPulls = __atomic_load_n(&pCounters->nOutputPulls, __ATOMIC_RELAXED);
+  pStats->nSamples = __atomic_load_n(&pCounters->nSamples, __ATOMIC_RELAXED);
+  pStats->nRefills = __atomic_load_n(&pCounters->nRefills, __ATOMIC_RELAXED);
+  pStats->nRefillMaxNs = __atomic_load_n(&pCounters->nRefillMaxNs, __ATOMIC_RELAXED);
+  pStats->nPulses = __atomic_load_n(&pCounters->nPulses, __ATOMIC_RELAXED);
+  pStats->nBytesRead = __atomic_load_n(&pCounters->nBytesRead, __ATOMIC_RELAXED);
+  pStats->nTimerWakeups = __atomic_load_n(&pCounters->nTimerWakeups, __ATOMIC_RELAXED);
+  pStats->nLateTimerWakeups = __atomic_load_n(&pCounters->nLateTimerWakeups, __ATOMIC_RELAXED);
+  pStats->nTimerMaxLateNs = __atomic_load_n(&pCounters->nTimerMaxLateNs, __ATOMIC_RELAXED);
+  pStats->nFileReads = __atomic_load_n(&pCounters->nFileReads, __ATOMIC_RELAXED);
+  pStats->nIoStallNs = __atomic_load_n(&pCounters->nIoStallNs, __ATOMIC_RELAXED);
+
+  for (unsigned i = 0; i < ZXTAPE_STATS_DURATION_BUCKETS; i++) {
+    pStats->refillHistogram[i] = __atomic_load_n(&pCounters->refillHistogram[i], __ATOMIC_RELAXED);
+  }
+
+  // Buffer fill summary, from the histogram
+  u64 nFillCount = 0;
+  for (unsigned i = 0; i < ZXTAPE_STATS_FILL_BUCKETS; i++) {
+    pStats->fillHistogram[i] = __atomic_load_n(&pCounters->fillHistogram[i], __ATOMIC_RELAXED);
+    nFillCount += pStats->fillHistogram[i];
+  }
+  if (nFillCount > 0) {
+    pStats->nFillMinPercent = fillPercentile(pStats->fillHistogram, nFillCount, 0);
+    pStats->nFillMaxPercent = fillPercentile(pStats->fillHistogram, nFillCount, 100);
+    pStats->nFillP50Percent = fillPercentile(pStats->fillHistogram, nFillCount, 50);
+    pStats->nFillP90Percent = fillPercentile(pStats->fillHistogram, nFillCount, 90);
+    pStats->nFillP99Percent = fillPercentile(pStats->fillHistogram, nFillCount, 99);
+  }
+}
+
+/**
+ * Reset the runtime statistics to zero
+ */
+void zxtape_resetStats(void) {
+  u64 *pCounter = (u64 *)&zxtapeStats_counters;
+
+  for (unsigned i = 0; i < sizeof(ZXTAPE_STATS_COUNTERS_T) / sizeof(u64); i++) {
+    __atomic_store_n(&pCounter[i], 0, __ATOMIC_RELAXED);
+  }
+}
+
+/**
+ * Format the runtime statistics as text, one "name value" line per statistic (the Prometheus text format, with the
+ * histograms as cumulative buckets)
+ *
+ * @param pStats Statistics (from zxtape_getStats())
+ * @param pBuffer Buffer for the text (terminated, truncated if too short)
+ * @param nLength Length of the buffer (bytes)
+ * @return unsigned Length of the full text (excluding the terminator), as snprintf()
+ */
+unsigned zxtape_formatStats(const ZXTAPE_STATS_T *pStats, char *pBuffer, unsigned nLength) {
+  unsigned nPos = 0;
+
+  if (nLength > 0) pBuffer[0] = 0;
+
+  nPos = formatLine(pBuffer, nLength, nPos, "zxtape_underruns_total %llu", pStats->nUnderruns);
+  nPos = formatLine(pBuffer, nLength, nPos, "zxtape_overflows_total %llu", pStats->nOverflows);
+  nPos = formatLine(pBuffer, nLength, nPos, "zxtape_output_pulls_total %llu", pStats->nOutputPulls);
+  nPos = formatLine(pBuffer, nLength, nPos, "zxtape_samples_total %llu", pStats->nSamples);
+  nPos = formatLine(pBuffer, nLength, nPos, "zxtape_buffer_fill_percent_min %u", pStats->nFillMinPercent);
+  nPos = formatLine(pBuffer, nLength, nPos, "zxtape_buffer_fill_percent_max %u", pStats->nFillMaxPercent);
+  nPos = formatLine(pBuffer, nLength, nPos, "zxtape_buffer_fill_percent{quantile=\"0.5\"} %u", pStats->nFillP50Percent);
+  nPos = formatLine(pBuffer, nLength, nPos, "zxtape_buffer_fill_percent{quantile=\"0.9\"} %u", pStats->nFillP90Percent);
+  nPos =
+      formatLine(pBuffer, nLength, nPos, "zxtape_buffer_fill_percent{quantile=\"0.99\"} %u", pStats->nFillP99Percent);
+  nPos = formatLine(pBuffer, nLength, nPos, "zxtape_buffer_fill_percent_count %llu", pStats->nOutputPulls);
+
+  u64 nCumulative = 0;
+  for (unsigned i = 0; i < ZXTAPE_STATS_DURATION_BUCKETS - 1; i++) {
+    nCumulative += pStats->refillHistogram[i];
+    nPos = formatLine(pBuffer, nLength, nPos, "zxtape_refill_duration_us_bucket{le=\"%llu\"} %llu", 1ull << i,
+                      nCumulative);
+  }
+  nCumulative += pStats->refillHistogram[ZXTAPE_STATS_DURATION_BUCKETS - 1];
+  nPos = formatLine(pBuffer, nLength, nPos, "zxtape_refill_duration_us_bucket{le=\"+Inf\"} %llu", nCumulative);
+  nPos = formatLine(pBuffer, nLength, nPos, "zxtape_refill_duration_us_count %llu", pStats->nRefills);
+  nPos = formatLine(pBuffer, nLength, nPos, "zxtape_refill_duration_ns_max %llu", pStats->nRefillMaxNs);
+
+  nPos = formatLine(pBuffer, nLength, nPos, "zxtape_pulses_total %llu", pStats->nPulses);
+  nPos = formatLine(pBuffer, nLength, nPos, "zxtape_bytes_read_total %llu", pStats->nBytesRead);
+  nPos = formatLine(pBuffer, nLength, nPos, "zxtape_timer_wakeups_total %llu", pStats->nTimerWakeups);
+  nPos = formatLine(pBuffer, nLength, nPos, "zxtape_timer_late_wakeups_total %llu", pStats->nLateTimerWakeups);
+  nPos = formatLine(pBuffer, nLength, nPos, "zxtape_timer_late_ns_max %llu", pStats->nTimerMaxLateNs);
+  nPos = formatLine(pBuffer, nLength, nPos, "zxtape_file_reads_total %llu", pStats->nFileReads);
+  nPos = formatLine(pBuffer, nLength, nPos, "zxtape_io_stall_ns_total %llu", pStats->nIoStallNs);
+
+  return nPos;
+}
+
+//
+// Recording (internal)
+//
+
+/**
+ * Count an underrun of the output
+ */
+void zxtapeStats_countUnderrun(void) {
+  __atomic_fetch_add(&zxtapeStats_counters.nUnderruns, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * Count a period dropped because the output buffer was full
+ */
+void zxtapeStats_countOverflow(void) {
+  __atomic_fetch_add(&zxtapeStats_counters.nOverflows, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * Record a pull of samples by the output, with the fill of the buffer before it
+ */
+void zxtapeStats_recordOutputPull(u32 nSamples, u32 nBufferCount, u32 nBufferCapacity) {
+  u32 nPercent = nBufferCapacity > 0 ? (u32)((u64)nBufferCount * 100 / nBufferCapacity) : 0;
+  if (nPercent > 100) nPercent = 100;
+
+  __atomic_fetch_add(&zxtapeStats_counters.nOutputPulls, 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&zxtapeStats_counters.nSamples, nSamples, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&zxtapeStats_counters.fillHistogram[nPercent], 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * Record a refill of the output buffer by the producer
+ */
+void zxtapeStats_recordRefill(u64 nDurationNs) {
+  __atomic_fetch_add(&zxtapeStats_counters.nRefills, 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&zxtapeStats_counters.refillHistogram[durationBucket(nDurationNs)], 1, __ATOMIC_RELAXED);
+  recordMax(&zxtapeStats_counters.nRefillMaxNs, nDurationNs);
+}
+
+/**
+ * Record a run of the output timer handler, with how late it ran
+ */
+void zxtapeStats_recordTimerWakeup(u64 nLateNs) {
+  __atomic_fetch_add(&zxtapeStats_counters.nTimerWakeups, 1, __ATOMIC_RELAXED);
+  if (nLateNs > ZXTAPE_STATS_LATE_NS) __atomic_fetch_add(&zxtapeStats_counters.nLateTimerWakeups, 1, __ATOMIC_RELAXED);
+  recordMax(&zxtapeStats_counters.nTimerMaxLateNs, nLateNs);
+}
+
+/**
+ * Record a read from a file, with how long it took
+ */
+void zxtapeStats_recordFileRead(u64 nBytes, u64 nDurationNs) {
+  __atomic_fetch_add(&zxtapeStats_counters.nBytesRead, nBytes, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&zxtapeStats_counters.nFileReads, 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&zxtapeStats_counters.nIoStallNs, nDurationNs, __ATOMIC_RELAXED);
+}
+
+//
+// Private functions
+//
+
+/**
+ * Find a percentile of the buffer fill (the lowest bucket at or above it, so 0 is the lowest and 100 the highest)
+ */
+static u32 fillPercentile(const u64 *pHistogram, u64 nCount, u32 nPercentile) {
+  u64 nRank = nPercentile == 0 ? 1 : (nCount * nPercentile + 99) / 100;
+  u64 nCumulative = 0;
+
+  for (u32 i = 0; i < ZXTAPE_STATS_FILL_BUCKETS; i++) {
+    nCumulative += pHistogram[i];
+    if (nCumulative >= nRank) return i;
+  }
+
+  return ZXTAPE_STATS_FILL_BUCKETS - 1;
+}
+
+/**
+ * Find the duration histogram bucket (below 1us, below 2us, below 4us, ...)
+ */
+static unsigned durationBucket(u64 nDurationNs) {
+  u64 nUs = nDurationNs / 1000;
+  unsigned nBucket = 0;
+
+  while (nUs > 0 && nBucket < ZXTAPE_STATS_DURATION_BUCKETS - 1) {
+    nUs >>= 1;
+    nBucket++;
+  }
+
+  return nBucket;
+}
+
+/**
+ * Raise a maximum (only written when it changes, which is rare once it has settled)
+ */
+static void recordMax(u64 *pMax, u64 nValue) {
+  u64 nMax = __atomic_load_n(pMax, __ATOMIC_RELAXED);
+
+  while (nValue > nMax) {
+    if (__atomic_compare_exchange_n(pMax, &nMax, nValue, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) break;
+  }
+}
+
+/**
+ * Append a line to the text (if it fits), and move on the position of the full text
+ */
+static unsigned formatLine(char *pBuffer, unsigned nLength, unsigned nPos, const char *pFormat, ...) {
+  char line[ZXTAPE_STATS_TEXT_LINE_LENGTH];
+  va_list args;
+
+  va_start(args, pFormat);
+  int nLineLength = vsnprintf(line, sizeof(line) - 1, pFormat, args);
+  va_end(args);
+  if (nLineLength < 0) return nPos;
+  if (nLineLength > (int)sizeof(line) - 2) nLineLength = sizeof(line) - 2;
+  line[nLineLength++] = '\n';
+  line[nLineLength] = 0;
+
+  if (nPos < nLength) snprintf(pBuffer + nPos, nLength - nPos, "%s", line);
+
+  return nPos + nLineLength;
+}
@@ -0,0 +1,52 @@
+#ifndef _zxtape_stats_internal_h_
+#define _zxtape_stats_internal_h_
+
+#include "../../../include/zxtape_stats.h"
+
+/**
+ * Counters behind zxtape_getStats() (relaxed atomics, so they can be updated from any thread, including real-time
+ * ones, without a lock)
+ */
+typedef struct _ZXTAPE_STATS_COUNTERS_T {
+  u64 nUnderruns;
+  u64 nOverflows;
+  u64 nOutputPulls;
+  u64 nSamples;
+  u64 fillHistogram[ZXTAPE_STATS_FILL_BUCKETS];
+  u64 nRefills;
+  u64 nRefillMaxNs;
+  u64 refillHistogram[ZXTAPE_STATS_DURATION_BUCKETS];
+  u64 nPulses;
+  u64 nBytesRead;
+  u64 nTimerWakeups;
+  u64 nLateTimerWakeups;
+  u64 nTimerMaxLateNs;
+  u64 nFileReads;
+  u64 nIoStallNs;
+} ZXTAPE_STATS_COUNTERS_T;
+
+extern ZXTAPE_STATS_COUNTERS_T zxtapeStats_counters;
+
+/* Exported functions */
+void zxtapeStats_countUnderrun(void);
+void zxtapeStats_countOverflow(void);
+void zxtapeStats_recordOutputPull(u32 nSamples, u32 nBufferCount, u32 nBufferCapacity);
+void zxtapeStats_recordRefill(u64 nDurationNs);
+void zxtapeStats_recordTimerWakeup(u64 nLateNs);
+void zxtapeStats_recordFileRead(u64 nBytes, u64 nDurationNs);
+
+/**
+ * Count a period generated (once per period, so inline)
+ */
+static inline void zxtapeStats_countPulse(void) {
+  __atomic_fetch_add(&zxtapeStats_counters.nPulses, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * Count tape file bytes read (once per read of a few bytes, so inline)
+ */
+static inline void zxtapeStats_countBytesRead(u64 nBytes) {
+  __atomic_fetch_add(&zxtapeStats_counters.nBytesRead, nBytes, __ATOMIC_RELAXED);
+}
+
+#endif  // _zxtape_stats_internal_h_
@@ -23,6 +23,7 @@
 // Private function declarations
 static void clearBuffer();
 static word TickToUs(word ticks);
+static unsigned long PeriodToUs(word period);
 static void checkForEXT (char *filename);
 static bool checkForTap(char *filename);
 static bool checkForP(char *filename);
@@ -57,6 +58,7 @@ PROGMEM const char AYFile[8] = {'Z','X','A','Y','E','M','U','L'}; // added addit
 PROGMEM const char TAPHdr[20] = {0x0,0x0,0x3,'Z','X','A','Y','F','i','l','e',' ',' ',0x1A,0xB,0x0,0xC0,0x0,0x80,0x6E}; //
 //const char TAPHdr[24] = {0x13,0x0,0x0,0x3,' ',' ',' ',' ',' ',' ',' ',' ',' ',' ',0x1A,0xB,0x0,0xC0,0x0,0x80,0x52,0x1C,0xB,0xFF};
 bool PauseAtStart = false;
+unsigned long startOffset = 0;  // File offset of the block to start playback from (0 for the start of the file)
 
 /* Local variables */
 //Keep track of which ID, Task, and Block Task we're dealing with
@@ -69,7 +71,9 @@ word currentPeriod=1;
 
 //ISR Variables
 volatile unsigned int pos = 0; // Originally byte; had to change to support buffers > 255 bytes
-volatile word wbuffer[buffsize+1][2];
+typedef word wbufferEntry[2];
+static volatile wbufferEntry wbufferStorage[buffsize+1];  // Buffer until a state is restored (each has its own)
+volatile wbufferEntry *wbuffer = wbufferStorage;
 volatile byte morebuff = HIGH;
 volatile byte workingBuffer=0;
 volatile byte isStopped=false;
@@ -142,6 +146,37 @@ byte wibble = 1;
 byte parity = 0 ;        //0:NoParity 1:ParityOdd 2:ParityEven (default:0)
 byte bitChecksum = 0;     // 0:Even 1:Odd number of one bits
 
+// Event state
+unsigned long long tapeTimeUs = 0;  // Tape output generated so far (us), used to timestamp events
+byte pauseEntered = false;          // Pause start has been signalled for the current pause
+byte endOfDataSignalled = false;    // End of data has been signalled
+
+// Playback state (everything above that changes), so the library can be shared by several controller instances in
+// turn (see TZXSaveState()). The playback buffer is not copied: each state has its own, and wbuffer is switched.
+// The EngineState test checks every global is listed (test/zxtape_engine_state.test.cmake).
+#define TZX_STATE_VARIABLES(X)                                                                                   \
+  X(PauseAtStart) X(startOffset) X(currentID) X(currentTask) X(currentBlockTask) X(currentPeriod) X(pos)         \
+  X(wbuffer) X(morebuff) X(workingBuffer) X(isStopped) X(pinState) X(isPauseBlock) X(wasPauseBlock) X(intError)  \
+  X(AYPASS) X(hdrptr) X(blkchksum) X(ayblklen) X(btemppos) X(copybuff) X(bytesRead) X(bytesToRead)              \
+  X(pulsesCountByte) X(pilotPulses) X(pilotLength) X(sync1Length) X(sync2Length) X(zeroPulse) X(onePulse)        \
+  X(TstatesperSample) X(usedBitsInLastByte) X(loopCount) X(seqPulses) X(input) X(forcePause0)                    \
+  X(firstBlockPause) X(loopStart) X(pauseLength) X(temppause) X(outByte) X(outWord) X(outLong) X(count)          \
+  X(currentBit) X(currentByte) X(currentChar) X(pass) X(debugCount) X(EndOfFile) X(lastByte) X(currpct)          \
+  X(newpct) X(spinpos) X(timeDiff2) X(lcdsegs) X(offset) X(TSXspeedup) X(BAUDRATE) X(chunkID) X(uefTurboMode)    \
+  X(outFloat) X(UEFPASS) X(passforZero) X(passforOne) X(FlipPolarity) X(ID15switch) X(wibble) X(parity)          \
+  X(bitChecksum) X(tapeTimeUs) X(pauseEntered) X(endOfDataSignalled)
+
+#define TZX_STATE_FIELD(name) __typeof__(name) name;
+
+typedef struct _TZX_VARIABLES_T {
+  TZX_STATE_VARIABLES(TZX_STATE_FIELD)
+} TZX_VARIABLES_T;
+
+typedef struct _TZX_STATE_T {
+  TZX_VARIABLES_T variables;
+  wbufferEntry buffer[buffsize+1];  // Playback buffer (wbuffer while the state is restored)
+} TZX_STATE_T;
+
 #endif // __ZX_TAPE__
 
 static void clearBuffer()
@@ -158,6 +193,17 @@ static word TickToUs(word ticks) {
   return (word) ((((float) ticks)/3.5)+0.5);
 }
 
+static unsigned long PeriodToUs(word period) {
+  // Length of a buffer period once played by wave()
+  if (period == TZX_EOF_PERIOD) return period;
+  if bitRead(period, 15) {
+    // Pause in ms: 1.5ms with the output untouched, then the remainder with the output LOW
+    return long(period & 0x7FFF) * 1000 + 500;
+  }
+  if bitRead(period, 14) return TstatesperSample;  // ID15 direct recording sample
+  return period;
+}
+
 
 static void checkForEXT (char *filename) {
   if(checkForTap(filename)) {                 //Check for Tap File.  As these have no header we can skip straight to playing data
@@ -212,6 +258,20 @@ void TZXPlay() {
   pinState=LOW;                               //Always Start on a LOW output for simplicity
   count = 255;                                //End of file buffer flush
   EndOfFile=false;
+#ifdef __ZX_TAPE__
+  currentPeriod = 0;                          // Clear the EOF period left by a previous playback (TZXLoop() checks it)
+  btemppos = 0;                               // Fill the initial buffer page from the start (as at power on)
+  morebuff = HIGH;
+  tapeTimeUs = 0;
+  pauseEntered = false;
+  endOfDataSignalled = false;
+  if (startOffset > 0) {
+    // Start at a block, in the state a pause leaves (output low, next pulse not toggled)
+    bytesRead = startOffset;
+    if (currentTask == GETFILEHEADER) currentTask = GETID;
+    wasPauseBlock = true;
+  }
+#endif // __ZX_TAPE__
 
   if(pinState==LOW)
   {
@@ -226,7 +286,15 @@ void TZXPlay() {
   // Call TZXLoop once to fill the initial buffer
   TZXLoop();
 
-  pos = buffsize;                             // Start at the end of the buffer, so as to overflow to the initial buffer
+  if (startOffset > 0) {
+    // Starting at a block, the pause before it stands for the start wait: start on the initial buffer (as the wait
+    // leaves it), so the first pulse is the first of the block
+    pos = 0;
+    workingBuffer ^= 1;
+    morebuff = HIGH;
+  } else {
+    pos = buffsize;                           // Start at the end of the buffer, so as to overflow to the initial buffer
+  }
   Timer.setPeriod(1000); // 1msec                   // set 1ms wait at start of a file (to fill initial buffer).
 #else
   Timer.setPeriod(1000);                     //set 1ms wait at start of a file.
@@ -319,6 +387,7 @@ void TZXLoop() {
                 wbuffer[btemppos][workingBuffer ^ 1] = currentPeriod;   //add period to the buffer
                 interrupts();
                 btemppos+=1;
+                tapeTimeUs += PeriodToUs(currentPeriod);
             }
         }
     }
@@ -373,6 +442,56 @@ void TZXLoop() {
 #endif // __ZX_TAPE__
 }
 
+#ifdef __ZX_TAPE__
+/**
+ * Create a playback state, as the library is at start up (see TZXSaveState())
+ *
+ * The first state must be created before the library is used.
+ */
+void *TZXCreateState() {
+  static TZX_VARIABLES_T startVariables;
+  static bool bStartSaved = false;
+
+  if (!bStartSaved) {
+#define TZX_SAVE_START(name) memcpy((void *)&startVariables.name, (const void *)&name, sizeof(name));
+    TZX_STATE_VARIABLES(TZX_SAVE_START)
+    bStartSaved = true;
+  }
+
+  TZX_STATE_T *pState = (TZX_STATE_T *)malloc(sizeof(TZX_STATE_T));
+  assert(pState != NULL);
+  memcpy(&pState->variables, &startVariables, sizeof(TZX_VARIABLES_T));
+  memset(pState->buffer, 0, sizeof(pState->buffer));
+  pState->variables.wbuffer = pState->buffer;
+
+  return pState;
+}
+
+void TZXDestroyState(void *pState) {
+  free(pState);
+}
+
+/**
+ * Save the playback state of the library (to switch to another with TZXRestoreState())
+ */
+void TZXSaveState(void *pState) {
+  TZX_VARIABLES_T *pVariables = &((TZX_STATE_T *)pState)->variables;
+
+#define TZX_SAVE_VARIABLE(name) memcpy((void *)&pVariables->name, (const void *)&name, sizeof(name));
+  TZX_STATE_VARIABLES(TZX_SAVE_VARIABLE)
+}
+
+/**
+ * Restore a playback state saved by TZXSaveState() (or created by TZXCreateState())
+ */
+void TZXRestoreState(const void *pState) {
+  const TZX_VARIABLES_T *pVariables = &((const TZX_STATE_T *)pState)->variables;
+
+#define TZX_RESTORE_VARIABLE(name) memcpy((void *)&name, (const void *)&pVariables->name, sizeof(name));
+  TZX_STATE_VARIABLES(TZX_RESTORE_VARIABLE)
+}
+#endif // __ZX_TAPE__
+
 void TZXSetup() {
     pinMode(outputPin, OUTPUT);               //Set output pin
     LowWrite();                               //Start output LOW
@@ -623,6 +742,9 @@ static void TZXProcess() {
       //grab 1 byte ID
       if(ReadByte(bytesRead)==1) {
         currentID = outByte;
+#ifdef __ZX_TAPE__
+        blockStart(currentID, bytesRead - 1);
+#endif // __ZX_TAPE__
       } else {
         currentID = EOF;
       }
@@ -825,6 +947,9 @@ static void TZXProcess() {
               temppause = outWord;
               currentID = IDPAUSE;
             } else {
+#ifdef __ZX_TAPE__
+              stopTape(false);
+#endif // __ZX_TAPE__
               currentTask = GETID;
             }
           }
@@ -863,6 +988,9 @@ static void TZXProcess() {
 
         case ID2A:
           //Skip//
+#ifdef __ZX_TAPE__
+          stopTape(true);
+#endif // __ZX_TAPE__
           bytesRead+=4;
           currentTask = GETID;
         break;
@@ -1010,6 +1138,9 @@ static void TZXProcess() {
           //Pure Tap file block
           switch(currentBlockTask) {
             case READPARAM:
+#ifdef __ZX_TAPE__
+              blockStart(TAP, bytesRead);
+#endif // __ZX_TAPE__
               pauseLength = PAUSELENGTH;
               if(r=ReadWord(bytesRead)==2) {
                     bytesToRead = outWord+1;
@@ -1203,6 +1334,12 @@ static void TZXProcess() {
 
 
         case IDPAUSE:
+#ifdef __ZX_TAPE__
+          if(temppause>0 && !pauseEntered) {
+            pauseEntered = true;
+            pauseStart(temppause);
+          }
+#endif // __ZX_TAPE__
 
           if(temppause>0) {
             if(temppause > 8300) {
@@ -1216,6 +1353,9 @@ static void TZXProcess() {
             bitSet(currentPeriod, 15);
           } else {
             currentTask = GETID;
+#ifdef __ZX_TAPE__
+            pauseEntered = false;
+#endif // __ZX_TAPE__
             if(EndOfFile==true) currentID=EOF;
           }
         break;
@@ -1223,6 +1363,10 @@ static void TZXProcess() {
         case EOF:
           //Handle end of file
 #ifdef __ZX_TAPE__
+          if(!endOfDataSignalled) {
+            endOfDataSignalled = true;
+            endOfData();
+          }
           if(!count==0) {
             // Pause for a long time at EOF
             // 32767 * 1000 * 100 = 3276.7 seconds ~= 1hr (TZXCompat_EOF_PERIOD)
@@ -1335,6 +1479,9 @@ static void StandardBlock() {
     temppause = pauseLength;
         currentID = IDPAUSE;
       } else {
+#ifdef __ZX_TAPE__
+    if(pauseLength>0) pauseStart(pauseLength);
+#endif // __ZX_TAPE__
     currentPeriod = pauseLength;
     bitSet(currentPeriod, 15);
         currentBlockTask = READPARAM;
@@ -1703,7 +1850,8 @@ void wave(bool bBuffer, unsigned int nBufferLen, unsigned long nBufferPeriodUs)
         }
 
         if (ID15switch == 1){
-          if (bitRead(workingPeriod, 14)== 0)
+          // (the end of file period has bit 14 set, but is not a direct recording sample)
+          if (bitRead(workingPeriod, 14)== 0 || workingPeriod == TZX_EOF_PERIOD)
           {
             //pinState = !pinState;
             if (pinState == LOW)
@@ -1785,7 +1933,7 @@ void wave(bool bBuffer, unsigned int nBufferLen, unsigned long nBufferPeriodUs)
 
     if (bBuffer) {
       // If in buffer mode and buffer filled, break out of the loop
-      TZXCompat_buffer(nextPeriod);
+      TZX_buffer(nextPeriod);
 
       // Increment the buffered count
       bufferedCount++;
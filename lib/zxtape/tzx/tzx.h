@@ -47,18 +47,26 @@
 #define noInterrupts            TZXCompat_noInterrupts
 #define interrupts              TZXCompat_interrupts
 #define pinMode(pin, mode)      TZX_pinMode(pin, mode)
-#define LowWrite                TZXCompat_setAudioLow
-#define HighWrite               TZXCompat_setAudioHigh
+#define LowWrite                TZX_setAudioLow
+#define HighWrite               TZX_setAudioHigh
 #define wave                    TZXCompat_waveOrBuffer
 #define stopFile                TZX_stopFile
 #define lcdTime                 TZX_lcdTime
 #define Counter2                TZX_Counter2
+#define blockStart              TZX_blockStart
+#define stopTape                TZX_stopTape
+#define pauseStart              TZX_pauseStart
+#define endOfData               TZX_endOfData
 #define ReadUEFHeader           TZX_ReadUEFHeader
 #define writeUEFData            TZX_writeUEFData
 #define UEFCarrierToneBlock     TZX_UEFCarrierToneBlock
 #define OricBitWrite            TZX_OricBitWrite
 #define OricDataBlock           TZX_OricDataBlock
+#if ZXTAPE_LOG_LEVEL <= ZXTAPE_LOG_LEVEL_DEBUG
 #define Log(pFormat, ...)       TZXCompat_log(pFormat, __VA_ARGS__)
+#else
+#define Log(pFormat, ...)       ((void)0)
+#endif
 
 #define buffsize                TZX_buffsize
 #define fileName                TZX_fileName
@@ -70,7 +78,9 @@
 #define pauseOn                 TZX_pauseOn
 
 #define currpct                 TZX_currpct
+#define tapeTimeUs              TZX_tapeTimeUs
 #define PauseAtStart            TZX_PauseAtStart
+#define startOffset             TZX_startOffset
 
 
 #endif
@@ -0,0 +1,36 @@
+
+#ifndef _tzx_compat_linux_os_headers_h_
+#define _tzx_compat_linux_os_headers_h_
+
+#include <assert.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef bool
+typedef unsigned char bool;
+#endif
+
+#ifndef false
+#define false 0
+#endif
+
+#ifndef true
+#define true 1
+#endif
+
+#define TZX_buffsize (1024 * 16)  // 16k buffer
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// No functions to declare
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // _tzx_compat_linux_os_headers_h_
@@ -22,7 +22,7 @@ typedef unsigned char bool;
 #endif
 
 // #define TZX_buffsize 1536  // 1.5k buffer
-#define TZX_buffsize 1024 * 16  // 16k buffer
+#define TZX_buffsize (1024 * 16)  // 16k buffer
 
 #ifdef __cplusplus
 extern "C" {
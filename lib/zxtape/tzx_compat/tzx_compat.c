@@ -1,5 +1,9 @@
 #include "tzx_compat_internal.h"
 
+#include "../stats/zxtape_stats.h"
+
+#define TZX_TIMER_RESYNC_NS 100000000ull  // Restart the timer timeline if it falls 100ms behind
+
 /* External global variables */
 extern bool TZX_PauseAtStart;      // Set to true to pause at start of file
 extern unsigned char TZX_currpct;  // Current percentage of file played (in file bytes, so not 100% accurate)
@@ -11,12 +15,30 @@ TZX_FILETYPE TZX_entry, TZX_dir;  // SD card current file (=entry) and current d
 size_t TZX_filesize;              // filesize used for dimensioning files
 TZX_TIMER TZX_Timer;              // Timer configure a timer to fire interrupts to control the output wave (call wave())
 bool TZX_pauseOn;                 // Control pause state
+u64 TZX_timerLateNs;              // How late the timer handler last ran (nanoseconds)
+u64 TZX_timerMaxLateNs;           // How late the timer handler ran at worst since playback started (nanoseconds)
 
 /* Local variables */
 static void *g_pControllerInstance = NULL;
 static TZX_CALLBACKS_T *g_pCallbacks = NULL;
+static u64 g_nTimerDeadlineNs = 0;   // Absolute deadline of the last timer period (0 = timeline not started)
+static bool g_bPulseOutput = false;  // Periods go to the pulse callback (not the compat implementation or timer)
+static u8 g_nAudioLevel = 0;         // Current output level
 // static unsigned g_tzxLoopCount = 0;  // HACK to call wave less than loop count at start
 
+// State of the layer for one controller instance (see TZXCompatInternal_saveState()), checked by the EngineState test
+#define TZX_COMPAT_STATE_VARIABLES(X)                                                                        \
+  X(TZX_fileName) X(TZX_fileIndex) X(TZX_entry) X(TZX_dir) X(TZX_filesize) X(TZX_Timer) X(TZX_pauseOn)     \
+  X(TZX_timerLateNs) X(TZX_timerMaxLateNs) X(g_pControllerInstance) X(g_pCallbacks) X(g_nTimerDeadlineNs) \
+  X(g_bPulseOutput) X(g_nAudioLevel)
+
+#define TZX_COMPAT_STATE_FIELD(name) __typeof__(name) name;
+
+typedef struct _TZX_COMPAT_STATE_T {
+  TZX_COMPAT_STATE_VARIABLES(TZX_COMPAT_STATE_FIELD)
+  void *pTzxState;  // State of the TZX library (see TZXCreateState())
+} TZX_COMPAT_STATE_T;
+
 /* Private function forward declarations */
 
 // Timer API
@@ -30,8 +52,6 @@ static void timer_setPeriod(unsigned long periodUs);
 //
 
 void TZXCompatInternal_initialize(void *pControllerInstance, TZX_CALLBACKS_T *pCallbacks) {
-  TZXCompat_create();
-
   g_pControllerInstance = pControllerInstance;
   g_pCallbacks = pCallbacks;
 
@@ -40,11 +60,67 @@ void TZXCompatInternal_initialize(void *pControllerInstance, TZX_CALLBACKS_T *pC
   TZX_pauseOn = false;
   TZX_currpct = 0;
   TZX_PauseAtStart = false;
+  TZX_timerLateNs = 0;
+  TZX_timerMaxLateNs = 0;
+  g_bPulseOutput = false;
+  g_nAudioLevel = 0;
   initializeTimer(&TZX_Timer);
 
   TZXSetup();
 }
 
+/**
+ * Send the output periods to the pulse callback, rather than to the compatibility layer
+ *
+ * The timer is not used, and the output pin is not written. Periods are generated when the controller calls
+ * TZXCompat_waveOrBuffer() in buffer mode.
+ */
+void TZXCompatInternal_setPulseOutput(bool bEnable) {
+  g_bPulseOutput = bEnable;
+}
+
+/**
+ * Create a state of the layer and the TZX library, for a controller instance sharing them with others
+ *
+ * The layer and the library keep their state in globals, so only one controller instance can use them at a time. To
+ * switch instance, save the state of the current one, and restore the state of the next. The output (timer, audio,
+ * GPIO) and file APIs of the compatibility layer implementation are not part of the state.
+ *
+ * @return void* State, as at start up (pass to TZXCompatInternal_restoreState() before initializing)
+ */
+void *TZXCompatInternal_createState(void) {
+  TZX_COMPAT_STATE_T *pState = (TZX_COMPAT_STATE_T *)calloc(1, sizeof(TZX_COMPAT_STATE_T));
+  assert(pState != NULL);
+
+  pState->pTzxState = TZXCreateState();
+  initializeTimer(&pState->TZX_Timer);
+
+  return pState;
+}
+
+void TZXCompatInternal_destroyState(void *pState) {
+  if (pState == NULL) return;
+
+  TZXDestroyState(((TZX_COMPAT_STATE_T *)pState)->pTzxState);
+  free(pState);
+}
+
+void TZXCompatInternal_saveState(void *pState) {
+  TZX_COMPAT_STATE_T *pCompatState = (TZX_COMPAT_STATE_T *)pState;
+
+#define TZX_COMPAT_SAVE_VARIABLE(name) memcpy((void *)&pCompatState->name, (const void *)&name, sizeof(name));
+  TZX_COMPAT_STATE_VARIABLES(TZX_COMPAT_SAVE_VARIABLE)
+  TZXSaveState(pCompatState->pTzxState);
+}
+
+void TZXCompatInternal_restoreState(const void *pState) {
+  const TZX_COMPAT_STATE_T *pCompatState = (const TZX_COMPAT_STATE_T *)pState;
+
+#define TZX_COMPAT_RESTORE_VARIABLE(name) memcpy((void *)&name, (const void *)&pCompatState->name, sizeof(name));
+  TZX_COMPAT_STATE_VARIABLES(TZX_COMPAT_RESTORE_VARIABLE)
+  TZXRestoreState(pCompatState->pTzxState);
+}
+
 // void TZXCompat_start(void) {
 //   // Set GPIO pin to output mode (ensuring it is LOW)
 //   // m_GpioOutputPin.Write(LOW);
@@ -154,6 +230,29 @@ void TZXCompatInternal_initialize(void *pControllerInstance, TZX_CALLBACKS_T *pC
 //   printf("-");
 // }
 
+// Set the output low (the device path, paced by the implementation's timer, is not a sink: see zxtape_sink.h)
+void TZX_setAudioLow() {
+  g_nAudioLevel = 0;
+  if (!g_bPulseOutput) TZXCompat_setAudioLow();
+}
+
+// Set the output high
+void TZX_setAudioHigh() {
+  g_nAudioLevel = 1;
+  if (!g_bPulseOutput) TZXCompat_setAudioHigh();
+}
+
+// Buffer a period at the current output level
+void TZX_buffer(unsigned long periodUs) {
+  zxtapeStats_countPulse();
+
+  if (g_bPulseOutput) {
+    g_pCallbacks->pulse(g_pControllerInstance, g_nAudioLevel, periodUs);
+  } else {
+    TZXCompat_buffer(periodUs);
+  }
+}
+
 // End the current file playback (EOF or error)
 void TZX_stopFile() {
   zxtape_log_debug("stopFile");
@@ -164,6 +263,69 @@ void TZX_stopFile() {
   g_pCallbacks->endPlayback(g_pControllerInstance);
 }
 
+// Called when a new block starts
+void TZX_blockStart(byte id, unsigned long offset) {
+  if (g_pCallbacks == NULL || g_pCallbacks->blockStart == NULL) return;
+
+  g_pCallbacks->blockStart(g_pControllerInstance, id, offset, TZX_tapeTimeUs);
+}
+
+// Called when a 'Stop the tape' block is reached (b48kOnly for 'Stop the tape if in 48K mode')
+void TZX_stopTape(bool b48kOnly) {
+  if (g_pCallbacks == NULL || g_pCallbacks->stopTape == NULL) return;
+
+  g_pCallbacks->stopTape(g_pControllerInstance, b48kOnly, TZX_tapeTimeUs);
+}
+
+// Called when a pause (silence) starts
+void TZX_pauseStart(word pauseMs) {
+  if (g_pCallbacks == NULL || g_pCallbacks->pauseStart == NULL) return;
+
+  g_pCallbacks->pauseStart(g_pControllerInstance, pauseMs, TZX_tapeTimeUs);
+}
+
+// Called once when the end of the tape data is reached
+void TZX_endOfData() {
+  if (g_pCallbacks == NULL || g_pCallbacks->endOfData == NULL) return;
+
+  g_pCallbacks->endOfData(g_pControllerInstance, TZX_tapeTimeUs);
+}
+
+// Called by the compat implementation when the output ran out of data (may be called from any thread)
+void TZX_underrun() {
+  zxtapeStats_countUnderrun();
+
+  if (g_pCallbacks == NULL || g_pCallbacks->underrun == NULL) return;
+
+  g_pCallbacks->underrun(g_pControllerInstance);
+}
+
+// Called by the compat implementation producer thread to refill the output buffer
+void TZX_refill(unsigned int nBufferLen) {
+  if (g_pCallbacks == NULL || g_pCallbacks->refill == NULL) return;
+
+  u64 nStartNs = TZXCompat_getTickNs();
+  g_pCallbacks->refill(g_pControllerInstance, nBufferLen);
+  zxtapeStats_recordRefill(TZXCompat_getTickNs() - nStartNs);
+}
+
+// Called by the compat implementation timer handler with how late it ran compared to its deadline
+void TZX_timerLate(unsigned long long nLateNs) {
+  TZX_timerLateNs = nLateNs;
+  if (nLateNs > TZX_timerMaxLateNs) TZX_timerMaxLateNs = nLateNs;
+  zxtapeStats_recordTimerWakeup(nLateNs);
+}
+
+// Called by the compat implementation when a period is dropped because the output buffer is full
+void TZX_overflow() {
+  zxtapeStats_countOverflow();
+}
+
+// Called by the compat implementation output with each pull of samples, and the fill of the buffer before it
+void TZX_outputPull(unsigned int nSamples, unsigned int nBufferCount, unsigned int nBufferCapacity) {
+  zxtapeStats_recordOutputPull(nSamples, nBufferCount, nBufferCapacity);
+}
+
 // Called to display the playback time (at start)
 void TZX_lcdTime() {
   // TZXCompat_log("lcdTime");
@@ -262,12 +424,32 @@ static void timer_initialize() {
 
 static void timer_stop() {
   // zxtape_log_debug("timer_stop");
-  // Ignore
-  // - stopping the timer is handled by the controller in runLoop() callback
+  // Stopping the timer is handled by the controller in runLoop() callback
   // - runLoop() calls TZX_TimerStop() to stop the timer
+  // Called at the start of playback, so restart the timeline
+  g_nTimerDeadlineNs = 0;
+  TZX_timerLateNs = 0;
+  TZX_timerMaxLateNs = 0;
 }
 
+/**
+ * Set the next timer period
+ *
+ * Periods are scheduled against an absolute timeline, so the next deadline is the previous deadline plus the period,
+ * not the time now plus the period. The time taken to run the handler (and arm the timer) does not accumulate.
+ * If the timeline falls too far behind (e.g. the process was suspended), it is restarted from now.
+ */
 static void timer_setPeriod(unsigned long periodUs) {
   // zxtape_log_debug("timer_setPeriod(%lu)", periodUs);
-  TZXCompat_timerStart(periodUs);
+  // Not used when the controller pulls the periods
+  if (g_bPulseOutput) return;
+
+  u64 nowNs = TZXCompat_getTickNs();
+
+  if (g_nTimerDeadlineNs == 0 || nowNs > g_nTimerDeadlineNs + TZX_TIMER_RESYNC_NS) {
+    g_nTimerDeadlineNs = nowNs;
+  }
+  g_nTimerDeadlineNs += (u64)periodUs * 1000ull;
+
+  TZXCompat_timerStartAt(g_nTimerDeadlineNs);
 }
@@ -6,6 +6,10 @@
 #include "./macos/tzx_compat_macos_os_headers.h"
 #endif  // __ZX_TAPE_MACOS__
 
+#ifdef __ZX_TAPE_LINUX__
+#include "./linux/tzx_compat_linux_os_headers.h"
+#endif  // __ZX_TAPE_LINUX__
+
 #ifdef __ZX_TAPE_CIRCLE__
 #include "./circle/tzx_compat_circle_os_headers.h"
 #endif  // __ZX_TAPE_CIRCLE__
@@ -61,6 +65,13 @@ typedef long long i64;  // 64-bit signed integer
 // TZX Compat Callbacks
 typedef struct _TZX_CALLBACKS_T {
   void (*endPlayback)(void* pInstance);
+  void (*blockStart)(void* pInstance, u8 id, u32 offset, u64 tapeTimeUs);
+  void (*stopTape)(void* pInstance, bool b48kOnly, u64 tapeTimeUs);
+  void (*pauseStart)(void* pInstance, u32 pauseMs, u64 tapeTimeUs);
+  void (*endOfData)(void* pInstance, u64 tapeTimeUs);
+  void (*underrun)(void* pInstance);
+  void (*refill)(void* pInstance, u32 nBufferLen);
+  void (*pulse)(void* pInstance, u8 nLevel, u32 nPeriodUs);
 } TZX_CALLBACKS_T;
 
 // TZX Compat Timer
@@ -93,13 +104,22 @@ extern TZX_TIMER TZX_Timer;  // Timer configure a timer to fire interrupts to co
 extern bool TZX_pauseOn;     // Control pause state
 
 /* External Variables (implemented in TZX library) */
-extern bool TZX_PauseAtStart;      // Set to true to pause at start of file
-extern unsigned char TZX_currpct;  // Current percentage of file played (in file bytes, so not 100% accurate)
+extern bool TZX_PauseAtStart;          // Set to true to pause at start of file
+extern unsigned long TZX_startOffset;  // File offset of the block to start from (0 for the start of the file)
+extern unsigned char TZX_currpct;      // Current percentage of file played (in file bytes, so not 100% accurate)
+extern u64 TZX_tapeTimeUs;             // Length of tape output generated so far (microseconds)
+
+/* External Variables (implemented in TZX compat) */
+extern u64 TZX_timerLateNs;     // How late the timer handler last ran (nanoseconds)
+extern u64 TZX_timerMaxLateNs;  // How late the timer handler ran at worst since playback started (nanoseconds)
 
 /* External functions */
 extern void TZXCompat_create(void);
 extern void TZXCompat_destroy(void);
-extern void TZXCompat_timerStart(unsigned long periodUs);
+extern void TZXCompat_timerStartAt(u64 deadlineNs);
+extern u64 TZXCompat_getTickNs(void);
+extern void TZXCompat_producerStart(unsigned int nLowWatermarkPercent, unsigned int nHighWatermarkPercent);
+extern void TZXCompat_producerStop(void);
 extern void TZXCompat_buffer(unsigned long periodUs);
 extern void TZXCompat_delay(unsigned long time);
 extern void TZXCompat_noInterrupts();                  // Disable interrupts
@@ -112,6 +132,11 @@ extern void TZXCompat_log(const char* pMessage, ...);  // Log a message
 
 // TZX Compat APIs
 void TZXCompatInternal_initialize(void* pControllerInstance, TZX_CALLBACKS_T* pCallbacks);
+void TZXCompatInternal_setPulseOutput(bool bEnable);
+void* TZXCompatInternal_createState(void);
+void TZXCompatInternal_destroyState(void* pState);
+void TZXCompatInternal_saveState(void* pState);
+void TZXCompatInternal_restoreState(const void* pState);
 
 /* TZX APIs */
 void TZXSetup();
@@ -119,13 +144,47 @@ void TZXLoop();
 void TZXPlay();
 void TZXPause();
 void TZXStop();
+void* TZXCreateState();
+void TZXDestroyState(void* pState);
+void TZXSaveState(void* pState);
+void TZXRestoreState(const void* pState);
+
+// ZxTape Logging API (levels below ZXTAPE_LOG_LEVEL compile to nothing, their arguments are not evaluated)
+#define ZXTAPE_LOG_LEVEL_DEBUG 0
+#define ZXTAPE_LOG_LEVEL_INFO 1
+#define ZXTAPE_LOG_LEVEL_WARN 2
+#define ZXTAPE_LOG_LEVEL_ERROR 3
+#define ZXTAPE_LOG_LEVEL_FATAL 4
+#define ZXTAPE_LOG_LEVEL_NONE 5
+#ifndef ZXTAPE_LOG_LEVEL
+#define ZXTAPE_LOG_LEVEL ZXTAPE_LOG_LEVEL_DEBUG
+#endif
 
-// ZxTape Logging API
-#define zxtape_log_info(...) zxtape_log("INFO", __VA_ARGS__)
+#if ZXTAPE_LOG_LEVEL <= ZXTAPE_LOG_LEVEL_DEBUG
 #define zxtape_log_debug(...) zxtape_log("DEBUG", __VA_ARGS__)
+#else
+#define zxtape_log_debug(...) ((void)0)
+#endif
+#if ZXTAPE_LOG_LEVEL <= ZXTAPE_LOG_LEVEL_INFO
+#define zxtape_log_info(...) zxtape_log("INFO", __VA_ARGS__)
+#else
+#define zxtape_log_info(...) ((void)0)
+#endif
+#if ZXTAPE_LOG_LEVEL <= ZXTAPE_LOG_LEVEL_WARN
 #define zxtape_log_warn(...) zxtape_log("WARN", __VA_ARGS__)
+#else
+#define zxtape_log_warn(...) ((void)0)
+#endif
+#if ZXTAPE_LOG_LEVEL <= ZXTAPE_LOG_LEVEL_ERROR
 #define zxtape_log_error(...) zxtape_log("ERROR", __VA_ARGS__)
+#else
+#define zxtape_log_error(...) ((void)0)
+#endif
+#if ZXTAPE_LOG_LEVEL <= ZXTAPE_LOG_LEVEL_FATAL
 #define zxtape_log_fatal(...) zxtape_log("FATAL", __VA_ARGS__)
+#else
+#define zxtape_log_fatal(...) ((void)0)
+#endif
 extern void zxtape_log(const char* pLevel, const char* pFormat, ...);
 
 #endif  // _tzx_compat_h_
\ No newline at end of file
@@ -49,8 +49,15 @@ int TZX_readfile(byte bytes, unsigned long p);
 void TZX_pinMode(unsigned pin, unsigned mode);  // Set the mode of a GPIO pin (i.e. set correct pin to output)
 // void TZX_Wave();                                // Function to call on Timer interrupt
 void TZX_stopFile();  // Stop the current file playback
+void TZX_setAudioLow();                              // Set the output low
+void TZX_setAudioHigh();                             // Set the output high
+void TZX_buffer(unsigned long periodUs);             // Buffer a period at the current output level
 void TZX_lcdTime();   // Called to display the playback percent (at start)
 void TZX_Counter2();  // Called to display the playback percent (during playback)
+void TZX_blockStart(byte id, unsigned long offset);  // Called when a new block starts (offset of the block in file)
+void TZX_stopTape(bool b48kOnly);                    // Called when a 'Stop the tape' block is reached
+void TZX_pauseStart(word pauseMs);                   // Called when a pause (silence) starts
+void TZX_endOfData();                                // Called once when the end of the tape data is reached
 void TZX_ReadUEFHeader();
 void TZX_writeUEFData();
 void TZX_UEFCarrierToneBlock();
@@ -0,0 +1,182 @@
+/**
+ * audio_output.c
+ *
+ * The transfer is wait-free, so the output never waits for a refill: it does not take the 'interrupt' lock, only the
+ * ring's published counts are shared with the producer, and the end of the tape is handed over to TZXCompat_poll().
+ * It marks itself in progress before checking the output is started, so StopAudioOutput() can wait for it and clear
+ * the ring.
+ *
+ */
+
+#include "audio_output.h"
+
+#include <sched.h>
+#include <string.h>
+#include <sys/param.h>
+
+#include "../../../../include/tzx_compat_impl.h"
+
+#define USEC_PER_SEC 1000000ull
+
+/* Forward declarations */
+static void clearOutput(AudioOutput *pOutput);
+static void stopTransfers(AudioOutput *pOutput);
+
+/**
+ * Initialize the output (stopped), and allocate its ring
+ *
+ * @param pOutput Output to initialize (the format is set by the implementation)
+ * @param capacity Periods in the ring (power of two)
+ * @param sampleRate Output sample rate (Hz)
+ * @param pProducer Producer woken by the transfers (its ring is pOutput->ring)
+ * @return false if the ring could not be allocated
+ */
+bool InitAudioOutput(AudioOutput *pOutput, uint32_t capacity, uint32_t sampleRate, AudioProducer *pProducer) {
+  memset(pOutput, 0, sizeof(AudioOutput));
+  pOutput->pProducer = pProducer;
+  pOutput->sampleRate = sampleRate;
+
+  return InitAudioRing(&pOutput->ring, capacity);
+}
+
+void DeinitAudioOutput(AudioOutput *pOutput) {
+  DeinitAudioRing(&pOutput->ring);
+}
+
+/**
+ * Clear the ring and start the transfers (with the 'interrupt' lock held)
+ */
+void StartAudioOutput(AudioOutput *pOutput) {
+  stopTransfers(pOutput);
+  clearOutput(pOutput);
+
+  __atomic_store_n(&pOutput->bStarted, true, __ATOMIC_SEQ_CST);
+}
+
+/**
+ * Stop the transfers and clear the ring (with the 'interrupt' lock held)
+ */
+void StopAudioOutput(AudioOutput *pOutput) {
+  stopTransfers(pOutput);
+  clearOutput(pOutput);
+
+  ResetAudioProducer(pOutput->pProducer);
+}
+
+/**
+ * Buffer a period at the pin level (from TZXCompat_buffer())
+ *
+ * @param pOutput Output
+ * @param periodUs Period (us), TZXCompat_EOF_PERIOD stops the tape when it is played
+ */
+void BufferAudioOutput(AudioOutput *pOutput, unsigned long periodUs) {
+  // Calculate the period in audio samples (carrying the remainder, so the sample timeline does not drift)
+  pOutput->remainder += (uint64_t)periodUs * pOutput->sampleRate;
+  uint32_t periodSamples = (uint32_t)(pOutput->remainder / USEC_PER_SEC);
+  pOutput->remainder -= (uint64_t)periodSamples * USEC_PER_SEC;
+
+  // Fill the audio buffer with the pin state and period (the EOF period stops the tape when it is reached)
+  if (!PushAudioRing(&pOutput->ring, pOutput->pinState, periodSamples, periodUs == TZXCompat_EOF_PERIOD)) {
+    // Buffer has overflowed
+    TZX_overflow();
+  }
+}
+
+/**
+ * Transfer the ring to an output buffer
+ *
+ * @param pOutput Output
+ * @param pBuffer Output buffer (in pOutput->format)
+ * @param bufferSize Frames to transfer (the last level is held if the ring runs out)
+ * @return false if the output is not started (nothing transferred)
+ */
+bool TransferAudioOutput(AudioOutput *pOutput, void *pBuffer, uint32_t bufferSize) {
+  // Mark the transfer before checking the output is started, so stopTransfers() can wait for it
+  __atomic_store_n(&pOutput->bTransferring, true, __ATOMIC_SEQ_CST);
+  if (!__atomic_load_n(&pOutput->bStarted, __ATOMIC_SEQ_CST)) {
+    __atomic_store_n(&pOutput->bTransferring, false, __ATOMIC_RELEASE);
+    return false;
+  }
+
+  bool stopTape = false;
+  bool bEmpty = false;
+  uint32_t i = 0;
+
+  TZX_outputPull(bufferSize, GetAudioRingCount(&pOutput->ring), GetAudioRingCapacity(&pOutput->ring));
+
+  while (i < bufferSize) {
+    uint32_t state, samples;
+    bool bStop;
+    if (!PeekAudioRing(&pOutput->ring, &state, &samples, &bStop)) {
+      // Buffer is empty
+      bEmpty = true;
+      break;
+    }
+    pOutput->lastState = state;
+
+    // Set any signals
+    if (bStop) stopTape = true;
+
+    // Output as much of the period as fits (moving to the next period at the end of it)
+    samples = MIN(samples, bufferSize - i);
+    FillSpan(&pOutput->format, pBuffer, i, samples, state);
+    ConsumeAudioRing(&pOutput->ring, samples);
+    i += samples;
+  }
+
+  // Hold the last level for the rest of the buffer
+  if (i < bufferSize) {
+    FillSpan(&pOutput->format, pBuffer, i, bufferSize - i, pOutput->lastState);
+  }
+
+  if (bEmpty) {
+    // Only signal an underrun while playing (not paused), and once per underrun
+    if (pOutput->bReady && !pOutput->bUnderrun && !__atomic_load_n(&TZX_pauseOn, __ATOMIC_RELAXED)) {
+      pOutput->bUnderrun = true;
+      TZX_underrun();
+    }
+  } else {
+    pOutput->bReady = true;
+    pOutput->bUnderrun = false;
+  }
+
+  if (stopTape) {
+    // Stop the tape (from PollAudioOutput())
+    __atomic_store_n(&pOutput->bStopTapePending, true, __ATOMIC_RELEASE);
+  }
+
+  // Wake the producer (once) when the buffer drops below the low watermark
+  PullAudioProducer(pOutput->pProducer, pOutput->bReady);
+
+  __atomic_store_n(&pOutput->bTransferring, false, __ATOMIC_RELEASE);
+
+  return true;
+}
+
+/**
+ * Stop the tape once the output has played the end of it (from TZXCompat_poll())
+ */
+void PollAudioOutput(AudioOutput *pOutput) {
+  if (__atomic_exchange_n(&pOutput->bStopTapePending, false, __ATOMIC_ACQ_REL)) TZX_stopFile();
+}
+
+//
+// private functions
+//
+
+static void clearOutput(AudioOutput *pOutput) {
+  ResetAudioRing(&pOutput->ring);
+  pOutput->lastState = 0;
+  pOutput->remainder = 0;
+  pOutput->bReady = false;
+  pOutput->bUnderrun = false;
+  pOutput->bStopTapePending = false;
+}
+
+/**
+ * Stop the transfers, and wait for a transfer in progress, so the ring can be cleared
+ */
+static void stopTransfers(AudioOutput *pOutput) {
+  __atomic_store_n(&pOutput->bStarted, false, __ATOMIC_SEQ_CST);
+  while (__atomic_load_n(&pOutput->bTransferring, __ATOMIC_SEQ_CST)) sched_yield();
+}
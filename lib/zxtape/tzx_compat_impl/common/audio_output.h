@@ -0,0 +1,46 @@
+/**
+ * audio_output.h
+ *
+ * Audio output from the ring, for the implementations that pull the output a buffer at a time (an output thread, or
+ * a deadline on a virtual clock).
+ *
+ * The TZX code buffers the periods at the pin level (BufferAudioOutput()), and the output transfers them to its buffer
+ * of samples (TransferAudioOutput()), signalling underruns, waking the producer, and handing the end of the tape over
+ * to TZXCompat_poll() (PollAudioOutput()).
+ *
+ */
+
+#ifndef _audio_output_h_
+#define _audio_output_h_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "audio_producer.h"
+#include "audio_ring.h"
+#include "span_fill.h"
+
+typedef struct _AudioOutput {
+  AudioRing ring;                  // Periods buffered by the TZX code
+  SpanFormat format;               // Format of the transferred samples
+  AudioProducer *pProducer;        // Producer woken by the transfers
+  uint32_t sampleRate;             // Output sample rate (Hz)
+  uint32_t pinState;               // Level of the periods buffered (TZXCompat_setAudioLow() / High())
+  uint32_t lastState;              // Level held when the ring is empty
+  uint64_t remainder;              // Fraction of a sample carried between periods (us * sample rate)
+  volatile bool bStarted;          // Transfers are allowed
+  volatile bool bTransferring;     // A transfer is in progress (StopAudioOutput() waits for it)
+  volatile bool bStopTapePending;  // The end of the tape was played (handed over to PollAudioOutput())
+  bool bReady;                     // The output has played from the ring (it is not being filled for the first time)
+  bool bUnderrun;                  // An underrun was signalled (once per underrun)
+} AudioOutput;
+
+bool InitAudioOutput(AudioOutput *pOutput, uint32_t capacity, uint32_t sampleRate, AudioProducer *pProducer);
+void DeinitAudioOutput(AudioOutput *pOutput);
+void StartAudioOutput(AudioOutput *pOutput);
+void StopAudioOutput(AudioOutput *pOutput);
+void BufferAudioOutput(AudioOutput *pOutput, unsigned long periodUs);
+bool TransferAudioOutput(AudioOutput *pOutput, void *pBuffer, uint32_t bufferSize);
+void PollAudioOutput(AudioOutput *pOutput);
+
+#endif  // _audio_output_h_
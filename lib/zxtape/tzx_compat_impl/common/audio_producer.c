@@ -0,0 +1,102 @@
+/**
+ * audio_producer.c
+ *
+ * The refill runs the TZX code (TZX_refill()) in chunks, so TZXLoop() can keep wbuffer full between them, and stops
+ * as soon as a chunk buffers nothing (the tape is stopped or paused). The TZX code then asks for the timer, which the
+ * implementation turns into a retry of the refill (see bRefilling), and the consumer does not wake the producer again
+ * until a refill has buffered something.
+ *
+ */
+
+#include "audio_producer.h"
+
+#include "../../../../include/tzx_compat_impl.h"
+
+/* Forward declarations */
+static uint32_t getCount(AudioProducer *pProducer);
+
+/**
+ * Start the producer (before starting the implementation's wait)
+ *
+ * @param pProducer Producer (pRing and the callbacks set)
+ * @param lowWatermarkPercent Wake the producer below this percentage of the ring
+ * @param highWatermarkPercent Refill up to this percentage of the ring
+ */
+void StartAudioProducer(AudioProducer *pProducer, uint32_t lowWatermarkPercent, uint32_t highWatermarkPercent) {
+  uint32_t capacity = GetAudioRingCapacity(pProducer->pRing);
+
+  pProducer->lowWatermark = capacity * lowWatermarkPercent / 100;
+  pProducer->highWatermark = capacity * highWatermarkPercent / 100;
+  if (pProducer->highWatermark > capacity) pProducer->highWatermark = capacity;
+  pProducer->bRefilling = false;
+  pProducer->bSignalled = false;
+  pProducer->bRunning = true;
+}
+
+/**
+ * Stop the producer (before waking the implementation's wait, so it can exit)
+ */
+void StopAudioProducer(AudioProducer *pProducer) {
+  pProducer->bRunning = false;
+}
+
+/**
+ * Allow the consumer to wake the producer again, when the ring is emptied
+ */
+void ResetAudioProducer(AudioProducer *pProducer) {
+  pProducer->bSignalled = false;
+}
+
+void WakeAudioProducer(AudioProducer *pProducer) {
+  pProducer->bSignalled = true;
+  pProducer->pfnWake();
+}
+
+/**
+ * Wake the producer (once) when the ring drops below the low watermark, after each pull by the consumer
+ *
+ * @param pProducer Producer
+ * @param bReady The output has started playing from the ring (it is not being filled for the first time)
+ */
+void PullAudioProducer(AudioProducer *pProducer, bool bReady) {
+  if (pProducer->bRunning && bReady && !pProducer->bSignalled &&
+      GetAudioRingCount(pProducer->pRing) < pProducer->lowWatermark) {
+    WakeAudioProducer(pProducer);
+  }
+}
+
+/**
+ * Refill the ring up to the high watermark (from the producer, when woken)
+ */
+void RefillAudioProducer(AudioProducer *pProducer) {
+  bool bRefilled = false;
+
+  pProducer->bRefilling = true;
+
+  while (pProducer->bRunning) {
+    uint32_t bufferCount = getCount(pProducer);
+    if (bufferCount >= pProducer->highWatermark) break;
+
+    uint32_t chunk = pProducer->highWatermark - bufferCount;
+    TZX_refill(chunk < AUDIO_PRODUCER_REFILL_CHUNK ? chunk : AUDIO_PRODUCER_REFILL_CHUNK);
+
+    // Nothing buffered (stopped / paused), so wait for the retry
+    if (getCount(pProducer) == bufferCount) break;
+    bRefilled = true;
+  }
+
+  pProducer->bRefilling = false;
+
+  // Allow the consumer to wake the producer again (if paused, wait for the retry instead)
+  if (bRefilled) pProducer->bSignalled = false;
+}
+
+static uint32_t getCount(AudioProducer *pProducer) {
+  if (pProducer->pfnLock == NULL) return GetAudioRingCount(pProducer->pRing);
+
+  pProducer->pfnLock();
+  uint32_t count = GetAudioRingCount(pProducer->pRing);
+  pProducer->pfnUnlock();
+
+  return count;
+}
@@ -0,0 +1,42 @@
+/**
+ * audio_producer.h
+ *
+ * Producer refilling the audio ring between a low and a high watermark, for the implementations that can run the TZX
+ * code ahead of the audio output (see TZXCompat_producerStart()).
+ *
+ * The consumer (the audio output) wakes the producer once when the ring drops below the low watermark, and the
+ * producer refills it up to the high watermark. The implementation provides the wait: a thread waiting on a semaphore,
+ * or a deadline on a virtual clock.
+ *
+ */
+
+#ifndef _audio_producer_h_
+#define _audio_producer_h_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "audio_ring.h"
+
+#define AUDIO_PRODUCER_REFILL_CHUNK (1024 * 4)  // Max periods per refill step (must not exceed TZX_buffsize)
+
+typedef struct _AudioProducer {
+  AudioRing *pRing;          // Ring refilled
+  void (*pfnWake)(void);     // Wake the producer (it then calls RefillAudioProducer())
+  void (*pfnLock)(void);     // Lock the 'interrupt' lock around reading the ring count (NULL if there is none)
+  void (*pfnUnlock)(void);   // Unlock it
+  uint32_t lowWatermark;     // Wake the producer below this many records
+  uint32_t highWatermark;    // Refill up to this many records
+  volatile bool bRunning;    // Started (the timer is not used)
+  volatile bool bRefilling;  // In RefillAudioProducer() (TZX code asking for the timer wants a retry)
+  volatile bool bSignalled;  // Woken, not yet refilled (the consumer only wakes the producer once)
+} AudioProducer;
+
+void StartAudioProducer(AudioProducer *pProducer, uint32_t lowWatermarkPercent, uint32_t highWatermarkPercent);
+void StopAudioProducer(AudioProducer *pProducer);
+void ResetAudioProducer(AudioProducer *pProducer);
+void WakeAudioProducer(AudioProducer *pProducer);
+void PullAudioProducer(AudioProducer *pProducer, bool bReady);
+void RefillAudioProducer(AudioProducer *pProducer);
+
+#endif  // _audio_producer_h_
@@ -0,0 +1,124 @@
+/**
+ * audio_ring.c
+ *
+ * Each period is a 4 byte record: its length in samples, and whether the level is held from the previous period (the
+ * TZX code nearly always toggles the pin, so the level itself is not stored). The reader follows the level as it
+ * enters each record. The stop signal is attached to one record per tape, so it is held beside the ring rather than
+ * in every record. The capacity is a power of two, indexed by masking free-running 32-bit counters, so the count is
+ * a subtraction that stays correct as the counters wrap, and every slot can be used.
+ *
+ * The producer writes a record (and the stop signal) before publishing writeCount with release ordering, and the
+ * consumer publishes readCount once it has finished with a record, so the slots are never shared.
+ *
+ */
+
+#include "audio_ring.h"
+
+#include <assert.h>
+#include <stdlib.h>
+
+/**
+ * Initialize a ring
+ *
+ * @param pRing Ring to initialize
+ * @param capacity Capacity in records (power of two)
+ * @return true if the ring was allocated
+ */
+bool InitAudioRing(AudioRing *pRing, uint32_t capacity) {
+  assert(capacity > 0 && (capacity & (capacity - 1)) == 0);
+
+  pRing->pRecords = (uint32_t *)malloc(capacity * sizeof(uint32_t));  // Freed in DeinitAudioRing
+  pRing->mask = capacity - 1;
+  ResetAudioRing(pRing);
+
+  return pRing->pRecords != NULL;
+}
+
+void DeinitAudioRing(AudioRing *pRing) {
+  free(pRing->pRecords);
+  pRing->pRecords = NULL;
+}
+
+/**
+ * Empty the ring (the level returns low). Only when neither side is using it.
+ */
+void ResetAudioRing(AudioRing *pRing) {
+  pRing->writeCount = 0;
+  pRing->readCount = 0;
+  pRing->writeLevel = 0;
+  pRing->readLevel = 0;
+  pRing->readRemaining = 0;
+  pRing->bReadEntered = false;
+  pRing->bReadStop = false;
+  pRing->bStop = false;
+  pRing->stopCount = 0;
+}
+
+/**
+ * Push a period
+ *
+ * @param pRing Ring
+ * @param level Level of the period (0 or 1)
+ * @param samples Length of the period in samples
+ * @param bStop Stop the tape once the period is reached
+ * @return true if pushed, false if the ring is full
+ */
+bool PushAudioRing(AudioRing *pRing, uint32_t level, uint32_t samples, bool bStop) {
+  if (GetAudioRingSpace(pRing) == 0) return false;
+
+  uint32_t record = samples & AUDIO_RING_SAMPLES_MASK;
+  if (level == pRing->writeLevel) record |= AUDIO_RING_HOLD;
+  pRing->pRecords[pRing->writeCount & pRing->mask] = record;
+  pRing->writeLevel = level;
+
+  if (bStop) {
+    __atomic_store_n(&pRing->stopCount, pRing->writeCount, __ATOMIC_RELAXED);
+    __atomic_store_n(&pRing->bStop, true, __ATOMIC_RELAXED);
+  }
+  __atomic_store_n(&pRing->writeCount, pRing->writeCount + 1, __ATOMIC_RELEASE);
+
+  return true;
+}
+
+/**
+ * Get the period being read (entering it if it is new)
+ *
+ * @param pRing Ring
+ * @param pLevel Level of the period
+ * @param pSamples Samples left in the period (may be 0)
+ * @param pStop Set if the tape should stop (returned once)
+ * @return true if there is a period, false if the ring is empty
+ */
+bool PeekAudioRing(AudioRing *pRing, uint32_t *pLevel, uint32_t *pSamples, bool *pStop) {
+  if (GetAudioRingCount(pRing) == 0) return false;
+
+  if (!pRing->bReadEntered) {
+    uint32_t record = pRing->pRecords[pRing->readCount & pRing->mask];
+    if (!(record & AUDIO_RING_HOLD)) pRing->readLevel ^= 1;
+    pRing->readRemaining = record & AUDIO_RING_SAMPLES_MASK;
+    pRing->bReadEntered = true;
+    pRing->bReadStop = __atomic_load_n(&pRing->bStop, __ATOMIC_RELAXED) &&
+                       __atomic_load_n(&pRing->stopCount, __ATOMIC_RELAXED) == pRing->readCount;
+  }
+
+  *pStop = pRing->bReadStop;
+  pRing->bReadStop = false;
+
+  *pLevel = pRing->readLevel;
+  *pSamples = pRing->readRemaining;
+
+  return true;
+}
+
+/**
+ * Consume samples of the period being read (see PeekAudioRing()), moving to the next period at the end of it
+ */
+void ConsumeAudioRing(AudioRing *pRing, uint32_t samples) {
+  assert(samples <= pRing->readRemaining);
+
+  pRing->readRemaining -= samples;
+  if (pRing->readRemaining == 0) {
+    pRing->bReadEntered = false;
+    __atomic_store_n(&pRing->readCount, pRing->readCount + 1, __ATOMIC_RELEASE);
+  }
+}
@@ -0,0 +1,66 @@
+/**
+ * audio_ring.h
+ *
+ * Ring of output periods (level and length in samples) between the TZX code and the implementations' audio output.
+ *
+ * Single producer (the TZX code, under the 'interrupt' lock) and single consumer (the audio output, which takes no
+ * lock). Each side only writes its own fields, and publishes its count, so neither side ever waits for the other.
+ *
+ */
+
+#ifndef _audio_ring_h_
+#define _audio_ring_h_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define AUDIO_RING_SAMPLES_MASK 0x7FFFFFFF  // Record: length in samples
+#define AUDIO_RING_HOLD 0x80000000          // Record: level is the same as the previous record (otherwise it toggles)
+
+typedef struct _AudioRing {
+  uint32_t *pRecords;  // Packed records (power of two)
+  uint32_t mask;       // Capacity - 1
+
+  // Producer
+  uint32_t writeCount;  // Records written (free-running, wraps, published to the consumer)
+  uint32_t writeLevel;  // Level of the last record written
+  bool bStop;           // Stop signal pushed (out-of-band, rare, published with writeCount)
+  uint32_t stopCount;   // Record the stop signal is attached to
+
+  // Consumer
+  uint32_t readCount;      // Records read (free-running, wraps, published to the producer)
+  uint32_t readLevel;      // Level of the record being read
+  uint32_t readRemaining;  // Samples left in the record being read
+  bool bReadEntered;       // The record at readCount has been entered (readLevel / readRemaining are its own)
+  bool bReadStop;          // The record being read has the stop signal, not yet returned
+} AudioRing;
+
+bool InitAudioRing(AudioRing *pRing, uint32_t capacity);
+void DeinitAudioRing(AudioRing *pRing);
+void ResetAudioRing(AudioRing *pRing);
+bool PushAudioRing(AudioRing *pRing, uint32_t level, uint32_t samples, bool bStop);
+bool PeekAudioRing(AudioRing *pRing, uint32_t *pLevel, uint32_t *pSamples, bool *pStop);
+void ConsumeAudioRing(AudioRing *pRing, uint32_t samples);
+
+/**
+ * Get the number of records in the ring (wrap-safe, from either side)
+ */
+static inline uint32_t GetAudioRingCount(const AudioRing *pRing) {
+  return __atomic_load_n(&pRing->writeCount, __ATOMIC_ACQUIRE) - __atomic_load_n(&pRing->readCount, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * Get the number of records that can be pushed (at least this many, as the consumer may be reading)
+ */
+static inline uint32_t GetAudioRingSpace(const AudioRing *pRing) {
+  return pRing->mask + 1 - GetAudioRingCount(pRing);
+}
+
+/**
+ * Get the capacity of the ring (records)
+ */
+static inline uint32_t GetAudioRingCapacity(const AudioRing *pRing) {
+  return pRing->mask + 1;
+}
+
+#endif  // _audio_ring_h_
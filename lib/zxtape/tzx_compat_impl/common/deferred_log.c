@@ -0,0 +1,559 @@
+/**
+ * deferred_log.c
+ *
+ * A message is a fixed size record: the static strings (source, level and format), a sequence number, and the
+ * arguments, found by scanning the format for conversions at capture time. Integers, pointers and doubles are stored
+ * as 64-bit words, and strings are copied into the record (the words hold their offsets), so nothing the caller owns
+ * is referenced once WriteDeferredLog() returns. The drain scans the format again, and formats each conversion with
+ * snprintf() from the stored word, cast back to the type the conversion expects ('*' widths and precisions are
+ * written into the conversion).
+ *
+ * Each thread's ring is indexed by masking free-running 32-bit counters, as the audio ring is. The rings are in a list
+ * that only grows (pushed with compare and swap), and a ring is released when its thread exits, to be reused by the
+ * next new thread. The drain writes the oldest message at the head of any ring first, so messages are written in the
+ * order they were logged (as far as they have been published).
+ *
+ */
+
+#include "deferred_log.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define STRING_NULL UINT64_MAX  // Argument word: the string argument was NULL
+#define SPEC_LENGTH 48          // Conversion specification buffer (longer ones are written as they are)
+
+typedef enum _LogArgType {
+  LOG_ARG_INT,      // int (and promoted char / short), signed or unsigned
+  LOG_ARG_LONG,     // long
+  LOG_ARG_LLONG,    // long long
+  LOG_ARG_SIZE,     // size_t
+  LOG_ARG_INTMAX,   // intmax_t
+  LOG_ARG_PTRDIFF,  // ptrdiff_t
+  LOG_ARG_POINTER,  // void * (%p)
+  LOG_ARG_DOUBLE,   // double
+  LOG_ARG_LDOUBLE,  // long double (stored as a double)
+  LOG_ARG_STRING,   // const char * (copied)
+  LOG_ARG_NONE,     // %n (the pointer is skipped, nothing is written)
+  LOG_ARG_INVALID,  // Unknown conversion (the rest of the format is written as it is)
+} LogArgType;
+
+typedef struct _LogSpec {
+  const char *pStart;  // The '%'
+  const char *pEnd;    // After the conversion character
+  uint32_t nStars;     // '*' widths and precisions (int arguments before the value)
+  LogArgType type;     // Value argument
+} LogSpec;
+
+typedef struct _LogRecord {
+  uint64_t sequence;                        // Order across threads
+  const char *pSource;                      // Static
+  const char *pLevel;                       // Static
+  const char *pFormat;                      // Static
+  uint32_t nArgs;                           // Arguments captured
+  uint32_t nStringBytes;                    // String bytes used
+  uint64_t args[DEFERRED_LOG_MAX_ARGS];     // Arguments (strings as offsets into strings)
+  char strings[DEFERRED_LOG_STRING_BYTES];  // String arguments (terminated)
+} LogRecord;
+
+typedef struct _LogRing {
+  LogRecord records[DEFERRED_LOG_RECORDS];
+  uint32_t writeCount;     // Records written (free-running, wraps, published to the drain)
+  uint32_t readCount;      // Records read (free-running, wraps, published to the producer)
+  bool bInUse;             // Owned by a thread
+  struct _LogRing *pNext;  // Next ring in the list
+} LogRing;
+
+/* Forward declarations */
+static LogRing *acquireRing(void);
+static void releaseRing(void *pRing);
+static void createRingKey(void);
+static const char *parseSpec(const char *p, LogSpec *pSpec);
+static void captureArgs(LogRecord *pRecord, va_list args);
+static uint32_t formatRecord(const LogRecord *pRecord, char *pLine, uint32_t nLength);
+static uint32_t formatArg(const LogRecord *pRecord, const LogSpec *pSpec, uint32_t *pArg, char *pOut, size_t nLength);
+static void *drainThread(void *arg);
+
+/* Local variables */
+static __thread LogRing *t_pRing = NULL;  // Calling thread's ring
+static LogRing *g_pRings = NULL;          // All rings (only grows)
+static pthread_once_t g_ringKeyOnce = PTHREAD_ONCE_INIT;
+static pthread_key_t g_ringKey;  // Releases a thread's ring when it exits
+static uint64_t g_sequence = 0;
+static uint64_t g_nDropped = 0;
+static uint64_t g_nDroppedReported = 0;
+static FILE *g_pFile = NULL;
+static bool g_bRunning = false;
+static uint32_t g_nWriters = 0;  // Threads in WriteDeferredLog() (the last flush waits for them)
+static pthread_t g_drainThread;
+static pthread_mutex_t g_drainMutex = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Start the drain thread
+ *
+ * @param pFile File the messages are written to
+ * @return true if the messages are deferred (otherwise WriteDeferredLog() returns false, so the caller writes them)
+ */
+bool StartDeferredLog(FILE *pFile) {
+  if (__atomic_load_n(&g_bRunning, __ATOMIC_ACQUIRE)) return true;
+
+  g_pFile = pFile;
+  __atomic_store_n(&g_bRunning, true, __ATOMIC_RELEASE);
+  if (pthread_create(&g_drainThread, NULL, drainThread, NULL) != 0) {
+    __atomic_store_n(&g_bRunning, false, __ATOMIC_RELEASE);
+    return false;
+  }
+
+  return true;
+}
+
+/**
+ * Stop the drain thread, once it has written the messages logged so far. Messages logged after this are not deferred.
+ */
+void StopDeferredLog(void) {
+  if (!__atomic_load_n(&g_bRunning, __ATOMIC_ACQUIRE)) return;
+
+  __atomic_store_n(&g_bRunning, false, __ATOMIC_SEQ_CST);
+  pthread_join(g_drainThread, NULL);
+
+  // A thread which saw the log running may still be capturing its message
+  while (__atomic_load_n(&g_nWriters, __ATOMIC_SEQ_CST) != 0) sched_yield();
+  FlushDeferredLog();
+}
+
+/**
+ * Capture a message into the calling thread's ring (never waits)
+ *
+ * @param pSource Source (static)
+ * @param pLevel Level (static)
+ * @param pFormat printf() format (static)
+ * @param args Arguments
+ * @return true if the message was deferred (or dropped as the ring was full), false if the drain is not running
+ */
+bool WriteDeferredLog(const char *pSource, const char *pLevel, const char *pFormat, va_list args) {
+  // Counted as a writer before checking the log is running, so StopDeferredLog() waits for the message
+  __atomic_fetch_add(&g_nWriters, 1, __ATOMIC_SEQ_CST);
+  if (!__atomic_load_n(&g_bRunning, __ATOMIC_SEQ_CST)) {
+    __atomic_fetch_sub(&g_nWriters, 1, __ATOMIC_RELEASE);
+    return false;
+  }
+
+  // Drop the message if the ring is full
+  LogRing *pRing = t_pRing != NULL ? t_pRing : acquireRing();
+  if (pRing == NULL ||
+      pRing->writeCount - __atomic_load_n(&pRing->readCount, __ATOMIC_ACQUIRE) >= DEFERRED_LOG_RECORDS) {
+    __atomic_fetch_add(&g_nDropped, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_sub(&g_nWriters, 1, __ATOMIC_RELEASE);
+    return true;
+  }
+
+  LogRecord *pRecord = &pRing->records[pRing->writeCount & (DEFERRED_LOG_RECORDS - 1)];
+  pRecord->sequence = __atomic_fetch_add(&g_sequence, 1, __ATOMIC_RELAXED);
+  pRecord->pSource = pSource;
+  pRecord->pLevel = pLevel;
+  pRecord->pFormat = pFormat;
+  captureArgs(pRecord, args);
+
+  __atomic_store_n(&pRing->writeCount, pRing->writeCount + 1, __ATOMIC_RELEASE);
+  __atomic_fetch_sub(&g_nWriters, 1, __ATOMIC_RELEASE);
+
+  return true;
+}
+
+/**
+ * Get the calling thread's ring now, so its first message does not allocate one. Call when a real-time thread starts.
+ *
+ * @return true if the thread has a ring
+ */
+bool AcquireDeferredLogRing(void) {
+  return t_pRing != NULL || acquireRing() != NULL;
+}
+
+/**
+ * Write the messages logged so far (and a count of any dropped since the last flush). Waits for the drain, so not
+ * from real-time threads.
+ */
+void FlushDeferredLog(void) {
+  char line[DEFERRED_LOG_LINE_LENGTH];
+
+  pthread_mutex_lock(&g_drainMutex);
+
+  for (;;) {
+    // Oldest message at the head of a ring
+    LogRing *pOldest = NULL;
+    for (LogRing *pRing = __atomic_load_n(&g_pRings, __ATOMIC_ACQUIRE); pRing != NULL; pRing = pRing->pNext) {
+      if (__atomic_load_n(&pRing->writeCount, __ATOMIC_ACQUIRE) == pRing->readCount) continue;
+      const LogRecord *pRecord = &pRing->records[pRing->readCount & (DEFERRED_LOG_RECORDS - 1)];
+      if (pOldest == NULL ||
+          pRecord->sequence < pOldest->records[pOldest->readCount & (DEFERRED_LOG_RECORDS - 1)].sequence) {
+        pOldest = pRing;
+      }
+    }
+    if (pOldest == NULL) break;
+
+    formatRecord(&pOldest->records[pOldest->readCount & (DEFERRED_LOG_RECORDS - 1)], line, sizeof(line));
+    __atomic_store_n(&pOldest->readCount, pOldest->readCount + 1, __ATOMIC_RELEASE);
+    fputs(line, g_pFile);
+  }
+
+  uint64_t nDropped = __atomic_load_n(&g_nDropped, __ATOMIC_RELAXED);
+  if (nDropped != g_nDroppedReported) {
+    fprintf(g_pFile, "ZxTape [WARN] %llu log messages dropped\n", (unsigned long long)(nDropped - g_nDroppedReported));
+    g_nDroppedReported = nDropped;
+  }
+  if (g_pFile != NULL) fflush(g_pFile);  // Not set if never started
+
+  pthread_mutex_unlock(&g_drainMutex);
+}
+
+/**
+ * Get the number of messages dropped as their thread's ring was full
+ */
+uint64_t GetDeferredLogDropped(void) {
+  return __atomic_load_n(&g_nDropped, __ATOMIC_RELAXED);
+}
+
+//
+// private functions
+//
+
+/**
+ * Get a ring for the calling thread: a released one, or a new one pushed onto the list
+ */
+static LogRing *acquireRing(void) {
+  LogRing *pRing;
+
+  pthread_once(&g_ringKeyOnce, createRingKey);
+
+  for (pRing = __atomic_load_n(&g_pRings, __ATOMIC_ACQUIRE); pRing != NULL; pRing = pRing->pNext) {
+    bool bInUse = false;
+    if (__atomic_compare_exchange_n(&pRing->bInUse, &bInUse, true, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) break;
+  }
+
+  if (pRing == NULL) {
+    pRing = (LogRing *)calloc(1, sizeof(LogRing));  // Never freed (reused once its thread exits)
+    if (pRing == NULL) return NULL;
+    pRing->bInUse = true;
+    pRing->pNext = __atomic_load_n(&g_pRings, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&g_pRings, &pRing->pNext, pRing, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+    }
+  }
+
+  pthread_setspecific(g_ringKey, pRing);
+  t_pRing = pRing;
+
+  return pRing;
+}
+
+/**
+ * Release a ring when its thread exits (its messages are still written)
+ */
+static void releaseRing(void *pRing) {
+  __atomic_store_n(&((LogRing *)pRing)->bInUse, false, __ATOMIC_RELEASE);
+}
+
+static void createRingKey(void) {
+  pthread_key_create(&g_ringKey, releaseRing);
+}
+
+/**
+ * Parse a conversion specification
+ *
+ * @param p The '%'
+ * @param pSpec Specification
+ * @return After the specification, or NULL if the format ends in it
+ */
+static const char *parseSpec(const char *p, LogSpec *pSpec) {
+  pSpec->pStart = p++;
+  pSpec->nStars = 0;
+
+  // Flags, width and precision
+  while (*p != '\0' && strchr("-+ #0'", *p) != NULL) p++;
+  if (*p == '*') {
+    pSpec->nStars++;
+    p++;
+  }
+  while (*p >= '0' && *p <= '9') p++;
+  if (*p == '.') {
+    p++;
+    if (*p == '*') {
+      pSpec->nStars++;
+      p++;
+    }
+    while (*p >= '0' && *p <= '9') p++;
+  }
+
+  // Length modifier
+  LogArgType intType = LOG_ARG_INT;
+  bool bLongDouble = false;
+  switch (*p) {
+    case 'h':
+      p += p[1] == 'h' ? 2 : 1;
+      break;
+    case 'l':
+      intType = p[1] == 'l' ? LOG_ARG_LLONG : LOG_ARG_LONG;
+      p += p[1] == 'l' ? 2 : 1;
+      break;
+    case 'j':
+      intType = LOG_ARG_INTMAX;
+      p++;
+      break;
+    case 'z':
+      intType = LOG_ARG_SIZE;
+      p++;
+      break;
+    case 't':
+      intType = LOG_ARG_PTRDIFF;
+      p++;
+      break;
+    case 'L':
+      bLongDouble = true;
+      p++;
+      break;
+  }
+
+  // Conversion
+  switch (*p) {
+    case '\0':
+      return NULL;
+    case 'd':
+    case 'i':
+    case 'u':
+    case 'o':
+    case 'x':
+    case 'X':
+    case 'c':
+      pSpec->type = intType;
+      break;
+    case 'f':
+    case 'F':
+    case 'e':
+    case 'E':
+    case 'g':
+    case 'G':
+    case 'a':
+    case 'A':
+      pSpec->type = bLongDouble ? LOG_ARG_LDOUBLE : LOG_ARG_DOUBLE;
+      break;
+    case 'p':
+      pSpec->type = LOG_ARG_POINTER;
+      break;
+    case 's':
+      pSpec->type = LOG_ARG_STRING;
+      break;
+    case 'n':
+      pSpec->type = LOG_ARG_NONE;
+      break;
+    default:
+      pSpec->type = LOG_ARG_INVALID;
+      break;
+  }
+  pSpec->pEnd = p + 1;
+
+  return pSpec->pEnd;
+}
+
+/**
+ * Capture the arguments of a message (as many as fit, the formatting stops at the first conversion not captured)
+ */
+static void captureArgs(LogRecord *pRecord, va_list args) {
+  LogSpec spec;
+  uint32_t nArgs = 0;
+  uint32_t nStringBytes = 0;
+
+  for (const char *p = pRecord->pFormat; (p = strchr(p, '%')) != NULL;) {
+    if (p[1] == '%') {
+      p += 2;
+      continue;
+    }
+    p = parseSpec(p, &spec);
+    if (p == NULL || spec.type == LOG_ARG_INVALID || nArgs + spec.nStars + 1 > DEFERRED_LOG_MAX_ARGS) break;
+
+    for (uint32_t i = 0; i < spec.nStars; i++) pRecord->args[nArgs++] = (uint64_t)(int64_t)va_arg(args, int);
+
+    uint64_t value = 0;
+    switch (spec.type) {
+      case LOG_ARG_INT:
+        value = (uint64_t)(int64_t)va_arg(args, int);
+        break;
+      case LOG_ARG_LONG:
+        value = (uint64_t)(int64_t)va_arg(args, long);
+        break;
+      case LOG_ARG_LLONG:
+        value = (uint64_t)va_arg(args, long long);
+        break;
+      case LOG_ARG_SIZE:
+        value = (uint64_t)va_arg(args, size_t);
+        break;
+      case LOG_ARG_INTMAX:
+        value = (uint64_t)va_arg(args, intmax_t);
+        break;
+      case LOG_ARG_PTRDIFF:
+        value = (uint64_t)(int64_t)va_arg(args, ptrdiff_t);
+        break;
+      case LOG_ARG_POINTER:
+      case LOG_ARG_NONE:
+        value = (uint64_t)(uintptr_t)va_arg(args, void *);
+        break;
+      case LOG_ARG_DOUBLE:
+      case LOG_ARG_LDOUBLE: {
+        double d = spec.type == LOG_ARG_DOUBLE ? va_arg(args, double) : (double)va_arg(args, long double);
+        memcpy(&value, &d, sizeof(value));
+        break;
+      }
+      case LOG_ARG_STRING: {
+        const char *pString = va_arg(args, const char *);
+        if (pString == NULL) {
+          value = STRING_NULL;
+          break;
+        }
+        // Copy as much as fits (an empty string once full)
+        uint32_t nSpace = DEFERRED_LOG_STRING_BYTES - nStringBytes - 1;
+        size_t nLength = strnlen(pString, nSpace);
+        memcpy(&pRecord->strings[nStringBytes], pString, nLength);
+        pRecord->strings[nStringBytes + nLength] = '\0';
+        value = nStringBytes;
+        nStringBytes += nLength + (nSpace > 0 ? 1 : 0);
+        break;
+      }
+      case LOG_ARG_INVALID:
+        break;
+    }
+    pRecord->args[nArgs++] = value;
+  }
+
+  pRecord->nArgs = nArgs;
+  pRecord->nStringBytes = nStringBytes;
+}
+
+/**
+ * Format a message as a line
+ *
+ * @return Length of the line (cut to fit, always terminated by a newline)
+ */
+static uint32_t formatRecord(const LogRecord *pRecord, char *pLine, uint32_t nLength) {
+  LogSpec spec;
+  uint32_t nArg = 0;
+  int n = snprintf(pLine, nLength, "%s [%s] ", pRecord->pSource, pRecord->pLevel);
+  uint32_t nPos = n > 0 ? (uint32_t)n : 0;
+
+  const char *p = pRecord->pFormat;
+  while (*p != '\0' && nPos < nLength - 2) {
+    if (*p != '%') {
+      pLine[nPos++] = *p++;
+      continue;
+    }
+    if (p[1] == '%') {
+      pLine[nPos++] = '%';
+      p += 2;
+      continue;
+    }
+
+    // Stop at a conversion not captured, writing the rest of the format as it is
+    const char *pNext = parseSpec(p, &spec);
+    if (pNext == NULL || spec.type == LOG_ARG_INVALID || nArg + spec.nStars + 1 > pRecord->nArgs) {
+      size_t nRest = strnlen(p, nLength - 2 - nPos);
+      memcpy(&pLine[nPos], p, nRest);
+      nPos += nRest;
+      break;
+    }
+
+    nPos += formatArg(pRecord, &spec, &nArg, &pLine[nPos], nLength - 1 - nPos);
+    if (nPos > nLength - 2) nPos = nLength - 2;
+    p = pNext;
+  }
+
+  pLine[nPos++] = '\n';
+  pLine[nPos] = '\0';
+
+  return nPos;
+}
+
+/**
+ * Format one conversion from the captured arguments
+ *
+ * @param pRecord Message
+ * @param pSpec Conversion
+ * @param pArg Next argument (advanced past the conversion's)
+ * @param pOut Output
+ * @param nLength Output length (including the terminator)
+ * @return Characters written (not counting the terminator)
+ */
+static uint32_t formatArg(const LogRecord *pRecord, const LogSpec *pSpec, uint32_t *pArg, char *pOut, size_t nLength) {
+  char spec[SPEC_LENGTH];
+  uint32_t nSpec = 0;
+
+  // Too long to format (with room for the '*' values), so written as it is
+  size_t nSpecLength = pSpec->pEnd - pSpec->pStart;
+  if (nSpecLength + 2 * 11 >= sizeof(spec)) {
+    *pArg += pSpec->nStars + 1;
+    if (nSpecLength >= nLength) nSpecLength = nLength - 1;
+    memcpy(pOut, pSpec->pStart, nSpecLength);
+    return nSpecLength;
+  }
+
+  // Write the '*' widths and precisions into the specification, and drop 'L' (the value is a double)
+  for (const char *p = pSpec->pStart; p < pSpec->pEnd; p++) {
+    if (*p == '*') {
+      nSpec += snprintf(&spec[nSpec], sizeof(spec) - nSpec, "%d", (int)pRecord->args[(*pArg)++]);
+    } else if (*p != 'L') {
+      spec[nSpec++] = *p;
+    }
+  }
+  spec[nSpec] = '\0';
+
+  uint64_t value = pRecord->args[(*pArg)++];
+  double d;
+  int n = 0;
+  switch (pSpec->type) {
+    case LOG_ARG_INT:
+      n = snprintf(pOut, nLength, spec, (int)value);
+      break;
+    case LOG_ARG_LONG:
+      n = snprintf(pOut, nLength, spec, (long)value);
+      break;
+    case LOG_ARG_LLONG:
+      n = snprintf(pOut, nLength, spec, (long long)value);
+      break;
+    case LOG_ARG_SIZE:
+      n = snprintf(pOut, nLength, spec, (size_t)value);
+      break;
+    case LOG_ARG_INTMAX:
+      n = snprintf(pOut, nLength, spec, (intmax_t)value);
+      break;
+    case LOG_ARG_PTRDIFF:
+      n = snprintf(pOut, nLength, spec, (ptrdiff_t)value);
+      break;
+    case LOG_ARG_POINTER:
+      n = snprintf(pOut, nLength, spec, (void *)(uintptr_t)value);
+      break;
+    case LOG_ARG_DOUBLE:
+    case LOG_ARG_LDOUBLE:
+      memcpy(&d, &value, sizeof(d));
+      n = snprintf(pOut, nLength, spec, d);
+      break;
+    case LOG_ARG_STRING:
+      n = snprintf(pOut, nLength, spec, value == STRING_NULL ? "(null)" : &pRecord->strings[value]);
+      break;
+    case LOG_ARG_NONE:
+    case LOG_ARG_INVALID:
+      break;
+  }
+
+  return n > 0 ? (uint32_t)n : 0;
+}
+
+static void *drainThread(void *arg) {
+  struct timespec interval = {0, DEFERRED_LOG_INTERVAL_MS * 1000000L};
+
+  while (__atomic_load_n(&g_bRunning, __ATOMIC_ACQUIRE)) {
+    FlushDeferredLog();
+    nanosleep(&interval, NULL);
+  }
+
+  return NULL;
+}
@@ -0,0 +1,37 @@
+/**
+ * deferred_log.h
+ *
+ * Deferred logging for the implementations with real-time threads: a message is captured (its format and arguments,
+ * not the formatted text) into a ring owned by the calling thread, and formatted and written by a background thread.
+ *
+ * Each ring has a single producer (its thread, which takes no lock and never waits: a message is dropped and counted
+ * if the ring is full) and a single consumer (the drain, under a lock only taken by the drain and by flushes).
+ *
+ * The format, level and source strings must be static (literals), as they are kept until the message is written.
+ * String arguments are copied. The first message from a thread allocates its ring (or reuses one of a thread that has
+ * exited), unless the thread acquired it when it started (AcquireDeferredLogRing()).
+ *
+ */
+
+#ifndef _deferred_log_h_
+#define _deferred_log_h_
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define DEFERRED_LOG_RECORDS 128       // Messages per thread ring (power of two)
+#define DEFERRED_LOG_MAX_ARGS 12       // Arguments captured per message (including '*' widths and precisions)
+#define DEFERRED_LOG_STRING_BYTES 120  // String argument bytes copied per message (longer strings are cut)
+#define DEFERRED_LOG_INTERVAL_MS 10    // Drain interval
+#define DEFERRED_LOG_LINE_LENGTH 1024  // Longest line written (longer lines are cut)
+
+bool StartDeferredLog(FILE *pFile);
+void StopDeferredLog(void);
+bool WriteDeferredLog(const char *pSource, const char *pLevel, const char *pFormat, va_list args);
+bool AcquireDeferredLogRing(void);
+void FlushDeferredLog(void);
+uint64_t GetDeferredLogDropped(void);
+
+#endif  // _deferred_log_h_
@@ -0,0 +1,58 @@
+/**
+ * file_stdio.c
+ *
+ * File API of the implementations with a C library file system: the tape file (TZX_fileName) is read with stdio.
+ *
+ */
+
+#include <stdio.h>
+
+#include "../../../../include/tzx_compat_impl.h"
+
+/* Local variables */
+static FILE *g_pFile = NULL;
+
+//
+// File API
+//
+
+unsigned char TZXCompat_fileOpen(void *dir, unsigned int index, unsigned oflag) {
+  const char *pF = TZX_fileName;
+
+  g_pFile = fopen(pF, "rb");
+  if (g_pFile == NULL) {
+    TZX_filesize = 0;
+    return 0;
+  }
+
+  // Must set TZX_filesize
+  fseek(g_pFile, 0, SEEK_END);
+  TZX_filesize = ftell(g_pFile);
+  fseek(g_pFile, 0, SEEK_SET);
+
+  return 1;
+}
+
+void TZXCompat_fileClose() {
+  if (g_pFile != NULL) {
+    fclose(g_pFile);
+    g_pFile = NULL;
+  }
+}
+
+int TZXCompat_fileRead(void *buf, unsigned long count) {
+  if (g_pFile != NULL) {
+    return fread(buf, 1, count, g_pFile);
+  }
+
+  return 0;
+}
+
+unsigned char TZXCompat_fileSeekSet(unsigned long long pos) {
+  if (g_pFile != NULL) {
+    fseek(g_pFile, pos, SEEK_SET);
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,70 @@
+/**
+ * span_fill.c
+ *
+ * The tape signal is a few long runs at one level per callback, so rather than writing (and converting) a sample at
+ * a time, each run is written as a span of identical frames. The frame is built once for the format, and the span is
+ * filled with memset() or 8 byte stores of a pattern of whole frames, with no per-sample branches.
+ *
+ */
+
+#include "span_fill.h"
+
+#include <assert.h>
+#include <string.h>
+
+/**
+ * Initialize an output format
+ *
+ * @param pFormat Format to initialize
+ * @param channels Channels per frame (1 or 2, the tape signal is written to both)
+ * @param bytesPerSample Bytes per sample (1 or 2, native byte order)
+ * @param low Sample value for a low level
+ * @param high Sample value for a high level
+ */
+void InitSpanFormat(SpanFormat *pFormat, uint32_t channels, uint32_t bytesPerSample, int32_t low, int32_t high) {
+  assert(channels == 1 || channels == 2);
+  assert(bytesPerSample == 1 || bytesPerSample == 2);
+
+  pFormat->channels = channels;
+  pFormat->bytesPerSample = bytesPerSample;
+  pFormat->frameBytes = channels * bytesPerSample;
+
+  // Build each level once, as a pattern of whole frames, so a span is a run of 8 byte stores
+  for (uint32_t i = 0; i < SPAN_PATTERN_BYTES / bytesPerSample; i++) {
+    if (bytesPerSample == 1) {
+      pFormat->lowPattern[i] = (uint8_t)low;
+      pFormat->highPattern[i] = (uint8_t)high;
+    } else {
+      int16_t lowSample = (int16_t)low;
+      int16_t highSample = (int16_t)high;
+      memcpy(&pFormat->lowPattern[i * 2], &lowSample, 2);
+      memcpy(&pFormat->highPattern[i * 2], &highSample, 2);
+    }
+  }
+}
+
+/**
+ * Fill a span of frames at one level
+ *
+ * @param pFormat Output format
+ * @param pBuffer Buffer (aligned for the frame size)
+ * @param frame First frame of the span
+ * @param frames Number of frames in the span
+ * @param bHigh Level of the span
+ */
+void FillSpan(const SpanFormat *pFormat, void *pBuffer, uint32_t frame, uint32_t frames, bool bHigh) {
+  const uint8_t *pPattern = bHigh ? pFormat->highPattern : pFormat->lowPattern;
+  uint8_t *p = (uint8_t *)pBuffer + frame * pFormat->frameBytes;
+
+  if (pFormat->frameBytes == 1) {
+    memset(p, pPattern[0], frames);
+    return;
+  }
+
+  // Whole frames fit any number of times in the 8 byte pattern, so it is stored 8 bytes at a time, then the tail
+  uint32_t bytes = frames * pFormat->frameBytes;
+  for (; bytes >= SPAN_PATTERN_BYTES; bytes -= SPAN_PATTERN_BYTES, p += SPAN_PATTERN_BYTES) {
+    memcpy(p, pPattern, SPAN_PATTERN_BYTES);
+  }
+  memcpy(p, pPattern, bytes);
+}
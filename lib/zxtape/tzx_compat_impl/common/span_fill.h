@@ -0,0 +1,28 @@
+/**
+ * span_fill.h
+ *
+ * Fill spans of audio frames at one level, in the output format (8 / 16-bit, mono / stereo), for the implementations'
+ * audio callbacks.
+ *
+ */
+
+#ifndef _span_fill_h_
+#define _span_fill_h_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define SPAN_PATTERN_BYTES 8  // Bytes stored at a time (a whole number of frames of any format)
+
+typedef struct _SpanFormat {
+  uint32_t channels;        // Channels per frame (1 or 2)
+  uint32_t bytesPerSample;  // Bytes per sample (1 or 2)
+  uint32_t frameBytes;      // Bytes per frame (1, 2 or 4)
+  uint8_t lowPattern[SPAN_PATTERN_BYTES];   // Low frames (all channels)
+  uint8_t highPattern[SPAN_PATTERN_BYTES];  // High frames (all channels)
+} SpanFormat;
+
+void InitSpanFormat(SpanFormat *pFormat, uint32_t channels, uint32_t bytesPerSample, int32_t low, int32_t high);
+void FillSpan(const SpanFormat *pFormat, void *pBuffer, uint32_t frame, uint32_t frames, bool bHigh);
+
+#endif  // _span_fill_h_
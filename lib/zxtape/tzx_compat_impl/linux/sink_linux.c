@@ -0,0 +1,155 @@
+/**
+ * Output sinks for the Linux implementation
+ *
+ * - null: discard the samples (timing only)
+ * - WAV: 8-bit unsigned mono WAV file, the header is completed when the sink is closed
+ * - raw: 8-bit unsigned mono samples to a file
+ * - stdout: 8-bit unsigned mono samples to stdout, for piping to a player (e.g. aplay -f U8 -r 44100)
+ */
+
+#include "sink_linux.h"
+
+#include <string.h>
+
+#include "../../sink/zxtape_sink.h"
+
+/* Forward declarations */
+static bool nullOpen(LinuxSink *pSink);
+static void nullWrite(LinuxSink *pSink, const uint8_t *pSamples, uint32_t count);
+static void nullClose(LinuxSink *pSink);
+static bool wavOpen(LinuxSink *pSink);
+static void wavClose(LinuxSink *pSink);
+static bool rawOpen(LinuxSink *pSink);
+static bool stdoutOpen(LinuxSink *pSink);
+static void fileWrite(LinuxSink *pSink, const uint8_t *pSamples, uint32_t count);
+static void fileClose(LinuxSink *pSink);
+static void writeWavHeader(LinuxSink *pSink, uint64_t samples);
+
+/**
+ * Initialise and open a sink
+ *
+ * @return false if the sink could not be opened (the null sink is used instead)
+ */
+bool InitLinuxSink(LinuxSink *pSink, TZX_LINUX_SINK_T type, const char *pPath, uint32_t sampleRate) {
+  memset(pSink, 0, sizeof(LinuxSink));
+  pSink->pPath = pPath;
+  pSink->sampleRate = sampleRate;
+
+  switch (type) {
+    case TZX_LINUX_SINK_WAV:
+      pSink->open = wavOpen;
+      pSink->write = fileWrite;
+      pSink->close = wavClose;
+      break;
+    case TZX_LINUX_SINK_RAW:
+      pSink->open = rawOpen;
+      pSink->write = fileWrite;
+      pSink->close = fileClose;
+      break;
+    case TZX_LINUX_SINK_STDOUT:
+      pSink->open = stdoutOpen;
+      pSink->write = fileWrite;
+      pSink->close = nullClose;
+      break;
+    case TZX_LINUX_SINK_NULL:
+    default:
+      pSink->open = nullOpen;
+      pSink->write = nullWrite;
+      pSink->close = nullClose;
+      break;
+  }
+
+  if (!pSink->open(pSink)) {
+    pSink->open = nullOpen;
+    pSink->write = nullWrite;
+    pSink->close = nullClose;
+    return false;
+  }
+
+  return true;
+}
+
+void DeinitLinuxSink(LinuxSink *pSink) {
+  pSink->close(pSink);
+  pSink->pFile = NULL;
+}
+
+void WriteLinuxSink(LinuxSink *pSink, const uint8_t *pSamples, uint32_t count) {
+  pSink->write(pSink, pSamples, count);
+  pSink->samplesWritten += count;
+}
+
+//
+// private functions
+//
+
+static bool nullOpen(LinuxSink *pSink) {
+  return true;
+}
+
+static void nullWrite(LinuxSink *pSink, const uint8_t *pSamples, uint32_t count) {
+  // Discard
+}
+
+static void nullClose(LinuxSink *pSink) {
+  // Nothing to close
+}
+
+static bool wavOpen(LinuxSink *pSink) {
+  if (pSink->pPath == NULL) return false;
+
+  pSink->pFile = fopen(pSink->pPath, "wb");
+  if (pSink->pFile == NULL) return false;
+
+  // Write a placeholder header, the sizes are filled in on close
+  writeWavHeader(pSink, 0);
+
+  return true;
+}
+
+static void wavClose(LinuxSink *pSink) {
+  if (pSink->pFile == NULL) return;
+
+  // Complete the header now the data size is known
+  uint64_t samples = pSink->samplesWritten;
+  if (samples > UINT32_MAX - ZXTAPE_SINK_WAV_HEADER_LENGTH) samples = UINT32_MAX - ZXTAPE_SINK_WAV_HEADER_LENGTH;
+  fseek(pSink->pFile, 0, SEEK_SET);
+  writeWavHeader(pSink, samples);
+
+  fileClose(pSink);
+}
+
+static bool rawOpen(LinuxSink *pSink) {
+  if (pSink->pPath == NULL) return false;
+
+  pSink->pFile = fopen(pSink->pPath, "wb");
+  return pSink->pFile != NULL;
+}
+
+static bool stdoutOpen(LinuxSink *pSink) {
+  pSink->pFile = stdout;
+  return true;
+}
+
+static void fileWrite(LinuxSink *pSink, const uint8_t *pSamples, uint32_t count) {
+  if (pSink->pFile == NULL) return;
+
+  fwrite(pSamples, 1, count, pSink->pFile);
+
+  // Keep a pipe consumer fed in real time
+  if (pSink->pFile == stdout) fflush(stdout);
+}
+
+static void fileClose(LinuxSink *pSink) {
+  if (pSink->pFile == NULL) return;
+
+  fclose(pSink->pFile);
+  pSink->pFile = NULL;
+}
+
+static void writeWavHeader(LinuxSink *pSink, uint64_t samples) {
+  uint8_t header[ZXTAPE_SINK_WAV_HEADER_LENGTH];
+
+  zxtapeSink_formatWavHeader(header, pSink->sampleRate, 8, samples);
+  fwrite(header, 1, ZXTAPE_SINK_WAV_HEADER_LENGTH, pSink->pFile);
+}
@@ -0,0 +1,31 @@
+/**
+ * sink_linux.h
+ *
+ * Output sinks for the Linux implementation (8-bit unsigned mono samples).
+ *
+ */
+
+#ifndef _sink_linux_h_
+#define _sink_linux_h_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "../../../../include/tzx_compat_impl_linux.h"
+
+typedef struct _LinuxSink {
+  bool (*open)(struct _LinuxSink *pSink);
+  void (*write)(struct _LinuxSink *pSink, const uint8_t *pSamples, uint32_t count);
+  void (*close)(struct _LinuxSink *pSink);
+  const char *pPath;
+  uint32_t sampleRate;
+  FILE *pFile;
+  uint64_t samplesWritten;
+} LinuxSink;
+
+bool InitLinuxSink(LinuxSink *pSink, TZX_LINUX_SINK_T type, const char *pPath, uint32_t sampleRate);
+void DeinitLinuxSink(LinuxSink *pSink);
+void WriteLinuxSink(LinuxSink *pSink, const uint8_t *pSamples, uint32_t count);
+
+#endif  // _sink_linux_h_
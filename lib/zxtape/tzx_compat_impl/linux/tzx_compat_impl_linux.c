@@ -0,0 +1,534 @@
+#define _GNU_SOURCE  // pthread_setaffinity_np(), pthread_setname_np()
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <sys/mman.h>
+#include <sys/param.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../../../../include/tzx_compat_impl.h"
+#include "../../../../include/tzx_compat_impl_linux.h"
+#include "../common/audio_output.h"
+#include "../common/audio_producer.h"
+#include "../common/deferred_log.h"
+#include "sink_linux.h"
+
+// Threads
+// - timer: timerfd armed with absolute deadlines, calls the TZX wave / buffer routine (as the macOS timer)
+// - output: clock_nanosleep(TIMER_ABSTIME) every interval, transfers the audio buffer to the sink (as CoreAudio)
+// - producer: optional, refills the audio buffer between the low / high watermarks
+// All can be run SCHED_FIFO and pinned to a CPU.
+
+#define NSEC_PER_SEC 1000000000ull
+#define NSEC_PER_MSEC 1000000ull
+#define NSEC_PER_USEC 1000ull
+
+#define AUDIO_BUFFER_LENGTH (1024 * 16)  // 16k periods (power of two)
+#define AUDIO_DEFAULT_SAMPLE_RATE 44100
+#define AUDIO_DEFAULT_INTERVAL_MS 10
+#define AUDIO_SAMPLE_LOW 0x00
+#define AUDIO_SAMPLE_HIGH 0xFF
+#define OUTPUT_RESYNC_NS (100 * NSEC_PER_MSEC)  // Restart the output timeline if it falls 100ms behind
+#define TIMER_FILL_MAX (TZX_buffsize / 2)       // Max periods per timer fill (TZXLoop() refills wbuffer in between)
+
+/* Forward declarations */
+static void onTimer();
+static void *timerThread(void *arg);
+static void *outputThread(void *arg);
+static void *producerThread(void *arg);
+static void signalProducer();
+static void lockInterrupt();
+static void unlockInterrupt();
+static void configureThread(const char *pName);
+static void armTimerFd(uint64_t deadlineNs);
+
+/* Local variables */
+static TZX_LINUX_CONFIG_T g_config = {
+    TZX_LINUX_SINK_NULL, NULL, AUDIO_DEFAULT_SAMPLE_RATE, AUDIO_DEFAULT_INTERVAL_MS, 0, -1, false,
+};
+static TZX_LINUX_STATS_T g_stats;
+static LinuxSink g_sink;
+
+static pthread_mutex_t g_interruptMutex;
+static pthread_mutexattr_t g_interruptMutexAttr;
+
+static int g_timerFd = -1;
+static pthread_t g_timerThread;
+static volatile bool g_bTimerThreadRunning = false;
+static volatile bool g_bAudioTimerRunning = false;
+static volatile uint64_t g_nAudioTimerDeadlineNs = 0;
+
+static pthread_t g_outputThread;
+static volatile bool g_bOutputThreadRunning = false;
+static uint8_t *g_pOutputBuffer = NULL;
+static uint32_t g_outputBufferLength = 0;
+
+static AudioOutput g_output;
+
+static AudioProducer g_producer = {
+    .pRing = &g_output.ring, .pfnWake = signalProducer, .pfnLock = lockInterrupt, .pfnUnlock = unlockInterrupt};
+static pthread_t g_producerThread;
+static sem_t g_producerSem;
+static volatile uint64_t g_nProducerRetryNs = 0;  // 0 = wait for the low watermark
+
+//
+// Linux specific configuration
+//
+
+void TZXCompatLinux_getDefaultConfig(TZX_LINUX_CONFIG_T *pConfig) {
+  pConfig->sink = TZX_LINUX_SINK_NULL;
+  pConfig->pSinkPath = NULL;
+  pConfig->nSampleRate = AUDIO_DEFAULT_SAMPLE_RATE;
+  pConfig->nIntervalMs = AUDIO_DEFAULT_INTERVAL_MS;
+  pConfig->nRealtimePriority = 0;
+  pConfig->nCpu = -1;
+  pConfig->bLockMemory = false;
+}
+
+void TZXCompatLinux_configure(const TZX_LINUX_CONFIG_T *pConfig) {
+  memcpy(&g_config, pConfig, sizeof(TZX_LINUX_CONFIG_T));
+
+  if (g_config.nSampleRate == 0) g_config.nSampleRate = AUDIO_DEFAULT_SAMPLE_RATE;
+  if (g_config.nIntervalMs == 0) g_config.nIntervalMs = AUDIO_DEFAULT_INTERVAL_MS;
+}
+
+void TZXCompatLinux_getStats(TZX_LINUX_STATS_T *pStats) {
+  pthread_mutex_lock(&g_interruptMutex);
+  g_stats.nSamplesWritten = g_sink.samplesWritten;
+  memcpy(pStats, &g_stats, sizeof(TZX_LINUX_STATS_T));
+  pthread_mutex_unlock(&g_interruptMutex);
+}
+
+//
+// TZX Compat Implemetation
+//
+
+void TZXCompat_create(void) {
+  // Create the interrupt mutex
+  pthread_mutexattr_init(&g_interruptMutexAttr);
+  pthread_mutexattr_settype(&g_interruptMutexAttr, PTHREAD_MUTEX_RECURSIVE);
+  pthread_mutex_init(&g_interruptMutex, &g_interruptMutexAttr);
+
+  memset(&g_stats, 0, sizeof(g_stats));
+
+  // Start writing log messages from a background thread, so the output threads never wait for stderr
+  StartDeferredLog(stderr);
+
+  // Lock memory, so the output threads do not page fault
+  if (g_config.bLockMemory && mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+    zxtape_log("WARN", "mlockall() failed: %s", strerror(errno));
+  }
+
+  // Allocate the audio buffer (freed in TZXCompat_destroy)
+  bool bRing = InitAudioOutput(&g_output, AUDIO_BUFFER_LENGTH, g_config.nSampleRate, &g_producer);
+  assert(bRing);
+
+  // Allocate the output buffer (one interval, plus one sample for rounding)
+  g_outputBufferLength = g_config.nSampleRate * g_config.nIntervalMs / 1000 + 1;
+  g_pOutputBuffer = (uint8_t *)malloc(g_outputBufferLength);  // Freed in TZXCompat_destroy
+  assert(g_pOutputBuffer != NULL);
+  InitSpanFormat(&g_output.format, 1, 1, AUDIO_SAMPLE_LOW, AUDIO_SAMPLE_HIGH);
+
+  // Open the sink
+  if (!InitLinuxSink(&g_sink, g_config.sink, g_config.pSinkPath, g_config.nSampleRate)) {
+    zxtape_log("WARN", "Failed to open output sink: %s", g_config.pSinkPath ? g_config.pSinkPath : "");
+  }
+
+  // Create the timer
+  g_bAudioTimerRunning = false;
+  g_nAudioTimerDeadlineNs = 0;
+  g_timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+  assert(g_timerFd >= 0);
+
+  g_bTimerThreadRunning = true;
+  int res = pthread_create(&g_timerThread, NULL, timerThread, NULL);
+  assert(res == 0);
+
+  // Create the output thread
+  g_bOutputThreadRunning = true;
+  res = pthread_create(&g_outputThread, NULL, outputThread, NULL);
+  assert(res == 0);
+}
+
+void TZXCompat_destroy(void) {
+  // Stop the producer thread (if running)
+  TZXCompat_producerStop();
+
+  // Stop the output thread
+  g_bOutputThreadRunning = false;
+  pthread_join(g_outputThread, NULL);
+
+  // Stop the timer thread (fire the timer so it wakes up)
+  g_bTimerThreadRunning = false;
+  armTimerFd(1);
+  pthread_join(g_timerThread, NULL);
+  close(g_timerFd);
+  g_timerFd = -1;
+
+  // Close the sink
+  DeinitLinuxSink(&g_sink);
+
+  // Free the buffers
+  free(g_pOutputBuffer);
+  g_pOutputBuffer = NULL;
+  DeinitAudioOutput(&g_output);
+
+  // Destroy the interrupt mutex
+  pthread_mutex_destroy(&g_interruptMutex);
+
+  // Write the remaining log messages (messages are written directly from now on)
+  StopDeferredLog();
+}
+
+void TZXCompat_start(void) {
+  pthread_mutex_lock(&g_interruptMutex);
+
+  // Clear the audio buffer, and start writing to the sink
+  StartAudioOutput(&g_output);
+
+  pthread_mutex_unlock(&g_interruptMutex);
+}
+
+void TZXCompat_stop(void) {
+  pthread_mutex_lock(&g_interruptMutex);
+
+  // Stop writing to the sink, and clear the audio buffer
+  StopAudioOutput(&g_output);
+  g_nProducerRetryNs = 0;
+
+  pthread_mutex_unlock(&g_interruptMutex);
+}
+
+void TZXCompat_poll(void) {
+  // Stop the tape once the output has played the end of it
+  PollAudioOutput(&g_output);
+}
+
+void TZXCompat_timerInitialize(void) {
+  // Initialise / reset the timer
+
+  // Stop the timer if it is running
+  TZXCompat_timerStop();
+
+  // Nothing else to do
+}
+
+void TZXCompat_timerStartAt(unsigned long long deadlineNs) {
+  // If the producer thread is running, it refills the buffer, and the timer is not used
+  if (g_producer.bRunning) {
+    if (g_producer.bRefilling) {
+      // Called from the refill, retry after the period if nothing could be buffered (0 = wait for the low watermark)
+      uint64_t nowNs = TZXCompat_getTickNs();
+      g_nProducerRetryNs = deadlineNs > nowNs ? deadlineNs - nowNs : 0;
+    } else {
+      // Tape started, fill the buffer
+      WakeAudioProducer(&g_producer);
+    }
+    return;
+  }
+
+  // timerfd supports absolute deadlines directly, so the period does not drift
+  g_bAudioTimerRunning = true;
+  g_nAudioTimerDeadlineNs = deadlineNs;
+  armTimerFd(deadlineNs);
+}
+
+void TZXCompat_timerStop(void) {
+  // Stop the timer
+  g_bAudioTimerRunning = false;
+  g_nAudioTimerDeadlineNs = 0;
+
+  armTimerFd(0);
+}
+
+static void onTimer() {
+  // Lock the 'interrupt' mutex when calling the timer routine to block out the main loop thread
+  pthread_mutex_lock(&g_interruptMutex);
+
+  // The timer may have been stopped after it expired
+  if (g_bAudioTimerRunning) {
+    g_bAudioTimerRunning = false;
+
+    // Report how late the timer ran (the next deadline is scheduled from this deadline, so lateness does not build up)
+    uint64_t nowNs = TZXCompat_getTickNs();
+    TZX_timerLate(nowNs > g_nAudioTimerDeadlineNs ? nowNs - g_nAudioTimerDeadlineNs : 0);
+
+    // Fill the free space in the buffer
+    TZXCompat_waveOrBuffer(true, MIN(GetAudioRingSpace(&g_output.ring), TIMER_FILL_MAX), 1000 * 1000);
+  }
+
+  // Unlock the 'interrupt' mutex
+  pthread_mutex_unlock(&g_interruptMutex);
+}
+
+/**
+ * Start the producer thread
+ *
+ * The thread sleeps until the output thread drains the buffer below the low watermark, then refills it up to the
+ * high watermark.
+ */
+void TZXCompat_producerStart(unsigned int nLowWatermarkPercent, unsigned int nHighWatermarkPercent) {
+  if (g_producer.bRunning) return;
+
+  g_nProducerRetryNs = 0;
+  sem_init(&g_producerSem, 0, 0);
+
+  StartAudioProducer(&g_producer, nLowWatermarkPercent, nHighWatermarkPercent);
+  int res = pthread_create(&g_producerThread, NULL, producerThread, NULL);
+  assert(res == 0);
+}
+
+/**
+ * Stop the producer thread
+ */
+void TZXCompat_producerStop(void) {
+  if (!g_producer.bRunning) return;
+
+  // Signal the semaphore in order to allow the thread to exit
+  StopAudioProducer(&g_producer);
+  sem_post(&g_producerSem);
+  pthread_join(g_producerThread, NULL);
+
+  sem_destroy(&g_producerSem);
+}
+
+void TZXCompat_buffer(unsigned long periodUs) {
+  BufferAudioOutput(&g_output, periodUs);
+}
+
+// Set the GPIO output pin low
+void TZXCompat_setAudioLow() {
+  g_output.pinState = 0;
+}
+
+// Set the GPIO output pin high
+void TZXCompat_setAudioHigh() {
+  g_output.pinState = 1;
+}
+
+unsigned int TZXCompat_getTickMs(void) {
+  // Get the current timer value in milliseconds
+  return (unsigned int)(TZXCompat_getTickNs() / NSEC_PER_MSEC);
+}
+
+unsigned long long TZXCompat_getTickNs(void) {
+  // Get the current monotonic timer value in nanoseconds (unaffected by changes to the wall clock)
+  struct timespec spec;
+
+  clock_gettime(CLOCK_MONOTONIC, &spec);
+
+  return (unsigned long long)spec.tv_sec * NSEC_PER_SEC + spec.tv_nsec;
+}
+
+/**
+ * Delay a number of milliseconds in a busy loop
+ */
+void TZXCompat_delay(unsigned long ms) {
+  //
+}
+
+/**
+ * Disable interrupts
+ *
+ * The timer is not on an interrupt, but is a separate thread. Use a mutex for synchronisation.
+ */
+void TZXCompat_noInterrupts() {
+  // Lock the mutex
+  pthread_mutex_lock(&g_interruptMutex);
+}
+
+/**
+ * Re-enable interrupts
+ *
+ * The timer is not on an interrupt, but is a separate thread. Use a mutex for synchronisation.
+ */
+void TZXCompat_interrupts() {
+  // Unlock the mutex
+  pthread_mutex_unlock(&g_interruptMutex);
+}
+
+//
+// Log functions (stderr, as stdout may be the output sink, deferred while the implementation exists)
+//
+
+// Log a TZX message
+void TZXCompat_log(const char *pFormat, ...) {
+  va_list args;
+
+  // Log a message
+  va_start(args, pFormat);
+  if (!WriteDeferredLog("TZX", "DEBUG", pFormat, args)) {
+    va_end(args);
+    va_start(args, pFormat);
+    fprintf(stderr, "%s [%s] ", "TZX", "DEBUG");
+    vfprintf(stderr, pFormat, args);
+    fprintf(stderr, "\n");
+  }
+  va_end(args);
+}
+
+// Log a zxtape message
+void zxtape_log(const char *pLevel, const char *pFormat, ...) {
+  va_list args;
+
+  // Log a message
+  va_start(args, pFormat);
+  if (!WriteDeferredLog("ZxTape", pLevel, pFormat, args)) {
+    va_end(args);
+    va_start(args, pFormat);
+    fprintf(stderr, "%s [%s] ", "ZxTape", pLevel);
+    vfprintf(stderr, pFormat, args);
+    fprintf(stderr, "\n");
+  }
+  va_end(args);
+}
+
+//
+// private functions
+//
+
+static void *timerThread(void *arg) {
+  configureThread("zxtape-timer");
+
+  while (g_bTimerThreadRunning) {
+    // Wait for the timer to expire
+    uint64_t expirations = 0;
+    ssize_t res = read(g_timerFd, &expirations, sizeof(expirations));
+
+    if (!g_bTimerThreadRunning) break;  // Check if the thread is still running
+    if (res != sizeof(expirations)) continue;
+
+    onTimer();
+  }
+
+  return (void *)0;
+}
+
+static void *outputThread(void *arg) {
+  uint64_t intervalNs = g_config.nIntervalMs * NSEC_PER_MSEC;
+  uint64_t startNs = TZXCompat_getTickNs();
+  uint64_t deadlineNs = startNs;
+  uint64_t intervals = 0;
+  uint64_t samplesDue = 0;
+
+  configureThread("zxtape-output");
+
+  while (g_bOutputThreadRunning) {
+    // Sleep until the next absolute deadline, so the output does not drift
+    deadlineNs += intervalNs;
+    struct timespec ts;
+    ts.tv_sec = deadlineNs / NSEC_PER_SEC;
+    ts.tv_nsec = deadlineNs % NSEC_PER_SEC;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {
+    }
+
+    if (!g_bOutputThreadRunning) break;  // Check if the thread is still running
+
+    // If the thread fell too far behind (e.g. the process was suspended), restart the timeline
+    uint64_t nowNs = TZXCompat_getTickNs();
+    if (nowNs > deadlineNs + OUTPUT_RESYNC_NS) {
+      startNs = deadlineNs = nowNs;
+      intervals = 0;
+      samplesDue = 0;
+    }
+
+    // Samples for this interval (calculated from the start, so rounding does not accumulate)
+    intervals++;
+    uint64_t samplesTotal = intervals * g_config.nIntervalMs * g_config.nSampleRate / 1000;
+    uint32_t samples = (uint32_t)MIN(samplesTotal - samplesDue, g_outputBufferLength);
+    samplesDue = samplesTotal;
+
+    if (!TransferAudioOutput(&g_output, g_pOutputBuffer, samples)) continue;
+
+    WriteLinuxSink(&g_sink, g_pOutputBuffer, samples);
+  }
+
+  return (void *)0;
+}
+
+static void *producerThread(void *arg) {
+  configureThread("zxtape-producer");
+
+  while (g_producer.bRunning) {
+    // Sleep until below the low watermark, or until the retry period expires (e.g. when paused)
+    uint64_t retryNs = g_nProducerRetryNs;
+    if (retryNs > 0) {
+      // sem_timedwait() uses the realtime clock, which is good enough for the (long) retry period
+      struct timespec ts;
+      clock_gettime(CLOCK_REALTIME, &ts);
+      uint64_t deadlineNs = (uint64_t)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec + retryNs;
+      ts.tv_sec = deadlineNs / NSEC_PER_SEC;
+      ts.tv_nsec = deadlineNs % NSEC_PER_SEC;
+      while (sem_timedwait(&g_producerSem, &ts) != 0 && errno == EINTR) {
+      }
+    } else {
+      while (sem_wait(&g_producerSem) != 0 && errno == EINTR) {
+      }
+    }
+
+    if (!g_producer.bRunning) break;  // Check if the thread is still running
+
+    g_nProducerRetryNs = 0;
+    RefillAudioProducer(&g_producer);
+  }
+
+  return (void *)0;
+}
+
+static void signalProducer() {
+  sem_post(&g_producerSem);
+}
+
+static void lockInterrupt() {
+  pthread_mutex_lock(&g_interruptMutex);
+}
+
+static void unlockInterrupt() {
+  pthread_mutex_unlock(&g_interruptMutex);
+}
+
+/**
+ * Apply the configured scheduling to the calling thread
+ *
+ * Failures are logged and ignored, so the player still runs without the privileges (e.g. CAP_SYS_NICE)
+ */
+static void configureThread(const char *pName) {
+  pthread_setname_np(pthread_self(), pName);
+
+  // The thread's log ring, so logging from the thread never allocates
+  AcquireDeferredLogRing();
+
+  if (g_config.nCpu >= 0) {
+    cpu_set_t cpuSet;
+    CPU_ZERO(&cpuSet);
+    CPU_SET(g_config.nCpu, &cpuSet);
+
+    int res = pthread_setaffinity_np(pthread_self(), sizeof(cpuSet), &cpuSet);
+    if (res != 0) zxtape_log("WARN", "%s: failed to pin to CPU %d: %s", pName, g_config.nCpu, strerror(res));
+  }
+
+  if (g_config.nRealtimePriority > 0) {
+    struct sched_param param;
+    memset(&param, 0, sizeof(param));
+    param.sched_priority = g_config.nRealtimePriority;
+
+    int res = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+    if (res != 0) zxtape_log("WARN", "%s: failed to set SCHED_FIFO: %s", pName, strerror(res));
+  }
+}
+
+/**
+ * Arm the timerfd for an absolute deadline (0 disarms the timer)
+ */
+static void armTimerFd(uint64_t deadlineNs) {
+  struct itimerspec spec;
+  memset(&spec, 0, sizeof(spec));
+  spec.it_value.tv_sec = deadlineNs / NSEC_PER_SEC;
+  spec.it_value.tv_nsec = deadlineNs % NSEC_PER_SEC;
+
+  timerfd_settime(g_timerFd, TFD_TIMER_ABSTIME, &spec, NULL);
+}
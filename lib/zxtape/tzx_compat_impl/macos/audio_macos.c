@@ -37,7 +37,6 @@ uint32 AudioIntervalMs = 128;      // ms
 /* Local variables */
 static bool SettingsMute = true;
 static bool SettingsSixteenBitSound = false;
-static bool SettingsStereo = false;
 
 static SInt32 macSoundVolume = 100;  // %
 
@@ -278,38 +277,13 @@ static OSStatus MacAURenderCallBack(void *inRefCon, AudioUnitRenderActionFlags *
   if (SettingsMute) {
     memset(ioData->mBuffers[0].mData, 0, ioData->mBuffers[0].mDataByteSize);
     *ioActionFlags |= kAudioUnitRenderAction_OutputIsSilence;
-  } else if (SettingsStereo) {
-    unsigned int samples;
-
-    samples = ioData->mBuffers[0].mDataByteSize;
-    if (SettingsSixteenBitSound) samples >>= 1;
-
-    pthread_mutex_lock(&mutex);
-    // TODO S9xMixSamples((uint8 *)ioData->mBuffers[0].mData, samples);
-    audioBufferCallback((void *)ioData->mBuffers[0].mData, samples);
-    pthread_mutex_unlock(&mutex);
-  } else  // Manually map L to R
-  {
-    unsigned int monosmp;
-
-    monosmp = ioData->mBuffers[0].mDataByteSize >> 1;
-    if (SettingsSixteenBitSound) monosmp >>= 1;
-
-    pthread_mutex_lock(&mutex);
-    // TODO S9xMixSamples((uint8 *)ioData->mBuffers[0].mData, monosmp);
-    audioBufferCallback((void *)ioData->mBuffers[0].mData, monosmp);
-
-    pthread_mutex_unlock(&mutex);
-
-    if (SettingsSixteenBitSound) {
-      for (int i = monosmp - 1; i >= 0; i--)
-        ((int16_t *)ioData->mBuffers[0].mData)[i * 2 + 1] = ((int16_t *)ioData->mBuffers[0].mData)[i * 2] =
-            ((int16_t *)ioData->mBuffers[0].mData)[i];
-    } else {
-      for (int i = monosmp - 1; i >= 0; i--)
-        ((int8_t *)ioData->mBuffers[0].mData)[i * 2 + 1] = ((int8_t *)ioData->mBuffers[0].mData)[i * 2] =
-            ((int8_t *)ioData->mBuffers[0].mData)[i];
-    }
+  } else {
+    // The format is always stereo; the (mono) tape signal is written to both channels as it is rendered
+    unsigned int bytesPerSample = SettingsSixteenBitSound ? 2 : 1;
+    unsigned int frames = ioData->mBuffers[0].mDataByteSize / (2 * bytesPerSample);
+
+    // No lock, the callback is wait-free
+    audioBufferCallback((void *)ioData->mBuffers[0].mData, frames, 2, bytesPerSample);
   }
 
   return (noErr);
@@ -3,7 +3,9 @@
 
 #include <stdbool.h>
 
-typedef void (*AudioBufferCallback)(void *buffer, unsigned int bufferSize);
+// Fill frames of interleaved samples (channels per frame, bytes per sample)
+typedef void (*AudioBufferCallback)(void *buffer, unsigned int frames, unsigned int channels,
+                                    unsigned int bytesPerSample);
 
 void InitMacSound(AudioBufferCallback callback);
 void DeinitMacSound(void);
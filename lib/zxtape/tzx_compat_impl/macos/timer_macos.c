@@ -18,6 +18,8 @@
 #include <stdlib.h>
 #include <sys/errno.h>
 
+#include "../common/deferred_log.h"
+
 /* Forward declarations */
 static inline void _timer_start(macos_timer_t tim, const struct itimerspec *its, struct itimerspec *remainvalue);
 static inline void _timer_cancel(macos_timer_t tim, const struct itimerspec *its, struct itimerspec *remainvalue);
@@ -181,6 +183,9 @@ static void *_timer_thread(void *arg) {
   // Set the thread priority for realtime audio
   // setPriorityRealtimeAudio();
 
+  // The thread's log ring, so logging from the timer handler never allocates
+  AcquireDeferredLogRing();
+
   while (tim->threadRunning) {
     // Wait for the start semaphore
     semaphore_wait(tim->startSem);
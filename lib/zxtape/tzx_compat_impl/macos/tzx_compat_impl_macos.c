@@ -1,10 +1,16 @@
 
 
+#include <mach/mach.h>
 #include <pthread.h>
+#include <sched.h>
 #include <sys/param.h>
 #include <time.h>
 
 #include "../../../../include/tzx_compat_impl.h"
+#include "../common/audio_producer.h"
+#include "../common/audio_ring.h"
+#include "../common/deferred_log.h"
+#include "../common/span_fill.h"
 #include "audio_macos.h"
 #include "timer_macos.h"
 
@@ -15,22 +21,14 @@
 // - https://chromium.googlesource.com/chromium/src/+/refs/heads/main/base/threading/platform_thread_apple.mm <== GOOD
 
 #define AUDIO_BUFFER_MULTIPLE 8
-#define AUDIO_BUFFER_LENGTH 1024 * 16  // 16k buffer
+#define AUDIO_BUFFER_LENGTH (1024 * 16)  // 16k periods (power of two)
 #define AUDIO_BUFFER_EQUALIBRIUM_PERCENT 1
 #define TIMER_FIXED_OFFSET_US 50
 #define TIMER_VARAIBLE_OFFSET_US 150
-
-typedef enum AudioBufferSignal_ {
-  AudioBufferSignalNone = 0,
-  AudioBufferSignalStopTape = 1,
-} AudioBufferSignal;
-
-/* structs */
-typedef struct AudioPinSample_ {
-  uint32_t state;
-  uint32_t samples;
-  AudioBufferSignal signal;
-} AudioPinSample;
+#define AUDIO_SAMPLE_LOW_8 0x00  // 8-bit (unsigned) output
+#define AUDIO_SAMPLE_HIGH_8 0xFF
+#define AUDIO_SAMPLE_LOW_16 (-0x7FFF)  // 16-bit (signed) output
+#define AUDIO_SAMPLE_HIGH_16 0x7FFF
 
 /* Imported global variables */
 extern uint32_t AudioPlaybackRate;
@@ -41,12 +39,18 @@ extern uint32_t AudioIntervalMs;
 
 /* Forward declarations */
 static void onTimer();
-static void transferAudioBuffer(void *buffer, unsigned int bufferSize);
+static void transferAudioBuffer(void *buffer, unsigned int frames, unsigned int channels,
+                                unsigned int bytesPerSample);
 // static void createAudioThread(pthread_t thread);
 // static void destroyAudioThread(pthread_t thread);
 // static void *audioThread(void *arg);
 static int setRealtime(uint32_t period, uint32_t computation, uint32_t constraint, boolean_t preemptible);
 static int setPriorityRealtimeAudio();
+static void stopTransfers();
+static void *producerThread(void *arg);
+static void signalProducer();
+static void lockInterrupt();
+static void unlockInterrupt();
 
 /* Local variables */
 static pthread_mutex_t g_interruptMutex;
@@ -58,18 +62,24 @@ static struct itimerspec g_audioTimerSpec;
 static volatile bool g_bAudioThreadRunning = false;
 static volatile bool g_bAudioTimerRunning = false;
 static volatile uint64_t g_nAudioTimerPeriodNs = 0;
-
-static uint32_t g_audioBufferLengthMs = 0;
-static uint32_t g_audioBufferLength = 0;
-static uint32_t g_audioBufferReadIndex = 0;
-static uint32_t g_audioBufferWriteIndex = 0;
-static AudioPinSample *g_audioBuffer = NULL;
-static int8_t g_audioBufferLastValue = 0;
+static volatile uint64_t g_nAudioTimerDeadlineNs = 0;
+
+static AudioRing g_audioRing;
+static uint32_t g_audioBufferLastState = 0;
+static SpanFormat g_audioFormat;
+static volatile bool g_bAudioStarted = false;
+static volatile bool g_bAudioTransferring = false;
+static volatile bool g_bStopTapePending = false;
 static bool g_audioBufferReady = false;
+static bool g_audioBufferUnderrun = false;
 
-static uint32_t g_pinState = 0;
+static AudioProducer g_producer = {
+    .pRing = &g_audioRing, .pfnWake = signalProducer, .pfnLock = lockInterrupt, .pfnUnlock = unlockInterrupt};
+static pthread_t g_producerThread = NULL;
+static semaphore_t g_producerSem;
+static volatile uint64_t g_nProducerRetryNs = 0;  // 0 = wait for the low watermark
 
-static FILE *g_pFile = NULL;
+static uint32_t g_pinState = 0;
 
 //
 // TZX Compat Implemetation
@@ -81,20 +91,18 @@ void TZXCompat_create(void) {
   pthread_mutexattr_settype(&g_interruptMutexAttr, PTHREAD_MUTEX_RECURSIVE);
   pthread_mutex_init(&g_interruptMutex, &g_interruptMutexAttr);
 
+  // Start writing log messages from a background thread, so the audio threads never wait for stdout
+  StartDeferredLog(stdout);
+
   // Create the timer
 
   g_bAudioTimerRunning = false;
   g_nAudioTimerPeriodNs = 0;
 
   // Allocate the audio buffer
-  // g_audioBufferLengthMs = AudioIntervalMs * AUDIO_BUFFER_MULTIPLE;
-  // g_audioBufferLength = g_audioBufferLengthMs * AudioPlaybackRate / 1000;
-  g_audioBufferLength = AUDIO_BUFFER_LENGTH;
-  g_audioBuffer = (AudioPinSample *)malloc(g_audioBufferLength * sizeof(AudioPinSample));  // Freed in TZXCompat_destroy
-  assert(g_audioBuffer != NULL);
-  g_audioBufferReadIndex = 0;
-  g_audioBufferWriteIndex = 0;
-  g_audioBufferLastValue = 0;
+  bool bRing = InitAudioRing(&g_audioRing, AUDIO_BUFFER_LENGTH);  // Freed in TZXCompat_destroy
+  assert(bRing);
+  g_audioBufferLastState = 0;
 
   // Initialise MACOS audio
   InitMacSound(transferAudioBuffer);
@@ -119,6 +127,9 @@ void TZXCompat_create(void) {
 }
 
 void TZXCompat_destroy(void) {
+  // Stop the producer thread (if running)
+  TZXCompat_producerStop();
+
   // Destroy the audio thread
   timer_delete(g_audioTimer);
 
@@ -127,11 +138,13 @@ void TZXCompat_destroy(void) {
   DeinitMacSound();
 
   // Free the audio buffer
-  free(g_audioBuffer);
-  g_audioBuffer = NULL;
+  DeinitAudioRing(&g_audioRing);
 
   // Destroy the interrupt mutex
   pthread_mutex_destroy(&g_interruptMutex);
+
+  // Write the remaining log messages (messages are written directly from now on)
+  StopDeferredLog();
 }
 
 void TZXCompat_start(void) {
@@ -140,10 +153,13 @@ void TZXCompat_start(void) {
   // m_GpioOutputPin.SetMode(GPIOModeOutput);
 
   // Clear the audio buffer
-  g_audioBufferReadIndex = 0;
-  g_audioBufferWriteIndex = 0;
-  g_audioBufferLastValue = 0;
+  stopTransfers();
+  ResetAudioRing(&g_audioRing);
+  g_audioBufferLastState = 0;
   g_audioBufferReady = false;
+  g_audioBufferUnderrun = false;
+  g_bStopTapePending = false;
+  __atomic_store_n(&g_bAudioStarted, true, __ATOMIC_SEQ_CST);
 
   // Unmute the audio
   SetMute(false);
@@ -157,10 +173,19 @@ void TZXCompat_stop(void) {
   SetMute(true);
 
   // Clear the audio buffer
-  g_audioBufferReadIndex = 0;
-  g_audioBufferWriteIndex = 0;
-  g_audioBufferLastValue = 0;
+  stopTransfers();
+  ResetAudioRing(&g_audioRing);
+  g_audioBufferLastState = 0;
   g_audioBufferReady = false;
+  g_audioBufferUnderrun = false;
+  g_bStopTapePending = false;
+  ResetAudioProducer(&g_producer);
+  g_nProducerRetryNs = 0;
+}
+
+void TZXCompat_poll(void) {
+  // Stop the tape once the audio callback has played the end of it
+  if (__atomic_exchange_n(&g_bStopTapePending, false, __ATOMIC_ACQ_REL)) TZX_stopFile();
 }
 
 void TZXCompat_timerInitialize(void) {
@@ -172,14 +197,31 @@ void TZXCompat_timerInitialize(void) {
   // Nothing else to do
 }
 
-void TZXCompat_timerStart(unsigned long periodUs) {
+void TZXCompat_timerStartAt(unsigned long long deadlineNs) {
+  uint64_t nowNs = TZXCompat_getTickNs();
+  uint64_t periodNs = deadlineNs > nowNs ? deadlineNs - nowNs : 0;
+
+  // If the producer thread is running, it refills the buffer, and the timer is not used
+  if (g_producer.bRunning) {
+    if (g_producer.bRefilling) {
+      // Called from the refill, retry after the period if nothing could be buffered (0 = wait for the low watermark)
+      g_nProducerRetryNs = periodNs;
+    } else {
+      // Tape started, fill the buffer
+      WakeAudioProducer(&g_producer);
+    }
+    return;
+  }
+
   // Stop the timer if it is running
   TZXCompat_timerStop();
 
+  // The macOS timer is relative, so convert the deadline to a period from now (a zero period would cancel the timer)
   g_bAudioTimerRunning = true;
-  g_nAudioTimerPeriodNs = periodUs * 1000ull;
+  g_nAudioTimerDeadlineNs = deadlineNs;
+  g_nAudioTimerPeriodNs = MAX(periodNs, 1);
 
-  // Start the timer for a period in microseconds
+  // Start the timer for a period in nanoseconds
 
   // Configure and start the timer
   g_audioTimerSpec.it_value.tv_sec = g_nAudioTimerPeriodNs / NSEC_PER_SEC;
@@ -234,52 +276,62 @@ void onTimer() {
   // Lock the 'interrupt' mutex when calling the timer routine to block out the main loop thread
   pthread_mutex_lock(&g_interruptMutex);
 
-  // Buffer count
-  uint32_t bufferCount = (g_audioBufferWriteIndex - g_audioBufferReadIndex);
-  if (bufferCount > g_audioBufferLength - 1) {
-    bufferCount = (g_audioBufferLength - g_audioBufferReadIndex) + g_audioBufferWriteIndex;
-  }
-  uint32_t bufferRemaining = MAX(g_audioBufferLength - bufferCount - 2, 0);
+  // Report how late the timer ran (the next deadline is scheduled from this deadline, so lateness does not build up)
+  uint64_t nowNs = TZXCompat_getTickNs();
+  TZX_timerLate(nowNs > g_nAudioTimerDeadlineNs ? nowNs - g_nAudioTimerDeadlineNs : 0);
 
   // Fire the timer event in the TZXCompat layer (250ms)
-  TZXCompat_waveOrBuffer(true, bufferRemaining, 1000 * 1000);
+  TZXCompat_waveOrBuffer(true, GetAudioRingSpace(&g_audioRing), 1000 * 1000);
 
   // Unlock the 'interrupt' mutex
   pthread_mutex_unlock(&g_interruptMutex);
 }
 
+/**
+ * Start the producer thread
+ *
+ * The thread sleeps until the audio callback drains the buffer below the low watermark, then refills it up to the
+ * high watermark.
+ */
+void TZXCompat_producerStart(unsigned int nLowWatermarkPercent, unsigned int nHighWatermarkPercent) {
+  if (g_producer.bRunning) return;
+
+  g_nProducerRetryNs = 0;
+  semaphore_create(mach_task_self(), &g_producerSem, SYNC_POLICY_FIFO, 0);
+
+  StartAudioProducer(&g_producer, nLowWatermarkPercent, nHighWatermarkPercent);
+  int res = pthread_create(&g_producerThread, NULL, producerThread, NULL);
+  assert(res == 0);
+}
+
+/**
+ * Stop the producer thread
+ */
+void TZXCompat_producerStop(void) {
+  if (!g_producer.bRunning) return;
+
+  // Signal the semaphore in order to allow the thread to exit
+  StopAudioProducer(&g_producer);
+  semaphore_signal(g_producerSem);
+  pthread_join(g_producerThread, NULL);
+  g_producerThread = NULL;
+
+  semaphore_destroy(mach_task_self(), g_producerSem);
+}
+
 void TZXCompat_buffer(unsigned long periodUs) {
   // Calculate the period in audio samples
   uint32_t periodSamples = ((uint64_t)periodUs * AudioPlaybackRate / 1000000ull);
 
   // Check for pauses, don't fill the buffer for a pause!
 
-  // Fill the audio buffer with the pin state and period
-  AudioPinSample *s = &g_audioBuffer[g_audioBufferWriteIndex];
-  s->state = g_pinState;
-  s->samples = periodSamples;
-  s->signal = AudioBufferSignalNone;
-
-  // If the period is the EOF period, then add a special signal to stop the tape
-  if (periodUs == TZXCompat_EOF_PERIOD) {
-    s->signal = AudioBufferSignalStopTape;
-  }
-
-  if (g_audioBufferWriteIndex + 1 != g_audioBufferReadIndex) {
-    g_audioBufferWriteIndex = (g_audioBufferWriteIndex + 1) % g_audioBufferLength;
-  } else {
+  // Fill the audio buffer with the pin state and period (the EOF period stops the tape when it is reached)
+  if (!PushAudioRing(&g_audioRing, g_pinState, periodSamples, periodUs == TZXCompat_EOF_PERIOD)) {
     // Buffer has overflowed
-    // printf("Audio buffer overflow\n");
-    // assert(false);
-    printf("^\n");
+    TZX_overflow();
   }
 
   // printf("+");
-
-  // uint32_t bufferCount = (g_audioBufferWriteIndex - g_audioBufferReadIndex);
-  // if (bufferCount > g_audioBufferLength - 1) {
-  //   bufferCount = (g_audioBufferLength - g_audioBufferReadIndex) + g_audioBufferWriteIndex;
-  // }
 }
 
 // Set the GPIO output pin low
@@ -298,13 +350,16 @@ void TZXCompat_setAudioHigh() {
 
 unsigned int TZXCompat_getTickMs(void) {
   // Get the current timer value in milliseconds
-  struct timespec spec;
+  return (unsigned int)(TZXCompat_getTickNs() / NSEC_PER_MSEC);
+}
 
-  clock_gettime(CLOCK_REALTIME, &spec);
+unsigned long long TZXCompat_getTickNs(void) {
+  // Get the current monotonic timer value in nanoseconds (unaffected by changes to the wall clock)
+  struct timespec spec;
 
-  unsigned int ms = (unsigned int)((spec.tv_sec * 1000) + (spec.tv_nsec / NSEC_PER_SEC));
+  clock_gettime(CLOCK_MONOTONIC, &spec);
 
-  return ms;
+  return (unsigned long long)spec.tv_sec * NSEC_PER_SEC + spec.tv_nsec;
 }
 
 /**
@@ -338,52 +393,7 @@ inline void TZXCompat_interrupts() {
 }
 
 //
-// File API
-//
-
-unsigned char TZXCompat_fileOpen(void *dir, unsigned int index, unsigned oflag) {
-  const char *pF = TZX_fileName;
-
-  g_pFile = fopen(pF, "rb");
-  if (g_pFile == NULL) {
-    TZX_filesize = 0;
-    return 0;
-  }
-
-  // Must set TZX_filesize
-  fseek(g_pFile, 0, SEEK_END);
-  TZX_filesize = ftell(g_pFile);
-  fseek(g_pFile, 0, SEEK_SET);
-
-  return 1;
-}
-
-void TZXCompat_fileClose() {
-  if (g_pFile != NULL) {
-    fclose(g_pFile);
-    g_pFile = NULL;
-  }
-}
-
-int TZXCompat_fileRead(void *buf, unsigned long count) {
-  if (g_pFile != NULL) {
-    return fread(buf, 1, count, g_pFile);
-  }
-
-  return 0;
-}
-
-unsigned char TZXCompat_fileSeekSet(unsigned long long pos) {
-  if (g_pFile != NULL) {
-    fseek(g_pFile, pos, SEEK_SET);
-    return 1;
-  }
-
-  return 0;
-}
-
-//
-// Log functions
+// Log functions (deferred while the implementation exists)
 //
 
 // Log a TZX message
@@ -392,9 +402,13 @@ void TZXCompat_log(const char *pFormat, ...) {
 
   // Log a message
   va_start(args, pFormat);
-  fprintf(stdout, "%s [%s] ", "TZX", "DEBUG");
-  vfprintf(stdout, pFormat, args);
-  fprintf(stdout, "\n");
+  if (!WriteDeferredLog("TZX", "DEBUG", pFormat, args)) {
+    va_end(args);
+    va_start(args, pFormat);
+    fprintf(stdout, "%s [%s] ", "TZX", "DEBUG");
+    vfprintf(stdout, pFormat, args);
+    fprintf(stdout, "\n");
+  }
   va_end(args);
 }
 
@@ -404,9 +418,13 @@ void zxtape_log(const char *pLevel, const char *pFormat, ...) {
 
   // Log a message
   va_start(args, pFormat);
-  fprintf(stdout, "%s [%s] ", "ZxTape", pLevel);
-  vfprintf(stdout, pFormat, args);
-  fprintf(stdout, "\n");
+  if (!WriteDeferredLog("ZxTape", pLevel, pFormat, args)) {
+    va_end(args);
+    va_start(args, pFormat);
+    fprintf(stdout, "%s [%s] ", "ZxTape", pLevel);
+    vfprintf(stdout, pFormat, args);
+    fprintf(stdout, "\n");
+  }
   va_end(args);
 }
 
@@ -414,97 +432,126 @@ void zxtape_log(const char *pLevel, const char *pFormat, ...) {
 // private functions
 //
 
-static void transferAudioBuffer(void *buffer, unsigned int bufferSize) {
-  // Lock the 'interrupt' mutex when calling the timer routine to block out the main loop thread
-  pthread_mutex_lock(&g_interruptMutex);
+/**
+ * Transfer the audio buffer to a CoreAudio buffer (called from the real-time audio thread)
+ *
+ * Wait-free, so the audio thread never waits for a refill: the lock is not taken, only the ring's published counts
+ * are shared with the producer, and the end of the tape is handed over to TZXCompat_poll().
+ */
+static void transferAudioBuffer(void *buffer, unsigned int frames, unsigned int channels,
+                                unsigned int bytesPerSample) {
+  // Mark the transfer before checking the audio is started, so stopTransfers() can wait for it
+  __atomic_store_n(&g_bAudioTransferring, true, __ATOMIC_SEQ_CST);
+  bool bStarted = __atomic_load_n(&g_bAudioStarted, __ATOMIC_SEQ_CST);
+
+  // Build the output frames if the format changed
+  if (channels != g_audioFormat.channels || bytesPerSample != g_audioFormat.bytesPerSample) {
+    if (bytesPerSample == 1) {
+      InitSpanFormat(&g_audioFormat, channels, bytesPerSample, AUDIO_SAMPLE_LOW_8, AUDIO_SAMPLE_HIGH_8);
+    } else {
+      InitSpanFormat(&g_audioFormat, channels, bytesPerSample, AUDIO_SAMPLE_LOW_16, AUDIO_SAMPLE_HIGH_16);
+    }
+  }
 
-  // If buffer is not ready, fill with silence
-  if (g_audioBufferReadIndex == g_audioBufferWriteIndex) {
-    memset(buffer, 0x00, bufferSize);
-    printf("W\n");
+  bool stopTape = false;
+  bool bEmpty = false;
+  uint32_t i = 0;
 
-  } else {
-    // printf("-");
-    bool stopTape = false;
-
-    int8_t *pBufferOut = (int8_t *)buffer;
-    // g_audioBufferReadIndex = 0;
-    // g_audioBufferWriteIndex = 0;
-    // g_audioBufferLastValue = 0;
-
-    bool bEmpty = false;
-
-    uint32_t i = 0;
-    AudioPinSample *aps = NULL;
-    int8_t value = g_audioBufferLastValue;
-    bool bEndOfAps = false;
-
-    while (i < bufferSize) {
-      if (aps == NULL) {
-        // If we don't have an AudioPinSample, get the next one from the buffer
-        if (g_audioBufferReadIndex != g_audioBufferWriteIndex) {
-          aps = &g_audioBuffer[g_audioBufferReadIndex];
-          value = g_audioBufferLastValue = aps->state ? 0xFF : 0x00;
-        } else {
-          // Buffer is empty
-          bEmpty = true;
-        }
-      }
-
-      if (!bEmpty) {
-        uint32_t samples = aps->samples;
-
-        // If we have an AudioPinSample, get the value, decrement the samples and check if we need to get the next one
-        if (aps->samples > 0) {
-          aps->samples--;
-
-          if (aps->samples == 0) {
-            bEndOfAps = true;
-          }
-        } else {
-          bEndOfAps = true;
-        }
-
-        // Set any signals
-        if (aps->signal == AudioBufferSignalStopTape) {
-          aps->signal = AudioBufferSignalNone;
-          stopTape = true;
-        }
-      }
-
-      // Handle end of AudioPinSample: Increment the read index and set the AudioPinSample to NULL
-      if (bEndOfAps) {
-        g_audioBufferReadIndex = (g_audioBufferReadIndex + 1) % g_audioBufferLength;
-        aps = NULL;
-        bEndOfAps = false;
-      }
-
-      // Set the value in the audio buffer
-      pBufferOut[i] = value;
-      i++;
-    }
+  if (bStarted) TZX_outputPull(frames, GetAudioRingCount(&g_audioRing), GetAudioRingCapacity(&g_audioRing));
 
-    uint32_t bufferCount = (g_audioBufferWriteIndex - g_audioBufferReadIndex);
-    if (bufferCount > g_audioBufferLength - 1) {
-      bufferCount = (g_audioBufferLength - g_audioBufferReadIndex) + g_audioBufferWriteIndex;
+  // Fill a span per period (or as much of it as fits)
+  while (bStarted && i < frames) {
+    uint32_t state, samples;
+    bool bStop;
+    if (!PeekAudioRing(&g_audioRing, &state, &samples, &bStop)) {
+      // Buffer is empty
+      bEmpty = true;
+      break;
     }
-    bool bPrint = ((double)rand() / RAND_MAX) * 100 < 10;  // Print 1 in 100 times
-    if (bPrint) printf("Buffer: %d\n", bufferCount);
+    g_audioBufferLastState = state;
+
+    // Set any signals
+    if (bStop) stopTape = true;
 
-    if (bEmpty) {
-      printf("E\n");
+    // Output as much of the period as fits (moving to the next period at the end of it)
+    samples = MIN(samples, frames - i);
+    FillSpan(&g_audioFormat, buffer, i, samples, state);
+    ConsumeAudioRing(&g_audioRing, samples);
+    i += samples;
+  }
+
+  // Hold the last level for the rest of the buffer
+  if (i < frames) {
+    FillSpan(&g_audioFormat, buffer, i, frames - i, g_audioBufferLastState);
+  }
+
+  if (!bStarted) {
+    // Stopped (the buffer may be being cleared)
+  } else if (bEmpty) {
+    // Only signal an underrun while playing (not paused), and once per underrun
+    if (g_audioBufferReady && !g_audioBufferUnderrun && !__atomic_load_n(&TZX_pauseOn, __ATOMIC_RELAXED)) {
+      g_audioBufferUnderrun = true;
+      TZX_underrun();
     }
+  } else {
+    g_audioBufferReady = true;
+    g_audioBufferUnderrun = false;
+  }
+
+  if (stopTape) {
+    // Stop the tape (from the control thread)
+    __atomic_store_n(&g_bStopTapePending, true, __ATOMIC_RELEASE);
+  }
+
+  // Wake the producer thread (once) when the buffer drops below the low watermark
+  PullAudioProducer(&g_producer, bStarted && g_audioBufferReady);
+
+  __atomic_store_n(&g_bAudioTransferring, false, __ATOMIC_RELEASE);
+}
+
+/**
+ * Stop the audio callback transferring the audio buffer, and wait for a transfer in progress, so it can be cleared
+ */
+static void stopTransfers() {
+  __atomic_store_n(&g_bAudioStarted, false, __ATOMIC_SEQ_CST);
+  while (__atomic_load_n(&g_bAudioTransferring, __ATOMIC_SEQ_CST)) sched_yield();
+}
 
-    if (stopTape) {
-      // Stop the tape
-      TZX_stopFile();
+static void *producerThread(void *arg) {
+  // The thread's log ring, so logging from the thread never allocates
+  AcquireDeferredLogRing();
+
+  while (g_producer.bRunning) {
+    // Sleep until below the low watermark, or until the retry period expires (e.g. when paused)
+    uint64_t retryNs = g_nProducerRetryNs;
+    if (retryNs > 0) {
+      struct mach_timespec ts;
+      ts.tv_sec = retryNs / NSEC_PER_SEC;
+      ts.tv_nsec = retryNs % NSEC_PER_SEC;
+      semaphore_timedwait(g_producerSem, ts);
+    } else {
+      semaphore_wait(g_producerSem);
     }
+
+    if (!g_producer.bRunning) break;  // Check if the thread is still running
+
+    g_nProducerRetryNs = 0;
+    RefillAudioProducer(&g_producer);
   }
 
-  // Unlock the mutex
-  pthread_mutex_unlock(&g_interruptMutex);
+  return (void *)0;
+}
 
-  // memset(buffer, g_pinState ? 0xFF : 0x00, bufferSize);
+static void signalProducer() {
+  semaphore_signal(g_producerSem);
+}
+
+static void lockInterrupt() {
+  pthread_mutex_lock(&g_interruptMutex);
+}
+
+static void unlockInterrupt() {
+  pthread_mutex_unlock(&g_interruptMutex);
 }
 
 // void createAudioThread(pthread_t thread) {
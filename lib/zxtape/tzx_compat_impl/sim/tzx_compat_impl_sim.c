@@ -0,0 +1,383 @@
+#include <sys/param.h>
+
+#include "../../../../include/tzx_compat_impl.h"
+#include "../../../../include/tzx_compat_impl_sim.h"
+#include "../common/audio_output.h"
+#include "../common/audio_producer.h"
+
+// Simulation (virtual clock) implementation
+//
+// There are no threads. The timer, the audio pull and the producer are deadlines on a virtual clock, which only moves
+// when the host calls TZXCompatSim_advance(). The clock jumps straight to each due deadline in turn, so a session runs
+// as fast as the TZX code can generate it, and always runs the same way for the same sequence of host calls.
+//
+// The output behaves like the real-time implementations: the audio pull consumes the buffer at the sample rate, the
+// timer fills it, and the producer (if enabled) refills it between the watermarks.
+
+#define NSEC_PER_SEC 1000000000ull
+#define NSEC_PER_MSEC 1000000ull
+
+#define AUDIO_BUFFER_LENGTH (1024 * 16)  // 16k periods (power of two)
+#define AUDIO_DEFAULT_SAMPLE_RATE 44100
+#define AUDIO_DEFAULT_INTERVAL_MS 10
+#define AUDIO_SAMPLE_LOW 0x00
+#define AUDIO_SAMPLE_HIGH 0xFF
+#define SIM_DEFAULT_START_TIME_NS NSEC_PER_SEC  // Start the clock at 1s, so 0 is never a valid time
+#define TIMER_FILL_MAX (TZX_buffsize / 2)       // Max periods per timer fill (TZXLoop() refills wbuffer in between)
+
+typedef enum SimDeadline_ {
+  SimDeadlineNone = 0,
+  SimDeadlineProducer = 1,
+  SimDeadlineTimer = 2,
+  SimDeadlineOutput = 3,
+} SimDeadline;
+
+/* Forward declarations */
+static void onTimer();
+static void onOutput();
+static void refillAudioBuffer();
+static void signalProducer();
+static bool isEarlierDeadline(uint64_t deadlineNs, SimDeadline next, uint64_t nextNs);
+
+/* Local variables */
+static TZX_SIM_CONFIG_T g_config = {
+    AUDIO_DEFAULT_SAMPLE_RATE, AUDIO_DEFAULT_INTERVAL_MS, SIM_DEFAULT_START_TIME_NS, false, NULL, NULL, NULL,
+};
+static TZX_SIM_STATS_T g_stats;
+
+static uint64_t g_nTimeNs = SIM_DEFAULT_START_TIME_NS;
+
+static bool g_bAudioTimerRunning = false;
+static uint64_t g_nAudioTimerDeadlineNs = 0;
+
+static uint64_t g_nOutputDeadlineNs = 0;
+static uint64_t g_nOutputIntervals = 0;
+static uint64_t g_nOutputSamplesDue = 0;
+static uint8_t *g_pOutputBuffer = NULL;
+static uint32_t g_outputBufferLength = 0;
+
+static AudioOutput g_output;
+
+static AudioProducer g_producer = {.pRing = &g_output.ring, .pfnWake = signalProducer};
+static bool g_bProducerPending = false;
+static uint64_t g_nProducerRetryDeadlineNs = 0;  // 0 = wait for the low watermark
+
+//
+// Simulation specific API
+//
+
+void TZXCompatSim_getDefaultConfig(TZX_SIM_CONFIG_T *pConfig) {
+  pConfig->nSampleRate = AUDIO_DEFAULT_SAMPLE_RATE;
+  pConfig->nIntervalMs = AUDIO_DEFAULT_INTERVAL_MS;
+  pConfig->nStartTimeNs = SIM_DEFAULT_START_TIME_NS;
+  pConfig->bLog = false;
+  pConfig->pfnSamples = NULL;
+  pConfig->pfnPulse = NULL;
+  pConfig->pUserData = NULL;
+}
+
+void TZXCompatSim_configure(const TZX_SIM_CONFIG_T *pConfig) {
+  memcpy(&g_config, pConfig, sizeof(TZX_SIM_CONFIG_T));
+
+  if (g_config.nSampleRate == 0) g_config.nSampleRate = AUDIO_DEFAULT_SAMPLE_RATE;
+  if (g_config.nIntervalMs == 0) g_config.nIntervalMs = AUDIO_DEFAULT_INTERVAL_MS;
+  if (g_config.nStartTimeNs == 0) g_config.nStartTimeNs = SIM_DEFAULT_START_TIME_NS;
+}
+
+/**
+ * Advance the virtual clock
+ *
+ * Runs every deadline (producer refill, timer, audio pull) due before the new time, in time order, moving the clock to
+ * each one as it is run. Deadlines already due run at the current time.
+ */
+void TZXCompatSim_advance(unsigned long long nDurationNs) {
+  uint64_t targetNs = g_nTimeNs + nDurationNs;
+
+  while (1) {
+    // Find the next deadline (due at the same time: producer, then timer, then output)
+    SimDeadline next = SimDeadlineNone;
+    uint64_t nextNs = targetNs;
+
+    if (g_bProducerPending) {
+      next = SimDeadlineProducer;
+      nextNs = g_nTimeNs;
+    } else if (g_producer.bRunning && g_nProducerRetryDeadlineNs != 0 && g_nProducerRetryDeadlineNs <= nextNs) {
+      next = SimDeadlineProducer;
+      nextNs = g_nProducerRetryDeadlineNs;
+    }
+    if (g_bAudioTimerRunning && isEarlierDeadline(g_nAudioTimerDeadlineNs, next, nextNs)) {
+      next = SimDeadlineTimer;
+      nextNs = g_nAudioTimerDeadlineNs;
+    }
+    if (isEarlierDeadline(g_nOutputDeadlineNs, next, nextNs)) {
+      next = SimDeadlineOutput;
+      nextNs = g_nOutputDeadlineNs;
+    }
+
+    // Move the clock (never backwards)
+    if (nextNs > g_nTimeNs) g_nTimeNs = nextNs;
+
+    switch (next) {
+      case SimDeadlineProducer:
+        g_bProducerPending = false;
+        g_nProducerRetryDeadlineNs = 0;
+        refillAudioBuffer();
+        break;
+      case SimDeadlineTimer:
+        onTimer();
+        break;
+      case SimDeadlineOutput:
+        onOutput();
+        break;
+      case SimDeadlineNone:
+      default:
+        return;
+    }
+  }
+}
+
+unsigned long long TZXCompatSim_getTimeNs(void) {
+  return TZXCompat_getTickNs();
+}
+
+void TZXCompatSim_getStats(TZX_SIM_STATS_T *pStats) {
+  memcpy(pStats, &g_stats, sizeof(TZX_SIM_STATS_T));
+}
+
+//
+// TZX Compat Implemetation
+//
+
+void TZXCompat_create(void) {
+  memset(&g_stats, 0, sizeof(g_stats));
+
+  g_nTimeNs = g_config.nStartTimeNs;
+
+  // Allocate the audio buffer (freed in TZXCompat_destroy)
+  bool bRing = InitAudioOutput(&g_output, AUDIO_BUFFER_LENGTH, g_config.nSampleRate, &g_producer);
+  assert(bRing);
+
+  // Allocate the output buffer (one interval, plus one sample for rounding)
+  g_outputBufferLength = g_config.nSampleRate * g_config.nIntervalMs / 1000 + 1;
+  g_pOutputBuffer = (uint8_t *)malloc(g_outputBufferLength);  // Freed in TZXCompat_destroy
+  assert(g_pOutputBuffer != NULL);
+  InitSpanFormat(&g_output.format, 1, 1, AUDIO_SAMPLE_LOW, AUDIO_SAMPLE_HIGH);
+
+  // Start the audio pull
+  g_nOutputIntervals = 0;
+  g_nOutputSamplesDue = 0;
+  g_nOutputDeadlineNs = g_nTimeNs + g_config.nIntervalMs * NSEC_PER_MSEC;
+
+  // Timer
+  g_bAudioTimerRunning = false;
+  g_nAudioTimerDeadlineNs = 0;
+}
+
+void TZXCompat_destroy(void) {
+  // Stop the producer (if running)
+  TZXCompat_producerStop();
+
+  // Free the buffers
+  free(g_pOutputBuffer);
+  g_pOutputBuffer = NULL;
+  DeinitAudioOutput(&g_output);
+}
+
+void TZXCompat_start(void) {
+  // Clear the audio buffer, and start output
+  StartAudioOutput(&g_output);
+}
+
+void TZXCompat_stop(void) {
+  // Stop output, and clear the audio buffer
+  StopAudioOutput(&g_output);
+  g_bProducerPending = false;
+  g_nProducerRetryDeadlineNs = 0;
+}
+
+void TZXCompat_poll(void) {
+  // Stop the tape once the output has played the end of it (handed over, as from the real-time implementations)
+  PollAudioOutput(&g_output);
+}
+
+void TZXCompat_timerInitialize(void) {
+  // Initialise / reset the timer
+
+  // Stop the timer if it is running
+  TZXCompat_timerStop();
+
+  // Nothing else to do
+}
+
+void TZXCompat_timerStartAt(unsigned long long deadlineNs) {
+  // If the producer is running, it refills the buffer, and the timer is not used
+  if (g_producer.bRunning) {
+    if (g_producer.bRefilling) {
+      // Called from the refill, retry at the deadline if nothing could be buffered
+      g_nProducerRetryDeadlineNs = deadlineNs > g_nTimeNs ? deadlineNs : 0;
+    } else {
+      // Tape started, fill the buffer
+      WakeAudioProducer(&g_producer);
+    }
+    return;
+  }
+
+  g_bAudioTimerRunning = true;
+  g_nAudioTimerDeadlineNs = deadlineNs;
+}
+
+void TZXCompat_timerStop(void) {
+  // Stop the timer
+  g_bAudioTimerRunning = false;
+  g_nAudioTimerDeadlineNs = 0;
+}
+
+/**
+ * Start the producer
+ *
+ * The producer runs (at the current virtual time) when the audio pull drains the buffer below the low watermark, and
+ * refills it up to the high watermark.
+ */
+void TZXCompat_producerStart(unsigned int nLowWatermarkPercent, unsigned int nHighWatermarkPercent) {
+  if (g_producer.bRunning) return;
+
+  g_bProducerPending = false;
+  g_nProducerRetryDeadlineNs = 0;
+
+  StartAudioProducer(&g_producer, nLowWatermarkPercent, nHighWatermarkPercent);
+}
+
+/**
+ * Stop the producer
+ */
+void TZXCompat_producerStop(void) {
+  StopAudioProducer(&g_producer);
+  g_bProducerPending = false;
+  g_nProducerRetryDeadlineNs = 0;
+}
+
+void TZXCompat_buffer(unsigned long periodUs) {
+  if (g_config.pfnPulse) g_config.pfnPulse((unsigned char)g_output.pinState, periodUs, g_config.pUserData);
+
+  BufferAudioOutput(&g_output, periodUs);
+}
+
+// Set the GPIO output pin low
+void TZXCompat_setAudioLow() {
+  g_output.pinState = 0;
+}
+
+// Set the GPIO output pin high
+void TZXCompat_setAudioHigh() {
+  g_output.pinState = 1;
+}
+
+unsigned int TZXCompat_getTickMs(void) {
+  // Get the clock in milliseconds
+  return (unsigned int)(TZXCompat_getTickNs() / NSEC_PER_MSEC);
+}
+
+unsigned long long TZXCompat_getTickNs(void) {
+  // Get the virtual clock in nanoseconds
+  return g_nTimeNs;
+}
+
+/**
+ * Delay a number of milliseconds in a busy loop
+ */
+void TZXCompat_delay(unsigned long ms) {
+  //
+}
+
+/**
+ * Disable interrupts
+ *
+ * Nothing to do, everything runs on the host thread
+ */
+void TZXCompat_noInterrupts() {
+  //
+}
+
+/**
+ * Re-enable interrupts
+ *
+ * Nothing to do, everything runs on the host thread
+ */
+void TZXCompat_interrupts() {
+  //
+}
+
+//
+// Log functions (stderr, only if enabled)
+//
+
+// Log a TZX message
+void TZXCompat_log(const char *pFormat, ...) {
+  va_list args;
+
+  if (!g_config.bLog) return;
+
+  // Log a message
+  va_start(args, pFormat);
+  fprintf(stderr, "%s [%s] ", "TZX", "DEBUG");
+  vfprintf(stderr, pFormat, args);
+  fprintf(stderr, "\n");
+  va_end(args);
+}
+
+// Log a zxtape message
+void zxtape_log(const char *pLevel, const char *pFormat, ...) {
+  va_list args;
+
+  if (!g_config.bLog) return;
+
+  // Log a message
+  va_start(args, pFormat);
+  fprintf(stderr, "%s [%s] ", "ZxTape", pLevel);
+  vfprintf(stderr, pFormat, args);
+  fprintf(stderr, "\n");
+  va_end(args);
+}
+
+//
+// private functions
+//
+
+static void onTimer() {
+  g_bAudioTimerRunning = false;
+  g_stats.nTimerFires++;
+
+  // The virtual clock is always exactly on time
+  TZX_timerLate(0);
+
+  // Fill the free space in the buffer
+  TZXCompat_waveOrBuffer(true, MIN(GetAudioRingSpace(&g_output.ring), TIMER_FILL_MAX), 1000 * 1000);
+}
+
+static void onOutput() {
+  // Samples for this interval (calculated from the start, so rounding does not accumulate)
+  g_nOutputIntervals++;
+  uint64_t samplesTotal = g_nOutputIntervals * g_config.nIntervalMs * g_config.nSampleRate / 1000;
+  uint32_t samples = (uint32_t)MIN(samplesTotal - g_nOutputSamplesDue, g_outputBufferLength);
+  g_nOutputSamplesDue = samplesTotal;
+  g_nOutputDeadlineNs += g_config.nIntervalMs * NSEC_PER_MSEC;
+
+  if (!TransferAudioOutput(&g_output, g_pOutputBuffer, samples)) return;
+  g_stats.nSamplesWritten += samples;
+
+  if (g_config.pfnSamples) g_config.pfnSamples(g_pOutputBuffer, samples, g_config.pUserData);
+}
+
+static void refillAudioBuffer() {
+  g_stats.nRefills++;
+  RefillAudioProducer(&g_producer);
+}
+
+static void signalProducer() {
+  g_bProducerPending = true;
+}
+
+static bool isEarlierDeadline(uint64_t deadlineNs, SimDeadline next, uint64_t nextNs) {
+  // Before the next deadline found so far, or (if none found) no later than the target time
+  return next == SimDeadlineNone ? deadlineNs <= nextNs : deadlineNs < nextNs;
+}
@@ -3,32 +3,105 @@
 // #include <zxtape/zxtape.h>
 
 #include "../../include/tzx_compat_impl.h"
+#include "./bits/zxtape_bits.h"
+#include "./ear/zxtape_ear.h"
+#include "./event/zxtape_event.h"
 #include "./file/zxtape_file_api_buffer.h"
 #include "./file/zxtape_file_api_dummy.h"
 #include "./file/zxtape_file_api_file.h"
 #include "./info/zxtape_info.h"
+#include "./render/zxtape_render.h"
 #include "./tzx_compat/tzx_compat.h"
 
+#ifndef __ZX_TAPE_CIRCLE__
+#include <pthread.h>
+#endif  // __ZX_TAPE_CIRCLE__
+
 // Maximum length for long filename support (ideally as large as possible to support very long filenames)
 // #define ZX_TAPE_MAX_FILENAME_LEN 1023
 
-#define ZX_TAPE_CONTROL_UPDATE_MS 100       // 100 ms (could be 0)
-#define ZX_TAPE_END_PLAYBACK_DELAY_MS 3000  // 3 seconds (could be longer by up to ZX_TAPE_CONTROL_UPDATE_MS)
+#define ZX_TAPE_CONTROL_UPDATE_MS 100                          // 100 ms (could be 0)
+#define ZX_TAPE_END_PLAYBACK_DELAY_MS 3000                     // 3 seconds (could be longer by up to ZX_TAPE_CONTROL_UPDATE_MS)
+#define ZX_TAPE_PRODUCER_LOW_WATERMARK_PERCENT 25              // Default producer low watermark (% of output buffer)
+#define ZX_TAPE_PRODUCER_HIGH_WATERMARK_PERCENT 75             // Default producer high watermark (% of output buffer)
+#define ZX_TAPE_PULSE_QUEUE_LENGTH 256                         // Pulses generated at a time in render mode
+#define ZX_TAPE_SINK_BATCHES_PER_RUN 64                        // Batches of pulses written to the sink by each zxtape_run()
+#define ZX_TAPE_EDGE_BATCH_MAX (ZXTAPE_EDGE_BATCH_LENGTH * 4)  // Most edges per edge scheduler batch
+#define ZX_TAPE_BLOCK_MARK_QUEUE_LENGTH 64                     // Block starts generated but not yet taken (must be a power of 2)
+#define ZX_TAPE_BLOCK_MARK_QUEUE_MASK (ZX_TAPE_BLOCK_MARK_QUEUE_LENGTH - 1)
+
+typedef struct _ZXTAPE_BLOCK_MARK_T {
+  u64 nTapeTimeUs;  // Position of the block start on the tape output timeline
+  u32 nBlockIndex;
+} ZXTAPE_BLOCK_MARK_T;
 
 typedef struct _ZXTAPE_T {
   ZXTAPE_HANDLE_T handle;
   ZXTAPE_STATUS_T status;
+  bool bInitialized;
   bool bLoaded;
   bool bRunning;
   bool bButtonPlayPause;
   bool bButtonStop;
   bool bEndPlayback;
+  bool bProducer;
+  bool bRender;
   unsigned nEndPlaybackDelay;
   const unsigned char *pGame;
   u32 nGameSize;
+  char filename[ZX_TAPE_MAX_FILENAME_LEN + 1];  // Filename of the loaded tape
+
+  // State of the TZX library and file API while another instance has them (see enterEngine())
+  void *pEngineState;
+  ZXTAPE_FILE_API_BUFFER_STATE_T fileBufferState;
 
   unsigned nlastTimerMs;
 
+  // Tape info (block / section index)
+  ZXTAPE_INFO_T info;
+  ZXTAPE_INFO_T *pInfo;  // &info once a tape is loaded
+  u32 nStartBlockIndex;  // Block playback starts from (see zxtape_setStartBlock())
+
+  // Current position (for events)
+  u32 nBlockIndex;
+  u32 nSectionIndex;
+  u8 nBlockId;
+
+  // Events
+  ZXTAPE_EVENT_QUEUE_T events;
+  ZXTAPE_EVENT_CALLBACK_T pfnEventCallback;
+  ZXTAPE_EVENT_NOTIFY_T pfnEventNotify;
+  void *pEventUserData;
+
+  // Render mode (pulses generated on demand by zxtape_render())
+  ZXTAPE_RENDER_T render;
+  ZXTAPE_BITS_T bits;
+  ZXTAPE_PULSE_T pulses[ZX_TAPE_PULSE_QUEUE_LENGTH];
+  u32 nPulseCount;
+  u32 nPulseIndex;
+  ZXTAPE_EAR_T ear;
+  u32 nEarClockHz;
+
+  // Render mode position of the pulses taken (blocks start when generated, which runs ahead of the pulses taken)
+  ZXTAPE_BLOCK_MARK_T blockMarks[ZX_TAPE_BLOCK_MARK_QUEUE_LENGTH];
+  u32 nBlockMarkWriteIndex;
+  u32 nBlockMarkReadIndex;
+  u32 nPulseBlockIndex;
+  u64 nPulseTimeUs;
+
+  // Render mode output sink (pulses pushed by zxtape_run()), or NULL
+  ZXTAPE_SINK_T sink;
+  bool bSink;
+  bool bSinkEnd;  // Playback stopped, the sink is told when the engine is left (see leaveEngine())
+
+  // Render mode edge scheduler (edges at absolute times pushed by zxtape_run()), or NULL
+  ZXTAPE_EDGE_SCHEDULER_T scheduler;
+  bool bScheduler;
+  bool bSchedulerEnd;  // Playback stopped, the scheduler is told when the engine is left (see leaveEngine())
+  ZXTAPE_EDGE_T edges[ZX_TAPE_EDGE_BATCH_MAX];
+  u64 nEdgeTimeNs;  // Time of the end of the last pulse scheduled (0 = timeline not started)
+  u8 nEdgeLevel;    // Level of the last edge scheduled
+
   // Callbacks
   TZX_CALLBACKS_T callbacks;
 } ZXTAPE_T;
@@ -51,35 +124,77 @@ typedef struct _INSTANCE_LIST_T {
 /* Local global variables */
 static INSTANCE_LIST_T *g_pInstanceList = NULL;
 static u32 g_nInstanceId = 0;
+static u32 g_nInstanceCount = 0;
+static u32 g_nInitializedCount = 0;      // Instances initialised (the compatibility layer is shared by them)
+static ZXTAPE_T *g_pEngineOwner = NULL;  // Instance whose state is in the TZX library and file API
+static ZXTAPE_T *g_pFileOwner = NULL;    // Instance whose tape is read by the platform file API (a single file)
+static u32 g_nEngineDepth = 0;           // Nested enterEngine() calls (the sink is only called outside the engine)
+#ifndef __ZX_TAPE_CIRCLE__
+// Serialises the instances' use of the TZX library (recursive, as exported functions call each other)
+static pthread_once_t g_engineLockOnce = PTHREAD_ONCE_INIT;
+static pthread_mutex_t g_engineLock;
+// Serialises reading tapes (zxtape_info.c keeps its state in globals), which is not always done in the engine
+static pthread_mutex_t g_infoLock = PTHREAD_MUTEX_INITIALIZER;
+#endif  // __ZX_TAPE_CIRCLE__
 
 // External functions
 // extern zxtape_log(const char *pMessage);
 
 /* Forward function declarations */
 static void endPlayback(ZXTAPE_T *pZxTape);
+static void onBlockStart(ZXTAPE_T *pZxTape, u8 id, u32 offset, u64 tapeTimeUs);
+static void onStopTape(ZXTAPE_T *pZxTape, bool b48kOnly, u64 tapeTimeUs);
+static void onPauseStart(ZXTAPE_T *pZxTape, u32 pauseMs, u64 tapeTimeUs);
+static void onEndOfData(ZXTAPE_T *pZxTape, u64 tapeTimeUs);
+static void onUnderrun(ZXTAPE_T *pZxTape);
+static void onRefill(ZXTAPE_T *pZxTape, u32 nBufferLen);
+static void onPulse(ZXTAPE_T *pZxTape, u8 nLevel, u32 nPeriodUs);
+static bool nextPulse(ZXTAPE_T *pZxTape, ZXTAPE_PULSE_T *pPulse);
+static bool generatePulses(ZXTAPE_T *pZxTape);
+static u64 writeSink(ZXTAPE_T *pZxTape, unsigned nMaxBatches, u64 nMaxUs);
+static void scheduleEdges(ZXTAPE_T *pZxTape);
+static void resetPulses(ZXTAPE_T *pZxTape);
+static void raiseEvent(ZXTAPE_T *pZxTape, ZXTAPE_EVENT_TYPE_T type, u64 tapeTimeUs, u32 nValue);
 static void loopPlayback(ZXTAPE_T *pZxTape);
 static void loopControl(ZXTAPE_T *pZxTape, unsigned nIntervalMs);
+static void handleControls(ZXTAPE_T *pZxTape, unsigned nElapsedMs);
 static void playFile(ZXTAPE_T *pZxTape);
 static void stopFile(ZXTAPE_T *pZxTape);
 static bool checkButtonPlayPause(ZXTAPE_T *pZxTape);
 static bool checkButtonStop(ZXTAPE_T *pZxTape);
+static void lockProducer(ZXTAPE_T *pZxTape);
+static void unlockProducer(ZXTAPE_T *pZxTape);
+static void lockEngine(void);
+static void unlockEngine(void);
+static void enterEngine(ZXTAPE_T *pZxTape);
+static void leaveEngine(void);
+static void lockInfo(void);
+static void unlockInfo(void);
 
 /* Exported functions */
 
 /**
  * Create a new ZxTape instance
  *
- * Only one instance is allowed
+ * Instances take turns with the TZX library, which keeps its state in globals: each instance has a copy of the state,
+ * switched in when it is used (see enterEngine()), and calls for different instances are serialised. Any number of
+ * instances can play in render mode, but playing to the device (the output of the compatibility layer) is only
+ * possible when there is one instance, so an instance cannot be created while one is.
  *
- * @return ZXTAPE_HANDLE_T* Pointer to the new ZxTape instance
+ * @return ZXTAPE_HANDLE_T* Pointer to the new ZxTape instance, or NULL if an instance is playing to the device
  */
 ZXTAPE_HANDLE_T *zxtape_create() {
   zxtape_log_info("Creating ZX TAPE instance");
 
-  // Only one instance is allowed
-  if (g_pInstanceList != NULL) {
-    zxtape_log_error("Only one ZX TAPE instance is allowed");
-    assert(g_pInstanceList == NULL);
+  lockEngine();
+
+  // The device output cannot be shared
+  for (INSTANCE_LIST_T *pListItem = g_pInstanceList; pListItem != NULL; pListItem = pListItem->pNext) {
+    if (pListItem->pInstance->bRunning && !pListItem->pInstance->bRender) {
+      zxtape_log_error("Cannot create a ZX TAPE instance while an instance is playing to the device");
+      unlockEngine();
+      return NULL;
+    }
   }
 
   ZXTAPE_T *pInstance = (ZXTAPE_T *)malloc(sizeof(ZXTAPE_T));
@@ -96,23 +211,58 @@ ZXTAPE_HANDLE_T *zxtape_create() {
     pInstance->status.bPaused = false;
     pInstance->status.nTrack = 0;
     pInstance->status.nPosition = 0;
-    pInstance->status.pFilename = "";
+    pInstance->status.pFilename = pInstance->filename;
     pInstance->status.nTrackCount = 0;
     pInstance->status.nLength = 0;
+    pInstance->status.nTimerLateNs = 0;
+    pInstance->status.nTimerMaxLateNs = 0;
 
+    pInstance->bInitialized = false;
     pInstance->bLoaded = false;
     pInstance->bRunning = false;
     pInstance->bButtonPlayPause = false;
     pInstance->bButtonStop = false;
     pInstance->bEndPlayback = false;
+    pInstance->bProducer = false;
+    pInstance->bRender = false;
     pInstance->nEndPlaybackDelay = 0;
     pInstance->pGame = NULL;
     pInstance->nGameSize = 0;
+    pInstance->filename[0] = 0;
+
+    pInstance->pEngineState = TZXCompatInternal_createState();
+    memset(&pInstance->fileBufferState, 0, sizeof(ZXTAPE_FILE_API_BUFFER_STATE_T));
 
     pInstance->nlastTimerMs = 0;
 
+    memset(&pInstance->info, 0, sizeof(ZXTAPE_INFO_T));
+    pInstance->pInfo = NULL;
+    pInstance->nStartBlockIndex = 0;
+    pInstance->nBlockIndex = ZXTAPE_INDEX_NONE;
+    pInstance->nSectionIndex = ZXTAPE_INDEX_NONE;
+    pInstance->nBlockId = 0;
+
+    pInstance->nEarClockHz = ZXTAPE_EAR_CLOCK_HZ;
+    pInstance->bSink = false;
+    pInstance->bSinkEnd = false;
+    pInstance->bScheduler = false;
+    pInstance->bSchedulerEnd = false;
+    resetPulses(pInstance);
+
+    zxtapeEvent_initialize(&pInstance->events);
+    pInstance->pfnEventCallback = NULL;
+    pInstance->pfnEventNotify = NULL;
+    pInstance->pEventUserData = NULL;
+
     // Set the callbacks
     pInstance->callbacks.endPlayback = (void (*)(void *))endPlayback;
+    pInstance->callbacks.blockStart = (void (*)(void *, u8, u32, u64))onBlockStart;
+    pInstance->callbacks.stopTape = (void (*)(void *, bool, u64))onStopTape;
+    pInstance->callbacks.pauseStart = (void (*)(void *, u32, u64))onPauseStart;
+    pInstance->callbacks.endOfData = (void (*)(void *, u64))onEndOfData;
+    pInstance->callbacks.underrun = (void (*)(void *))onUnderrun;
+    pInstance->callbacks.refill = (void (*)(void *, u32))onRefill;
+    pInstance->callbacks.pulse = (void (*)(void *, u8, u32))onPulse;
 
     // Add the instance to the list
     INSTANCE_LIST_T *pNewListItem = (INSTANCE_LIST_T *)malloc(sizeof(INSTANCE_LIST_T));
@@ -122,9 +272,12 @@ ZXTAPE_HANDLE_T *zxtape_create() {
       pNewListItem->pInstance = pInstance;
       pNewListItem->pNext = g_pInstanceList;
       g_pInstanceList = pNewListItem;
+      g_nInstanceCount++;
     }
   }
 
+  unlockEngine();
+
   return (ZXTAPE_HANDLE_T *)pInstance;
 }
 
@@ -137,31 +290,48 @@ void zxtape_destroy(ZXTAPE_HANDLE_T *pInstance) {
   zxtape_log_info("Destroying ZX TAPE instance");
   assert(pInstance != NULL);
 
+  lockEngine();
+
   // Check if the instance is in the list
   ZXTAPE_HANDLE_T *pFoundInstance = NULL;
   INSTANCE_LIST_T *pListItem = g_pInstanceList;
-  INSTANCE_LIST_T *pListPrev = g_pInstanceList;
+  INSTANCE_LIST_T *pListPrev = NULL;
   while (pListItem) {
     if (pListItem->pInstance == (ZXTAPE_T *)pInstance) {
       pFoundInstance = pInstance;
       break;
     } else {
+      pListPrev = pListItem;
       pListItem = pListItem->pNext;
     }
-    pListPrev = pListItem;
   }
 
   // Ensure the instance was found
   assert(pFoundInstance != NULL);
 
+  // Release the compatibility layer (created in zxtape_init, by the first instance)
+  ZXTAPE_T *pZxTape = pListItem->pInstance;
+  if (pZxTape->bInitialized && --g_nInitializedCount == 0) TZXCompat_destroy();
+
   // If the instance was found, free it, and remove it from the list
+  if (g_pEngineOwner == pZxTape) g_pEngineOwner = NULL;
+  if (g_pFileOwner == pZxTape) g_pFileOwner = NULL;
+  TZXCompatInternal_destroyState(pZxTape->pEngineState);
+  zxtapeInfo_freeInfo(&pZxTape->info);
 
   // Free instance
-  free(pListItem->pInstance);
+  free(pZxTape);
 
   // Remove from list
-  pListPrev->pNext = pListItem->pNext;
+  if (pListPrev) {
+    pListPrev->pNext = pListItem->pNext;
+  } else {
+    g_pInstanceList = pListItem->pNext;
+  }
   free(pListItem);
+  g_nInstanceCount--;
+
+  unlockEngine();
 }
 
 /**
@@ -177,22 +347,36 @@ void zxtape_init(ZXTAPE_HANDLE_T *pInstance) {
   zxtape_log_info("Initializing ZX TAPE");
   assert(pInstance != NULL);
 
+  enterEngine(pZxTape);
+
+  // The compatibility layer implementation is shared by the instances (created with the first)
+  if (!pZxTape->bInitialized && g_nInitializedCount++ == 0) TZXCompat_create();
+
   TZXCompatInternal_initialize(pInstance, &pZxTape->callbacks);
+  pZxTape->bInitialized = true;
+
+  leaveEngine();
 }
 
 void zxtape_status(ZXTAPE_HANDLE_T *pInstance, ZXTAPE_STATUS_T *pStatus) {
   assert(pInstance != NULL);
   ZXTAPE_T *pZxTape = (ZXTAPE_T *)pInstance;
 
+  enterEngine(pZxTape);
+
   // Update the status
   pZxTape->status.bLoaded = zxtape_isLoaded(pInstance);
   pZxTape->status.bRewound = zxtape_isRewound(pInstance);
   pZxTape->status.bPlaying = zxtape_isPlaying(pInstance);
   pZxTape->status.bPaused = zxtape_isPaused(pInstance);
-  pZxTape->status.pFilename = TZX_fileName;
+  pZxTape->status.pFilename = pZxTape->filename;
+  pZxTape->status.nTimerLateNs = TZX_timerLateNs;
+  pZxTape->status.nTimerMaxLateNs = TZX_timerMaxLateNs;
 
   // Return a copy of the current status
   memcpy(pStatus, &pZxTape->status, sizeof(ZXTAPE_STATUS_T));
+
+  leaveEngine();
 }
 
 // TODO - how to handle loading from a file or buffer?
@@ -209,19 +393,37 @@ void zxtape_loadBuffer(ZXTAPE_HANDLE_T *pInstance, const char *pFilename, const
   // Stop the tape if it it playing
   pZxTape->bButtonStop = true;
 
+  // Analyse the tape before taking the engine, so a large tape does not hold up the other instances
+  ZXTAPE_INFO_T info;
+  memset(&info, 0, sizeof(ZXTAPE_INFO_T));
+  lockInfo();
+  zxtapeInfo_loadInfoBuffer(&info, pFilename, pTapeBuffer, nTapeBufferLen);
+  unlockInfo();
+
+  enterEngine(pZxTape);
+  if (g_pFileOwner == pZxTape) g_pFileOwner = NULL;
+
   // TZX_fileName, TZX_filesize are externs used by tzx
+  lockProducer(pZxTape);
   strncpy(TZX_fileName, pFilename, ZX_TAPE_MAX_FILENAME_LEN);
+  strncpy(pZxTape->filename, pFilename, ZX_TAPE_MAX_FILENAME_LEN);
   TZX_filesize = nTapeBufferLen;
 
   // Initialise TZX_dir and TZX_entry
   zxtapeFileApiDummy_initialize(&TZX_dir);
   zxtapeFileApiBuffer_initialize(&TZX_entry, pTapeBuffer, nTapeBufferLen);
+  pZxTape->pGame = pTapeBuffer;
+  pZxTape->nGameSize = nTapeBufferLen;
 
-  // Analyse the file
-  ZXTAPE_INFO_T *pInfo;
-  zxtapeInfo_loadInfo(&pInfo);
+  // Replace the info of the previous tape
+  zxtapeInfo_freeInfo(&pZxTape->info);
+  pZxTape->info = info;
+  pZxTape->pInfo = &pZxTape->info;
+  pZxTape->nStartBlockIndex = 0;
+  unlockProducer(pZxTape);
+  leaveEngine();
 
-  zxtapeInfo_printInfo(pInfo);
+  zxtapeInfo_printInfo(pZxTape->pInfo);
 
   // TODO - check if the file is a valid TAP/TZX file
   // (NOTE, is it possible to check TAP files for validity?)
@@ -238,28 +440,49 @@ bool zxtape_loadFile(ZXTAPE_HANDLE_T *pInstance, const char *pFilename) {
 
   zxtape_log_debug("Loading TAPE (file): %s", pFilename);
 
+  enterEngine(pZxTape);
+
+  // The platform file API reads a single file
+  if (g_pFileOwner != NULL && g_pFileOwner != pZxTape) {
+    leaveEngine();
+    zxtape_log_error("Another instance has a tape loaded from a file (load from a buffer instead): %s", pFilename);
+    return false;
+  }
+
   // Stop the tape if it it playing
   pZxTape->bButtonStop = true;
 
   // TZX_fileName, TZX_filesize are externs used by tzx
+  lockProducer(pZxTape);
   strncpy(TZX_fileName, pFilename, ZX_TAPE_MAX_FILENAME_LEN);
+  strncpy(pZxTape->filename, pFilename, ZX_TAPE_MAX_FILENAME_LEN);
 
   // Initialise TZX_dir and TZX_entry
   zxtapeFileApiDummy_initialize(&TZX_dir);
   zxtapeFileApiFile_initialize(&TZX_entry);
+  pZxTape->pGame = NULL;
+  pZxTape->nGameSize = 0;
 
   // Open the file, will set the filesize
   bool res = TZXCompat_fileOpen(NULL, 0, 0);
   if (!res) {
+    unlockProducer(pZxTape);
+    leaveEngine();
     zxtape_log_error("Failed to open file: %s", pFilename);
     return false;
   }
+  g_pFileOwner = pZxTape;
 
   // Analyse the file
-  ZXTAPE_INFO_T *pInfo;
-  zxtapeInfo_loadInfo(&pInfo);
-
-  zxtapeInfo_printInfo(pInfo);
+  lockInfo();
+  zxtapeInfo_loadInfo(&pZxTape->info);
+  unlockInfo();
+  pZxTape->pInfo = &pZxTape->info;
+  pZxTape->nStartBlockIndex = 0;
+  unlockProducer(pZxTape);
+  leaveEngine();
+
+  zxtapeInfo_printInfo(pZxTape->pInfo);
   // TODO - check if the file is a valid TAP/TZX file
   // (NOTE, is it possible to check TAP files for validity?)
 
@@ -269,6 +492,77 @@ bool zxtape_loadFile(ZXTAPE_HANDLE_T *pInstance, const char *pFilename) {
   return true;
 }
 
+/**
+ * Get the number of blocks in the loaded tape
+ *
+ * @param pInstance Pointer to the ZxTape instance
+ * @return u32 Number of blocks (0 if no tape is loaded)
+ */
+u32 zxtape_getBlockCount(ZXTAPE_HANDLE_T *pInstance) {
+  assert(pInstance != NULL);
+  ZXTAPE_T *pZxTape = (ZXTAPE_T *)pInstance;
+
+  if (!pZxTape->bLoaded || pZxTape->pInfo == NULL) return 0;
+
+  return pZxTape->pInfo->blockCount;
+}
+
+/**
+ * Get the payload of a data block of the loaded tape, without playing it
+ *
+ * For instant loading (e.g. ROM traps in emulators) and extracting data from tapes: the decoded bytes of a TZX
+ * standard speed, turbo speed or pure data block, or of a TAP file block, straight from the file. When the tape was
+ * loaded from a buffer the payload points into it (no copy, and pBuffer may be NULL). Otherwise the payload is read
+ * into pBuffer if it fits; if not, pData->pData is NULL and pData->nLength is the buffer size required. Can be called
+ * while the tape is playing.
+ *
+ * @param pInstance Pointer to the ZxTape instance
+ * @param nBlockIndex Index of the block (see zxtape_getBlockCount())
+ * @param pData Block data (set on success)
+ * @param pBuffer Buffer for the payload (if the tape was loaded from a file)
+ * @param nBufferLen Length of pBuffer
+ * @return true if the block is a data block, false if not (only pData->nBlockId is set, and pData->nPauseMs for a
+ * pause block), or it could not be read
+ */
+bool zxtape_getBlockData(ZXTAPE_HANDLE_T *pInstance, u32 nBlockIndex, ZXTAPE_BLOCK_DATA_T *pData, u8 *pBuffer,
+                         u32 nBufferLen) {
+  assert(pInstance != NULL);
+  ZXTAPE_T *pZxTape = (ZXTAPE_T *)pInstance;
+
+  assert(pData != NULL);
+
+  if (!pZxTape->bLoaded) return false;
+
+  // The file position is shared with playback (which always seeks before reading), so hold off the producer
+  enterEngine(pZxTape);
+  lockProducer(pZxTape);
+  lockInfo();
+  bool res = zxtapeInfo_getBlockData(pZxTape->pInfo, nBlockIndex, pZxTape->pGame, pData, pBuffer, nBufferLen);
+  unlockInfo();
+  unlockProducer(pZxTape);
+  leaveEngine();
+
+  return res;
+}
+
+/**
+ * Set the block playback starts from, for the next time the tape is played from the start (reset when a tape is
+ * loaded)
+ *
+ * Playback starts as it would after the pause ending the previous block (output low, the first pulse not toggling it,
+ * and no start wait before it), so the signal from the block on is the same as when played from the start, provided
+ * the previous block ends with a pause. Used to render parts of a tape independently (see zxtape_convertToWav()).
+ *
+ * @param pInstance Pointer to the ZxTape instance
+ * @param nBlockIndex Index of the block (0 for the start of the tape)
+ */
+void zxtape_setStartBlock(ZXTAPE_HANDLE_T *pInstance, u32 nBlockIndex) {
+  assert(pInstance != NULL);
+  ZXTAPE_T *pZxTape = (ZXTAPE_T *)pInstance;
+
+  pZxTape->nStartBlockIndex = nBlockIndex;
+}
+
 void zxtape_playPause(ZXTAPE_HANDLE_T *pInstance) {
   assert(pInstance != NULL);
   ZXTAPE_T *pZxTape = (ZXTAPE_T *)pInstance;
@@ -343,7 +637,13 @@ bool zxtape_isStarted(ZXTAPE_HANDLE_T *pInstance) {
 bool zxtape_isPlaying(ZXTAPE_HANDLE_T *pInstance) {
   assert(pInstance != NULL);
   ZXTAPE_T *pZxTape = (ZXTAPE_T *)pInstance;
-  return pZxTape->bRunning && !TZX_pauseOn;
+  if (!pZxTape->bRunning) return false;
+
+  enterEngine(pZxTape);
+  bool bPlaying = !TZX_pauseOn;
+  leaveEngine();
+
+  return bPlaying;
 }
 
 /**
@@ -353,7 +653,13 @@ bool zxtape_isPlaying(ZXTAPE_HANDLE_T *pInstance) {
 bool zxtape_isPaused(ZXTAPE_HANDLE_T *pInstance) {
   assert(pInstance != NULL);
   ZXTAPE_T *pZxTape = (ZXTAPE_T *)pInstance;
-  return pZxTape->bRunning && TZX_pauseOn;
+  if (!pZxTape->bRunning) return false;
+
+  enterEngine(pZxTape);
+  bool bPaused = TZX_pauseOn;
+  leaveEngine();
+
+  return bPaused;
 }
 
 /**
@@ -365,11 +671,405 @@ void zxtape_run(ZXTAPE_HANDLE_T *pInstance, unsigned nIntervalMs) {
   assert(pInstance != NULL);
   ZXTAPE_T *pZxTape = (ZXTAPE_T *)pInstance;
 
+  // Render mode sink (written outside the engine, see writeSink())
+  if (pZxTape->bRender && pZxTape->bSink) writeSink(pZxTape, ZX_TAPE_SINK_BATCHES_PER_RUN, ~0ull);
+
+  enterEngine(pZxTape);
+
   // Playback loop
   loopPlayback(pZxTape);
 
   //  Control loop
   loopControl(pZxTape, nIntervalMs);
+
+  leaveEngine();
+}
+
+/**
+ * Set the event callback
+ *
+ * Events are queued (without blocking) from the thread raising them, and delivered by zxtape_dispatchEvents() on the
+ * thread of the host's choosing. Set the callback before starting playback.
+ *
+ * @param pInstance Pointer to the ZxTape instance
+ * @param pfnCallback Callback to deliver events to, or NULL to disable events
+ * @param pfnNotify Optional notification when an event is queued (e.g. to wake the dispatching thread), or NULL
+ * @param pUserData User data passed to the callbacks
+ */
+void zxtape_setEventCallback(ZXTAPE_HANDLE_T *pInstance, ZXTAPE_EVENT_CALLBACK_T pfnCallback,
+                             ZXTAPE_EVENT_NOTIFY_T pfnNotify, void *pUserData) {
+  assert(pInstance != NULL);
+  ZXTAPE_T *pZxTape = (ZXTAPE_T *)pInstance;
+
+  pZxTape->pfnEventCallback = NULL;
+  pZxTape->pfnEventNotify = pfnNotify;
+  pZxTape->pEventUserData = pUserData;
+  zxtapeEvent_initialize(&pZxTape->events);
+  pZxTape->pfnEventCallback = pfnCallback;
+}
+
+/**
+ * Deliver queued events to the event callback. Call from the thread which should receive the events.
+ *
+ * @param pInstance Pointer to the ZxTape instance
+ * @return unsigned Number of events delivered
+ */
+unsigned zxtape_dispatchEvents(ZXTAPE_HANDLE_T *pInstance) {
+  assert(pInstance != NULL);
+  ZXTAPE_T *pZxTape = (ZXTAPE_T *)pInstance;
+  ZXTAPE_EVENT_T event;
+  unsigned nCount = 0;
+
+  while (zxtapeEvent_pop(&pZxTape->events, &event)) {
+    if (pZxTape->pfnEventCallback) pZxTape->pfnEventCallback(pInstance, &event, pZxTape->pEventUserData);
+    nCount++;
+  }
+
+  return nCount;
+}
+
+/**
+ * Enable / disable the producer thread
+ *
+ * When enabled, the output buffer is refilled by a thread owned by the compatibility layer, rather than by
+ * zxtape_run(). The thread sleeps until the output buffer drops below the low watermark, and then refills it in bulk
+ * up to the high watermark. zxtape_run() must still be called to handle the controls, but the buffer health no longer
+ * depends on how often it is called. Call after zxtape_init(), and while the tape is stopped.
+ *
+ * @param pInstance Pointer to the ZxTape instance
+ * @param bEnable true to enable the producer thread, false to refill from zxtape_run()
+ * @param nLowWatermarkPercent Refill when the output buffer is below this level (% of buffer, 0 for default)
+ * @param nHighWatermarkPercent Refill up to this level (% of buffer, 0 for default)
+ */
+void zxtape_setProducer(ZXTAPE_HANDLE_T *pInstance, bool bEnable, unsigned nLowWatermarkPercent,
+                        unsigned nHighWatermarkPercent) {
+  assert(pInstance != NULL);
+  ZXTAPE_T *pZxTape = (ZXTAPE_T *)pInstance;
+
+  if (nLowWatermarkPercent == 0) nLowWatermarkPercent = ZX_TAPE_PRODUCER_LOW_WATERMARK_PERCENT;
+  if (nHighWatermarkPercent == 0) nHighWatermarkPercent = ZX_TAPE_PRODUCER_HIGH_WATERMARK_PERCENT;
+  if (nHighWatermarkPercent > 100) nHighWatermarkPercent = 100;
+  if (nLowWatermarkPercent >= nHighWatermarkPercent) nLowWatermarkPercent = nHighWatermarkPercent / 2;
+
+  zxtape_log_debug("Producer thread: %s (%u%% - %u%%)", bEnable ? "on" : "off", nLowWatermarkPercent,
+                   nHighWatermarkPercent);
+
+  enterEngine(pZxTape);
+
+  if (pZxTape->bProducer) {
+    TZXCompat_producerStop();
+    pZxTape->bProducer = false;
+  }
+
+  if (bEnable) {
+    if (pZxTape->bRender) zxtape_setRenderMode(pInstance, false);
+
+    pZxTape->bProducer = true;
+    TZXCompat_producerStart(nLowWatermarkPercent, nHighWatermarkPercent);
+  }
+
+  leaveEngine();
+}
+
+/**
+ * Enable / disable render (pull) mode
+ *
+ * When enabled, the output timer and output buffer of the compatibility layer are not used. Instead the host pulls
+ * the tape signal from its own audio callback with zxtape_render(), and pulses are generated on demand. No threads,
+ * timers or locks are involved, so all calls for the instance must be made from the same thread (or serialised by the
+ * host). Only the file and logging APIs of the compatibility layer are used. Call after zxtape_init(), and while the
+ * tape is stopped.
+ *
+ * @param pInstance Pointer to the ZxTape instance
+ * @param bEnable true to enable render mode, false to output through the compatibility layer
+ */
+void zxtape_setRenderMode(ZXTAPE_HANDLE_T *pInstance, bool bEnable) {
+  assert(pInstance != NULL);
+  ZXTAPE_T *pZxTape = (ZXTAPE_T *)pInstance;
+
+  zxtape_log_debug("Render mode: %s", bEnable ? "on" : "off");
+
+  enterEngine(pZxTape);
+
+  if (bEnable && pZxTape->bProducer) zxtape_setProducer(pInstance, false, 0, 0);
+
+  pZxTape->bRender = bEnable;
+  if (!bEnable) {
+    pZxTape->bSink = false;
+    pZxTape->bScheduler = false;
+  }
+  resetPulses(pZxTape);
+  TZXCompatInternal_setPulseOutput(bEnable);
+
+  leaveEngine();
+}
+
+/**
+ * Render the tape signal (render mode only)
+ *
+ * Generates exactly nFrames frames of mono 16-bit PCM at nSampleRate. Pulse edges keep their exact phase (an edge part
+ * way through a frame gives an intermediate value), and the position is carried between calls. While stopped or
+ * paused the output level is held. Controls (play / pause / stop / load) are applied at the start of each call, and
+ * playback stops once the end of the tape has been rendered, so zxtape_run() need not be called.
+ *
+ * @param pInstance Pointer to the ZxTape instance
+ * @param pOut Buffer for nFrames frames
+ * @param nFrames Number of frames to render
+ * @param nSampleRate Output sample rate (Hz)
+ */
+void zxtape_render(ZXTAPE_HANDLE_T *pInstance, i16 *pOut, unsigned nFrames, unsigned nSampleRate) {
+  assert(pInstance != NULL);
+  ZXTAPE_T *pZxTape = (ZXTAPE_T *)pInstance;
+
+  if (!pZxTape->bRender) {
+    zxtape_log_error("zxtape_render() called when not in render mode");
+    memset(pOut, 0, nFrames * sizeof(i16));
+    return;
+  }
+
+  enterEngine(pZxTape);
+
+  // Apply controls
+  handleControls(pZxTape, 0);
+
+  zxtapeRender_render(&pZxTape->render, pOut, nFrames, nSampleRate, (ZXTAPE_RENDER_NEXT_PULSE_T)nextPulse, pZxTape);
+
+  // Stop if the end of the tape was rendered
+  if (pZxTape->bEndPlayback) stopFile(pZxTape);
+
+  leaveEngine();
+}
+
+/**
+ * Render the tape signal as a packed bitstream (render mode only)
+ *
+ * Generates exactly nWords words of 1-bit samples at nBitRate, packed from the most significant bit of each word, for
+ * a pin driven from memory by DMA (SPI / PWM serialiser). Each bit is the level at its middle, so edges are rounded to
+ * the nearest bit without drifting, and runs of identical bits are filled a word at a time. Call for each half of a
+ * double-buffered region as the DMA completes it. Otherwise as zxtape_render() (which it should not be mixed with).
+ *
+ * @param pInstance Pointer to the ZxTape instance
+ * @param pOut Buffer for nWords words
+ * @param nWords Number of words to render
+ * @param nBitRate Output bit rate (Hz), e.g. 1000000
+ */
+void zxtape_renderBits(ZXTAPE_HANDLE_T *pInstance, u32 *pOut, unsigned nWords, unsigned nBitRate) {
+  assert(pInstance != NULL);
+  ZXTAPE_T *pZxTape = (ZXTAPE_T *)pInstance;
+
+  if (!pZxTape->bRender) {
+    zxtape_log_error("zxtape_renderBits() called when not in render mode");
+    memset(pOut, 0, nWords * sizeof(u32));
+    return;
+  }
+
+  enterEngine(pZxTape);
+
+  // Apply controls
+  handleControls(pZxTape, 0);
+
+  zxtapeBits_render(&pZxTape->bits, pOut, nWords, nBitRate, (ZXTAPE_RENDER_NEXT_PULSE_T)nextPulse, pZxTape);
+
+  // Stop if the end of the tape was rendered
+  if (pZxTape->bEndPlayback) stopFile(pZxTape);
+
+  leaveEngine();
+}
+
+/**
+ * Set the clock for zxtape_earAt(), zxtape_nextEdge() and zxtape_readPulses() (render mode only)
+ *
+ * @param pInstance Pointer to the ZxTape instance
+ * @param nClockHz T-states per second (0 for the default, ZXTAPE_EAR_CLOCK_HZ)
+ */
+void zxtape_setEarClock(ZXTAPE_HANDLE_T *pInstance, unsigned nClockHz) {
+  assert(pInstance != NULL);
+  ZXTAPE_T *pZxTape = (ZXTAPE_T *)pInstance;
+
+  pZxTape->nEarClockHz = nClockHz ? nClockHz : ZXTAPE_EAR_CLOCK_HZ;
+  zxtapeEar_initialize(&pZxTape->ear, pZxTape->nEarClockHz);
+}
+
+/**
+ * Get the EAR level at a CPU T-state (render mode only)
+ *
+ * An alternative to zxtape_render() for emulators: rather than audio, the level of the tape signal at a T-state of
+ * the emulated CPU. The tape starts at the T-state of the first query after play is pressed. Queries must not go
+ * backwards; with increasing T-states the cost is amortised O(1) per query, and a long pause or gap between queries
+ * costs no more than a single pulse. While stopped or paused the level is held, and the tape continues from the
+ * next query once resumed. Controls are applied on each query, and playback stops once the last edge has passed.
+ *
+ * @param pInstance Pointer to the ZxTape instance
+ * @param nTstate T-state (on the host's own timeline)
+ * @return u8 EAR level (0 or 1)
+ */
+u8 zxtape_earAt(ZXTAPE_HANDLE_T *pInstance, u64 nTstate) {
+  assert(pInstance != NULL);
+  ZXTAPE_T *pZxTape = (ZXTAPE_T *)pInstance;
+
+  if (!pZxTape->bRender) return 0;
+
+  enterEngine(pZxTape);
+
+  // Apply controls (but at the end of the tape, only stop once the last pulse has been played)
+  if (!pZxTape->bEndPlayback || zxtapeEar_isPastEnd(&pZxTape->ear, nTstate)) handleControls(pZxTape, 0);
+
+  u8 nLevel = zxtapeEar_levelAt(&pZxTape->ear, nTstate, (ZXTAPE_RENDER_NEXT_PULSE_T)nextPulse, pZxTape);
+
+  leaveEngine();
+
+  return nLevel;
+}
+
+/**
+ * Get the T-state of the next edge after the last zxtape_earAt() query (render mode only)
+ *
+ * Lets an emulator skip straight to the next edge (e.g. to fast load) rather than polling.
+ *
+ * @param pInstance Pointer to the ZxTape instance
+ * @return u64 T-state of the next edge, or ZXTAPE_TSTATE_NONE if there is none (stopped, paused or ended)
+ */
+u64 zxtape_nextEdge(ZXTAPE_HANDLE_T *pInstance) {
+  assert(pInstance != NULL);
+  ZXTAPE_T *pZxTape = (ZXTAPE_T *)pInstance;
+
+  if (!pZxTape->bRender) return ZXTAPE_TSTATE_NONE;
+
+  enterEngine(pZxTape);
+  u64 nEdge = zxtapeEar_nextEdge(&pZxTape->ear, (ZXTAPE_RENDER_NEXT_PULSE_T)nextPulse, pZxTape);
+  leaveEngine();
+
+  return nEdge;
+}
+
+/**
+ * Set the output sink (enables render mode)
+ *
+ * Rather than being pulled by the host, the tape signal is pushed to the sink by zxtape_run(), in batches of pulses,
+ * as fast as it can be generated (e.g. for converting to a file, or benchmarking). Controls are applied on each
+ * zxtape_run(), and the sink is told when playback stops. Set while the tape is stopped. Without a sink (and outside
+ * render mode) the output goes to the compatibility layer implementation (audio / GPIO), paced by its timer.
+ *
+ * @param pInstance Pointer to the ZxTape instance
+ * @param pSink Sink (copied), or NULL for no sink
+ */
+void zxtape_setSink(ZXTAPE_HANDLE_T *pInstance, const ZXTAPE_SINK_T *pSink) {
+  assert(pInstance != NULL);
+  ZXTAPE_T *pZxTape = (ZXTAPE_T *)pInstance;
+
+  enterEngine(pZxTape);
+
+  if (pSink != NULL) {
+    assert(pSink->write != NULL);
+    if (!pZxTape->bRender) zxtape_setRenderMode(pInstance, true);
+    pZxTape->sink = *pSink;
+    pZxTape->bScheduler = false;
+  }
+  pZxTape->bSink = pSink != NULL;
+
+  leaveEngine();
+}
+
+/**
+ * Write the next pulses to the sink, up to a length of tape (render mode with a sink)
+ *
+ * As zxtape_run(), but rather than as fast as they can be generated, pulses are written until at least nMaxUs of tape
+ * has been written (so up to a pulse more), for hosts pacing the output themselves (see zxtape_createScheduler()).
+ *
+ * @param pInstance Pointer to the ZxTape instance
+ * @param nMaxUs Length of tape to write (us)
+ * @return u64 Length of tape written (us), 0 if stopped, paused or ended
+ */
+u64 zxtape_writeSink(ZXTAPE_HANDLE_T *pInstance, u64 nMaxUs) {
+  assert(pInstance != NULL);
+  ZXTAPE_T *pZxTape = (ZXTAPE_T *)pInstance;
+
+  if (!pZxTape->bRender || !pZxTape->bSink) {
+    zxtape_log_error("zxtape_writeSink() called without a sink");
+    return 0;
+  }
+
+  return writeSink(pZxTape, ~0u, nMaxUs);
+}
+
+/**
+ * Set the edge scheduler (enables render mode)
+ *
+ * Rather than a timer interrupt per edge, the tape signal is handed to the platform as batches of edges at absolute
+ * times (TZXCompat_getTickNs() clock) by zxtape_run(), as long as the platform has space for them. Edges at the same
+ * level are merged. Call zxtape_run() often enough that the platform queue does not run dry; if it does (or after a
+ * pause), the timeline restarts nLeadUs from now. Controls are applied on each zxtape_run(), and the scheduler is
+ * told when playback stops (the last edge scheduled returns the output low). Set while the tape is stopped.
+ *
+ * @param pInstance Pointer to the ZxTape instance
+ * @param pScheduler Scheduler (copied), or NULL for no scheduler
+ */
+void zxtape_setEdgeScheduler(ZXTAPE_HANDLE_T *pInstance, const ZXTAPE_EDGE_SCHEDULER_T *pScheduler) {
+  assert(pInstance != NULL);
+  ZXTAPE_T *pZxTape = (ZXTAPE_T *)pInstance;
+
+  enterEngine(pZxTape);
+
+  if (pScheduler != NULL) {
+    assert(pScheduler->space != NULL && pScheduler->schedule != NULL);
+    if (!pZxTape->bRender) zxtape_setRenderMode(pInstance, true);
+    pZxTape->scheduler = *pScheduler;
+    unsigned *pBatchEdges = &pZxTape->scheduler.nBatchEdges;
+    if (*pBatchEdges == 0) *pBatchEdges = ZXTAPE_EDGE_BATCH_LENGTH;
+    if (*pBatchEdges > ZX_TAPE_EDGE_BATCH_MAX) *pBatchEdges = ZX_TAPE_EDGE_BATCH_MAX;
+    pZxTape->bSink = false;
+  }
+  pZxTape->bScheduler = pScheduler != NULL;
+
+  leaveEngine();
+}
+
+/**
+ * Read the next pulses of the tape signal (render mode only)
+ *
+ * An alternative to zxtape_render() for converters and analysers: the raw edge timeline, as fast as it can be
+ * generated. Each record is a pulse at one level, with its length and the block it belongs to. Lengths are in T-states
+ * at the EAR clock (see zxtape_setEarClock()), rounded so they never drift from the tape time. Controls are applied
+ * at the start of each call, and playback stops once the last pulse has been read.
+ *
+ * @param pInstance Pointer to the ZxTape instance
+ * @param pRecords Buffer for nMaxRecords records
+ * @param nMaxRecords Maximum number of records to read
+ * @return unsigned Number of records read (0 if stopped, paused or ended)
+ */
+unsigned zxtape_readPulses(ZXTAPE_HANDLE_T *pInstance, ZXTAPE_PULSE_RECORD_T *pRecords, unsigned nMaxRecords) {
+  assert(pInstance != NULL);
+  ZXTAPE_T *pZxTape = (ZXTAPE_T *)pInstance;
+  ZXTAPE_PULSE_T pulse;
+  unsigned nRecords = 0;
+  u64 nClockHz = pZxTape->nEarClockHz;
+
+  if (!pZxTape->bRender) {
+    zxtape_log_error("zxtape_readPulses() called when not in render mode");
+    return 0;
+  }
+
+  enterEngine(pZxTape);
+
+  // Apply controls
+  handleControls(pZxTape, 0);
+
+  while (nRecords < nMaxRecords && nextPulse(pZxTape, &pulse)) {
+    ZXTAPE_PULSE_RECORD_T *pRecord = &pRecords[nRecords++];
+    u64 nEndUs = pZxTape->nPulseTimeUs;
+    u64 nStartUs = nEndUs - pulse.nPeriodUs;
+
+    pRecord->nLevel = pulse.nLevel;
+    pRecord->nDurationTstates = (u32)(nEndUs * nClockHz / 1000000 - nStartUs * nClockHz / 1000000);
+    pRecord->nBlockIndex = pZxTape->nPulseBlockIndex;
+  }
+
+  // Stop if the last pulse was read
+  if (pZxTape->bEndPlayback) stopFile(pZxTape);
+
+  leaveEngine();
+
+  return nRecords;
 }
 
 //
@@ -393,14 +1093,275 @@ static void endPlayback(ZXTAPE_T *pZxTape) {
   // This avoids blocking any thread.
 }
 
+/**
+ * Called by the TZX library when a new block starts
+ */
+static void onBlockStart(ZXTAPE_T *pZxTape, u8 id, u32 offset, u64 tapeTimeUs) {
+  int blockIndex = zxtapeInfo_findBlockIndex(pZxTape->pInfo, offset);
+
+  pZxTape->nBlockId = id;
+  pZxTape->nBlockIndex = blockIndex >= 0 ? (u32)blockIndex : ZXTAPE_INDEX_NONE;
+
+  if (pZxTape->bRender) {
+    // Mark where the block starts, for when the pulses are taken (if full, the latest start replaces the last mark)
+    u32 nMarks = pZxTape->nBlockMarkWriteIndex - pZxTape->nBlockMarkReadIndex;
+    if (nMarks == ZX_TAPE_BLOCK_MARK_QUEUE_LENGTH) pZxTape->nBlockMarkWriteIndex--;
+    ZXTAPE_BLOCK_MARK_T *pMark = &pZxTape->blockMarks[pZxTape->nBlockMarkWriteIndex++ & ZX_TAPE_BLOCK_MARK_QUEUE_MASK];
+    pMark->nTapeTimeUs = tapeTimeUs;
+    pMark->nBlockIndex = pZxTape->nBlockIndex;
+  }
+
+  // Check if this block starts a new section
+  if (blockIndex >= 0) {
+    ZXTAPE_SECTION_INFO_T *pSection = zxtapeInfo_findSectionStart(pZxTape->pInfo, (unsigned int)blockIndex);
+    if (pSection != NULL) {
+      pZxTape->nSectionIndex = pSection->index;
+      raiseEvent(pZxTape, ZXTAPE_EVENT_SECTION_START, tapeTimeUs, 0);
+    }
+  }
+
+  raiseEvent(pZxTape, ZXTAPE_EVENT_BLOCK_START, tapeTimeUs, offset);
+}
+
+/**
+ * Called by the TZX library when a 'Stop the tape' block is reached
+ */
+static void onStopTape(ZXTAPE_T *pZxTape, bool b48kOnly, u64 tapeTimeUs) {
+  raiseEvent(pZxTape, ZXTAPE_EVENT_STOP_TAPE, tapeTimeUs, b48kOnly ? 1 : 0);
+}
+
+/**
+ * Called by the TZX library when a pause starts
+ */
+static void onPauseStart(ZXTAPE_T *pZxTape, u32 pauseMs, u64 tapeTimeUs) {
+  raiseEvent(pZxTape, ZXTAPE_EVENT_PAUSE, tapeTimeUs, pauseMs);
+}
+
+/**
+ * Called by the TZX library when the end of the tape data is reached
+ */
+static void onEndOfData(ZXTAPE_T *pZxTape, u64 tapeTimeUs) {
+  raiseEvent(pZxTape, ZXTAPE_EVENT_END_OF_DATA, tapeTimeUs, 0);
+}
+
+/**
+ * Called by the compatibility layer when the output runs out of data (may be a real-time thread)
+ */
+static void onUnderrun(ZXTAPE_T *pZxTape) {
+  // Position on the tape timeline is not known by the output, so use the generated position
+  raiseEvent(pZxTape, ZXTAPE_EVENT_UNDERRUN, TZX_tapeTimeUs, 0);
+}
+
+/**
+ * Called by the compatibility layer producer thread when the output buffer needs refilling
+ */
+static void onRefill(ZXTAPE_T *pZxTape, u32 nBufferLen) {
+  // Hold the lock so the tape cannot be started / stopped / loaded part way through the refill
+  TZXCompat_noInterrupts();
+
+  if (pZxTape->bRunning && !pZxTape->bEndPlayback) {
+    // Top up wbuffer, then move up to nBufferLen periods from it to the output buffer
+    TZXLoop();
+    TZXCompat_waveOrBuffer(true, nBufferLen, 0);
+  }
+
+  TZXCompat_interrupts();
+}
+
+/**
+ * Called by the TZX library with each output period (render mode)
+ */
+static void onPulse(ZXTAPE_T *pZxTape, u8 nLevel, u32 nPeriodUs) {
+  // Never more than requested from TZXCompat_waveOrBuffer()
+  if (pZxTape->nPulseCount < ZX_TAPE_PULSE_QUEUE_LENGTH) {
+    ZXTAPE_PULSE_T *pPulse = &pZxTape->pulses[pZxTape->nPulseCount++];
+    pPulse->nLevel = nLevel;
+    pPulse->nPeriodUs = nPeriodUs;
+  }
+}
+
 //
 // Private functions
 //
 
+/**
+ * Get the next pulse in render mode, generating more when required
+ */
+static bool nextPulse(ZXTAPE_T *pZxTape, ZXTAPE_PULSE_T *pPulse) {
+  if (pZxTape->nPulseIndex >= pZxTape->nPulseCount && !generatePulses(pZxTape)) return false;
+
+  *pPulse = pZxTape->pulses[pZxTape->nPulseIndex++];
+
+  if (pPulse->nPeriodUs == TZXCompat_EOF_PERIOD) {
+    // End of the tape, stop once rendered up to here
+    endPlayback(pZxTape);
+    return false;
+  }
+
+  // Move to the block the pulse starts in
+  while (pZxTape->nBlockMarkReadIndex != pZxTape->nBlockMarkWriteIndex) {
+    ZXTAPE_BLOCK_MARK_T *pMark = &pZxTape->blockMarks[pZxTape->nBlockMarkReadIndex & ZX_TAPE_BLOCK_MARK_QUEUE_MASK];
+    if (pMark->nTapeTimeUs > pZxTape->nPulseTimeUs) break;
+    pZxTape->nPulseBlockIndex = pMark->nBlockIndex;
+    pZxTape->nBlockMarkReadIndex++;
+  }
+  pZxTape->nPulseTimeUs += pPulse->nPeriodUs;
+
+  return true;
+}
+
+/**
+ * Generate the next pulses into the (empty) pulse queue in render mode
+ *
+ * @return true if pulses were generated, false if not (stopped, paused or ended)
+ */
+static bool generatePulses(ZXTAPE_T *pZxTape) {
+  pZxTape->nPulseIndex = 0;
+  pZxTape->nPulseCount = 0;
+
+  if (!pZxTape->bRunning || pZxTape->bEndPlayback || TZX_pauseOn) return false;
+
+  // Top up wbuffer, then take the next periods from it
+  TZXLoop();
+  TZXCompat_waveOrBuffer(true, ZX_TAPE_PULSE_QUEUE_LENGTH, 0);
+
+  // Nothing generated (paused)
+  return pZxTape->nPulseCount > 0;
+}
+
+/**
+ * Write the next batches of pulses to the sink, until nMaxUs of tape is written (render mode with a sink)
+ *
+ * Called outside the engine: each batch is generated and copied out in the engine, and written to the sink once the
+ * engine is left, so a slow sink only holds up its own instance.
+ *
+ * @return u64 Length of the pulses written (us)
+ */
+static u64 writeSink(ZXTAPE_T *pZxTape, unsigned nMaxBatches, u64 nMaxUs) {
+  ZXTAPE_PULSE_T batch[ZX_TAPE_PULSE_QUEUE_LENGTH];
+  u64 nWrittenUs = 0;
+
+  enterEngine(pZxTape);
+
+  // Apply controls
+  handleControls(pZxTape, 0);
+
+  for (unsigned i = 0; i < nMaxBatches && nWrittenUs < nMaxUs && pZxTape->bSink && !pZxTape->bEndPlayback; i++) {
+    if (pZxTape->nPulseIndex >= pZxTape->nPulseCount && !generatePulses(pZxTape)) break;
+
+    // Take as much of the queue as is wanted in one go, up to the end of the tape
+    ZXTAPE_PULSE_T *pPulses = pZxTape->pulses;
+    u32 nStart = pZxTape->nPulseIndex;
+    u32 nEnd = nStart;
+    while (nEnd < pZxTape->nPulseCount && nWrittenUs < nMaxUs && pPulses[nEnd].nPeriodUs != TZXCompat_EOF_PERIOD) {
+      nWrittenUs += pPulses[nEnd++].nPeriodUs;
+    }
+    u32 nCount = nEnd - nStart;
+    memcpy(batch, &pPulses[nStart], nCount * sizeof(ZXTAPE_PULSE_T));
+    pZxTape->nPulseIndex = nEnd;
+
+    // End of the tape
+    if (nEnd < pZxTape->nPulseCount && pPulses[nEnd].nPeriodUs == TZXCompat_EOF_PERIOD) {
+      pZxTape->nPulseIndex = pZxTape->nPulseCount;
+      endPlayback(pZxTape);
+    }
+
+    // Write the batch outside the engine
+    ZXTAPE_SINK_T sink = pZxTape->sink;
+    leaveEngine();
+    if (nCount > 0) sink.write(sink.pContext, batch, nCount);
+    enterEngine(pZxTape);
+  }
+
+  // Stop if the end of the tape was written (the sink is told when the engine is left)
+  if (pZxTape->bEndPlayback) stopFile(pZxTape);
+
+  leaveEngine();
+
+  return nWrittenUs;
+}
+
+/**
+ * Hand the next batches of edges to the edge scheduler (render mode with an edge scheduler)
+ */
+static void scheduleEdges(ZXTAPE_T *pZxTape) {
+  ZXTAPE_EDGE_SCHEDULER_T *pScheduler = &pZxTape->scheduler;
+  ZXTAPE_PULSE_T pulse;
+
+  // Apply controls
+  handleControls(pZxTape, 0);
+
+  // Restart the timeline if it is not started or has fallen behind (the platform queue ran dry, or after a pause)
+  u64 nowNs = TZXCompat_getTickNs();
+  if (pZxTape->nEdgeTimeNs < nowNs) pZxTape->nEdgeTimeNs = nowNs + (u64)pScheduler->nLeadUs * 1000ull;
+
+  while (pZxTape->bRunning && (!pZxTape->bEndPlayback || pZxTape->nEdgeLevel != 0)) {
+    unsigned nSpace = pScheduler->space(pScheduler->pContext);
+    if (nSpace > pScheduler->nBatchEdges) nSpace = pScheduler->nBatchEdges;
+    if (nSpace == 0) break;
+
+    // Fill the batch with the next edges, merging pulses at the same level
+    unsigned nEdges = 0;
+    bool bMore = true;
+    while (nEdges < nSpace && !pZxTape->bEndPlayback && (bMore = nextPulse(pZxTape, &pulse))) {
+      if (pulse.nLevel != pZxTape->nEdgeLevel) {
+        pZxTape->edges[nEdges].nTimeNs = pZxTape->nEdgeTimeNs;
+        pZxTape->edges[nEdges].nLevel = pulse.nLevel;
+        pZxTape->nEdgeLevel = pulse.nLevel;
+        nEdges++;
+      }
+      pZxTape->nEdgeTimeNs += (u64)pulse.nPeriodUs * 1000ull;
+    }
+
+    // At the end of the tape, return the output low once the last pulse has played
+    if (pZxTape->bEndPlayback && pZxTape->nEdgeLevel != 0 && nEdges < nSpace) {
+      pZxTape->edges[nEdges].nTimeNs = pZxTape->nEdgeTimeNs;
+      pZxTape->edges[nEdges].nLevel = 0;
+      pZxTape->nEdgeLevel = 0;
+      nEdges++;
+    }
+
+    if (nEdges > 0) pScheduler->schedule(pScheduler->pContext, pZxTape->edges, nEdges);
+    if (!bMore) break;
+  }
+
+  // Stop once the end of the tape was scheduled
+  if (pZxTape->bEndPlayback && pZxTape->nEdgeLevel == 0) stopFile(pZxTape);
+}
+
+/**
+ * Discard any generated pulses, and reset the render position
+ */
+static void resetPulses(ZXTAPE_T *pZxTape) {
+  pZxTape->nPulseCount = 0;
+  pZxTape->nPulseIndex = 0;
+  zxtapeRender_initialize(&pZxTape->render);
+  zxtapeBits_initialize(&pZxTape->bits);
+  zxtapeEar_initialize(&pZxTape->ear, pZxTape->nEarClockHz);
+  pZxTape->nBlockMarkWriteIndex = 0;
+  pZxTape->nBlockMarkReadIndex = 0;
+  pZxTape->nPulseBlockIndex = ZXTAPE_INDEX_NONE;
+  pZxTape->nPulseTimeUs = 0;
+  pZxTape->nEdgeTimeNs = 0;
+  pZxTape->nEdgeLevel = 0;
+}
+
 /**
  * Handle playback loop
  */
 static void loopPlayback(ZXTAPE_T *pZxTape) {
+  // In render mode pulses are generated on demand, unless there is a sink (see zxtape_run()) or scheduler to push to
+  if (pZxTape->bRender) {
+    if (pZxTape->bScheduler) scheduleEdges(pZxTape);
+    return;
+  }
+
+  // The output never stops the tape from its (real-time) thread, it hands the end of the tape over to here
+  TZXCompat_poll();
+
+  // The producer thread (if enabled) keeps the buffer full
+  if (pZxTape->bProducer) return;
+
   if (pZxTape->bRunning && !pZxTape->bEndPlayback) {
     // If tape is running, and we are not ending playback, then run the TZX loop
 
@@ -422,6 +1383,13 @@ static void loopControl(ZXTAPE_T *pZxTape, unsigned nIntervalMs) {
 
   pZxTape->nlastTimerMs = lastTimerMs;
 
+  handleControls(pZxTape, elapsedMs);
+}
+
+/**
+ * Handle the controls (buttons) and end of playback
+ */
+static void handleControls(ZXTAPE_T *pZxTape, unsigned nElapsedMs) {
   // Handle Play / pause button
   if (checkButtonPlayPause(pZxTape)) {
     if (!pZxTape->bRunning) {
@@ -454,7 +1422,7 @@ static void loopControl(ZXTAPE_T *pZxTape, unsigned nIntervalMs) {
     // End of playback delay has expired, buffer should be empty, so stop playing
     stopFile(pZxTape);
     // }
-    pZxTape->nEndPlaybackDelay -= elapsedMs;
+    pZxTape->nEndPlaybackDelay -= nElapsedMs;
   }
 }
 
@@ -465,19 +1433,42 @@ static void playFile(ZXTAPE_T *pZxTape) {
   // Ensure stopped
   stopFile(pZxTape);
 
+  // The output, timer and threads of the compatibility layer are not switched between instances
+  if (!pZxTape->bRender && g_nInstanceCount > 1) {
+    zxtape_log_error("Only a single ZX TAPE instance can play to the device (use render mode)");
+    return;
+  }
+
   // Set initial playback state
   TZX_pauseOn = false;
   TZX_currpct = 100;
 
-  // Notify compatibility layer on start (so can enable audio output, etc)
-  TZXCompat_start();
+  if (pZxTape->bRender) {
+    // Render mode does not use the compatibility layer output
+    resetPulses(pZxTape);
+  } else {
+    // Notify compatibility layer on start (so can enable audio output, etc)
+    TZXCompat_start();
 
-  // Initialise (reset) the output timer
-  TZXCompat_timerInitialize();
+    // Initialise (reset) the output timer
+    TZXCompat_timerInitialize();
+  }
+
+  // Reset the current position (updated by block start events)
+  pZxTape->nBlockIndex = ZXTAPE_INDEX_NONE;
+  pZxTape->nSectionIndex = ZXTAPE_INDEX_NONE;
+  pZxTape->nBlockId = 0;
 
+  // Start from the start block (if set, and the tape has one)
+  ZXTAPE_INFO_T *pInfo = pZxTape->pInfo;
+  u32 nStart = pZxTape->nStartBlockIndex;
+  TZX_startOffset = pInfo != NULL && nStart > 0 && nStart < pInfo->blockCount ? pInfo->pBlockOffsets[nStart] : 0;
+
+  lockProducer(pZxTape);
   TZXPlay();
 
   pZxTape->bRunning = true;
+  unlockProducer(pZxTape);
 
   if (TZX_PauseAtStart) {
     TZX_pauseOn = true;
@@ -492,21 +1483,52 @@ static void stopFile(ZXTAPE_T *pZxTape) {
   zxtape_log_debug("stopFile");
 
   // Notify compatibility layer on stop (so can disable audio output, etc)
-  TZXCompat_stop();
+  if (!pZxTape->bRender) TZXCompat_stop();
 
-  if (pZxTape->bRunning) {
+  if (pZxTape->bRunning && !pZxTape->bRender) {
     zxtape_log_debug("TZXCompat_timerStop()");
 
     // Stop the output timer (only if it was initialised)
     TZXCompat_timerStop();
   }
 
+  // Tell the sink and the scheduler (if any), once the engine is left
+  if (pZxTape->bRunning && pZxTape->bRender && pZxTape->bSink && pZxTape->sink.end != NULL) pZxTape->bSinkEnd = true;
+  if (pZxTape->bRunning && pZxTape->bRender && pZxTape->bScheduler && pZxTape->scheduler.end != NULL) {
+    pZxTape->bSchedulerEnd = true;
+  }
+
   // Stop tzx library
+  lockProducer(pZxTape);
   TZXStop();
 
   pZxTape->bRunning = false;
   pZxTape->bEndPlayback = false;
   pZxTape->nEndPlaybackDelay = 0;
+  if (pZxTape->bRender) resetPulses(pZxTape);
+  unlockProducer(pZxTape);
+}
+
+/**
+ * Queue an event for delivery by zxtape_dispatchEvents()
+ *
+ * Bounded cost, never blocks. If the queue is full the event is dropped.
+ */
+static void raiseEvent(ZXTAPE_T *pZxTape, ZXTAPE_EVENT_TYPE_T type, u64 tapeTimeUs, u32 nValue) {
+  if (pZxTape->pfnEventCallback == NULL) return;
+
+  ZXTAPE_EVENT_T event;
+  event.type = type;
+  event.nTickMs = TZXCompat_getTickMs();
+  event.nTapeTimeUs = tapeTimeUs;
+  event.nBlockIndex = pZxTape->nBlockIndex;
+  event.nSectionIndex = pZxTape->nSectionIndex;
+  event.nBlockId = pZxTape->nBlockId;
+  event.nValue = nValue;
+
+  if (zxtapeEvent_push(&pZxTape->events, &event) && pZxTape->pfnEventNotify) {
+    pZxTape->pfnEventNotify((ZXTAPE_HANDLE_T *)pZxTape, pZxTape->pEventUserData);
+  }
 }
 
 /**
@@ -529,4 +1551,110 @@ static bool checkButtonStop(ZXTAPE_T *pZxTape) {
     return true;
   }
   return false;
-}
\ No newline at end of file
+}
+
+/**
+ * Keep the producer thread out of the TZX library while it is being started / stopped / loaded
+ *
+ * Only locks when the producer thread is enabled; otherwise the TZX library is only run from zxtape_run().
+ */
+static void lockProducer(ZXTAPE_T *pZxTape) {
+  if (pZxTape->bProducer) TZXCompat_noInterrupts();
+}
+
+static void unlockProducer(ZXTAPE_T *pZxTape) {
+  if (pZxTape->bProducer) TZXCompat_interrupts();
+}
+
+#ifndef __ZX_TAPE_CIRCLE__
+static void initializeEngineLock(void) {
+  pthread_mutexattr_t attr;
+  pthread_mutexattr_init(&attr);
+  pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+  pthread_mutex_init(&g_engineLock, &attr);
+  pthread_mutexattr_destroy(&attr);
+}
+#endif  // __ZX_TAPE_CIRCLE__
+
+/**
+ * Serialise the instances (and the instance list)
+ */
+static void lockEngine(void) {
+#ifndef __ZX_TAPE_CIRCLE__
+  pthread_once(&g_engineLockOnce, initializeEngineLock);
+  pthread_mutex_lock(&g_engineLock);
+#endif  // __ZX_TAPE_CIRCLE__
+}
+
+static void unlockEngine(void) {
+#ifndef __ZX_TAPE_CIRCLE__
+  pthread_mutex_unlock(&g_engineLock);
+#endif  // __ZX_TAPE_CIRCLE__
+}
+
+/**
+ * Serialise reading tapes (see zxtape_info.c), in or outside the engine
+ */
+static void lockInfo(void) {
+#ifndef __ZX_TAPE_CIRCLE__
+  pthread_mutex_lock(&g_infoLock);
+#endif  // __ZX_TAPE_CIRCLE__
+}
+
+static void unlockInfo(void) {
+#ifndef __ZX_TAPE_CIRCLE__
+  pthread_mutex_unlock(&g_infoLock);
+#endif  // __ZX_TAPE_CIRCLE__
+}
+
+/**
+ * Take the TZX library for an instance, until leaveEngine()
+ *
+ * The TZX library, the compatibility layer and the buffer file API keep their state in globals. If another instance
+ * used them last, its state is saved, and the state of this instance restored (around 2KB copied each way, the
+ * playback buffers are not copied). With a single instance nothing is ever switched.
+ */
+static void enterEngine(ZXTAPE_T *pZxTape) {
+  lockEngine();
+  g_nEngineDepth++;
+
+  if (g_pEngineOwner != pZxTape) {
+    if (g_pEngineOwner != NULL) {
+      TZXCompatInternal_saveState(g_pEngineOwner->pEngineState);
+      zxtapeFileApiBuffer_saveState(&g_pEngineOwner->fileBufferState);
+    }
+    TZXCompatInternal_restoreState(pZxTape->pEngineState);
+    zxtapeFileApiBuffer_restoreState(&pZxTape->fileBufferState);
+    g_pEngineOwner = pZxTape;
+  }
+}
+
+/**
+ * Give up the TZX library, and tell the sink and the scheduler playback stopped (if it did) once the engine is no
+ * longer held
+ */
+static void leaveEngine(void) {
+  ZXTAPE_T *pZxTape = g_pEngineOwner;
+  ZXTAPE_SINK_T sink;
+  ZXTAPE_EDGE_SCHEDULER_T scheduler;
+  bool bSinkEnd = false;
+  bool bSchedulerEnd = false;
+
+  if (--g_nEngineDepth == 0 && pZxTape != NULL) {
+    if (pZxTape->bSinkEnd) {
+      pZxTape->bSinkEnd = false;
+      sink = pZxTape->sink;
+      bSinkEnd = true;
+    }
+    if (pZxTape->bSchedulerEnd) {
+      pZxTape->bSchedulerEnd = false;
+      scheduler = pZxTape->scheduler;
+      bSchedulerEnd = true;
+    }
+  }
+
+  unlockEngine();
+
+  if (bSinkEnd) sink.end(sink.pContext);
+  if (bSchedulerEnd) scheduler.end(scheduler.pContext);
+}
@@ -0,0 +1,206 @@
+#include "bench_corpus.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "../games/starquake.h"
+
+#define TZX_HEADER_LENGTH 10       // "ZXTape!", 0x1A, version
+#define PILOT_BLOCKS 16            // Pure tone blocks in the pilot tape
+#define PILOT_PULSES 65535         // Pulses per pure tone block (about 40s each)
+#define TURBO_BLOCKS 4             // Turbo data blocks in the turbo tape
+#define TURBO_LENGTH (32 * 1024)   // Bytes per turbo data block
+#define DIRECT_BLOCKS 4            // Direct recording blocks in the direct tape
+#define DIRECT_LENGTH (64 * 1024)  // Bytes (8 samples each) per direct recording block
+#define PAUSE_BLOCKS 1000          // Short data blocks in the pauses tape, each followed by a pause block
+#define PAUSE_DATA_LENGTH 19       // Bytes per short data block (a header)
+#define SEED 0x5A585441            // Pseudo-random data seed ("ZXTA")
+
+typedef struct _BENCH_BUILDER_T {
+  u8* pData;
+  unsigned long nLength;
+  unsigned long nCapacity;
+  u32 nSeed;
+} BENCH_BUILDER_T;
+
+typedef void (*BENCH_BUILD_FN)(BENCH_BUILDER_T* pBuilder);
+
+typedef struct _BENCH_CORPUS_ENTRY_T {
+  const char* pName;
+  const char* pFilename;
+  const char* pDescription;
+  BENCH_BUILD_FN build;  // NULL for Starquake
+} BENCH_CORPUS_ENTRY_T;
+
+/* Forward declarations */
+static void buildPilot(BENCH_BUILDER_T* pBuilder);
+static void buildTurbo(BENCH_BUILDER_T* pBuilder);
+static void buildDirect(BENCH_BUILDER_T* pBuilder);
+static void buildPauses(BENCH_BUILDER_T* pBuilder);
+static void putHeader(BENCH_BUILDER_T* pBuilder);
+static void putByte(BENCH_BUILDER_T* pBuilder, u8 nValue);
+static void putWord(BENCH_BUILDER_T* pBuilder, u16 nValue);
+static void putTriple(BENCH_BUILDER_T* pBuilder, u32 nValue);
+static void putRandom(BENCH_BUILDER_T* pBuilder, unsigned long nLength);
+
+/* Local variables */
+static const BENCH_CORPUS_ENTRY_T g_corpus[] = {
+    {"starquake", "starquake.tzx", "Starquake (standard speed loader)", NULL},
+    {"pilot", "pilot.tzx", "Pure tone blocks (ID 0x12), long pilot tones", buildPilot},
+    {"turbo", "turbo.tzx", "Turbo speed data blocks (ID 0x11), short pulses", buildTurbo},
+    {"direct", "direct.tzx", "Direct recording blocks (ID 0x15), 44.1kHz samples", buildDirect},
+    {"pauses", "pauses.tzx", "Short data blocks (ID 0x10) with long pauses (ID 0x20)", buildPauses},
+};
+
+/* Exported functions */
+
+/**
+ * Get the number of tapes in the corpus
+ */
+unsigned benchCorpus_getCount(void) {
+  return sizeof(g_corpus) / sizeof(g_corpus[0]);
+}
+
+/**
+ * Get (build) a tape of the corpus. Free with benchCorpus_free().
+ *
+ * @param nIndex Index of the tape
+ * @param pTape Tape (set)
+ * @return true if the tape exists
+ */
+bool benchCorpus_get(unsigned nIndex, BENCH_TAPE_T* pTape) {
+  if (nIndex >= benchCorpus_getCount()) return false;
+  const BENCH_CORPUS_ENTRY_T* pEntry = &g_corpus[nIndex];
+
+  memset(pTape, 0, sizeof(BENCH_TAPE_T));
+  pTape->pName = pEntry->pName;
+  pTape->pFilename = pEntry->pFilename;
+  pTape->pDescription = pEntry->pDescription;
+
+  if (pEntry->build == NULL) {
+    pTape->pData = Starquake;
+    pTape->nLength = sizeof(Starquake);
+    return true;
+  }
+
+  BENCH_BUILDER_T builder = {NULL, 0, 0, SEED};
+  putHeader(&builder);
+  pEntry->build(&builder);
+  pTape->pData = builder.pData;
+  pTape->nLength = builder.nLength;
+
+  return true;
+}
+
+/**
+ * Find a tape of the corpus by name
+ *
+ * @param pName Name of the tape
+ * @param pIndex Index of the tape (set)
+ * @return true if the tape exists
+ */
+bool benchCorpus_find(const char* pName, unsigned* pIndex) {
+  for (unsigned i = 0; i < benchCorpus_getCount(); i++) {
+    if (strcmp(g_corpus[i].pName, pName) != 0) continue;
+    *pIndex = i;
+    return true;
+  }
+
+  return false;
+}
+
+/**
+ * Free a tape of the corpus
+ */
+void benchCorpus_free(BENCH_TAPE_T* pTape) {
+  if (pTape->pData != Starquake) free((void*)pTape->pData);
+  pTape->pData = NULL;
+}
+
+//
+// Synthetic tapes
+//
+
+static void buildPilot(BENCH_BUILDER_T* pBuilder) {
+  for (int i = 0; i < PILOT_BLOCKS; i++) {
+    putByte(pBuilder, 0x12);
+    putWord(pBuilder, 2168);  // Pulse length (T-states)
+    putWord(pBuilder, PILOT_PULSES);
+  }
+}
+
+static void buildTurbo(BENCH_BUILDER_T* pBuilder) {
+  for (int i = 0; i < TURBO_BLOCKS; i++) {
+    putByte(pBuilder, 0x11);
+    putWord(pBuilder, 1000);  // Pilot pulse
+    putWord(pBuilder, 300);   // First sync pulse
+    putWord(pBuilder, 350);   // Second sync pulse
+    putWord(pBuilder, 400);   // Zero bit pulse
+    putWord(pBuilder, 800);   // One bit pulse
+    putWord(pBuilder, 2000);  // Pilot pulses
+    putByte(pBuilder, 8);     // Used bits in the last byte
+    putWord(pBuilder, 100);   // Pause (ms)
+    putTriple(pBuilder, TURBO_LENGTH);
+    putRandom(pBuilder, TURBO_LENGTH);
+  }
+}
+
+static void buildDirect(BENCH_BUILDER_T* pBuilder) {
+  for (int i = 0; i < DIRECT_BLOCKS; i++) {
+    putByte(pBuilder, 0x15);
+    putWord(pBuilder, 79);   // T-states per sample (44.1kHz)
+    putWord(pBuilder, 100);  // Pause (ms)
+    putByte(pBuilder, 8);    // Used bits in the last byte
+    putTriple(pBuilder, DIRECT_LENGTH);
+    putRandom(pBuilder, DIRECT_LENGTH);
+  }
+}
+
+static void buildPauses(BENCH_BUILDER_T* pBuilder) {
+  for (int i = 0; i < PAUSE_BLOCKS; i++) {
+    putByte(pBuilder, 0x10);
+    putWord(pBuilder, 2000);  // Pause (ms)
+    putWord(pBuilder, PAUSE_DATA_LENGTH);
+    putRandom(pBuilder, PAUSE_DATA_LENGTH);
+
+    putByte(pBuilder, 0x20);
+    putWord(pBuilder, 5000);  // Pause (ms)
+  }
+}
+
+static void putHeader(BENCH_BUILDER_T* pBuilder) {
+  for (int i = 0; i < TZX_HEADER_LENGTH; i++) putByte(pBuilder, Starquake[i]);
+}
+
+static void putByte(BENCH_BUILDER_T* pBuilder, u8 nValue) {
+  if (pBuilder->nLength == pBuilder->nCapacity) {
+    pBuilder->nCapacity = pBuilder->nCapacity ? pBuilder->nCapacity * 2 : 4096;
+    pBuilder->pData = (u8*)realloc(pBuilder->pData, pBuilder->nCapacity);
+  }
+  pBuilder->pData[pBuilder->nLength++] = nValue;
+}
+
+static void putWord(BENCH_BUILDER_T* pBuilder, u16 nValue) {
+  putByte(pBuilder, (u8)nValue);
+  putByte(pBuilder, (u8)(nValue >> 8));
+}
+
+static void putTriple(BENCH_BUILDER_T* pBuilder, u32 nValue) {
+  putWord(pBuilder, (u16)nValue);
+  putByte(pBuilder, (u8)(nValue >> 16));
+}
+
+/**
+ * Pseudo-random bytes (xorshift32, from the builder's seed)
+ */
+static void putRandom(BENCH_BUILDER_T* pBuilder, unsigned long nLength) {
+  u32 x = pBuilder->nSeed;
+
+  for (unsigned long i = 0; i < nLength; i++) {
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    putByte(pBuilder, (u8)(x >> 24));
+  }
+  pBuilder->nSeed = x;
+}
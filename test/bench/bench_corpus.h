@@ -0,0 +1,33 @@
+#ifndef _bench_corpus_h_
+#define _bench_corpus_h_
+
+#include <zxtape.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//
+// Benchmark corpus: Starquake, and synthetic tapes each stressing one kind of block. The synthetic tapes are built
+// from a fixed seed, so are the same on every run and every machine.
+//
+
+typedef struct _BENCH_TAPE_T {
+  const char* pName;      // Corpus name (e.g. "pilot")
+  const char* pFilename;  // File name, for its type
+  const char* pDescription;
+  const u8* pData;        // Contents of the TZX file
+  unsigned long nLength;  // Length of the contents (bytes)
+} BENCH_TAPE_T;
+
+/* Exported functions */
+unsigned benchCorpus_getCount(void);
+bool benchCorpus_get(unsigned nIndex, BENCH_TAPE_T* pTape);
+bool benchCorpus_find(const char* pName, unsigned* pIndex);
+void benchCorpus_free(BENCH_TAPE_T* pTape);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // _bench_corpus_h_
@@ -0,0 +1,342 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+#include <zxtape.h>
+
+#include "bench_corpus.h"
+
+#define DEFAULT_RUNS 3                // Runs of each tape (the fastest is reported)
+#define DEFAULT_TOLERANCE_PERCENT 50  // Allowed regression from the baseline
+#define MAX_RUNS 10000000             // Give up if the tape has not ended after this many zxtape_run() calls
+#define MAX_BASELINE_LENGTH 65536     // Longest baseline file
+
+typedef struct _BENCH_RESULT_T {
+  unsigned long long nPulses;  // Pulses played
+  unsigned long long nTapeUs;  // Tape played (us)
+  double nWallSeconds;         // Time taken (fastest run)
+  double nPulsesPerSecond;     // Pulses played per second
+  double nBytesPerSecond;      // Tape file bytes played per second
+  double nRealTimeFactor;      // Tape played per second taken
+  long long nAllocations;      // Heap allocations made by a run (-1 if not counted)
+  long long nAllocatedBytes;   // Bytes allocated by a run (-1 if not counted)
+  long long nPeakRssKb;        // Peak resident set size of the process (KB)
+} BENCH_RESULT_T;
+
+typedef struct _BENCH_COUNT_SINK_T {
+  ZXTAPE_SINK_T sink;
+  unsigned long long nPulses;
+  unsigned long long nTapeUs;
+} BENCH_COUNT_SINK_T;
+
+/* Forward declarations */
+static void usage(const char* pName);
+static void benchTape(const BENCH_TAPE_T* pTape, unsigned nRuns, BENCH_RESULT_T* pResult);
+static void writeResult(FILE* pFile, const BENCH_TAPE_T* pTape, const BENCH_RESULT_T* pResult, bool bLast);
+static int compareBaseline(const char* pBaseline, const BENCH_TAPE_T* pTape, const BENCH_RESULT_T* pResult,
+                           unsigned nTolerancePercent, bool bRates);
+static bool findBaselineValue(const char* pBaseline, const char* pTape, const char* pKey, double* pValue);
+static char* readFile(const char* pFilename);
+static void countWrite(void* pContext, const ZXTAPE_PULSE_T* pPulses, unsigned nCount);
+static double nowSeconds(void);
+
+/* Local variables */
+static long long g_nAllocations = 0;
+static long long g_nAllocatedBytes = 0;
+
+/**
+ * End-to-end benchmark: play each tape of the corpus to a sink as fast as it can be generated, and report the
+ * throughput, real-time factor and memory used as JSON. With a baseline (a previous output), fail if any tape plays
+ * differently, or allocates more than the tolerance above the baseline. With -R, also fail if the rates or the peak
+ * RSS regressed by more than the tolerance (only meaningful against a baseline from the same machine, when nothing
+ * else is running).
+ *
+ * zxtape_bench [-t tape] [-r runs] [-o results.json] [-b baseline.json] [-p tolerance percent] [-R] [-l]
+ */
+int main(int argc, char* argv[]) {
+  const char* pTapeName = NULL;
+  const char* pOutput = NULL;
+  const char* pBaselineFile = NULL;
+  unsigned nRuns = DEFAULT_RUNS;
+  unsigned nTolerancePercent = DEFAULT_TOLERANCE_PERCENT;
+  bool bRates = false;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "t:r:o:b:p:Rlh")) != -1) {
+    switch (opt) {
+      case 't':
+        pTapeName = optarg;
+        break;
+      case 'r':
+        nRuns = (unsigned)atoi(optarg);
+        if (nRuns == 0) nRuns = 1;
+        break;
+      case 'o':
+        pOutput = optarg;
+        break;
+      case 'b':
+        pBaselineFile = optarg;
+        break;
+      case 'p':
+        nTolerancePercent = (unsigned)atoi(optarg);
+        break;
+      case 'R':
+        bRates = true;
+        break;
+      case 'l':
+        for (unsigned i = 0; i < benchCorpus_getCount(); i++) {
+          BENCH_TAPE_T tape;
+          benchCorpus_get(i, &tape);
+          printf("%-10s %8lu bytes  %s\n", tape.pName, tape.nLength, tape.pDescription);
+          benchCorpus_free(&tape);
+        }
+        return 0;
+      default:
+        usage(argv[0]);
+        return 1;
+    }
+  }
+
+  char* pBaseline = NULL;
+  if (pBaselineFile != NULL && (pBaseline = readFile(pBaselineFile)) == NULL) {
+    fprintf(stderr, "FAIL: could not read baseline %s\n", pBaselineFile);
+    return 1;
+  }
+
+  FILE* pFile = pOutput != NULL ? fopen(pOutput, "w") : stdout;
+  if (pFile == NULL) {
+    fprintf(stderr, "FAIL: could not write %s\n", pOutput);
+    return 1;
+  }
+
+  // Each tape, or the one given
+  unsigned nFirst = 0, nLast = benchCorpus_getCount();
+  if (pTapeName != NULL) {
+    if (!benchCorpus_find(pTapeName, &nFirst)) {
+      fprintf(stderr, "FAIL: no tape %s in the corpus (-l lists them)\n", pTapeName);
+      return 1;
+    }
+    nLast = nFirst + 1;
+  }
+
+  int nFailed = 0;
+  fprintf(pFile, "{\n  \"benchmark\": \"zxtape_bench\",\n  \"runs\": %u,\n  \"results\": [\n", nRuns);
+  for (unsigned i = nFirst; i < nLast; i++) {
+    BENCH_TAPE_T tape;
+    BENCH_RESULT_T result;
+    benchCorpus_get(i, &tape);
+    benchTape(&tape, nRuns, &result);
+    writeResult(pFile, &tape, &result, i + 1 == nLast);
+    fprintf(stderr, "%s: %llu pulses, %.1fs of tape in %.3fs, %.0f pulses/s, %.0f bytes/s, %.0fx real time, %lld "
+            "allocations (%lld bytes), peak RSS %lldKB\n", tape.pName, result.nPulses, result.nTapeUs / 1e6,
+            result.nWallSeconds, result.nPulsesPerSecond, result.nBytesPerSecond, result.nRealTimeFactor,
+            result.nAllocations, result.nAllocatedBytes, result.nPeakRssKb);
+    if (pBaseline != NULL) nFailed += compareBaseline(pBaseline, &tape, &result, nTolerancePercent, bRates);
+    benchCorpus_free(&tape);
+  }
+  fprintf(pFile, "  ]\n}\n");
+
+  if (pFile != stdout) fclose(pFile);
+  free(pBaseline);
+
+  return nFailed ? 1 : 0;
+}
+
+static void usage(const char* pName) {
+  fprintf(stderr,
+          "Usage: %s [-t tape (default all)] [-r runs (default %u)] [-o results.json (default stdout)] "
+          "[-b baseline.json] [-p tolerance percent (default %u)] [-R (compare the rates and peak RSS)] "
+          "[-l (list the corpus)]\n",
+          pName, DEFAULT_RUNS, DEFAULT_TOLERANCE_PERCENT);
+}
+
+/**
+ * Play the tape to a counting sink as fast as it can be generated, several times, and measure the fastest
+ */
+static void benchTape(const BENCH_TAPE_T* pTape, unsigned nRuns, BENCH_RESULT_T* pResult) {
+  memset(pResult, 0, sizeof(BENCH_RESULT_T));
+
+  for (unsigned nRun = 0; nRun < nRuns; nRun++) {
+    BENCH_COUNT_SINK_T count = {{countWrite, NULL, NULL}, 0, 0};
+    count.sink.pContext = &count;
+    long long nAllocations = g_nAllocations;
+    long long nAllocatedBytes = g_nAllocatedBytes;
+    double nStart = nowSeconds();
+
+    ZXTAPE_HANDLE_T* pZxTape = zxtape_create();
+    zxtape_init(pZxTape);
+    zxtape_setSink(pZxTape, &count.sink);
+    zxtape_loadBuffer(pZxTape, pTape->pFilename, pTape->pData, pTape->nLength);
+    zxtape_playPause(pZxTape);
+    bool bStarted = false;
+    for (unsigned nRuns = 0; nRuns < MAX_RUNS; nRuns++) {
+      zxtape_run(pZxTape, 0);
+      if (zxtape_isStarted(pZxTape)) {
+        bStarted = true;
+      } else if (bStarted) {
+        break;
+      }
+    }
+    zxtape_destroy(pZxTape);
+
+    double nSeconds = nowSeconds() - nStart;
+    if (nRun == 0 || nSeconds < pResult->nWallSeconds) pResult->nWallSeconds = nSeconds;
+    pResult->nPulses = count.nPulses;
+    pResult->nTapeUs = count.nTapeUs;
+    pResult->nAllocations = g_nAllocations - nAllocations;
+    pResult->nAllocatedBytes = g_nAllocatedBytes - nAllocatedBytes;
+  }
+
+  double nSeconds = pResult->nWallSeconds > 0 ? pResult->nWallSeconds : 1e-9;
+  pResult->nPulsesPerSecond = pResult->nPulses / nSeconds;
+  pResult->nBytesPerSecond = pTape->nLength / nSeconds;
+  pResult->nRealTimeFactor = pResult->nTapeUs / 1e6 / nSeconds;
+
+#ifndef ZXTAPE_BENCH_COUNT_ALLOCATIONS
+  pResult->nAllocations = -1;
+  pResult->nAllocatedBytes = -1;
+#endif
+
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+  pResult->nPeakRssKb = usage.ru_maxrss / 1024;  // (bytes on macOS)
+#else
+  pResult->nPeakRssKb = usage.ru_maxrss;
+#endif
+}
+
+static void writeResult(FILE* pFile, const BENCH_TAPE_T* pTape, const BENCH_RESULT_T* pResult, bool bLast) {
+  fprintf(pFile,
+          "    {\"tape\": \"%s\", \"bytes\": %lu, \"pulses\": %llu, \"tape_us\": %llu, \"wall_s\": %.6f, "
+          "\"pulses_per_s\": %.0f, \"bytes_per_s\": %.0f, \"rtf\": %.1f, \"allocations\": %lld, "
+          "\"allocated_bytes\": %lld, \"peak_rss_kb\": %lld}%s\n",
+          pTape->pName, pTape->nLength, pResult->nPulses, pResult->nTapeUs, pResult->nWallSeconds,
+          pResult->nPulsesPerSecond, pResult->nBytesPerSecond, pResult->nRealTimeFactor, pResult->nAllocations,
+          pResult->nAllocatedBytes, pResult->nPeakRssKb, bLast ? "" : ",");
+}
+
+/**
+ * Compare the result with the baseline: the output must be the same and the allocations no higher (within the
+ * tolerance), and with bRates the rates no lower and the peak RSS no higher (within the tolerance, as these depend on
+ * the machine and its load). Returns the number of failures.
+ */
+static int compareBaseline(const char* pBaseline, const BENCH_TAPE_T* pTape, const BENCH_RESULT_T* pResult,
+                           unsigned nTolerancePercent, bool bRates) {
+  static const char* pRateKeys[] = {"pulses_per_s", "bytes_per_s", "rtf"};
+  static const char* pResourceKeys[] = {"allocations", "allocated_bytes", "peak_rss_kb"};
+  static const unsigned nDeterministicResources = 2;  // The allocations (peak RSS depends on the machine)
+  double nRates[] = {pResult->nPulsesPerSecond, pResult->nBytesPerSecond, pResult->nRealTimeFactor};
+  double nResources[] = {(double)pResult->nAllocations, (double)pResult->nAllocatedBytes,
+                         (double)pResult->nPeakRssKb};
+  double nTolerance = nTolerancePercent / 100.0;
+  double nValue;
+  int nFailed = 0;
+
+  if (!findBaselineValue(pBaseline, pTape->pName, "pulses", &nValue)) {
+    fprintf(stderr, "%s: not in the baseline\n", pTape->pName);
+    return 0;
+  }
+  if ((unsigned long long)nValue != pResult->nPulses ||
+      !findBaselineValue(pBaseline, pTape->pName, "tape_us", &nValue) ||
+      (unsigned long long)nValue != pResult->nTapeUs) {
+    fprintf(stderr, "FAIL: %s: output differs from the baseline\n", pTape->pName);
+    nFailed++;
+  }
+
+  for (unsigned i = 0; bRates && i < sizeof(pRateKeys) / sizeof(pRateKeys[0]); i++) {
+    if (!findBaselineValue(pBaseline, pTape->pName, pRateKeys[i], &nValue)) continue;
+    if (nRates[i] < nValue * (1 - nTolerance)) {
+      fprintf(stderr, "FAIL: %s: %s %.0f, baseline %.0f\n", pTape->pName, pRateKeys[i], nRates[i], nValue);
+      nFailed++;
+    }
+  }
+
+  for (unsigned i = 0; i < sizeof(pResourceKeys) / sizeof(pResourceKeys[0]); i++) {
+    if (!bRates && i >= nDeterministicResources) break;
+    if (!findBaselineValue(pBaseline, pTape->pName, pResourceKeys[i], &nValue) || nValue < 0 || nResources[i] < 0) {
+      continue;
+    }
+    if (nResources[i] > nValue * (1 + nTolerance)) {
+      fprintf(stderr, "FAIL: %s: %s %.0f, baseline %.0f\n", pTape->pName, pResourceKeys[i], nResources[i], nValue);
+      nFailed++;
+    }
+  }
+
+  return nFailed;
+}
+
+/**
+ * Find a value of a tape's result in the baseline (as written by writeResult(), one result per line)
+ */
+static bool findBaselineValue(const char* pBaseline, const char* pTape, const char* pKey, double* pValue) {
+  char tapeKey[64], valueKey[64];
+  snprintf(tapeKey, sizeof(tapeKey), "\"tape\": \"%s\"", pTape);
+  snprintf(valueKey, sizeof(valueKey), "\"%s\": ", pKey);
+
+  const char* pLine = strstr(pBaseline, tapeKey);
+  if (pLine == NULL) return false;
+  const char* pEnd = strchr(pLine, '}');
+  const char* pFound = strstr(pLine, valueKey);
+  if (pFound == NULL || (pEnd != NULL && pFound > pEnd)) return false;
+
+  *pValue = strtod(pFound + strlen(valueKey), NULL);
+
+  return true;
+}
+
+static char* readFile(const char* pFilename) {
+  FILE* pFile = fopen(pFilename, "rb");
+  if (pFile == NULL) return NULL;
+
+  char* pData = (char*)malloc(MAX_BASELINE_LENGTH + 1);
+  size_t nRead = fread(pData, 1, MAX_BASELINE_LENGTH, pFile);
+  pData[nRead] = 0;
+  fclose(pFile);
+
+  return pData;
+}
+
+static void countWrite(void* pContext, const ZXTAPE_PULSE_T* pPulses, unsigned nCount) {
+  BENCH_COUNT_SINK_T* pCount = (BENCH_COUNT_SINK_T*)pContext;
+
+  pCount->nPulses += nCount;
+  for (unsigned i = 0; i < nCount; i++) pCount->nTapeUs += pPulses[i].nPeriodUs;
+}
+
+static double nowSeconds(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+#ifdef ZXTAPE_BENCH_COUNT_ALLOCATIONS
+//
+// Allocation counting: the executable is linked with the allocator wrapped (-Wl,--wrap=malloc etc.), so the library's
+// allocations come here first
+//
+void* __real_malloc(size_t nSize);
+void* __real_calloc(size_t nCount, size_t nSize);
+void* __real_realloc(void* p, size_t nSize);
+
+void* __wrap_malloc(size_t nSize) {
+  __atomic_add_fetch(&g_nAllocations, 1, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&g_nAllocatedBytes, (long long)nSize, __ATOMIC_RELAXED);
+  return __real_malloc(nSize);
+}
+
+void* __wrap_calloc(size_t nCount, size_t nSize) {
+  __atomic_add_fetch(&g_nAllocations, 1, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&g_nAllocatedBytes, (long long)(nCount * nSize), __ATOMIC_RELAXED);
+  return __real_calloc(nCount, nSize);
+}
+
+void* __wrap_realloc(void* p, size_t nSize) {
+  __atomic_add_fetch(&g_nAllocations, 1, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&g_nAllocatedBytes, (long long)nSize, __ATOMIC_RELAXED);
+  return __real_realloc(p, nSize);
+}
+#endif  // ZXTAPE_BENCH_COUNT_ALLOCATIONS
@@ -0,0 +1,514 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "../../include/tzx_compat_impl.h"
+#include "../../include/tzx_compat_impl_sim.h"
+#include "../../lib/zxtape/file/zxtape_file_api_buffer.h"
+#include "../../lib/zxtape/file/zxtape_file_api_dummy.h"
+#include "../../lib/zxtape/file/zxtape_file_api_file.h"
+#include "../../lib/zxtape/info/zxtape_info.h"
+#include "../../lib/zxtape/tzx_compat/tzx_compat.h"
+#include "bench_corpus.h"
+
+#define DEFAULT_RUNS 10                  // Warm runs of each kernel (after the cold run)
+#define MAX_RUNS 1000                    // Most warm runs kept
+#define PLAY_BATCH 256                   // Periods taken from wbuffer per wave() call (as render mode)
+#define MAX_PLAY_CALLS 100000000         // Give up if the tape has not ended after this many TZXLoop() calls
+#define OUTPUT_PERIODS 4096              // Fixed periods buffered to the output per run (fits the simulation ring)
+#define EVICT_LENGTH (32 * 1024 * 1024)  // Bytes written before a cold run, to evict the caches
+
+typedef struct _MICRO_RESULT_T {
+  const char* pKernel;  // Kernel measured
+  const char* pInput;   // Input it was given
+  const char* pItem;    // What is counted (per item timings)
+  unsigned long long nItems;
+  double nCold;        // Ticks per item, first run (caches evicted)
+  double nWarmMin;     // Ticks per item, fastest warm run
+  double nWarmMedian;  // Ticks per item, median warm run
+  bool bStable;        // Every run counted the same items
+} MICRO_RESULT_T;
+
+typedef struct _MICRO_PLAY_T {
+  unsigned long long nPulses;
+  bool bEnded;
+} MICRO_PLAY_T;
+
+typedef struct _MICRO_RUN_T {
+  unsigned long long nItems;
+  unsigned long long nTicks;
+} MICRO_RUN_T;
+
+/* Forward declarations */
+static void usage(const char* pName);
+static bool selected(const char* pFilter, const char* pKernel);
+static void benchPlayback(const BENCH_TAPE_T* pTape, unsigned nRuns, MICRO_RESULT_T* pProcess, MICRO_RESULT_T* pWave);
+static bool playTape(const BENCH_TAPE_T* pTape, MICRO_RUN_T* pProcess, MICRO_RUN_T* pWave);
+static void benchOutput(unsigned nRuns, MICRO_RESULT_T* pBuffer, MICRO_RESULT_T* pFill);
+static void outputPeriods(const unsigned long* pPeriods, MICRO_RUN_T* pBuffer, MICRO_RUN_T* pFill);
+static void benchLoadInfo(const BENCH_TAPE_T* pTape, unsigned nRuns, MICRO_RESULT_T* pResult);
+static void benchFileRead(const BENCH_TAPE_T* pTape, const char* pBackend, unsigned nRuns, MICRO_RESULT_T* pResult);
+static void readTape(unsigned long nLength, MICRO_RUN_T* pRun);
+static bool writeTempFile(const BENCH_TAPE_T* pTape, char* pPath, size_t nPathLength);
+static void openTape(const BENCH_TAPE_T* pTape, const char* pFilename, bool bFile);
+static void summarise(const MICRO_RUN_T* pRuns, unsigned nRuns, MICRO_RESULT_T* pResult);
+static int compareDouble(const void* pA, const void* pB);
+static void writeResult(FILE* pFile, const MICRO_RESULT_T* pResult, bool* pFirst);
+static void evictCaches(void);
+static unsigned long long ticks(void);
+static void onEndPlayback(void* pInstance);
+static void onPulse(void* pInstance, u8 nLevel, u32 nPeriodUs);
+
+/* Local variables */
+static MICRO_PLAY_T g_play;
+static TZX_CALLBACKS_T g_callbacks = {
+    .endPlayback = onEndPlayback,
+    .pulse = onPulse,
+};
+static volatile u8 g_nReadSink;  // Bytes read are accumulated here, so the reads are not optimised away
+static u8* g_pEvict = NULL;
+
+#if defined(__x86_64__) || defined(__i386__)
+static const char* g_pTickUnit = "cycles";  // Time stamp counter
+#else
+static const char* g_pTickUnit = "ns";  // Monotonic clock
+#endif
+
+/**
+ * Microbenchmarks: time each hot kernel of the engine in isolation, on fixed inputs (the benchmark corpus, and a fixed
+ * period pattern), so that a change to one stage shows up in its own numbers. Each kernel is run once with the caches
+ * evicted (cold), then repeatedly (warm), and reported in ticks (TSC cycles on x86, otherwise ns) per item as JSON.
+ *
+ * Kernels:
+ *   process       TZXProcess() (through TZXLoop(), which only runs it to fill wbuffer), per pulse, per tape
+ *   wave          wave() in buffer mode (TZXCompat_waveOrBuffer(true, ...)), per pulse, per tape
+ *   buffer        TZXCompat_buffer() of the simulation implementation (and the level set before it), per period
+ *   pcm_fill      Audio pull of the simulation implementation (transferAudioBuffer()), per sample
+ *   load_info     zxtapeInfo_loadInfo(), per tape byte, per tape
+ *   read_buffer   Buffer TZX_FILETYPE read path (seekSet() and read() a byte, as ReadByte()), per byte, per tape
+ *   read_file     File TZX_FILETYPE read path (the same, through the compatibility layer file API), per byte, per tape
+ *
+ * The kernels drive the TZX library directly, without a ZxTape instance.
+ *
+ * zxtape_micro [-k kernel (prefix)] [-t tape] [-r runs] [-o results.json] [-l]
+ */
+int main(int argc, char* argv[]) {
+  const char* pKernel = NULL;
+  const char* pTapeName = NULL;
+  const char* pOutput = NULL;
+  unsigned nRuns = DEFAULT_RUNS;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "k:t:r:o:lh")) != -1) {
+    switch (opt) {
+      case 'k':
+        pKernel = optarg;
+        break;
+      case 't':
+        pTapeName = optarg;
+        break;
+      case 'r':
+        nRuns = (unsigned)atoi(optarg);
+        if (nRuns == 0) nRuns = 1;
+        if (nRuns > MAX_RUNS) nRuns = MAX_RUNS;
+        break;
+      case 'o':
+        pOutput = optarg;
+        break;
+      case 'l':
+        printf("process wave buffer pcm_fill load_info read_buffer read_file\n");
+        return 0;
+      default:
+        usage(argv[0]);
+        return 1;
+    }
+  }
+
+  FILE* pFile = pOutput != NULL ? fopen(pOutput, "w") : stdout;
+  if (pFile == NULL) {
+    fprintf(stderr, "FAIL: could not write %s\n", pOutput);
+    return 1;
+  }
+
+  // Each tape, or the one given
+  unsigned nFirst = 0, nLast = benchCorpus_getCount();
+  if (pTapeName != NULL) {
+    if (!benchCorpus_find(pTapeName, &nFirst)) {
+      fprintf(stderr, "FAIL: no tape %s in the corpus\n", pTapeName);
+      return 1;
+    }
+    nLast = nFirst + 1;
+  }
+
+  g_pEvict = (u8*)malloc(EVICT_LENGTH);
+  TZXCompat_create();
+  TZXCompatInternal_initialize(&g_play, &g_callbacks);
+
+  MICRO_RESULT_T results[2];
+  bool bFirst = true;
+  int nFailed = 0;
+  fprintf(pFile, "{\n  \"benchmark\": \"zxtape_micro\",\n  \"unit\": \"%s\",\n  \"runs\": %u,\n  \"results\": [",
+          g_pTickUnit, nRuns);
+
+  for (unsigned i = nFirst; i < nLast; i++) {
+    BENCH_TAPE_T tape;
+    benchCorpus_get(i, &tape);
+
+    if (selected(pKernel, "process") || selected(pKernel, "wave")) {
+      benchPlayback(&tape, nRuns, &results[0], &results[1]);
+      if (selected(pKernel, "process")) writeResult(pFile, &results[0], &bFirst);
+      if (selected(pKernel, "wave")) writeResult(pFile, &results[1], &bFirst);
+      nFailed += !results[0].bStable;
+    }
+    if (selected(pKernel, "load_info")) {
+      benchLoadInfo(&tape, nRuns, &results[0]);
+      writeResult(pFile, &results[0], &bFirst);
+      nFailed += !results[0].bStable;
+    }
+    if (selected(pKernel, "read_buffer")) {
+      benchFileRead(&tape, "read_buffer", nRuns, &results[0]);
+      writeResult(pFile, &results[0], &bFirst);
+      nFailed += !results[0].bStable;
+    }
+    if (selected(pKernel, "read_file")) {
+      benchFileRead(&tape, "read_file", nRuns, &results[0]);
+      writeResult(pFile, &results[0], &bFirst);
+      nFailed += !results[0].bStable;
+    }
+
+    benchCorpus_free(&tape);
+  }
+
+  if (selected(pKernel, "buffer") || selected(pKernel, "pcm_fill")) {
+    benchOutput(nRuns, &results[0], &results[1]);
+    if (selected(pKernel, "buffer")) writeResult(pFile, &results[0], &bFirst);
+    if (selected(pKernel, "pcm_fill")) writeResult(pFile, &results[1], &bFirst);
+    nFailed += !results[1].bStable;
+  }
+
+  fprintf(pFile, "\n  ]\n}\n");
+  if (pFile != stdout) fclose(pFile);
+
+  TZXCompat_destroy();
+  free(g_pEvict);
+
+  return nFailed ? 1 : 0;
+}
+
+static void usage(const char* pName) {
+  fprintf(stderr,
+          "Usage: %s [-k kernel (prefix, default all)] [-t tape (default all)] [-r warm runs (default %u)] "
+          "[-o results.json (default stdout)] [-l (list the kernels)]\n",
+          pName, DEFAULT_RUNS);
+}
+
+static bool selected(const char* pFilter, const char* pKernel) {
+  return pFilter == NULL || strncmp(pFilter, pKernel, strlen(pFilter)) == 0;
+}
+
+//
+// Kernels
+//
+
+/**
+ * Play the tape to the end through the TZX library, timing the generation of the periods (TZXProcess()) and the
+ * buffer mode output (wave()) separately
+ */
+static void benchPlayback(const BENCH_TAPE_T* pTape, unsigned nRuns, MICRO_RESULT_T* pProcess, MICRO_RESULT_T* pWave) {
+  MICRO_RUN_T processRuns[MAX_RUNS + 1];
+  MICRO_RUN_T waveRuns[MAX_RUNS + 1];
+  bool bEnded = true;
+
+  for (unsigned nRun = 0; nRun <= nRuns; nRun++) {
+    if (nRun == 0) evictCaches();
+    bEnded &= playTape(pTape, &processRuns[nRun], &waveRuns[nRun]);
+  }
+
+  *pProcess = (MICRO_RESULT_T){.pKernel = "process", .pInput = pTape->pName, .pItem = "pulse"};
+  *pWave = (MICRO_RESULT_T){.pKernel = "wave", .pInput = pTape->pName, .pItem = "pulse"};
+  summarise(processRuns, nRuns, pProcess);
+  summarise(waveRuns, nRuns, pWave);
+  pProcess->bStable &= bEnded;
+}
+
+static bool playTape(const BENCH_TAPE_T* pTape, MICRO_RUN_T* pProcess, MICRO_RUN_T* pWave) {
+  memset(pProcess, 0, sizeof(MICRO_RUN_T));
+  memset(pWave, 0, sizeof(MICRO_RUN_T));
+  memset(&g_play, 0, sizeof(g_play));
+
+  // Render mode playback (as playFile()), with the periods sent to onPulse()
+  openTape(pTape, pTape->pFilename, false);
+  TZXCompatInternal_setPulseOutput(true);
+  TZX_pauseOn = false;
+  TZX_currpct = 100;
+  TZX_startOffset = 0;
+  TZXPlay();
+
+  for (unsigned nCalls = 0; nCalls < MAX_PLAY_CALLS && !g_play.bEnded; nCalls++) {
+    unsigned long long nStart = ticks();
+    TZXLoop();
+    unsigned long long nProcessed = ticks();
+    TZXCompat_waveOrBuffer(true, PLAY_BATCH, 0);
+    unsigned long long nWaved = ticks();
+
+    pProcess->nTicks += nProcessed - nStart;
+    pWave->nTicks += nWaved - nProcessed;
+  }
+
+  TZXStop();
+  TZXCompatInternal_setPulseOutput(false);
+  pProcess->nItems = g_play.nPulses;
+  pWave->nItems = g_play.nPulses;
+
+  return g_play.bEnded;
+}
+
+/**
+ * Buffer a fixed pattern of periods to the simulation implementation output, then pull them out as samples
+ */
+static void benchOutput(unsigned nRuns, MICRO_RESULT_T* pBuffer, MICRO_RESULT_T* pFill) {
+  MICRO_RUN_T bufferRuns[MAX_RUNS + 1];
+  MICRO_RUN_T fillRuns[MAX_RUNS + 1];
+  unsigned long* pPeriods = (unsigned long*)malloc(OUTPUT_PERIODS * sizeof(unsigned long));
+
+  // Standard speed periods: a pilot tone, sync pulses, then pseudo-random bits (two pulses each)
+  u32 x = 0x5A585441;
+  for (unsigned i = 0; i < OUTPUT_PERIODS; i++) {
+    if (i < OUTPUT_PERIODS / 4) {
+      pPeriods[i] = 619;
+    } else if (i < OUTPUT_PERIODS / 4 + 2) {
+      pPeriods[i] = i & 1 ? 210 : 190;
+    } else {
+      if ((i & 1) == 0) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+      }
+      pPeriods[i] = x & 0x80000000 ? 488 : 244;
+    }
+  }
+
+  for (unsigned nRun = 0; nRun <= nRuns; nRun++) {
+    if (nRun == 0) evictCaches();
+    outputPeriods(pPeriods, &bufferRuns[nRun], &fillRuns[nRun]);
+  }
+
+  *pBuffer = (MICRO_RESULT_T){.pKernel = "buffer", .pInput = "standard_speed", .pItem = "period"};
+  *pFill = (MICRO_RESULT_T){.pKernel = "pcm_fill", .pInput = "standard_speed", .pItem = "sample"};
+  summarise(bufferRuns, nRuns, pBuffer);
+  summarise(fillRuns, nRuns, pFill);
+
+  free(pPeriods);
+}
+
+static void outputPeriods(const unsigned long* pPeriods, MICRO_RUN_T* pBuffer, MICRO_RUN_T* pFill) {
+  TZX_SIM_STATS_T stats;
+  unsigned long long nPeriodsUs = 0;
+
+  TZXCompat_start();
+
+  // Buffer (as TZX_buffer() when not in pulse output mode, after the level is set)
+  unsigned long long nStart = ticks();
+  for (unsigned i = 0; i < OUTPUT_PERIODS; i++) {
+    if (i & 1) {
+      TZXCompat_setAudioHigh();
+    } else {
+      TZXCompat_setAudioLow();
+    }
+    TZXCompat_buffer(pPeriods[i]);
+  }
+  pBuffer->nTicks = ticks() - nStart;
+  pBuffer->nItems = OUTPUT_PERIODS;
+  for (unsigned i = 0; i < OUTPUT_PERIODS; i++) nPeriodsUs += pPeriods[i];
+
+  // Pull the periods out (stopping short of the end, so the output never runs dry)
+  TZXCompatSim_getStats(&stats);
+  unsigned long long nSamples = stats.nSamplesWritten;
+  nStart = ticks();
+  TZXCompatSim_advance(nPeriodsUs * 1000 * 9 / 10);
+  pFill->nTicks = ticks() - nStart;
+  TZXCompatSim_getStats(&stats);
+  pFill->nItems = stats.nSamplesWritten - nSamples;
+
+  TZXCompat_stop();
+}
+
+/**
+ * Scan the tape for its sections and blocks (per byte, as the scan skips through the data of each block)
+ */
+static void benchLoadInfo(const BENCH_TAPE_T* pTape, unsigned nRuns, MICRO_RESULT_T* pResult) {
+  MICRO_RUN_T runs[MAX_RUNS + 1];
+  ZXTAPE_INFO_T info;
+  memset(&info, 0, sizeof(info));
+
+  openTape(pTape, pTape->pFilename, false);
+
+  for (unsigned nRun = 0; nRun <= nRuns; nRun++) {
+    if (nRun == 0) evictCaches();
+    unsigned long long nStart = ticks();
+    zxtapeInfo_loadInfo(&info);
+    runs[nRun].nTicks = ticks() - nStart;
+    runs[nRun].nItems = info.blockCount > 0 ? pTape->nLength : 0;
+    zxtapeInfo_freeInfo(&info);
+  }
+
+  TZX_entry.close();
+
+  *pResult = (MICRO_RESULT_T){.pKernel = "load_info", .pInput = pTape->pName, .pItem = "byte"};
+  summarise(runs, nRuns, pResult);
+}
+
+/**
+ * Read the tape a byte at a time through a TZX_FILETYPE backend, as ReadByte() does
+ */
+static void benchFileRead(const BENCH_TAPE_T* pTape, const char* pBackend, unsigned nRuns, MICRO_RESULT_T* pResult) {
+  MICRO_RUN_T runs[MAX_RUNS + 1];
+  char path[ZX_TAPE_MAX_FILENAME_LEN + 1];
+  bool bFile = strcmp(pBackend, "read_file") == 0;
+
+  *pResult = (MICRO_RESULT_T){.pKernel = pBackend, .pInput = pTape->pName, .pItem = "byte"};
+
+  if (bFile && !writeTempFile(pTape, path, sizeof(path))) {
+    fprintf(stderr, "FAIL: could not write a temporary file for %s\n", pTape->pName);
+    return;
+  }
+  openTape(pTape, bFile ? path : pTape->pFilename, bFile);
+
+  for (unsigned nRun = 0; nRun <= nRuns; nRun++) {
+    if (nRun == 0) evictCaches();
+    readTape(pTape->nLength, &runs[nRun]);
+  }
+
+  TZX_entry.close();
+  if (bFile) unlink(path);
+
+  summarise(runs, nRuns, pResult);
+}
+
+static void readTape(unsigned long nLength, MICRO_RUN_T* pRun) {
+  u8 sum = 0;
+
+  pRun->nItems = 0;
+  unsigned long long nStart = ticks();
+  for (unsigned long nPos = 0; nPos < nLength; nPos++) {
+    u8 out[1];
+    if (TZX_entry.seekSet(nPos) && TZX_entry.read(out, 1) == 1) {
+      sum += out[0];
+      pRun->nItems++;
+    }
+  }
+  pRun->nTicks = ticks() - nStart;
+
+  g_nReadSink = sum;
+}
+
+//
+// Helpers
+//
+
+static bool writeTempFile(const BENCH_TAPE_T* pTape, char* pPath, size_t nPathLength) {
+  snprintf(pPath, nPathLength, "/tmp/zxtape_micro_XXXXXX");
+  int fd = mkstemp(pPath);
+  if (fd < 0) return false;
+
+  bool bWritten = write(fd, pTape->pData, pTape->nLength) == (ssize_t)pTape->nLength;
+  close(fd);
+
+  return bWritten;
+}
+
+/**
+ * Open the tape as the current TZX file (from memory, or from a file through the compatibility layer)
+ */
+static void openTape(const BENCH_TAPE_T* pTape, const char* pFilename, bool bFile) {
+  zxtapeFileApiDummy_initialize(&TZX_dir);
+  if (bFile) {
+    zxtapeFileApiFile_initialize(&TZX_entry);
+  } else {
+    zxtapeFileApiBuffer_initialize(&TZX_entry, pTape->pData, pTape->nLength);
+  }
+  snprintf(TZX_fileName, ZX_TAPE_MAX_FILENAME_LEN + 1, "%s", pFilename);
+  TZX_filesize = pTape->nLength;
+  TZX_entry.open(&TZX_dir, 0, 0);
+}
+
+/**
+ * Reduce the runs (the first cold, the rest warm) to ticks per item
+ */
+static void summarise(const MICRO_RUN_T* pRuns, unsigned nRuns, MICRO_RESULT_T* pResult) {
+  double perItem[MAX_RUNS];
+  unsigned long long nItems = pRuns[0].nItems;
+
+  pResult->nItems = nItems;
+  pResult->bStable = nItems > 0;
+  if (nItems == 0) return;
+
+  pResult->nCold = (double)pRuns[0].nTicks / nItems;
+  for (unsigned i = 0; i < nRuns; i++) {
+    const MICRO_RUN_T* pRun = &pRuns[i + 1];
+    if (pRun->nItems != nItems) pResult->bStable = false;
+    perItem[i] = (double)pRun->nTicks / nItems;
+  }
+  qsort(perItem, nRuns, sizeof(double), compareDouble);
+  pResult->nWarmMin = perItem[0];
+  pResult->nWarmMedian = perItem[nRuns / 2];
+}
+
+static int compareDouble(const void* pA, const void* pB) {
+  double a = *(const double*)pA, b = *(const double*)pB;
+  return a < b ? -1 : a > b;
+}
+
+static void writeResult(FILE* pFile, const MICRO_RESULT_T* pResult, bool* pFirst) {
+  fprintf(pFile,
+          "%s\n    {\"kernel\": \"%s\", \"input\": \"%s\", \"item\": \"%s\", \"items\": %llu, \"cold\": %.2f, "
+          "\"warm_min\": %.2f, \"warm_median\": %.2f}",
+          *pFirst ? "" : ",", pResult->pKernel, pResult->pInput, pResult->pItem, pResult->nItems, pResult->nCold,
+          pResult->nWarmMin, pResult->nWarmMedian);
+  *pFirst = false;
+
+  fprintf(stderr, "%-12s %-15s %10llu %-7s cold %9.2f  warm %9.2f (median %9.2f) %s/%s%s\n", pResult->pKernel,
+          pResult->pInput, pResult->nItems, pResult->pItem, pResult->nCold, pResult->nWarmMin, pResult->nWarmMedian,
+          g_pTickUnit, pResult->pItem, pResult->bStable ? "" : "  FAIL: runs differ");
+}
+
+/**
+ * Write a buffer larger than the last level cache, so the next run starts cold
+ */
+static void evictCaches(void) {
+  if (g_pEvict == NULL) return;
+  for (unsigned long i = 0; i < EVICT_LENGTH; i += 64) g_pEvict[i] = (u8)i;
+}
+
+static unsigned long long ticks(void) {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned long long)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+#endif
+}
+
+//
+// TZX library callbacks
+//
+
+static void onEndPlayback(void* pInstance) {
+  ((MICRO_PLAY_T*)pInstance)->bEnded = true;
+}
+
+static void onPulse(void* pInstance, u8 nLevel, u32 nPeriodUs) {
+  MICRO_PLAY_T* pPlay = (MICRO_PLAY_T*)pInstance;
+
+  if (nPeriodUs == TZXCompat_EOF_PERIOD) {
+    pPlay->bEnded = true;
+    return;
+  }
+  pPlay->nPulses++;
+}
@@ -0,0 +1,436 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <zxtape.h>
+
+#include "../bench/bench_corpus.h"
+
+#define BATCH_RECORDS 1024                // Records per zxtape_readPulses() call
+#define MAX_PULSES (64ull * 1024 * 1024)  // Give up if the tape has not ended after this many pulses
+#define CHECKPOINT_PULSES 4096            // Pulses between the checkpoint digests of a segment
+#define REPORT_PULSES 8                   // Pulses shown from where a segment diverges
+#define MAX_LINE_LENGTH (1024 * 1024)     // Longest golden file line
+#define FNV_OFFSET 0xcbf29ce484222325ull  // FNV-1a 64-bit
+#define FNV_PRIME 0x100000001b3ull
+
+/**
+ * A run of consecutive pulses in one block (a block played more than once, e.g. in a loop, has a segment each time)
+ */
+typedef struct _GOLDEN_SEGMENT_T {
+  u32 nBlockIndex;       // Block (ZXTAPE_INDEX_NONE if unknown)
+  u64 nFirstPulse;       // Index of its first pulse in the tape
+  u32 nPulses;           // Pulses
+  u64 nTstates;          // Length (T-states at the default EAR clock)
+  u64 nDigest;           // Digest of the pulses (level and length)
+  u32 nFirstCheckpoint;  // Index of its first checkpoint in the timeline
+  u32 nCheckpoints;      // Digests of its pulses so far, after each CHECKPOINT_PULSES pulses
+} GOLDEN_SEGMENT_T;
+
+/**
+ * The edge timeline of a tape, as digests
+ */
+typedef struct _GOLDEN_TIMELINE_T {
+  GOLDEN_SEGMENT_T* pSegments;
+  u32 nSegments;
+  u32 nSegmentCapacity;
+  u64* pCheckpoints;
+  u32 nCheckpoints;
+  u32 nCheckpointCapacity;
+  u64 nPulses;
+  u64 nTstates;
+  u64 nDigest;  // Digest of the whole timeline (pulses and blocks)
+  bool bEnded;  // Played to the end (not stopped by MAX_PULSES)
+} GOLDEN_TIMELINE_T;
+
+/* Forward declarations */
+static void usage(const char* pName);
+static void renderTimeline(const BENCH_TAPE_T* pTape, GOLDEN_TIMELINE_T* pTimeline, FILE* pDump, u64 nShowFrom,
+                           u64 nShowTo);
+static void addSegment(GOLDEN_TIMELINE_T* pTimeline, u32 nBlockIndex, u64 nFirstPulse);
+static void addCheckpoint(GOLDEN_TIMELINE_T* pTimeline, u64 nDigest);
+static void freeTimeline(GOLDEN_TIMELINE_T* pTimeline);
+static void writeTimeline(FILE* pFile, const char* pName, const GOLDEN_TIMELINE_T* pTimeline);
+static bool readTimeline(FILE* pFile, const char* pName, GOLDEN_TIMELINE_T* pTimeline);
+static int compareTimeline(const BENCH_TAPE_T* pTape, const GOLDEN_TIMELINE_T* pTimeline,
+                           const GOLDEN_TIMELINE_T* pGolden);
+static void formatBlock(u32 nBlockIndex, char* pText, unsigned nLength);
+static u64 hash(u64 h, u64 nValue, unsigned nBytes);
+
+/**
+ * Golden pulse stream regression harness: render each tape of the corpus to its exact edge timeline (level, length in
+ * T-states and block of every pulse), digest it per segment (a run of pulses in one block), and compare with the
+ * golden digests. On a mismatch, report the first diverging segment (and its block), and the pulses around the first
+ * diverging one (to within CHECKPOINT_PULSES, from the checkpoint digests). With -w, write the golden digests instead
+ * (only after checking the change to the output is intended). With -d, write every pulse as text, to diff against a
+ * dump from a known good build for the exact pulse.
+ *
+ * zxtape_golden [-t tape] [-g corpus.golden] [-w corpus.golden] [-d dump.txt] [-l]
+ */
+int main(int argc, char* argv[]) {
+  const char* pTapeName = NULL;
+  const char* pGoldenFile = NULL;
+  const char* pWriteFile = NULL;
+  const char* pDumpFile = NULL;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "t:g:w:d:lh")) != -1) {
+    switch (opt) {
+      case 't':
+        pTapeName = optarg;
+        break;
+      case 'g':
+        pGoldenFile = optarg;
+        break;
+      case 'w':
+        pWriteFile = optarg;
+        break;
+      case 'd':
+        pDumpFile = optarg;
+        break;
+      case 'l':
+        for (unsigned i = 0; i < benchCorpus_getCount(); i++) {
+          BENCH_TAPE_T tape;
+          benchCorpus_get(i, &tape);
+          printf("%-10s %8lu bytes  %s\n", tape.pName, tape.nLength, tape.pDescription);
+          benchCorpus_free(&tape);
+        }
+        return 0;
+      default:
+        usage(argv[0]);
+        return 1;
+    }
+  }
+
+  FILE* pGolden = NULL;
+  if (pGoldenFile != NULL && (pGolden = fopen(pGoldenFile, "r")) == NULL) {
+    fprintf(stderr, "FAIL: could not read golden digests %s\n", pGoldenFile);
+    return 1;
+  }
+  FILE* pWrite = NULL;
+  if (pWriteFile != NULL && (pWrite = fopen(pWriteFile, "w")) == NULL) {
+    fprintf(stderr, "FAIL: could not write %s\n", pWriteFile);
+    return 1;
+  }
+  FILE* pDump = NULL;
+  if (pDumpFile != NULL && (pDump = fopen(pDumpFile, "w")) == NULL) {
+    fprintf(stderr, "FAIL: could not write %s\n", pDumpFile);
+    return 1;
+  }
+
+  // Each tape, or the one given
+  unsigned nFirst = 0, nLast = benchCorpus_getCount();
+  if (pTapeName != NULL) {
+    if (!benchCorpus_find(pTapeName, &nFirst)) {
+      fprintf(stderr, "FAIL: no tape %s in the corpus (-l lists them)\n", pTapeName);
+      return 1;
+    }
+    nLast = nFirst + 1;
+  }
+
+  int nFailed = 0;
+  if (pWrite != NULL) {
+    fprintf(pWrite, "# Golden pulse streams of the benchmark corpus (written by zxtape_golden -w)\n");
+    fprintf(pWrite, "# tape <name> <segments> <pulses> <T-states> <digest>\n");
+    fprintf(pWrite, "# <segment> <block> <pulses> <T-states> <digest> [<digest after each %u pulses>...]\n",
+            CHECKPOINT_PULSES);
+  }
+  for (unsigned i = nFirst; i < nLast; i++) {
+    BENCH_TAPE_T tape;
+    GOLDEN_TIMELINE_T timeline, golden;
+    benchCorpus_get(i, &tape);
+
+    if (pDump != NULL) fprintf(pDump, "tape %s\n", tape.pName);
+    renderTimeline(&tape, &timeline, pDump, 0, 0);
+    fprintf(stderr, "%s: %u segments, %llu pulses, %llu T-states, digest %016llx\n", tape.pName, timeline.nSegments,
+            timeline.nPulses, timeline.nTstates, timeline.nDigest);
+    if (!timeline.bEnded) {
+      fprintf(stderr, "FAIL: %s did not end after %llu pulses\n", tape.pName, MAX_PULSES);
+      nFailed++;
+    }
+
+    if (pWrite != NULL) writeTimeline(pWrite, tape.pName, &timeline);
+    if (pGolden != NULL) {
+      if (!readTimeline(pGolden, tape.pName, &golden)) {
+        fprintf(stderr, "FAIL: no golden digests for %s\n", tape.pName);
+        nFailed++;
+      } else {
+        nFailed += compareTimeline(&tape, &timeline, &golden);
+        freeTimeline(&golden);
+      }
+    }
+
+    freeTimeline(&timeline);
+    benchCorpus_free(&tape);
+  }
+
+  if (pGolden != NULL) fclose(pGolden);
+  if (pWrite != NULL) fclose(pWrite);
+  if (pDump != NULL) fclose(pDump);
+
+  return nFailed ? 1 : 0;
+}
+
+static void usage(const char* pName) {
+  fprintf(stderr,
+          "Usage: %s [-t tape (default all)] [-g corpus.golden (compare)] [-w corpus.golden (write)] "
+          "[-d dump.txt (every pulse)] [-l (list the corpus)]\n",
+          pName);
+}
+
+/**
+ * Read every pulse of the tape, and digest them per segment
+ *
+ * @param pTape Tape
+ * @param pTimeline Timeline (free with freeTimeline())
+ * @param pDump If not NULL, every pulse is written here
+ * @param nShowFrom First pulse written to stderr (with its index in the tape and segment)
+ * @param nShowTo After the last pulse written to stderr
+ */
+static void renderTimeline(const BENCH_TAPE_T* pTape, GOLDEN_TIMELINE_T* pTimeline, FILE* pDump, u64 nShowFrom,
+                           u64 nShowTo) {
+  static ZXTAPE_PULSE_RECORD_T records[BATCH_RECORDS];
+  GOLDEN_SEGMENT_T* pSegment = NULL;
+
+  memset(pTimeline, 0, sizeof(GOLDEN_TIMELINE_T));
+  pTimeline->nDigest = FNV_OFFSET;
+
+  ZXTAPE_HANDLE_T* pZxTape = zxtape_create();
+  zxtape_init(pZxTape);
+  zxtape_setRenderMode(pZxTape, true);
+  zxtape_loadBuffer(pZxTape, pTape->pFilename, pTape->pData, pTape->nLength);
+  zxtape_playPause(pZxTape);
+
+  while (pTimeline->nPulses < MAX_PULSES) {
+    unsigned n = zxtape_readPulses(pZxTape, records, BATCH_RECORDS);
+    if (n == 0 && !zxtape_isStarted(pZxTape)) {
+      pTimeline->bEnded = true;
+      break;
+    }
+
+    for (unsigned i = 0; i < n; i++) {
+      const ZXTAPE_PULSE_RECORD_T* pRecord = &records[i];
+
+      if (pSegment == NULL || pRecord->nBlockIndex != pSegment->nBlockIndex) {
+        addSegment(pTimeline, pRecord->nBlockIndex, pTimeline->nPulses);
+        pSegment = &pTimeline->pSegments[pTimeline->nSegments - 1];
+        pTimeline->nDigest = hash(pTimeline->nDigest, pRecord->nBlockIndex, sizeof(u32));
+      }
+
+      if (pDump != NULL) fprintf(pDump, "%u %u %d\n", pRecord->nLevel, pRecord->nDurationTstates,
+                                 (int)pRecord->nBlockIndex);
+      if (pTimeline->nPulses >= nShowFrom && pTimeline->nPulses < nShowTo) {
+        fprintf(stderr, "  pulse %llu (%u of segment %u): level %u, %u T-states\n", pTimeline->nPulses,
+                pSegment->nPulses, pTimeline->nSegments - 1, pRecord->nLevel, pRecord->nDurationTstates);
+      }
+
+      pSegment->nDigest = hash(pSegment->nDigest, pRecord->nLevel, sizeof(u8));
+      pSegment->nDigest = hash(pSegment->nDigest, pRecord->nDurationTstates, sizeof(u32));
+      pSegment->nTstates += pRecord->nDurationTstates;
+      pSegment->nPulses++;
+      if (pSegment->nPulses % CHECKPOINT_PULSES == 0) {
+        addCheckpoint(pTimeline, pSegment->nDigest);
+        pSegment->nCheckpoints++;
+      }
+
+      pTimeline->nDigest = hash(pTimeline->nDigest, pRecord->nLevel, sizeof(u8));
+      pTimeline->nDigest = hash(pTimeline->nDigest, pRecord->nDurationTstates, sizeof(u32));
+      pTimeline->nTstates += pRecord->nDurationTstates;
+      pTimeline->nPulses++;
+    }
+  }
+
+  zxtape_destroy(pZxTape);
+}
+
+static void addSegment(GOLDEN_TIMELINE_T* pTimeline, u32 nBlockIndex, u64 nFirstPulse) {
+  if (pTimeline->nSegments == pTimeline->nSegmentCapacity) {
+    pTimeline->nSegmentCapacity = pTimeline->nSegmentCapacity ? pTimeline->nSegmentCapacity * 2 : 64;
+    pTimeline->pSegments = (GOLDEN_SEGMENT_T*)realloc(pTimeline->pSegments,
+                                                      pTimeline->nSegmentCapacity * sizeof(GOLDEN_SEGMENT_T));
+  }
+
+  GOLDEN_SEGMENT_T* pSegment = &pTimeline->pSegments[pTimeline->nSegments++];
+  memset(pSegment, 0, sizeof(GOLDEN_SEGMENT_T));
+  pSegment->nBlockIndex = nBlockIndex;
+  pSegment->nFirstPulse = nFirstPulse;
+  pSegment->nDigest = FNV_OFFSET;
+  pSegment->nFirstCheckpoint = pTimeline->nCheckpoints;
+}
+
+static void addCheckpoint(GOLDEN_TIMELINE_T* pTimeline, u64 nDigest) {
+  if (pTimeline->nCheckpoints == pTimeline->nCheckpointCapacity) {
+    pTimeline->nCheckpointCapacity = pTimeline->nCheckpointCapacity ? pTimeline->nCheckpointCapacity * 2 : 256;
+    pTimeline->pCheckpoints = (u64*)realloc(pTimeline->pCheckpoints, pTimeline->nCheckpointCapacity * sizeof(u64));
+  }
+  pTimeline->pCheckpoints[pTimeline->nCheckpoints++] = nDigest;
+}
+
+static void freeTimeline(GOLDEN_TIMELINE_T* pTimeline) {
+  free(pTimeline->pSegments);
+  free(pTimeline->pCheckpoints);
+  memset(pTimeline, 0, sizeof(GOLDEN_TIMELINE_T));
+}
+
+/**
+ * Write the digests of a tape's timeline (a 'tape' line, then a line per segment)
+ */
+static void writeTimeline(FILE* pFile, const char* pName, const GOLDEN_TIMELINE_T* pTimeline) {
+  char block[16];
+
+  fprintf(pFile, "tape %s %u %llu %llu %016llx\n", pName, pTimeline->nSegments, pTimeline->nPulses,
+          pTimeline->nTstates, pTimeline->nDigest);
+  for (u32 i = 0; i < pTimeline->nSegments; i++) {
+    const GOLDEN_SEGMENT_T* pSegment = &pTimeline->pSegments[i];
+    formatBlock(pSegment->nBlockIndex, block, sizeof(block));
+    fprintf(pFile, "%u %s %u %llu %016llx", i, block, pSegment->nPulses, pSegment->nTstates, pSegment->nDigest);
+    for (u32 j = 0; j < pSegment->nCheckpoints; j++) {
+      fprintf(pFile, " %016llx", pTimeline->pCheckpoints[pSegment->nFirstCheckpoint + j]);
+    }
+    fprintf(pFile, "\n");
+  }
+}
+
+/**
+ * Read the golden digests of a tape's timeline
+ *
+ * @return true if the tape was found, and its digests are complete
+ */
+static bool readTimeline(FILE* pFile, const char* pName, GOLDEN_TIMELINE_T* pTimeline) {
+  char* pLine = (char*)malloc(MAX_LINE_LENGTH);
+  char name[64];
+  u32 nSegments = 0;
+  bool bFound = false;
+
+  memset(pTimeline, 0, sizeof(GOLDEN_TIMELINE_T));
+  rewind(pFile);
+
+  // The tape
+  while (!bFound && fgets(pLine, MAX_LINE_LENGTH, pFile) != NULL) {
+    bFound = sscanf(pLine, "tape %63s %u %llu %llu %llx", name, &nSegments, &pTimeline->nPulses,
+                    &pTimeline->nTstates, &pTimeline->nDigest) == 5 &&
+             strcmp(name, pName) == 0;
+  }
+
+  // Its segments
+  while (bFound && pTimeline->nSegments < nSegments && fgets(pLine, MAX_LINE_LENGTH, pFile) != NULL) {
+    u32 nSegment, nPulses;
+    u64 nTstates, nDigest;
+    char block[16];
+    int nRead = 0;
+    if (sscanf(pLine, "%u %15s %u %llu %llx%n", &nSegment, block, &nPulses, &nTstates, &nDigest, &nRead) != 5 ||
+        nSegment != pTimeline->nSegments) {
+      break;
+    }
+
+    addSegment(pTimeline, strcmp(block, "-") == 0 ? ZXTAPE_INDEX_NONE : (u32)strtoul(block, NULL, 10), 0);
+    GOLDEN_SEGMENT_T* pSegment = &pTimeline->pSegments[pTimeline->nSegments - 1];
+    pSegment->nPulses = nPulses;
+    pSegment->nTstates = nTstates;
+    pSegment->nDigest = nDigest;
+    if (pTimeline->nSegments > 1) {
+      const GOLDEN_SEGMENT_T* pPrevious = pSegment - 1;
+      pSegment->nFirstPulse = pPrevious->nFirstPulse + pPrevious->nPulses;
+    }
+
+    char* p = pLine + nRead;
+    char* pEnd;
+    for (u64 nCheckpoint = strtoull(p, &pEnd, 16); pEnd != p; nCheckpoint = strtoull(p, &pEnd, 16)) {
+      addCheckpoint(pTimeline, nCheckpoint);
+      pSegment->nCheckpoints++;
+      p = pEnd;
+    }
+  }
+
+  free(pLine);
+
+  return bFound && pTimeline->nSegments == nSegments;
+}
+
+/**
+ * Compare a tape's timeline with its golden digests, and report the first diverging segment and pulses
+ *
+ * @return 0 if they are the same, otherwise 1
+ */
+static int compareTimeline(const BENCH_TAPE_T* pTape, const GOLDEN_TIMELINE_T* pTimeline,
+                           const GOLDEN_TIMELINE_T* pGolden) {
+  char block[16], goldenBlock[16];
+
+  if (pTimeline->nDigest == pGolden->nDigest && pTimeline->nPulses == pGolden->nPulses &&
+      pTimeline->nSegments == pGolden->nSegments) {
+    return 0;
+  }
+
+  // First diverging segment (or the first extra or missing one)
+  u32 nSegment = 0;
+  while (nSegment < pTimeline->nSegments && nSegment < pGolden->nSegments) {
+    const GOLDEN_SEGMENT_T* pSegment = &pTimeline->pSegments[nSegment];
+    const GOLDEN_SEGMENT_T* pGoldenSegment = &pGolden->pSegments[nSegment];
+    if (pSegment->nBlockIndex != pGoldenSegment->nBlockIndex || pSegment->nPulses != pGoldenSegment->nPulses ||
+        pSegment->nDigest != pGoldenSegment->nDigest) {
+      break;
+    }
+    nSegment++;
+  }
+  if (nSegment == pTimeline->nSegments || nSegment == pGolden->nSegments) {
+    fprintf(stderr, "FAIL: %s: %u segments, golden %u (the first %u are the same)\n", pTape->pName,
+            pTimeline->nSegments, pGolden->nSegments, nSegment);
+    return 1;
+  }
+
+  const GOLDEN_SEGMENT_T* pSegment = &pTimeline->pSegments[nSegment];
+  const GOLDEN_SEGMENT_T* pGoldenSegment = &pGolden->pSegments[nSegment];
+  formatBlock(pSegment->nBlockIndex, block, sizeof(block));
+  formatBlock(pGoldenSegment->nBlockIndex, goldenBlock, sizeof(goldenBlock));
+  fprintf(stderr,
+          "FAIL: %s: segment %u diverges (from pulse %llu of the tape): block %s, %u pulses, %llu T-states, digest "
+          "%016llx; golden block %s, %u pulses, %llu T-states, digest %016llx\n",
+          pTape->pName, nSegment, pSegment->nFirstPulse, block, pSegment->nPulses, pSegment->nTstates,
+          pSegment->nDigest, goldenBlock, pGoldenSegment->nPulses, pGoldenSegment->nTstates,
+          pGoldenSegment->nDigest);
+
+  // First diverging checkpoint (the first diverging pulse is after the last matching one)
+  u32 nCheckpoint = 0;
+  while (nCheckpoint < pSegment->nCheckpoints && nCheckpoint < pGoldenSegment->nCheckpoints &&
+         pTimeline->pCheckpoints[pSegment->nFirstCheckpoint + nCheckpoint] ==
+             pGolden->pCheckpoints[pGoldenSegment->nFirstCheckpoint + nCheckpoint]) {
+    nCheckpoint++;
+  }
+  u32 nFrom = nCheckpoint * CHECKPOINT_PULSES;
+  u32 nTo = nFrom + CHECKPOINT_PULSES;
+  if (pSegment->nBlockIndex != pGoldenSegment->nBlockIndex) nTo = 1;  // The first pulse is in another block
+  if (nTo > pSegment->nPulses) nTo = pSegment->nPulses;
+  if (nTo > pGoldenSegment->nPulses) nTo = pGoldenSegment->nPulses;
+  if (nFrom >= nTo) nFrom = nTo ? nTo - 1 : 0;
+  fprintf(stderr, "  first diverging pulse: %u to %u of the segment (%llu to %llu of the tape), from:\n", nFrom,
+          nTo ? nTo - 1 : 0, pSegment->nFirstPulse + nFrom, pSegment->nFirstPulse + (nTo ? nTo - 1 : 0));
+
+  // The pulses from there (rendered again, as only the digests are kept)
+  GOLDEN_TIMELINE_T shown;
+  renderTimeline(pTape, &shown, NULL, pSegment->nFirstPulse + nFrom, pSegment->nFirstPulse + nFrom + REPORT_PULSES);
+  freeTimeline(&shown);
+  fprintf(stderr, "  (zxtape_golden -t %s -d <file> writes every pulse, to diff with a known good build)\n",
+          pTape->pName);
+
+  return 1;
+}
+
+static void formatBlock(u32 nBlockIndex, char* pText, unsigned nLength) {
+  if (nBlockIndex == ZXTAPE_INDEX_NONE) {
+    snprintf(pText, nLength, "-");
+  } else {
+    snprintf(pText, nLength, "%u", nBlockIndex);
+  }
+}
+
+/**
+ * FNV-1a 64-bit of a value (little endian, so the digests are the same on every machine)
+ */
+static u64 hash(u64 h, u64 nValue, unsigned nBytes) {
+  for (unsigned i = 0; i < nBytes; i++) {
+    h ^= (nValue >> (i * 8)) & 0xFF;
+    h *= FNV_PRIME;
+  }
+
+  return h;
+}
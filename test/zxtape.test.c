@@ -32,6 +32,9 @@ int main(int argc, char* argv[]) {
   // Initialize the ZXTape instance
   zxtape_init(pZxTape);
 
+  // Refill the output buffer from the producer thread, so the tape thread sleep does not affect the buffer
+  zxtape_setProducer(pZxTape, true, 25, 75);
+
   // Create the tape thread
   createTapeThread(zxtapeThread, pZxTape);
 
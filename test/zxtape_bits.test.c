@@ -0,0 +1,191 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <zxtape.h>
+
+#include "./games/starquake.h"
+
+#define BIT_RATE 1000000                       // Bitstream rate (1MHz, so each bit is a microsecond)
+#define HALF_WORDS (32 * 1024 / 4)             // Words in each half of the double buffer (64KB in total)
+#define BATCH_RECORDS 1024                     // Records per zxtape_readPulses() call (reference pulses)
+#define MAX_EDGES (4 * 1024 * 1024)            // Most edges compared
+#define MAX_HALVES (15 * 60 * 2 * 4)           // Give up if the tape has not ended after this many halves
+#define COMPARE_RATE 3500000                   // Rate compared between chunk sizes (not a whole number of bits per us)
+#define COMPARE_WORDS (COMPARE_RATE / 32 * 8)  // Words compared between chunk sizes (pilot, header and data)
+#define CHUNK_WORDS 1024                       // Most words per zxtape_renderBits() call when comparing
+#define BITS_FILENAME "zxtape_bits_test.bin"   // Bitstream output
+#define FNV_OFFSET 0xcbf29ce484222325ull       // FNV-1a 64-bit
+#define FNV_PRIME 0x100000001b3ull
+
+/* Forward declarations */
+static ZXTAPE_HANDLE_T* createSession(void);
+static unsigned long long renderWords(ZXTAPE_HANDLE_T* pZxTape, unsigned long nWords, bool bVaryChunks);
+static unsigned long long hash(unsigned long long h, const void* pData, unsigned nLen);
+
+/**
+ * Render the tape as a packed bitstream into a double buffer, write it to a file, and check it matches the pulses
+ */
+int main(int argc, char* argv[]) {
+  static ZXTAPE_PULSE_RECORD_T records[BATCH_RECORDS];
+  static unsigned buffer[2][HALF_WORDS];
+  static unsigned char bytes[HALF_WORDS * 4];
+  int nFailed = 0;
+
+  //
+  // Reference: edge times (us) from the zxtape_readPulses() pulses (1MHz clock, so T-states are us)
+  //
+  unsigned long long* pReference = (unsigned long long*)malloc(MAX_EDGES * sizeof(unsigned long long));
+  unsigned long nReference = 0;
+  unsigned long long nTimeUs = 0;
+  unsigned char nLevel = 0;
+
+  ZXTAPE_HANDLE_T* pZxTape = createSession();
+  zxtape_setEarClock(pZxTape, 1000000);
+  while (nReference < MAX_EDGES - BATCH_RECORDS) {
+    unsigned n = zxtape_readPulses(pZxTape, records, BATCH_RECORDS);
+    if (n == 0 && !zxtape_isStarted(pZxTape)) break;
+    for (unsigned i = 0; i < n; i++) {
+      if (records[i].nLevel != nLevel) {
+        nLevel = records[i].nLevel;
+        pReference[nReference++] = nTimeUs;
+      }
+      nTimeUs += records[i].nDurationTstates;
+    }
+  }
+  if (nLevel != 0) pReference[nReference++] = nTimeUs;
+  zxtape_destroy(pZxTape);
+
+  //
+  // Whole tape, rendered into alternate halves of a double buffer, each written (MSB first) to a file
+  //
+  FILE* pFile = fopen(BITS_FILENAME, "wb");
+  if (!pFile) {
+    fprintf(stderr, "FAIL: cannot create %s\n", BITS_FILENAME);
+    return 1;
+  }
+
+  double nMaxFillUs = 0;
+  double nTotalFillUs = 0;
+  unsigned nHalves = 0;
+  pZxTape = createSession();
+  while (nHalves < MAX_HALVES) {
+    unsigned* pHalf = buffer[nHalves % 2];
+
+    clock_t nStartClock = clock();
+    zxtape_renderBits(pZxTape, pHalf, HALF_WORDS, BIT_RATE);
+    double nFillUs = (double)(clock() - nStartClock) * 1000000 / CLOCKS_PER_SEC;
+    if (nFillUs > nMaxFillUs) nMaxFillUs = nFillUs;
+    nTotalFillUs += nFillUs;
+    nHalves++;
+
+    for (unsigned i = 0; i < HALF_WORDS; i++) {
+      bytes[i * 4] = (unsigned char)(pHalf[i] >> 24);
+      bytes[i * 4 + 1] = (unsigned char)(pHalf[i] >> 16);
+      bytes[i * 4 + 2] = (unsigned char)(pHalf[i] >> 8);
+      bytes[i * 4 + 3] = (unsigned char)pHalf[i];
+    }
+    fwrite(bytes, 1, sizeof(bytes), pFile);
+
+    if (!zxtape_isStarted(pZxTape)) break;
+  }
+  zxtape_destroy(pZxTape);
+  fclose(pFile);
+
+  fprintf(stderr, "Fill: %u halves of %u bytes, average %.0fus, max %.0fus per 64KB\n", nHalves, HALF_WORDS * 4,
+          nTotalFillUs * 2 / nHalves, nMaxFillUs * 2);
+
+  //
+  // Read the file back: every edge is at its exact bit
+  //
+  unsigned long nEdges = 0;
+  unsigned long nMismatch = 0;
+  unsigned long long nBit = 0;
+  nLevel = 0;
+  pFile = fopen(BITS_FILENAME, "rb");
+  size_t nRead;
+  while (pFile && (nRead = fread(bytes, 1, sizeof(bytes), pFile)) > 0) {
+    for (size_t i = 0; i < nRead; i++) {
+      for (int b = 7; b >= 0; b--, nBit++) {
+        unsigned char nBitLevel = (bytes[i] >> b) & 1;
+        if (nBitLevel == nLevel) continue;
+        nLevel = nBitLevel;
+        if (nEdges >= nReference || pReference[nEdges] != nBit) {
+          if (nMismatch++ == 0) fprintf(stderr, "First mismatch at edge %lu, bit %llu\n", nEdges, nBit);
+        }
+        nEdges++;
+      }
+    }
+  }
+  if (pFile) fclose(pFile);
+  remove(BITS_FILENAME);
+
+  fprintf(stderr, "File: %llu bits, %lu edges (reference %lu edges, %llu us)\n", nBit, nEdges, nReference, nTimeUs);
+  if (nEdges != nReference || nMismatch != 0 || nBit < nTimeUs) {
+    fprintf(stderr, "FAIL: bitstream does not match the pulses\n");
+    nFailed++;
+  }
+
+  //
+  // Rendering in chunks of any size gives exactly the same bitstream (edges rounded to the nearest bit)
+  //
+  pZxTape = createSession();
+  unsigned long long nHash = renderWords(pZxTape, COMPARE_WORDS, false);
+  zxtape_destroy(pZxTape);
+
+  pZxTape = createSession();
+  unsigned long long nHashVaried = renderWords(pZxTape, COMPARE_WORDS, true);
+  zxtape_destroy(pZxTape);
+
+  fprintf(stderr, "Chunks: hash %016llx / %016llx\n", nHash, nHashVaried);
+  if (nHash != nHashVaried) {
+    fprintf(stderr, "FAIL: bitstream depends on the chunk size\n");
+    nFailed++;
+  }
+
+  free(pReference);
+
+  return nFailed ? 1 : 0;
+}
+
+static ZXTAPE_HANDLE_T* createSession(void) {
+  ZXTAPE_HANDLE_T* pZxTape = zxtape_create();
+  zxtape_init(pZxTape);
+  zxtape_setRenderMode(pZxTape, true);
+  zxtape_loadBuffer(pZxTape, "starquake.tzx", Starquake, sizeof(Starquake));
+  zxtape_playPause(pZxTape);
+
+  return pZxTape;
+}
+
+/**
+ * Render words at COMPARE_RATE, and return a hash of them
+ */
+static unsigned long long renderWords(ZXTAPE_HANDLE_T* pZxTape, unsigned long nWords, bool bVaryChunks) {
+  unsigned buffer[CHUNK_WORDS];
+  unsigned long long h = FNV_OFFSET;
+  unsigned nChunk = 1;
+
+  while (nWords > 0) {
+    unsigned n = bVaryChunks ? nChunk : CHUNK_WORDS;
+    if (n > nWords) n = nWords;
+    nChunk = (nChunk + 37) % CHUNK_WORDS + 1;
+
+    zxtape_renderBits(pZxTape, buffer, n, COMPARE_RATE);
+    h = hash(h, buffer, n * sizeof(unsigned));
+    nWords -= n;
+  }
+
+  return h;
+}
+
+static unsigned long long hash(unsigned long long h, const void* pData, unsigned nLen) {
+  const unsigned char* p = (const unsigned char*)pData;
+
+  for (unsigned i = 0; i < nLen; i++) {
+    h ^= p[i];
+    h *= FNV_PRIME;
+  }
+
+  return h;
+}
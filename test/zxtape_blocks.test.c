@@ -0,0 +1,169 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zxtape.h>
+
+#include "./games/starquake.h"
+
+#define TAPE_FILENAME "zxtape_blocks_test.tzx"  // Copy of the tape, to check reading from a file
+#define MAX_BLOCKS 256                          // Blocks checked
+#define MAX_PAYLOAD 65536                       // Largest payload checked
+#define BATCH_RECORDS 1024                      // Records per zxtape_readPulses() call
+#define SYNC_MAX_TSTATES 1000                   // Pulses shorter than this (after the pilot) are sync / data
+#define ONE_MIN_TSTATES 1283                    // Data pulses longer than this are one bits (855 zero, 1710 one)
+#define PAUSE_MIN_TSTATES 5000                  // Pulses longer than this end the data
+
+typedef struct _DECODED_BLOCK_T {
+  unsigned char data[MAX_PAYLOAD];
+  unsigned long nLength;
+} DECODED_BLOCK_T;
+
+/* Forward declarations */
+static void decodeTape(void);
+
+/* Local variables */
+static DECODED_BLOCK_T g_decoded[MAX_BLOCKS];
+static unsigned char g_buffer[MAX_PAYLOAD];
+
+/**
+ * Extract the block payloads without playing the tape, and check they match the bytes played
+ */
+int main(int argc, char* argv[]) {
+  ZXTAPE_BLOCK_DATA_T block, fileBlock;
+  int nFailed = 0;
+
+  // Decode the bytes played from the pulses, for comparison
+  decodeTape();
+
+  ZXTAPE_HANDLE_T* pZxTape = zxtape_create();
+  zxtape_init(pZxTape);
+  zxtape_loadBuffer(pZxTape, "starquake.tzx", Starquake, sizeof(Starquake));
+  unsigned nBlocks = zxtape_getBlockCount(pZxTape);
+
+  //
+  // Payloads from the buffer (in place), compared with the bytes played
+  //
+  unsigned nDataBlocks = 0;
+  unsigned nMismatched = 0;
+  for (unsigned i = 0; i < nBlocks && i < MAX_BLOCKS; i++) {
+    if (!zxtape_getBlockData(pZxTape, i, &block, NULL, 0)) continue;
+    nDataBlocks++;
+
+    bool bInPlace = block.pData == Starquake + block.nOffset;
+    bool bMatch = block.nLength == g_decoded[i].nLength && memcmp(block.pData, g_decoded[i].data, block.nLength) == 0;
+    fprintf(stderr, "Block %u: ID %02x, %u bytes, flag %02x, checksum %02x (%s), pause %ums, %s, %s\n", i,
+            block.nBlockId, block.nLength, block.nFlag, block.nChecksum, block.bChecksumValid ? "valid" : "INVALID",
+            block.nPauseMs, bInPlace ? "in place" : "COPIED", bMatch ? "matches playback" : "DOES NOT MATCH PLAYBACK");
+    if (!bInPlace || !bMatch || !block.bChecksumValid) nMismatched++;
+  }
+  zxtape_destroy(pZxTape);
+
+  if (nDataBlocks == 0 || nMismatched != 0) {
+    fprintf(stderr, "FAIL: %u of %u data blocks do not match the bytes played\n", nMismatched, nDataBlocks);
+    nFailed++;
+  }
+
+  //
+  // Payloads from a file (into the caller's buffer), compared with the buffer
+  //
+  FILE* pFile = fopen(TAPE_FILENAME, "wb");
+  if (pFile == NULL || fwrite(Starquake, 1, sizeof(Starquake), pFile) != sizeof(Starquake)) {
+    fprintf(stderr, "FAIL: could not write %s\n", TAPE_FILENAME);
+    return 1;
+  }
+  fclose(pFile);
+
+  unsigned nFileMismatched = 0;
+  pZxTape = zxtape_create();
+  zxtape_init(pZxTape);
+  zxtape_loadFile(pZxTape, TAPE_FILENAME);
+  for (unsigned i = 0; i < nBlocks && i < MAX_BLOCKS; i++) {
+    if (!zxtape_getBlockData(pZxTape, i, &fileBlock, g_buffer, sizeof(g_buffer))) continue;
+
+    // Too small a buffer gives the length required, but no payload
+    ZXTAPE_BLOCK_DATA_T smallBlock;
+    bool bSmall = zxtape_getBlockData(pZxTape, i, &smallBlock, g_buffer, 1);
+    if (!bSmall || smallBlock.pData != NULL || smallBlock.nLength != fileBlock.nLength) nFileMismatched++;
+
+    if (fileBlock.pData != g_buffer || fileBlock.nLength != g_decoded[i].nLength ||
+        memcmp(fileBlock.pData, g_decoded[i].data, fileBlock.nLength) != 0 || !fileBlock.bChecksumValid) {
+      nFileMismatched++;
+    }
+  }
+  zxtape_destroy(pZxTape);
+  remove(TAPE_FILENAME);
+
+  fprintf(stderr, "File: %u data blocks, %u mismatched\n", nDataBlocks, nFileMismatched);
+  if (nFileMismatched != 0) {
+    fprintf(stderr, "FAIL: payloads read from the file do not match\n");
+    nFailed++;
+  }
+
+  return nFailed ? 1 : 0;
+}
+
+/**
+ * Play the whole tape with zxtape_readPulses(), and decode the ROM encoded bytes of each block
+ */
+static void decodeTape(void) {
+  static ZXTAPE_PULSE_RECORD_T records[BATCH_RECORDS];
+  unsigned nBlockIndex = ZXTAPE_INDEX_NONE;
+  unsigned nSyncPulses = 0;
+  unsigned nBitPulses = 0;
+  unsigned char nByte = 0;
+  unsigned nBits = 0;
+  bool bData = false;
+
+  ZXTAPE_HANDLE_T* pZxTape = zxtape_create();
+  zxtape_init(pZxTape);
+  zxtape_setRenderMode(pZxTape, true);
+  zxtape_loadBuffer(pZxTape, "starquake.tzx", Starquake, sizeof(Starquake));
+  zxtape_playPause(pZxTape);
+
+  while (1) {
+    unsigned n = zxtape_readPulses(pZxTape, records, BATCH_RECORDS);
+    if (n == 0 && !zxtape_isStarted(pZxTape)) break;
+
+    for (unsigned i = 0; i < n; i++) {
+      const ZXTAPE_PULSE_RECORD_T* pRecord = &records[i];
+
+      if (pRecord->nBlockIndex != nBlockIndex) {
+        // New block, wait for the end of the pilot
+        nBlockIndex = pRecord->nBlockIndex;
+        nSyncPulses = 0;
+        bData = false;
+      }
+      if (nBlockIndex >= MAX_BLOCKS) continue;
+      DECODED_BLOCK_T* pDecoded = &g_decoded[nBlockIndex];
+
+      if (!bData) {
+        // Two sync pulses, then data
+        if (pRecord->nDurationTstates < SYNC_MAX_TSTATES) nSyncPulses++;
+        if (nSyncPulses == 2) {
+          bData = true;
+          nBitPulses = 0;
+          nBits = 0;
+          nByte = 0;
+        }
+        continue;
+      }
+      if (pRecord->nDurationTstates > PAUSE_MIN_TSTATES) {
+        bData = false;
+        nSyncPulses = 0;
+        continue;
+      }
+
+      // Two pulses per bit
+      if (++nBitPulses < 2) continue;
+      nBitPulses = 0;
+      nByte = (unsigned char)((nByte << 1) | (pRecord->nDurationTstates > ONE_MIN_TSTATES ? 1 : 0));
+      if (++nBits == 8) {
+        if (pDecoded->nLength < MAX_PAYLOAD) pDecoded->data[pDecoded->nLength++] = nByte;
+        nBits = 0;
+        nByte = 0;
+      }
+    }
+  }
+
+  zxtape_destroy(pZxTape);
+}
@@ -0,0 +1,208 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <zxtape.h>
+#include <zxtape_convert.h>
+#include <zxtape_sink.h>
+
+#include "./games/starquake.h"
+
+#define TZX_HEADER_LENGTH 10                                 // "ZXTape!", 0x1A, version
+#define TZX_COPIES 4                                         // Copies of the blocks in the TZX compilation
+#define TAP_COPIES 2                                         // Copies of the blocks in the TAP compilation
+#define PAUSE_BLOCK_MS 500                                   // Pause block between the copies (ID20)
+#define WORKERS 4                                            // Worker threads for the parallel conversion
+#define MAX_RUNS 1000000                                     // Give up after this many zxtape_run() calls
+#define REFERENCE_FILENAME "zxtape_convert_test_serial.wav"  // WAV sink output
+#define CONVERT_FILENAME "zxtape_convert_test_parallel.wav"  // zxtape_convertToWav() output
+#define COMPARE_LENGTH (64 * 1024)
+
+/* Forward declarations */
+static int checkConversion(const char* pName, const unsigned char* pTape, unsigned long nLen, unsigned nSampleRate);
+static double renderReference(const char* pName, const unsigned char* pTape, unsigned long nLen, unsigned nSampleRate);
+static bool compareFiles(const char* pFilename1, const char* pFilename2, unsigned long* pLength);
+static double nowSeconds(void);
+
+/**
+ * Convert tapes of many blocks to WAV files in parallel, and check they are the same as the WAV sink writes
+ */
+int main(int argc, char* argv[]) {
+  int nFailed = 0;
+
+  //
+  // TZX compilation: the blocks of the tape, several times over
+  //
+  unsigned long nBlocksLen = sizeof(Starquake) - TZX_HEADER_LENGTH;
+  unsigned long nTzxLen = TZX_HEADER_LENGTH + nBlocksLen * TZX_COPIES;
+  unsigned char* pTzx = (unsigned char*)malloc(nTzxLen);
+  memcpy(pTzx, Starquake, TZX_HEADER_LENGTH);
+  for (int i = 0; i < TZX_COPIES; i++) {
+    memcpy(&pTzx[TZX_HEADER_LENGTH + nBlocksLen * i], &Starquake[TZX_HEADER_LENGTH], nBlocksLen);
+  }
+
+  nFailed += checkConversion("compilation.tzx", pTzx, nTzxLen, 22050);
+
+  //
+  // TZX compilation with pause blocks between the copies (shard boundaries, as data blocks ending in a pause)
+  //
+  unsigned char pauseBlock[] = {0x20, PAUSE_BLOCK_MS & 0xFF, PAUSE_BLOCK_MS >> 8};
+  unsigned long nPausedLen = nTzxLen + sizeof(pauseBlock) * TZX_COPIES;
+  unsigned char* pPaused = (unsigned char*)malloc(nPausedLen);
+  memcpy(pPaused, Starquake, TZX_HEADER_LENGTH);
+  for (int i = 0; i < TZX_COPIES; i++) {
+    unsigned char* pCopy = &pPaused[TZX_HEADER_LENGTH + (nBlocksLen + sizeof(pauseBlock)) * i];
+    memcpy(pCopy, &Starquake[TZX_HEADER_LENGTH], nBlocksLen);
+    memcpy(&pCopy[nBlocksLen], pauseBlock, sizeof(pauseBlock));
+  }
+
+  nFailed += checkConversion("paused.tzx", pPaused, nPausedLen, 22050);
+  free(pPaused);
+
+  //
+  // TAP compilation: the payloads of the data blocks, several times over
+  //
+  ZXTAPE_HANDLE_T* pZxTape = zxtape_create();
+  zxtape_init(pZxTape);
+  zxtape_loadBuffer(pZxTape, "starquake.tzx", Starquake, sizeof(Starquake));
+  unsigned char* pTap = (unsigned char*)malloc(sizeof(Starquake) * TAP_COPIES);
+  unsigned long nTapLen = 0;
+  for (int i = 0; i < TAP_COPIES; i++) {
+    for (unsigned b = 0; b < zxtape_getBlockCount(pZxTape); b++) {
+      ZXTAPE_BLOCK_DATA_T data;
+      if (!zxtape_getBlockData(pZxTape, b, &data, NULL, 0)) continue;
+      pTap[nTapLen++] = (unsigned char)data.nLength;
+      pTap[nTapLen++] = (unsigned char)(data.nLength >> 8);
+      memcpy(&pTap[nTapLen], data.pData, data.nLength);
+      nTapLen += data.nLength;
+    }
+  }
+  zxtape_destroy(pZxTape);
+
+  nFailed += checkConversion("compilation.tap", pTap, nTapLen, 44100);
+
+  //
+  // Starquake alone has too few blocks to be worth splitting, but converts the same serially
+  //
+  double nSerialSeconds = renderReference("starquake.tzx", Starquake, sizeof(Starquake), 44100);
+  ZXTAPE_CONVERT_STATS_T stats;
+  bool bOk = zxtape_convertToWav("starquake.tzx", Starquake, sizeof(Starquake), CONVERT_FILENAME, 44100, 1, &stats);
+  unsigned long nLength = 0;
+  bool bSame = bOk && compareFiles(REFERENCE_FILENAME, CONVERT_FILENAME, &nLength);
+  fprintf(stderr, "starquake.tzx: %lu bytes, %u shard(s), %u worker(s), %s (serial %.2fs)\n", nLength, stats.nShards,
+          stats.nWorkers, bSame ? "same" : "DIFFERENT", nSerialSeconds);
+  if (!bSame || stats.nShards != 1 || stats.nWorkers != 0) {
+    fprintf(stderr, "FAIL: serial conversion\n");
+    nFailed++;
+  }
+
+  //
+  // Converted the same while another instance plays (each shard has an instance, switched in by the engine)
+  //
+  pZxTape = zxtape_create();
+  zxtape_init(pZxTape);
+  zxtape_setRenderMode(pZxTape, true);
+  zxtape_loadBuffer(pZxTape, "starquake.tzx", Starquake, sizeof(Starquake));
+  zxtape_playPause(pZxTape);
+  ZXTAPE_PULSE_RECORD_T records[64];
+  zxtape_readPulses(pZxTape, records, 64);
+  nFailed += checkConversion("compilation.tzx", pTzx, nTzxLen, 22050);
+  if (zxtape_readPulses(pZxTape, records, 64) == 0) {
+    fprintf(stderr, "FAIL: instance playing during the conversion\n");
+    nFailed++;
+  }
+  zxtape_destroy(pZxTape);
+  remove(REFERENCE_FILENAME);
+  remove(CONVERT_FILENAME);
+
+  free(pTzx);
+  free(pTap);
+
+  return nFailed ? 1 : 0;
+}
+
+/**
+ * Convert a tape in parallel, and check the file is the same as the WAV sink's
+ */
+static int checkConversion(const char* pName, const unsigned char* pTape, unsigned long nLen, unsigned nSampleRate) {
+  double nSerialSeconds = renderReference(pName, pTape, nLen, nSampleRate);
+
+  ZXTAPE_CONVERT_STATS_T stats;
+  double nStart = nowSeconds();
+  bool bOk = zxtape_convertToWav(pName, pTape, nLen, CONVERT_FILENAME, nSampleRate, WORKERS, &stats);
+  double nParallelSeconds = nowSeconds() - nStart;
+
+  unsigned long nLength = 0;
+  bool bSame = bOk && compareFiles(REFERENCE_FILENAME, CONVERT_FILENAME, &nLength);
+  remove(REFERENCE_FILENAME);
+  remove(CONVERT_FILENAME);
+
+  fprintf(stderr, "%s: %lu bytes, %u shards, %u workers, %s, serial %.2fs, parallel %.2fs (%.1fx)\n", pName, nLength,
+          stats.nShards, stats.nWorkers, bSame ? "same" : "DIFFERENT", nSerialSeconds, nParallelSeconds,
+          nParallelSeconds > 0 ? nSerialSeconds / nParallelSeconds : 0);
+  if (!bSame || stats.nShards < 2 || stats.nWorkers < 2) {
+    fprintf(stderr, "FAIL: %s parallel conversion\n", pName);
+    return 1;
+  }
+
+  return 0;
+}
+
+/**
+ * Play the tape to a WAV file sink with zxtape_run(). Returns the time taken.
+ */
+static double renderReference(const char* pName, const unsigned char* pTape, unsigned long nLen, unsigned nSampleRate) {
+  static ZXTAPE_SINK_WAV_T wav;
+  double nStart = nowSeconds();
+
+  zxtape_openWavSink(&wav, REFERENCE_FILENAME, nSampleRate);
+  ZXTAPE_HANDLE_T* pZxTape = zxtape_create();
+  zxtape_init(pZxTape);
+  zxtape_setRenderMode(pZxTape, true);
+  zxtape_setSink(pZxTape, &wav.sink);
+  zxtape_loadBuffer(pZxTape, pName, pTape, nLen);
+  zxtape_playPause(pZxTape);
+
+  bool bStarted = false;
+  for (unsigned nRuns = 0; nRuns < MAX_RUNS; nRuns++) {
+    zxtape_run(pZxTape, 0);
+    if (zxtape_isStarted(pZxTape)) {
+      bStarted = true;
+    } else if (bStarted) {
+      break;
+    }
+  }
+  zxtape_destroy(pZxTape);
+  zxtape_closeWavSink(&wav);
+
+  return nowSeconds() - nStart;
+}
+
+static bool compareFiles(const char* pFilename1, const char* pFilename2, unsigned long* pLength) {
+  static unsigned char data1[COMPARE_LENGTH];
+  static unsigned char data2[COMPARE_LENGTH];
+  FILE* pFile1 = fopen(pFilename1, "rb");
+  FILE* pFile2 = fopen(pFilename2, "rb");
+  bool bSame = pFile1 != NULL && pFile2 != NULL;
+
+  *pLength = 0;
+  while (bSame) {
+    size_t n1 = fread(data1, 1, COMPARE_LENGTH, pFile1);
+    size_t n2 = fread(data2, 1, COMPARE_LENGTH, pFile2);
+    bSame = n1 == n2 && memcmp(data1, data2, n1) == 0;
+    if (bSame && n1 > 0 && *pLength == 0 && memcmp(data1, "RIFF", 4) != 0) bSame = false;
+    *pLength += n1;
+    if (n1 == 0) break;
+  }
+  if (pFile1 != NULL) fclose(pFile1);
+  if (pFile2 != NULL) fclose(pFile2);
+
+  return bSame;
+}
+
+static double nowSeconds(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
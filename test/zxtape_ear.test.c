@@ -0,0 +1,166 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <zxtape.h>
+
+#include "./games/starquake.h"
+
+#define START_TSTATE 1000000ull                            // T-state of the first query (the tape starts here)
+#define COMPARE_EDGES 20000                                // Edges compared between walking edges and polling
+#define POLL_TSTATES 69888                                 // Polling scenario: T-states between queries (one 48K frame)
+#define PAUSE_AT_EDGES 5000                                // Pause scenario: pause after this many edges
+#define PAUSE_TSTATES (ZXTAPE_EAR_CLOCK_HZ * 60ull)        // Pause scenario: T-states to stay paused for
+#define MAX_TSTATES (ZXTAPE_EAR_CLOCK_HZ * 15ull * 60ull)  // Give up if the tape has not ended after this long
+#define MAX_SECONDS 10                                     // Whole tape must be walked faster than this (wall clock)
+
+/* Forward declarations */
+static ZXTAPE_HANDLE_T* createSession(void);
+static void onEvent(ZXTAPE_HANDLE_T* pZxTape, const ZXTAPE_EVENT_T* pEvent, void* pUserData);
+
+/* Local variables */
+static bool g_bEnded = false;
+static unsigned long long g_nEndTapeUs = 0;
+static unsigned long long g_edges[COMPARE_EDGES];
+
+/**
+ * Query the EAR level at CPU T-states (as an emulator would), and check the edges are exact and the tape ends
+ */
+int main(int argc, char* argv[]) {
+  int nFailed = 0;
+
+  //
+  // Whole tape, skipping from edge to edge, until playback stops at the end
+  //
+  clock_t nStartClock = clock();
+  ZXTAPE_HANDLE_T* pZxTape = createSession();
+  unsigned long nEdges = 0;
+  unsigned long nBadLevels = 0;
+  unsigned long long nTstate = START_TSTATE;
+  unsigned char nLevel = zxtape_earAt(pZxTape, nTstate);
+  while (nTstate < START_TSTATE + MAX_TSTATES) {
+    unsigned long long nEdge = zxtape_nextEdge(pZxTape);
+    if (nEdge == ZXTAPE_TSTATE_NONE) {
+      // No edge yet (end of tape, or between blocks): move on, and let the controls be applied
+      nTstate += POLL_TSTATES;
+      zxtape_earAt(pZxTape, nTstate);
+      zxtape_dispatchEvents(pZxTape);
+      if (!zxtape_isStarted(pZxTape)) break;
+      continue;
+    }
+    if (nEdge <= nTstate) nBadLevels++;
+    if (zxtape_earAt(pZxTape, nEdge - 1) != nLevel || zxtape_earAt(pZxTape, nEdge) == nLevel) nBadLevels++;
+    if (nEdges < COMPARE_EDGES) g_edges[nEdges] = nEdge;
+    nLevel = !nLevel;
+    nTstate = nEdge;
+    nEdges++;
+  }
+  zxtape_destroy(pZxTape);
+  double nSeconds = (double)(clock() - nStartClock) / CLOCKS_PER_SEC;
+
+  // Playback stops once the end of the tape has passed
+  unsigned long long nExpectedTstates = g_nEndTapeUs * ZXTAPE_EAR_CLOCK_HZ / 1000000;
+  unsigned long long nTstates = nTstate - START_TSTATE;
+  fprintf(stderr, "Whole tape: %s, %lu edges, %llu T-states (end of data at %llu T-states), %.2fs\n",
+          g_bEnded ? "ended" : "NOT ENDED", nEdges, nTstates, nExpectedTstates, nSeconds);
+  if (!g_bEnded || nEdges == 0 || nTstates < nExpectedTstates ||
+      nTstates > nExpectedTstates + ZXTAPE_EAR_CLOCK_HZ) {
+    fprintf(stderr, "FAIL: playback did not stop at the end of the tape\n");
+    nFailed++;
+  }
+  if (nBadLevels != 0) {
+    fprintf(stderr, "FAIL: %lu edges where the level did not change\n", nBadLevels);
+    nFailed++;
+  }
+  if (nSeconds > MAX_SECONDS) {
+    fprintf(stderr, "FAIL: too slow\n");
+    nFailed++;
+  }
+
+  //
+  // Polling once per frame sees exactly the same edges
+  //
+  unsigned long nMismatched = 0;
+  unsigned long nCompared = nEdges < COMPARE_EDGES ? nEdges : COMPARE_EDGES;
+  pZxTape = createSession();
+  nLevel = zxtape_earAt(pZxTape, START_TSTATE);
+  for (unsigned long i = 0; i < nCompared; i++) {
+    // Poll to just before the edge, then check the level changes exactly at the edge
+    nTstate = i > 0 ? g_edges[i - 1] : START_TSTATE;
+    for (; nTstate + POLL_TSTATES < g_edges[i]; nTstate += POLL_TSTATES) {
+      if (zxtape_earAt(pZxTape, nTstate) != nLevel) nMismatched++;
+    }
+    if (zxtape_earAt(pZxTape, g_edges[i] - 1) != nLevel) nMismatched++;
+    nLevel = !nLevel;
+    if (zxtape_earAt(pZxTape, g_edges[i]) != nLevel) nMismatched++;
+  }
+  zxtape_destroy(pZxTape);
+
+  fprintf(stderr, "Polling: %lu edges compared, %lu mismatched\n", nCompared, nMismatched);
+  if (nCompared == 0 || nMismatched != 0) {
+    fprintf(stderr, "FAIL: polling does not match the edges\n");
+    nFailed++;
+  }
+
+  //
+  // Pausing holds the level (however long for), and the tape continues from the next query once resumed
+  //
+  pZxTape = createSession();
+  nTstate = START_TSTATE;
+  zxtape_earAt(pZxTape, nTstate);
+  for (unsigned long i = 0; i < PAUSE_AT_EDGES; i++) {
+    unsigned long long nEdge = zxtape_nextEdge(pZxTape);
+    if (nEdge == ZXTAPE_TSTATE_NONE) nEdge = nTstate + POLL_TSTATES;
+    nTstate = nEdge;
+    zxtape_earAt(pZxTape, nTstate);
+  }
+  zxtape_playPause(pZxTape);
+  zxtape_earAt(pZxTape, nTstate);
+
+  // Play out the pulses generated before the pause
+  unsigned long long nEdge;
+  while ((nEdge = zxtape_nextEdge(pZxTape)) != ZXTAPE_TSTATE_NONE) zxtape_earAt(pZxTape, nTstate = nEdge);
+  bool bPaused = zxtape_isPaused(pZxTape);
+  nLevel = zxtape_earAt(pZxTape, nTstate + PAUSE_TSTATES / 2);
+  bool bHeld = zxtape_earAt(pZxTape, nTstate + PAUSE_TSTATES) == nLevel &&
+               zxtape_nextEdge(pZxTape) == ZXTAPE_TSTATE_NONE;
+
+  zxtape_playPause(pZxTape);
+  unsigned long long nResumeTstate = nTstate + PAUSE_TSTATES + 1;
+  zxtape_earAt(pZxTape, nResumeTstate);
+  nEdge = zxtape_nextEdge(pZxTape);
+  bool bResumed = zxtape_isStarted(pZxTape) && !zxtape_isPaused(pZxTape) && nEdge != ZXTAPE_TSTATE_NONE &&
+                  nEdge >= nResumeTstate;
+  zxtape_destroy(pZxTape);
+
+  fprintf(stderr, "Pause: %s, %s, %s (next edge %llu T-states after resuming)\n", bPaused ? "paused" : "NOT PAUSED",
+          bHeld ? "held" : "NOT HELD", bResumed ? "resumed" : "NOT RESUMED",
+          nEdge == ZXTAPE_TSTATE_NONE ? 0 : nEdge - nResumeTstate);
+  if (!bPaused || !bHeld || !bResumed) {
+    fprintf(stderr, "FAIL: pause / resume\n");
+    nFailed++;
+  }
+
+  return nFailed ? 1 : 0;
+}
+
+static ZXTAPE_HANDLE_T* createSession(void) {
+  g_bEnded = false;
+  g_nEndTapeUs = 0;
+
+  ZXTAPE_HANDLE_T* pZxTape = zxtape_create();
+  zxtape_init(pZxTape);
+  zxtape_setRenderMode(pZxTape, true);
+  zxtape_setEventCallback(pZxTape, onEvent, NULL, NULL);
+  zxtape_loadBuffer(pZxTape, "starquake.tzx", Starquake, sizeof(Starquake));
+  zxtape_playPause(pZxTape);
+
+  return pZxTape;
+}
+
+static void onEvent(ZXTAPE_HANDLE_T* pZxTape, const ZXTAPE_EVENT_T* pEvent, void* pUserData) {
+  if (pEvent->type == ZXTAPE_EVENT_END_OF_DATA) {
+    g_bEnded = true;
+    g_nEndTapeUs = pEvent->nTapeTimeUs;
+  }
+}
@@ -0,0 +1,181 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <tzx_compat_impl_sim.h>
+#include <zxtape.h>
+
+#include "./games/starquake.h"
+
+#define BATCH_RECORDS 1024                 // Records per zxtape_readPulses() call (reference pulses)
+#define MAX_EDGES (4 * 1024 * 1024)        // Most edges recorded
+#define QUEUE_LENGTH 512                   // Simulated platform edge queue length
+#define RUN_INTERVAL_NS 10000000ull        // Time between zxtape_run() calls (virtual clock)
+#define LEAD_US 20000                      // Scheduler lead time
+#define MAX_RUNS (15 * 60 * 100)           // Give up if the tape has not ended after this many zxtape_run() calls
+
+typedef struct _PLATFORM_T {
+  ZXTAPE_EDGE_T queue[QUEUE_LENGTH];  // Edges waiting to be played
+  unsigned nHead;                     // Next edge to play
+  unsigned nCount;                    // Edges in the queue
+  ZXTAPE_EDGE_T* pPlayed;             // Edges played
+  unsigned long nPlayed;
+  unsigned long nBatches;  // schedule() calls (platform wakeups)
+  unsigned long nLate;     // Edges scheduled after their time
+  unsigned nEnds;          // end() calls
+} PLATFORM_T;
+
+/* Forward declarations */
+static unsigned platformSpace(void* pContext);
+static void platformSchedule(void* pContext, const ZXTAPE_EDGE_T* pEdges, unsigned nCount);
+static void platformEnd(void* pContext);
+static void platformPlay(PLATFORM_T* pPlatform, unsigned long long nowNs);
+
+/**
+ * Hand the tape to a simulated timestamp queue with an edge scheduler, and check the edges match the pulled pulses
+ */
+int main(int argc, char* argv[]) {
+  static ZXTAPE_PULSE_RECORD_T records[BATCH_RECORDS];
+  static PLATFORM_T platform;
+  int nFailed = 0;
+
+  TZX_SIM_CONFIG_T config;
+  TZXCompatSim_getDefaultConfig(&config);
+  TZXCompatSim_configure(&config);
+
+  //
+  // Reference: edges (relative times, us) from the zxtape_readPulses() pulses (1MHz clock, so T-states are us)
+  //
+  ZXTAPE_EDGE_T* pReference = (ZXTAPE_EDGE_T*)malloc(MAX_EDGES * sizeof(ZXTAPE_EDGE_T));
+  unsigned long nReference = 0;
+  unsigned long long nTimeUs = 0;
+  unsigned char nLevel = 0;
+
+  ZXTAPE_HANDLE_T* pZxTape = zxtape_create();
+  zxtape_init(pZxTape);
+  zxtape_setRenderMode(pZxTape, true);
+  zxtape_setEarClock(pZxTape, 1000000);
+  zxtape_loadBuffer(pZxTape, "starquake.tzx", Starquake, sizeof(Starquake));
+  zxtape_playPause(pZxTape);
+  while (nReference < MAX_EDGES - BATCH_RECORDS) {
+    unsigned n = zxtape_readPulses(pZxTape, records, BATCH_RECORDS);
+    if (n == 0 && !zxtape_isStarted(pZxTape)) break;
+    for (unsigned i = 0; i < n; i++) {
+      if (records[i].nLevel != nLevel) {
+        nLevel = records[i].nLevel;
+        pReference[nReference].nTimeNs = nTimeUs;
+        pReference[nReference++].nLevel = nLevel;
+      }
+      nTimeUs += records[i].nDurationTstates;
+    }
+  }
+  if (nLevel != 0) {
+    pReference[nReference].nTimeNs = nTimeUs;
+    pReference[nReference++].nLevel = 0;
+  }
+  zxtape_destroy(pZxTape);
+
+  //
+  // Edge scheduler, with zxtape_run() called periodically on the virtual clock
+  //
+  platform.pPlayed = (ZXTAPE_EDGE_T*)malloc(MAX_EDGES * sizeof(ZXTAPE_EDGE_T));
+
+  ZXTAPE_EDGE_SCHEDULER_T scheduler;
+  memset(&scheduler, 0, sizeof(scheduler));
+  scheduler.space = platformSpace;
+  scheduler.schedule = platformSchedule;
+  scheduler.end = platformEnd;
+  scheduler.pContext = &platform;
+  scheduler.nLeadUs = LEAD_US;
+
+  pZxTape = zxtape_create();
+  zxtape_init(pZxTape);
+  zxtape_setEdgeScheduler(pZxTape, &scheduler);
+  zxtape_loadBuffer(pZxTape, "starquake.tzx", Starquake, sizeof(Starquake));
+  zxtape_playPause(pZxTape);
+
+  bool bStarted = false;
+  unsigned nRuns = 0;
+  while (nRuns < MAX_RUNS) {
+    zxtape_run(pZxTape, 0);
+    nRuns++;
+
+    if (zxtape_isStarted(pZxTape)) {
+      bStarted = true;
+    } else if (bStarted) {
+      break;
+    }
+
+    TZXCompatSim_advance(RUN_INTERVAL_NS);
+    platformPlay(&platform, TZXCompatSim_getTimeNs());
+  }
+  platformPlay(&platform, ~0ull);
+  zxtape_destroy(pZxTape);
+
+  // Every edge is at its exact time, relative to the first
+  unsigned long nMismatch = 0;
+  for (unsigned long i = 0; i < platform.nPlayed && i < nReference; i++) {
+    unsigned long long nExpectedNs =
+        platform.pPlayed[0].nTimeNs + (pReference[i].nTimeNs - pReference[0].nTimeNs) * 1000;
+    if (platform.pPlayed[i].nTimeNs != nExpectedNs || platform.pPlayed[i].nLevel != pReference[i].nLevel) {
+      if (nMismatch++ == 0) fprintf(stderr, "First mismatch at edge %lu\n", i);
+    }
+  }
+
+  fprintf(stderr, "Edges: %lu in %lu batches over %u runs, %lu late, %u ends (reference %lu edges)\n",
+          platform.nPlayed, platform.nBatches, nRuns, platform.nLate, platform.nEnds, nReference);
+  if (platform.nPlayed != nReference || nMismatch != 0) {
+    fprintf(stderr, "FAIL: edges do not match the pulses\n");
+    nFailed++;
+  }
+  if (platform.nLate != 0 || platform.nEnds != 1) {
+    fprintf(stderr, "FAIL: edges scheduled late, or end not signalled once\n");
+    nFailed++;
+  }
+  if (platform.nBatches == 0 || platform.nBatches * 16 > platform.nPlayed) {
+    fprintf(stderr, "FAIL: edges not batched\n");
+    nFailed++;
+  }
+
+  free(pReference);
+  free(platform.pPlayed);
+
+  return nFailed ? 1 : 0;
+}
+
+static unsigned platformSpace(void* pContext) {
+  PLATFORM_T* pPlatform = (PLATFORM_T*)pContext;
+
+  return QUEUE_LENGTH - pPlatform->nCount;
+}
+
+static void platformSchedule(void* pContext, const ZXTAPE_EDGE_T* pEdges, unsigned nCount) {
+  PLATFORM_T* pPlatform = (PLATFORM_T*)pContext;
+  unsigned long long nowNs = TZXCompatSim_getTimeNs();
+
+  for (unsigned i = 0; i < nCount; i++) {
+    if (pPlatform->nCount == QUEUE_LENGTH) {
+      fprintf(stderr, "Platform queue overflow\n");
+      exit(1);
+    }
+    if (pEdges[i].nTimeNs < nowNs) pPlatform->nLate++;
+    pPlatform->queue[(pPlatform->nHead + pPlatform->nCount++) % QUEUE_LENGTH] = pEdges[i];
+  }
+  pPlatform->nBatches++;
+}
+
+static void platformEnd(void* pContext) {
+  PLATFORM_T* pPlatform = (PLATFORM_T*)pContext;
+
+  pPlatform->nEnds++;
+}
+
+/**
+ * Play the queued edges that are due
+ */
+static void platformPlay(PLATFORM_T* pPlatform, unsigned long long nowNs) {
+  while (pPlatform->nCount > 0 && pPlatform->queue[pPlatform->nHead].nTimeNs <= nowNs) {
+    if (pPlatform->nPlayed < MAX_EDGES) pPlatform->pPlayed[pPlatform->nPlayed++] = pPlatform->queue[pPlatform->nHead];
+    pPlatform->nHead = (pPlatform->nHead + 1) % QUEUE_LENGTH;
+    pPlatform->nCount--;
+  }
+}
@@ -0,0 +1,81 @@
+#
+# Check the lists of globals switched between instances (TZX_STATE_VARIABLES in tzx.c, TZX_COMPAT_STATE_VARIABLES
+# in tzx_compat.c) name every writable global of their object, so a global added to the TZX library or the layer is
+# not silently shared by the instances
+#
+# cmake -DNM=<nm> -DLIBRARY=<libzxtape.a> -DSOURCE_DIR=<source dir> -P zxtape_engine_state.test.cmake
+#
+
+cmake_policy(SET CMP0057 NEW)  # if(IN_LIST)
+
+# Globals deliberately not in the lists
+set(TZX_EXEMPT wbufferStorage)  # The playback buffer until a state is restored (each state has its own)
+set(TZX_COMPAT_EXEMPT)
+
+execute_process(COMMAND ${NM} ${LIBRARY} OUTPUT_VARIABLE NM_OUTPUT RESULT_VARIABLE NM_RESULT)
+if(NOT NM_RESULT EQUAL 0)
+  message(FATAL_ERROR "FAIL: ${NM} ${LIBRARY} failed")
+endif()
+string(REPLACE "\n" ";" NM_LINES "${NM_OUTPUT}")
+
+# Names renamed by tzx.h (so the symbols differ from the names in the source)
+file(STRINGS ${SOURCE_DIR}/lib/zxtape/tzx/tzx.h RENAMES REGEX "^#define +[A-Za-z0-9_]+ +TZX_[A-Za-z0-9_]+ *$")
+
+function(check_state OBJECT SOURCE MACRO EXEMPT)
+  # Names in the list
+  file(READ ${SOURCE_DIR}/${SOURCE} TEXT)
+  string(REGEX MATCH "#define ${MACRO}\\(X\\)([^\n]*\\\\\n)*[^\n]*" BLOCK "${TEXT}")
+  string(REGEX MATCHALL "X\\([A-Za-z0-9_]+\\)" ITEMS "${BLOCK}")
+  set(LISTED)
+  foreach(ITEM ${ITEMS})
+    string(REGEX REPLACE "X\\(([A-Za-z0-9_]+)\\)" "\\1" NAME ${ITEM})
+    foreach(RENAME ${RENAMES})
+      if(RENAME MATCHES "^#define +${NAME} +(TZX_[A-Za-z0-9_]+)")
+        set(NAME ${CMAKE_MATCH_1})
+      endif()
+    endforeach()
+    list(APPEND LISTED ${NAME})
+  endforeach()
+  if(NOT LISTED)
+    message(SEND_ERROR "FAIL: ${MACRO} not found in ${SOURCE}")
+    return()
+  endif()
+
+  # Writable globals of the object (function statics, named with a '.', are only ever set once)
+  set(GLOBALS)
+  set(IN_OBJECT FALSE)
+  foreach(LINE ${NM_LINES})
+    if(LINE MATCHES "[(/]?([A-Za-z0-9_.]+\\.o)\\)?:$")
+      string(COMPARE EQUAL "${CMAKE_MATCH_1}" "${OBJECT}" IN_OBJECT)
+    elseif(IN_OBJECT AND LINE MATCHES " [bBdD] _?([A-Za-z0-9_]+)$")
+      list(APPEND GLOBALS ${CMAKE_MATCH_1})
+    endif()
+  endforeach()
+
+  set(MISSING)
+  foreach(NAME ${GLOBALS})
+    if(NOT NAME IN_LIST LISTED AND NOT NAME IN_LIST EXEMPT)
+      list(APPEND MISSING ${NAME})
+    endif()
+  endforeach()
+  set(STALE)
+  foreach(NAME ${LISTED})
+    if(NOT NAME IN_LIST GLOBALS)
+      list(APPEND STALE ${NAME})
+    endif()
+  endforeach()
+
+  list(LENGTH LISTED NLISTED)
+  message(STATUS "${MACRO}: ${NLISTED} globals listed")
+  if(MISSING)
+    string(REPLACE ";" " " MISSING "${MISSING}")
+    message(SEND_ERROR "FAIL: globals of ${OBJECT} not in ${MACRO}: ${MISSING}")
+  endif()
+  if(STALE)
+    string(REPLACE ";" " " STALE "${STALE}")
+    message(SEND_ERROR "FAIL: ${MACRO} names globals ${OBJECT} does not have: ${STALE}")
+  endif()
+endfunction()
+
+check_state(tzx.c.o lib/zxtape/tzx/tzx.c TZX_STATE_VARIABLES "${TZX_EXEMPT}")
+check_state(tzx_compat.c.o lib/zxtape/tzx_compat/tzx_compat.c TZX_COMPAT_STATE_VARIABLES "${TZX_COMPAT_EXEMPT}")
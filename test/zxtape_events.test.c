@@ -0,0 +1,292 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <tzx_compat_impl_sim.h>
+#include <zxtape.h>
+
+#define RUN_INTERVAL_MS 10              // zxtape_run() interval (virtual time)
+#define MAX_SESSION_MS (5 * 60 * 1000)  // Give up if the tape has not ended after this long (virtual time)
+#define MAX_EVENTS 64                   // Events recorded
+#define MAX_PULSES (64 * 1024)          // Pulses recorded
+#define PAYLOAD_LENGTH 5                // Bytes of each data block (flag, 3 bytes, checksum)
+#define HEADER_PAUSE_MS 250             // Pause after the header block (ID10)
+#define PAUSE_BLOCK_MS 300              // Pause block (ID20)
+#define PAUSE_TOLERANCE_US 1000         // A pause starts with 1.5ms at the level the block left
+#define START_WAIT_US 1000              // The TZX code waits 1ms at the start of a file, before the tape time
+#define CPU_CLOCK_KHZ 3500              // ROM timings (T-states at 3.5MHz)
+#define PILOT_T 2168                    // ROM timings (T-states)
+#define PILOT_HEADER_PULSES 8063
+#define PILOT_DATA_PULSES 3223
+#define SYNC1_T 667
+#define SYNC2_T 735
+#define BIT0_T 855
+#define BIT1_T 1710
+
+typedef struct _EXPECTED_EVENT_T {
+  ZXTAPE_EVENT_TYPE_T type;
+  unsigned nBlockIndex;
+  unsigned char nBlockId;
+  unsigned nSectionIndex;
+  unsigned nValue;    // File offset of BLOCK_START events (from the tape built), pause length of PAUSE events
+  int nDataFlag;      // The event follows a data block with this flag (-1 if not)
+  unsigned nPauseMs;  // The event follows a pause of this length (0 if not)
+} EXPECTED_EVENT_T;
+
+typedef struct _SESSION_RESULT_T {
+  ZXTAPE_EVENT_T events[MAX_EVENTS];
+  unsigned nEvents;
+  unsigned long long* pPulseEndUs;  // Output timeline at the end of each pulse buffered (us)
+  unsigned long nPulses;
+  unsigned long long nOutputUs;  // Periods buffered so far (us)
+} SESSION_RESULT_T;
+
+/* Forward declarations */
+static unsigned long buildTape(unsigned char* pTape, unsigned long* pOffsets);
+static unsigned long addDataBlock(unsigned char* pTape, unsigned long nLen, unsigned char nFlag, unsigned nPauseMs);
+static void makePayload(unsigned char nFlag, unsigned char* pPayload);
+static unsigned long long getDataBlockUs(unsigned char nFlag, unsigned* pPulses);
+static void runSession(const unsigned char* pTape, unsigned long nLen, SESSION_RESULT_T* pResult);
+static int checkEvent(unsigned i, const ZXTAPE_EVENT_T* pEvent, const ZXTAPE_EVENT_T* pPrevious,
+                      const EXPECTED_EVENT_T* pExpected, const SESSION_RESULT_T* pResult);
+static bool isPulseBoundary(const SESSION_RESULT_T* pResult, unsigned long long nTimeUs);
+static void onPulse(unsigned char nLevel, unsigned long nPeriodUs, void* pUserData);
+static void onEvent(ZXTAPE_HANDLE_T* pZxTape, const ZXTAPE_EVENT_T* pEvent, void* pUserData);
+
+/* Local variables */
+static const char* g_pEventNames[] = {"BLOCK", "SECTION", "STOP", "PAUSE", "END", "UNDERRUN"};
+
+/**
+ * Play a small tape on the simulated (virtual) clock, and check the events arrive in order, for the right blocks and
+ * sections, at the right tape times
+ */
+int main(int argc, char* argv[]) {
+  unsigned char tape[256];
+  unsigned long offsets[6];
+  SESSION_RESULT_T result;
+  int nFailed = 0;
+
+  unsigned long nLen = buildTape(tape, offsets);
+
+  const EXPECTED_EVENT_T expected[] = {
+      {ZXTAPE_EVENT_SECTION_START, 0, 0x30, 0, 0, -1, 0},
+      {ZXTAPE_EVENT_BLOCK_START, 0, 0x30, 0, offsets[0], -1, 0},
+      {ZXTAPE_EVENT_BLOCK_START, 1, 0x10, 0, offsets[1], -1, 0},
+      {ZXTAPE_EVENT_PAUSE, 1, 0x10, 0, HEADER_PAUSE_MS, 0x00, 0},
+      {ZXTAPE_EVENT_BLOCK_START, 2, 0x10, 0, offsets[2], -1, HEADER_PAUSE_MS},
+      {ZXTAPE_EVENT_BLOCK_START, 3, 0x20, 0, offsets[3], 0xFF, 0},
+      {ZXTAPE_EVENT_PAUSE, 3, 0x20, 0, PAUSE_BLOCK_MS, -1, 0},
+      {ZXTAPE_EVENT_SECTION_START, 4, 0x30, 1, 0, -1, PAUSE_BLOCK_MS},
+      {ZXTAPE_EVENT_BLOCK_START, 4, 0x30, 1, offsets[4], -1, 0},
+      {ZXTAPE_EVENT_BLOCK_START, 5, 0x10, 1, offsets[5], -1, 0},
+      {ZXTAPE_EVENT_END_OF_DATA, 5, 0x10, 1, 0, 0xFF, 0},
+  };
+  const unsigned nExpected = sizeof(expected) / sizeof(expected[0]);
+
+  runSession(tape, nLen, &result);
+
+  for (unsigned i = 0; i < result.nEvents; i++) {
+    const ZXTAPE_EVENT_T* pEvent = &result.events[i];
+    fprintf(stderr, "%-8s block %d (0x%02x) section %d value %u at %lluus\n", g_pEventNames[pEvent->type],
+            (int)pEvent->nBlockIndex, pEvent->nBlockId, (int)pEvent->nSectionIndex, pEvent->nValue,
+            pEvent->nTapeTimeUs);
+  }
+  fprintf(stderr, "%u events, %lu pulses, %lluus output\n", result.nEvents, result.nPulses, result.nOutputUs);
+
+  if (result.nEvents != nExpected) {
+    fprintf(stderr, "FAIL: %u events, expected %u\n", result.nEvents, nExpected);
+    nFailed++;
+  }
+  for (unsigned i = 0; i < result.nEvents && i < nExpected; i++) {
+    nFailed += checkEvent(i, &result.events[i], i > 0 ? &result.events[i - 1] : NULL, &expected[i], &result);
+  }
+
+  free(result.pPulseEndUs);
+
+  return nFailed ? 1 : 0;
+}
+
+/**
+ * Build the test tape: two sections (each starting with a text description), a header block ending in a pause, a data
+ * block, a pause block, and a last data block
+ *
+ * @return Length of the tape
+ */
+static unsigned long buildTape(unsigned char* pTape, unsigned long* pOffsets) {
+  static const unsigned char header[] = {'Z', 'X', 'T', 'a', 'p', 'e', '!', 0x1A, 1, 20};
+  unsigned long nLen = sizeof(header);
+
+  memcpy(pTape, header, sizeof(header));
+
+  // Section 0: description, header, data
+  pOffsets[0] = nLen;
+  memcpy(&pTape[nLen], "\x30\x03ONE", 5);
+  nLen += 5;
+  pOffsets[1] = nLen;
+  nLen = addDataBlock(pTape, nLen, 0x00, HEADER_PAUSE_MS);
+  pOffsets[2] = nLen;
+  nLen = addDataBlock(pTape, nLen, 0xFF, 0);
+
+  // Pause block
+  pOffsets[3] = nLen;
+  pTape[nLen++] = 0x20;
+  pTape[nLen++] = PAUSE_BLOCK_MS & 0xFF;
+  pTape[nLen++] = PAUSE_BLOCK_MS >> 8;
+
+  // Section 1: description, data
+  pOffsets[4] = nLen;
+  memcpy(&pTape[nLen], "\x30\x03TWO", 5);
+  nLen += 5;
+  pOffsets[5] = nLen;
+  nLen = addDataBlock(pTape, nLen, 0xFF, 0);
+
+  return nLen;
+}
+
+/**
+ * Add a standard speed data block (ID10)
+ *
+ * @return Length of the tape
+ */
+static unsigned long addDataBlock(unsigned char* pTape, unsigned long nLen, unsigned char nFlag, unsigned nPauseMs) {
+  pTape[nLen++] = 0x10;
+  pTape[nLen++] = nPauseMs & 0xFF;
+  pTape[nLen++] = nPauseMs >> 8;
+  pTape[nLen++] = PAYLOAD_LENGTH;
+  pTape[nLen++] = 0;
+  makePayload(nFlag, &pTape[nLen]);
+
+  return nLen + PAYLOAD_LENGTH;
+}
+
+static void makePayload(unsigned char nFlag, unsigned char* pPayload) {
+  const unsigned char payload[PAYLOAD_LENGTH] = {nFlag, 0x01, 0x02, 0x03, (unsigned char)(nFlag ^ 0x01 ^ 0x02 ^ 0x03)};
+
+  memcpy(pPayload, payload, PAYLOAD_LENGTH);
+}
+
+/**
+ * Length of a data block from the ROM timings (the pilot, the sync pulses, and two pulses a bit)
+ *
+ * @param nFlag Flag of the block (the pilot of a header is longer)
+ * @param pPulses Number of pulses in the block
+ * @return Length (us), each pulse may be rounded by up to 1us
+ */
+static unsigned long long getDataBlockUs(unsigned char nFlag, unsigned* pPulses) {
+  unsigned char payload[PAYLOAD_LENGTH];
+  unsigned nPilotPulses = nFlag < 0x80 ? PILOT_HEADER_PULSES : PILOT_DATA_PULSES;
+  unsigned long long nTstates = (unsigned long long)nPilotPulses * PILOT_T + SYNC1_T + SYNC2_T;
+
+  makePayload(nFlag, payload);
+  for (unsigned i = 0; i < PAYLOAD_LENGTH; i++) {
+    for (unsigned b = 0; b < 8; b++) nTstates += 2 * ((payload[i] >> b) & 1 ? BIT1_T : BIT0_T);
+  }
+  *pPulses = nPilotPulses + 2 + PAYLOAD_LENGTH * 8 * 2;
+
+  return nTstates * 1000 / CPU_CLOCK_KHZ;
+}
+
+static void runSession(const unsigned char* pTape, unsigned long nLen, SESSION_RESULT_T* pResult) {
+  TZX_SIM_CONFIG_T config;
+
+  memset(pResult, 0, sizeof(SESSION_RESULT_T));
+  pResult->pPulseEndUs = (unsigned long long*)malloc(MAX_PULSES * sizeof(unsigned long long));
+
+  TZXCompatSim_getDefaultConfig(&config);
+  config.pfnPulse = onPulse;
+  config.pUserData = pResult;
+  TZXCompatSim_configure(&config);
+
+  ZXTAPE_HANDLE_T* pZxTape = zxtape_create();
+  zxtape_init(pZxTape);
+  zxtape_setEventCallback(pZxTape, onEvent, NULL, pResult);
+  zxtape_loadBuffer(pZxTape, "events.tzx", pTape, nLen);
+  zxtape_playPause(pZxTape);
+
+  unsigned long long nStartNs = TZXCompatSim_getTimeNs();
+  bool bStarted = false;
+  while (TZXCompatSim_getTimeNs() - nStartNs < MAX_SESSION_MS * 1000000ull) {
+    zxtape_run(pZxTape, RUN_INTERVAL_MS);
+    zxtape_dispatchEvents(pZxTape);
+
+    if (!bStarted && zxtape_isStarted(pZxTape)) {
+      bStarted = true;
+    } else if (bStarted && !zxtape_isStarted(pZxTape)) {
+      // End of tape
+      break;
+    }
+
+    TZXCompatSim_advance(RUN_INTERVAL_MS * 1000000ull);
+  }
+
+  zxtape_destroy(pZxTape);
+}
+
+/**
+ * Check an event is the one expected, and follows the previous one by the length of the tape between them
+ */
+static int checkEvent(unsigned i, const ZXTAPE_EVENT_T* pEvent, const ZXTAPE_EVENT_T* pPrevious,
+                      const EXPECTED_EVENT_T* pExpected, const SESSION_RESULT_T* pResult) {
+  int nFailed = 0;
+
+  if (pEvent->type != pExpected->type || pEvent->nBlockIndex != pExpected->nBlockIndex ||
+      pEvent->nBlockId != pExpected->nBlockId || pEvent->nSectionIndex != pExpected->nSectionIndex ||
+      pEvent->nValue != pExpected->nValue) {
+    fprintf(stderr,
+            "FAIL: event %u is %s block %u (0x%02x) section %u value %u, expected %s block %u (0x%02x) section %u "
+            "value %u\n",
+            i, g_pEventNames[pEvent->type], pEvent->nBlockIndex, pEvent->nBlockId, pEvent->nSectionIndex,
+            pEvent->nValue, g_pEventNames[pExpected->type], pExpected->nBlockIndex, pExpected->nBlockId,
+            pExpected->nSectionIndex, pExpected->nValue);
+    nFailed++;
+  }
+
+  // The tape between the events: nothing, a data block, or a pause
+  unsigned long long nPreviousUs = pPrevious != NULL ? pPrevious->nTapeTimeUs : 0;
+  unsigned long long nMinUs = 0;
+  unsigned long long nMaxUs = 0;
+  if (pExpected->nDataFlag >= 0) {
+    unsigned nPulses;
+    unsigned long long nBlockUs = getDataBlockUs((unsigned char)pExpected->nDataFlag, &nPulses);
+    nMinUs = nBlockUs - nPulses;
+    nMaxUs = nBlockUs + nPulses;
+  } else if (pExpected->nPauseMs > 0) {
+    nMinUs = pExpected->nPauseMs * 1000ull;
+    nMaxUs = nMinUs + PAUSE_TOLERANCE_US;
+  }
+  unsigned long long nGapUs = pEvent->nTapeTimeUs - nPreviousUs;
+  if (pEvent->nTapeTimeUs < nPreviousUs || nGapUs < nMinUs || nGapUs > nMaxUs) {
+    fprintf(stderr, "FAIL: event %u at %lluus, %lluus after the previous one, expected %llu-%lluus\n", i,
+            pEvent->nTapeTimeUs, nGapUs, nMinUs, nMaxUs);
+    nFailed++;
+  }
+
+  // Events are on the output timeline (after the wait at the start)
+  if (!isPulseBoundary(pResult, START_WAIT_US + pEvent->nTapeTimeUs)) {
+    fprintf(stderr, "FAIL: event %u at %lluus is not at the start of a pulse output\n", i, pEvent->nTapeTimeUs);
+    nFailed++;
+  }
+
+  return nFailed;
+}
+
+static bool isPulseBoundary(const SESSION_RESULT_T* pResult, unsigned long long nTimeUs) {
+  for (unsigned long i = 0; i < pResult->nPulses; i++) {
+    if (pResult->pPulseEndUs[i] == nTimeUs) return true;
+    if (pResult->pPulseEndUs[i] > nTimeUs) break;
+  }
+
+  return false;
+}
+
+static void onPulse(unsigned char nLevel, unsigned long nPeriodUs, void* pUserData) {
+  SESSION_RESULT_T* pResult = (SESSION_RESULT_T*)pUserData;
+
+  pResult->nOutputUs += nPeriodUs;
+  if (pResult->nPulses < MAX_PULSES) pResult->pPulseEndUs[pResult->nPulses++] = pResult->nOutputUs;
+}
+
+static void onEvent(ZXTAPE_HANDLE_T* pZxTape, const ZXTAPE_EVENT_T* pEvent, void* pUserData) {
+  SESSION_RESULT_T* pResult = (SESSION_RESULT_T*)pUserData;
+
+  if (pResult->nEvents < MAX_EVENTS) pResult->events[pResult->nEvents++] = *pEvent;
+}
@@ -0,0 +1,227 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <zxtape.h>
+#include <zxtape_sink.h>
+
+#include "./games/starquake.h"
+
+#define FANOUT_LENGTH (1 << 16)             // Fan-out ring length (pulses)
+#define RING_LENGTH (1 << 20)               // PCM ring sink length (samples, reference signal)
+#define MAX_PULSES (16 * 1024 * 1024)       // Most pulses kept
+#define MAX_FRAMES (44100 * 15 * 60)        // Most frames kept (15 minutes at 44.1kHz)
+#define MAX_RUNS 100000                     // Give up if the tape has not ended after this many zxtape_run() calls
+#define SLOW_RUNS 64                        // Runs between reads of the slow reader
+#define SLOW_READ 4096                      // Most pulses the slow reader reads at a time
+#define THREAD_READ 256                     // Most pulses the reader thread reads at a time (one ring copy)
+#define HALF_GAIN (ZXTAPE_SINK_FANOUT_GAIN_UNITY / 2)
+
+typedef struct {
+  ZXTAPE_SINK_FANOUT_READER_T reader;
+  const ZXTAPE_PULSE_T* pReference;
+  unsigned long nRead;
+  unsigned long nMismatches;
+  bool bDone;
+} THREAD_READER_T;
+
+/* Forward declarations */
+static ZXTAPE_HANDLE_T* createSession(const ZXTAPE_SINK_T* pSink);
+static void runSession(ZXTAPE_HANDLE_T* pZxTape, ZXTAPE_SINK_RING_T* pRing, short* pOut, unsigned long* pCount);
+static void* readerThread(void* pArg);
+static void readThread(THREAD_READER_T* pThread);
+
+/* Local variables */
+static short g_ring[RING_LENGTH];
+static unsigned g_fanout[FANOUT_LENGTH];
+
+/**
+ * Generate the tape once and broadcast it to readers of different formats, rates, gains and speeds, and check each
+ * gets the same signal as a sink of its own, and that slow readers hold up neither the tape nor the other readers
+ */
+int main(int argc, char* argv[]) {
+  int nFailed = 0;
+
+  //
+  // References: the pulses, and PCM at each rate, each from an instance of its own
+  //
+  ZXTAPE_SINK_LIST_T list;
+  zxtape_initListSink(&list);
+  ZXTAPE_HANDLE_T* pZxTape = createSession(&list.sink);
+  runSession(pZxTape, NULL, NULL, NULL);
+  zxtape_destroy(pZxTape);
+
+  short* pS16Reference = (short*)malloc(MAX_FRAMES * sizeof(short));
+  short* pU8Reference = (short*)malloc(MAX_FRAMES * sizeof(short));
+  unsigned long nS16Reference = 0, nU8Reference = 0;
+  ZXTAPE_SINK_RING_T ring;
+  zxtape_initRingSink(&ring, g_ring, RING_LENGTH, 44100);
+  pZxTape = createSession(&ring.sink);
+  runSession(pZxTape, &ring, pS16Reference, &nS16Reference);
+  zxtape_destroy(pZxTape);
+  zxtape_initRingSink(&ring, g_ring, RING_LENGTH, 22050);
+  pZxTape = createSession(&ring.sink);
+  runSession(pZxTape, &ring, pU8Reference, &nU8Reference);
+  zxtape_destroy(pZxTape);
+
+  //
+  // One instance broadcasting to all the readers
+  //
+  ZXTAPE_SINK_FANOUT_T fanout;
+  zxtape_initFanoutSink(&fanout, g_fanout, FANOUT_LENGTH);
+
+  ZXTAPE_SINK_FANOUT_READER_T pulseReader, s16Reader, u8Reader, slowReader;
+  zxtape_initFanoutReader(&pulseReader, &fanout, ZXTAPE_SINK_FANOUT_FORMAT_PULSES, 0, 0);
+  zxtape_initFanoutReader(&s16Reader, &fanout, ZXTAPE_SINK_FANOUT_FORMAT_S16, 44100, ZXTAPE_SINK_FANOUT_GAIN_UNITY);
+  zxtape_initFanoutReader(&u8Reader, &fanout, ZXTAPE_SINK_FANOUT_FORMAT_U8, 22050, HALF_GAIN);
+  zxtape_initFanoutReader(&slowReader, &fanout, ZXTAPE_SINK_FANOUT_FORMAT_PULSES, 0, 0);
+
+  static THREAD_READER_T thread;
+  zxtape_initFanoutReader(&thread.reader, &fanout, ZXTAPE_SINK_FANOUT_FORMAT_PULSES, 0, 0);
+  thread.pReference = list.pPulses;
+  pthread_t threadId;
+  pthread_create(&threadId, NULL, readerThread, &thread);
+
+  ZXTAPE_PULSE_T* pPulses = (ZXTAPE_PULSE_T*)malloc(MAX_PULSES * sizeof(ZXTAPE_PULSE_T));
+  short* pS16 = (short*)malloc(MAX_FRAMES * sizeof(short));
+  unsigned char* pU8 = (unsigned char*)malloc(MAX_FRAMES);
+  static ZXTAPE_PULSE_T slowPulses[SLOW_READ];
+  unsigned long nPulses = 0, nS16 = 0, nU8 = 0, nSlow = 0;
+
+  pZxTape = createSession(&fanout.sink);
+  bool bStarted = false;
+  for (unsigned nRuns = 0; nRuns < MAX_RUNS; nRuns++) {
+    zxtape_run(pZxTape, 0);
+
+    nPulses += zxtape_readFanoutReader(&pulseReader, &pPulses[nPulses], (unsigned)(MAX_PULSES - nPulses));
+    nS16 += zxtape_readFanoutReader(&s16Reader, &pS16[nS16], (unsigned)(MAX_FRAMES - nS16));
+    nU8 += zxtape_readFanoutReader(&u8Reader, &pU8[nU8], (unsigned)(MAX_FRAMES - nU8));
+    if (nRuns % SLOW_RUNS == 0) nSlow += zxtape_readFanoutReader(&slowReader, slowPulses, SLOW_READ);
+
+    if (zxtape_isStarted(pZxTape)) {
+      bStarted = true;
+    } else if (bStarted) {
+      break;
+    }
+  }
+  zxtape_destroy(pZxTape);
+
+  __atomic_store_n(&thread.bDone, true, __ATOMIC_RELEASE);
+  pthread_join(threadId, NULL);
+  unsigned nWritten = fanout.nWriteIndex;
+  unsigned n;
+  while ((n = zxtape_readFanoutReader(&slowReader, slowPulses, SLOW_READ)) > 0) nSlow += n;
+
+  //
+  // Check each reader against its reference
+  //
+  bool bPulsesMatch = nPulses == list.nCount && pulseReader.nDropped == 0 &&
+                      memcmp(pPulses, list.pPulses, nPulses * sizeof(ZXTAPE_PULSE_T)) == 0;
+  fprintf(stderr, "Pulses: %lu (reference %u), %s\n", nPulses, list.nCount, bPulsesMatch ? "matches" : "DOES NOT MATCH");
+  if (!bPulsesMatch) {
+    fprintf(stderr, "FAIL: pulse reader\n");
+    nFailed++;
+  }
+
+  bool bS16Match = nS16 == nS16Reference && memcmp(pS16, pS16Reference, nS16 * sizeof(short)) == 0;
+  fprintf(stderr, "S16 44.1kHz: %lu frames (reference %lu), %s\n", nS16, nS16Reference,
+          bS16Match ? "matches" : "DOES NOT MATCH");
+  if (!bS16Match) {
+    fprintf(stderr, "FAIL: S16 reader\n");
+    nFailed++;
+  }
+
+  bool bU8Match = nU8 == nU8Reference;
+  for (unsigned long i = 0; bU8Match && i < nU8; i++) {
+    bU8Match = pU8[i] == (unsigned char)((pU8Reference[i] * HALF_GAIN / ZXTAPE_SINK_FANOUT_GAIN_UNITY + 0x8000) >> 8);
+  }
+  fprintf(stderr, "U8 22.05kHz half gain: %lu frames (reference %lu), %s\n", nU8, nU8Reference,
+          bU8Match ? "matches" : "DOES NOT MATCH");
+  if (!bU8Match) {
+    fprintf(stderr, "FAIL: U8 reader\n");
+    nFailed++;
+  }
+
+  fprintf(stderr, "Slow reader: %lu pulses read, %llu dropped, of %u\n", nSlow, slowReader.nDropped, nWritten);
+  if (slowReader.nDropped == 0 || nSlow + slowReader.nDropped != nWritten) {
+    fprintf(stderr, "FAIL: slow reader\n");
+    nFailed++;
+  }
+
+  fprintf(stderr, "Reader thread: %lu pulses read, %llu dropped, %lu mismatched, of %u\n", thread.nRead,
+          thread.reader.nDropped, thread.nMismatches, nWritten);
+  if (thread.nMismatches != 0 || thread.nRead + thread.reader.nDropped != nWritten) {
+    fprintf(stderr, "FAIL: reader thread\n");
+    nFailed++;
+  }
+
+  zxtape_freeListSink(&list);
+  free(pS16Reference);
+  free(pU8Reference);
+  free(pPulses);
+  free(pS16);
+  free(pU8);
+
+  return nFailed ? 1 : 0;
+}
+
+static ZXTAPE_HANDLE_T* createSession(const ZXTAPE_SINK_T* pSink) {
+  ZXTAPE_HANDLE_T* pZxTape = zxtape_create();
+  zxtape_init(pZxTape);
+  zxtape_setRenderMode(pZxTape, true);
+  zxtape_setSink(pZxTape, pSink);
+  zxtape_loadBuffer(pZxTape, "starquake.tzx", Starquake, sizeof(Starquake));
+  zxtape_playPause(pZxTape);
+
+  return pZxTape;
+}
+
+static void runSession(ZXTAPE_HANDLE_T* pZxTape, ZXTAPE_SINK_RING_T* pRing, short* pOut, unsigned long* pCount) {
+  bool bStarted = false;
+
+  for (unsigned nRuns = 0; nRuns < MAX_RUNS; nRuns++) {
+    zxtape_run(pZxTape, 0);
+
+    if (pRing) *pCount += zxtape_readRingSink(pRing, &pOut[*pCount], (unsigned)(MAX_FRAMES - *pCount));
+
+    if (zxtape_isStarted(pZxTape)) {
+      bStarted = true;
+    } else if (bStarted) {
+      break;
+    }
+  }
+}
+
+/**
+ * Read on another thread, at its own pace, checking each run of pulses read is the same as the reference at the
+ * reader's position on the tape
+ */
+static void* readerThread(void* pArg) {
+  THREAD_READER_T* pThread = (THREAD_READER_T*)pArg;
+  struct timespec pause = {0, 100000};
+
+  while (!__atomic_load_n(&pThread->bDone, __ATOMIC_ACQUIRE)) {
+    readThread(pThread);
+    nanosleep(&pause, NULL);
+  }
+  readThread(pThread);
+
+  return NULL;
+}
+
+static void readThread(THREAD_READER_T* pThread) {
+  ZXTAPE_PULSE_T pulses[THREAD_READ];
+  unsigned n;
+
+  while ((n = zxtape_readFanoutReader(&pThread->reader, pulses, THREAD_READ)) > 0) {
+    unsigned nStart = pThread->reader.nReadIndex - n;
+    for (unsigned i = 0; i < n; i++) {
+      const ZXTAPE_PULSE_T* pReference = &pThread->pReference[nStart + i];
+      if (pulses[i].nLevel != pReference->nLevel || pulses[i].nPeriodUs != pReference->nPeriodUs) {
+        pThread->nMismatches++;
+      }
+    }
+    pThread->nRead += n;
+  }
+}
@@ -0,0 +1,177 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <tzx_compat_impl_linux.h>
+#include <unistd.h>
+#include <zxtape.h>
+#include <zxtape_stats.h>
+
+#include "./games/starquake.h"
+
+#define RUN_INTERVAL_MS 10           // zxtape_run() interval
+#define DEFAULT_SECONDS 2            // Default play time
+#define SAMPLE_TOLERANCE_PERCENT 20  // Allowed difference between the samples written and the real time elapsed
+
+/* Forward declarations */
+static void usage(const char* pName);
+static void onEvent(ZXTAPE_HANDLE_T* pZxTape, const ZXTAPE_EVENT_T* pEvent, void* pUserData);
+static void sleepMs(unsigned ms);
+static unsigned getTickMs(void);
+
+/* Local variables */
+static unsigned g_nBlockEvents = 0;
+static bool g_bVerbose = false;
+
+/**
+ * Play a tape on Linux for a number of seconds (or until the end of the tape) and check the output ran in real time
+ *
+ * zxtape_linux_test [-s seconds] [-o null|wav|raw|stdout] [-f path] [-p] [-r priority] [-c cpu] [-m] [-v] [tape]
+ *
+ * e.g. zxtape_linux_test -s 0 -o stdout game.tzx | aplay -f U8 -r 44100
+ */
+int main(int argc, char* argv[]) {
+  TZX_LINUX_CONFIG_T config;
+  unsigned nSeconds = DEFAULT_SECONDS;
+  bool bProducer = false;
+  int opt;
+
+  TZXCompatLinux_getDefaultConfig(&config);
+
+  while ((opt = getopt(argc, argv, "s:o:f:pr:c:mvh")) != -1) {
+    switch (opt) {
+      case 's':
+        nSeconds = (unsigned)atoi(optarg);
+        break;
+      case 'o':
+        if (strcmp(optarg, "wav") == 0) {
+          config.sink = TZX_LINUX_SINK_WAV;
+        } else if (strcmp(optarg, "raw") == 0) {
+          config.sink = TZX_LINUX_SINK_RAW;
+        } else if (strcmp(optarg, "stdout") == 0) {
+          config.sink = TZX_LINUX_SINK_STDOUT;
+        } else {
+          config.sink = TZX_LINUX_SINK_NULL;
+        }
+        break;
+      case 'f':
+        config.pSinkPath = optarg;
+        break;
+      case 'p':
+        bProducer = true;
+        break;
+      case 'r':
+        config.nRealtimePriority = atoi(optarg);
+        break;
+      case 'c':
+        config.nCpu = atoi(optarg);
+        break;
+      case 'm':
+        config.bLockMemory = true;
+        break;
+      case 'v':
+        g_bVerbose = true;
+        break;
+      default:
+        usage(argv[0]);
+        return 1;
+    }
+  }
+
+  // Configure the Linux implementation before initialising
+  TZXCompatLinux_configure(&config);
+
+  ZXTAPE_HANDLE_T* pZxTape = zxtape_create();
+  zxtape_init(pZxTape);
+  zxtape_setEventCallback(pZxTape, onEvent, NULL, NULL);
+  if (bProducer) zxtape_setProducer(pZxTape, true, 0, 0);
+
+  if (optind < argc) {
+    if (!zxtape_loadFile(pZxTape, argv[optind])) return 1;
+  } else {
+    zxtape_loadBuffer(pZxTape, "starquake.tzx", Starquake, sizeof(Starquake));
+  }
+
+  // Start playing, and run until the time has elapsed, or the tape has ended
+  zxtape_playPause(pZxTape);
+
+  unsigned nStartMs = 0;
+  unsigned nElapsedMs = 0;
+  bool bStarted = false;
+  while (nSeconds == 0 || nElapsedMs < nSeconds * 1000) {
+    zxtape_run(pZxTape, RUN_INTERVAL_MS);
+    zxtape_dispatchEvents(pZxTape);
+
+    if (!bStarted && zxtape_isStarted(pZxTape)) {
+      // Measure from when playback actually started
+      bStarted = true;
+      nStartMs = getTickMs();
+    } else if (bStarted && !zxtape_isStarted(pZxTape)) {
+      // End of tape
+      break;
+    }
+    if (bStarted) nElapsedMs = getTickMs() - nStartMs;
+
+    sleepMs(RUN_INTERVAL_MS);
+  }
+
+  ZXTAPE_STATUS_T status;
+  TZX_LINUX_STATS_T stats;
+  ZXTAPE_STATS_T zxtapeStats;
+  zxtape_status(pZxTape, &status);
+  TZXCompatLinux_getStats(&stats);
+  zxtape_getStats(&zxtapeStats);
+  zxtape_destroy(pZxTape);
+
+  unsigned long long nExpectedSamples = (unsigned long long)nElapsedMs * config.nSampleRate / 1000;
+  fprintf(stderr,
+          "Played %ums: %llu samples (expected ~%llu), %llu underruns, %llu overflows, %u blocks, timer late %lluus "
+          "(max %lluus)\n",
+          nElapsedMs, stats.nSamplesWritten, nExpectedSamples, zxtapeStats.nUnderruns, zxtapeStats.nOverflows,
+          g_nBlockEvents, status.nTimerLateNs / 1000, status.nTimerMaxLateNs / 1000);
+
+  // Check playback started, and the output kept up with real time
+  if (!bStarted || g_nBlockEvents == 0) {
+    fprintf(stderr, "FAIL: playback did not start\n");
+    return 1;
+  }
+  unsigned long long nTolerance = nExpectedSamples * SAMPLE_TOLERANCE_PERCENT / 100 + config.nSampleRate / 10;
+  if (stats.nSamplesWritten + nTolerance < nExpectedSamples || stats.nSamplesWritten > nExpectedSamples + nTolerance) {
+    fprintf(stderr, "FAIL: output did not run in real time\n");
+    return 1;
+  }
+
+  return 0;
+}
+
+static void usage(const char* pName) {
+  fprintf(stderr,
+          "Usage: %s [-s seconds (0 = to end)] [-o null|wav|raw|stdout] [-f path] [-p (producer thread)] "
+          "[-r SCHED_FIFO priority] [-c cpu] [-m (mlockall)] [-v] [tape]\n",
+          pName);
+}
+
+static void onEvent(ZXTAPE_HANDLE_T* pZxTape, const ZXTAPE_EVENT_T* pEvent, void* pUserData) {
+  static const char* pEventNames[] = {"BLOCK", "SECTION", "STOP", "PAUSE", "END", "UNDERRUN"};
+
+  if (pEvent->type == ZXTAPE_EVENT_BLOCK_START) g_nBlockEvents++;
+
+  if (g_bVerbose) {
+    fprintf(stderr, "Event: %-8s block %d (0x%02x) section %d value %u at %llums\n", pEventNames[pEvent->type],
+            (int)pEvent->nBlockIndex, pEvent->nBlockId, (int)pEvent->nSectionIndex, pEvent->nValue,
+            pEvent->nTapeTimeUs / 1000);
+  }
+}
+
+static void sleepMs(unsigned ms) {
+  struct timespec ts;
+  ts.tv_sec = ms / 1000;
+  ts.tv_nsec = (ms % 1000) * 1000000l;
+  nanosleep(&ts, NULL);
+}
+
+static unsigned getTickMs(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned)(ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
@@ -0,0 +1,272 @@
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Only WARN and above compiled in (to check the lower levels compile to nothing)
+#undef ZXTAPE_LOG_LEVEL
+#define ZXTAPE_LOG_LEVEL 2
+
+#include "../lib/zxtape/tzx_compat/tzx_compat.h"
+#include "../lib/zxtape/tzx_compat_impl/common/deferred_log.h"
+
+#define MAX_LINES 16384       // Lines read back from the log
+#define LINE_LENGTH 1024      // Longest line read back
+#define THREADS 4             // Threads logging at once
+#define THREAD_MESSAGES 2000  // Messages logged by each thread
+#define BURST_MESSAGES 50     // Messages logged by a thread at once (fewer than a ring holds)
+#define BURST_GAP_MS 20       // Time between bursts (longer than the drain interval)
+
+/* Forward declarations */
+static int checkLevels(void);
+static int checkFormats(FILE* pFile);
+static int checkThreads(FILE* pFile);
+static bool logMessage(const char* pFormat, ...);
+static unsigned readLines(FILE* pFile);
+static int countEvaluated(void);
+static void* logThread(void* arg);
+static void logThreadMessage(const char* pFormat, ...);
+
+/* Local variables */
+static char g_expected[64][LINE_LENGTH];
+static unsigned g_nExpected = 0;
+static char g_lines[MAX_LINES][LINE_LENGTH];
+static unsigned g_nEvaluated = 0;
+static unsigned g_nLogged = 0;
+
+/**
+ * Check the deferred log formats messages as printf() would, keeps the order of each thread's messages, and that log
+ * calls below the compiled in level are not evaluated
+ */
+int main(int argc, char* argv[]) {
+  int nFailed = 0;
+
+  nFailed += checkLevels();
+
+  // Not deferred until started
+  if (logMessage("not started")) {
+    fprintf(stderr, "FAIL: message deferred before the log was started\n");
+    nFailed++;
+  }
+
+  // A thread's ring can be acquired before its first message
+  if (!AcquireDeferredLogRing()) {
+    fprintf(stderr, "FAIL: could not acquire a log ring\n");
+    nFailed++;
+  }
+
+  FILE* pFile = tmpfile();
+  if (pFile == NULL || !StartDeferredLog(pFile)) {
+    fprintf(stderr, "FAIL: could not start the log\n");
+    return 1;
+  }
+  nFailed += checkFormats(pFile);
+  nFailed += checkThreads(pFile);
+  StopDeferredLog();
+
+  // Not deferred once stopped
+  if (logMessage("stopped")) {
+    fprintf(stderr, "FAIL: message deferred after the log was stopped\n");
+    nFailed++;
+  }
+  fclose(pFile);
+
+  return nFailed ? 1 : 0;
+}
+
+/**
+ * Check the levels below ZXTAPE_LOG_LEVEL compile to nothing (their arguments are not evaluated)
+ */
+static int checkLevels(void) {
+  zxtape_log_debug("debug %d", countEvaluated());
+  zxtape_log_info("info %d", countEvaluated());
+  zxtape_log_warn("warn %d", countEvaluated());
+  zxtape_log_error("error %d", countEvaluated());
+
+  if (g_nEvaluated != 2 || g_nLogged != 2) {
+    fprintf(stderr, "FAIL: %u log arguments evaluated, %u messages logged, expected 2\n", g_nEvaluated, g_nLogged);
+    return 1;
+  }
+
+  return 0;
+}
+
+/**
+ * Check the messages are written as printf() would write them (string arguments copied when logged)
+ */
+static int checkFormats(FILE* pFile) {
+  char name[32];
+  char longString[300];
+  int nFailed = 0;
+
+  strcpy(name, "Starquake");
+  memset(longString, 'x', sizeof(longString) - 1);
+  longString[sizeof(longString) - 1] = '\0';
+  g_nExpected = 0;
+
+  logMessage("no arguments");
+  logMessage("%d %i %u %x %X %o", -42, 7, 4000000000u, 0xbeef, 0xBEEF, 8);
+  logMessage("%ld %lu %lld %llu %zu %hd %hhu", -1234567890123L, 1234567890123UL, -9000000000000000000LL,
+             18000000000000000000ULL, (size_t)123456789, (short)-5, (unsigned char)200);
+  logMessage("'%s' '%-12s' '%12s' '%.4s'", name, name, name, name);
+  logMessage("%5.2f %e %g %a", 3.14159, 0.000123, 1e20, 1.0);
+  logMessage("|%*d|%-*d|%.*f|%*.*s|", 6, 42, 6, 42, 3, 2.5, 8, 3, name);
+  logMessage("%c%c%c 100%% %p", 'Z', 'x', '!', (void*)name);
+  logMessage("null %s", (const char*)NULL);
+  logMessage("%s %s %s", name, "two", "three");
+  logMessage("block %u of %u: %s (%lu bytes) at %.1f%%", 3u, 12u, "Program: STARQUAKE", 6912UL, 25.0);
+
+  // Changed before the message is written, so is only right if copied
+  strcpy(name, "Changed");
+
+  FlushDeferredLog();
+  unsigned nLines = readLines(pFile);
+  if (nLines != g_nExpected) {
+    fprintf(stderr, "FAIL: %u lines written, expected %u\n", nLines, g_nExpected);
+    return 1;
+  }
+  for (unsigned i = 0; i < nLines; i++) {
+    if (strcmp(g_lines[i], g_expected[i]) != 0) {
+      fprintf(stderr, "FAIL: line %u\n  written:  %s  expected: %s", i, g_lines[i], g_expected[i]);
+      nFailed++;
+    }
+  }
+
+  // A string longer than a message holds is cut, not overrun
+  fseek(pFile, 0, SEEK_SET);
+  logMessage("long %s end", longString);
+  FlushDeferredLog();
+  nLines = readLines(pFile);
+  if (nLines != 1 || strncmp(g_lines[0], "Test [INFO] long xxxx", 21) != 0 || strstr(g_lines[0], " end\n") == NULL ||
+      strlen(g_lines[0]) >= strlen(g_expected[g_nExpected - 1])) {
+    fprintf(stderr, "FAIL: long string written as %s", nLines ? g_lines[0] : "nothing\n");
+    nFailed++;
+  }
+
+  return nFailed;
+}
+
+/**
+ * Check messages from many threads at once are each written once, in each thread's order, or are counted as dropped
+ * (without waiting, when a thread's ring is full)
+ */
+static int checkThreads(FILE* pFile) {
+  pthread_t threads[THREADS];
+  int ids[THREADS];
+  int nFailed = 0;
+
+  fseek(pFile, 0, SEEK_SET);
+  uint64_t nDroppedBefore = GetDeferredLogDropped();
+
+  for (int i = 0; i < THREADS; i++) {
+    ids[i] = i;
+    pthread_create(&threads[i], NULL, logThread, &ids[i]);
+  }
+  for (int i = 0; i < THREADS; i++) pthread_join(threads[i], NULL);
+
+  FlushDeferredLog();
+  unsigned nLines = readLines(pFile);
+  unsigned nDropped = (unsigned)(GetDeferredLogDropped() - nDroppedBefore);
+
+  int next[THREADS] = {0};
+  unsigned nMessages = 0, nDroppedLines = 0;
+  for (unsigned i = 0; i < nLines; i++) {
+    int nThread, nMessage;
+    unsigned nCount;
+    if (sscanf(g_lines[i], "Test [INFO] thread %d message %d", &nThread, &nMessage) == 2 && nThread >= 0 &&
+        nThread < THREADS) {
+      if (nMessage < next[nThread]) {
+        fprintf(stderr, "FAIL: thread %d message %d after %d\n", nThread, nMessage, next[nThread] - 1);
+        nFailed++;
+      }
+      next[nThread] = nMessage + 1;
+      nMessages++;
+    } else if (sscanf(g_lines[i], "ZxTape [WARN] %u log messages dropped", &nCount) == 1) {
+      nDroppedLines += nCount;
+    } else {
+      fprintf(stderr, "FAIL: unexpected line %s", g_lines[i]);
+      nFailed++;
+    }
+  }
+
+  fprintf(stderr, "%u messages from %d threads: %u written, %u dropped\n", THREADS * THREAD_MESSAGES, THREADS,
+          nMessages, nDropped);
+  if (nMessages + nDropped != THREADS * THREAD_MESSAGES || nDroppedLines != nDropped || nDropped == 0 ||
+      nMessages < THREADS * THREAD_MESSAGES / 2) {
+    fprintf(stderr, "FAIL: %u written and %u dropped (%u reported), expected %u\n", nMessages, nDropped,
+            nDroppedLines, THREADS * THREAD_MESSAGES);
+    nFailed++;
+  }
+
+  return nFailed;
+}
+
+/**
+ * Log a message through the deferred log, and format the line it should be written as
+ */
+static bool logMessage(const char* pFormat, ...) {
+  va_list args;
+
+  if (g_nExpected < sizeof(g_expected) / sizeof(g_expected[0])) {
+    va_start(args, pFormat);
+    int n = snprintf(g_expected[g_nExpected], LINE_LENGTH, "Test [INFO] ");
+    vsnprintf(&g_expected[g_nExpected][n], LINE_LENGTH - n - 1, pFormat, args);
+    strcat(g_expected[g_nExpected], "\n");
+    g_nExpected++;
+    va_end(args);
+  }
+
+  va_start(args, pFormat);
+  bool bDeferred = WriteDeferredLog("Test", "INFO", pFormat, args);
+  va_end(args);
+
+  return bDeferred;
+}
+
+/**
+ * Read the lines written since the file position was last reset, and reset it
+ */
+static unsigned readLines(FILE* pFile) {
+  unsigned nLines = 0;
+
+  long nEnd = ftell(pFile);
+  fseek(pFile, 0, SEEK_SET);
+  while (ftell(pFile) < nEnd && nLines < MAX_LINES && fgets(g_lines[nLines], LINE_LENGTH, pFile) != NULL) nLines++;
+  fseek(pFile, 0, SEEK_SET);
+
+  return nLines;
+}
+
+static int countEvaluated(void) {
+  return ++g_nEvaluated;
+}
+
+static void* logThread(void* arg) {
+  int nThread = *(int*)arg;
+
+  struct timespec gap = {0, BURST_GAP_MS * 1000000L};
+
+  // In bursts the drain keeps up with, after a first burst longer than a ring holds (so some are dropped)
+  for (int i = 0; i < THREAD_MESSAGES; i++) {
+    logThreadMessage("thread %d message %d", nThread, i);
+    if (i >= 4 * DEFERRED_LOG_RECORDS && i % BURST_MESSAGES == 0) nanosleep(&gap, NULL);
+  }
+
+  return NULL;
+}
+
+// Called by the zxtape_log_xxx() macros
+void zxtape_log(const char* pLevel, const char* pFormat, ...) {
+  g_nLogged++;
+}
+
+static void logThreadMessage(const char* pFormat, ...) {
+  va_list args;
+
+  va_start(args, pFormat);
+  WriteDeferredLog("Test", "INFO", pFormat, args);
+  va_end(args);
+}
@@ -0,0 +1,151 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <zxtape.h>
+
+#include "./games/starquake.h"
+
+#define BATCH_RECORDS 1024                 // Records per zxtape_readPulses() call
+#define MAX_BLOCK_STARTS 1024              // Block start events recorded
+#define MAX_RECORDS (16ul * 1024 * 1024)   // Give up if the tape has not ended after this many pulses
+#define FNV_OFFSET 0xcbf29ce484222325ull   // FNV-1a 64-bit
+#define FNV_PRIME 0x100000001b3ull
+
+typedef struct _BLOCK_START_T {
+  unsigned long long nTapeTimeUs;
+  unsigned nBlockIndex;
+} BLOCK_START_T;
+
+typedef struct _SESSION_RESULT_T {
+  unsigned long long nHash;
+  unsigned long nRecords;
+  unsigned long long nTstates;
+  unsigned long nMisplaced;  // Pulses not in the block started (by the events) at their position
+  double nSeconds;
+} SESSION_RESULT_T;
+
+/* Forward declarations */
+static void readSession(unsigned nClockHz, bool bVaryBatches, SESSION_RESULT_T* pResult);
+static void onEvent(ZXTAPE_HANDLE_T* pZxTape, const ZXTAPE_EVENT_T* pEvent, void* pUserData);
+static unsigned long long hash(unsigned long long h, const void* pData, unsigned nLen);
+
+/* Local variables */
+static bool g_bEnded = false;
+static unsigned long long g_nEndTapeUs = 0;
+static BLOCK_START_T g_blockStarts[MAX_BLOCK_STARTS];
+static unsigned g_nBlockStarts = 0;
+
+/**
+ * Read the pulses of a whole tape with zxtape_readPulses(), and check they are complete, exact and in the right blocks
+ */
+int main(int argc, char* argv[]) {
+  SESSION_RESULT_T fixed, varied, micro;
+  int nFailed = 0;
+
+  // Read in fixed and varied batches (T-states at the default clock)
+  readSession(0, false, &fixed);
+  readSession(0, true, &varied);
+
+  // Read with a 1MHz clock, so T-states are microseconds and each pulse can be placed against the block start events
+  readSession(1000000, false, &micro);
+
+  unsigned long long nExpectedTstates = g_nEndTapeUs * ZXTAPE_EAR_CLOCK_HZ / 1000000;
+  fprintf(stderr, "Pulses: %s, %lu pulses, %llu T-states (end of data at %llu T-states), %u blocks, %.3fs\n",
+          g_bEnded ? "ended" : "NOT ENDED", fixed.nRecords, fixed.nTstates, nExpectedTstates, g_nBlockStarts,
+          fixed.nSeconds);
+  fprintf(stderr, "Batches: hash %016llx / %016llx, %lu pulses misplaced\n", fixed.nHash, varied.nHash,
+          micro.nMisplaced);
+
+  // The whole tape is read, up to the end of the data
+  if (!g_bEnded || fixed.nRecords == 0 || fixed.nTstates < nExpectedTstates ||
+      fixed.nTstates > nExpectedTstates + ZXTAPE_EAR_CLOCK_HZ / 1000) {
+    fprintf(stderr, "FAIL: pulses do not cover the whole tape\n");
+    nFailed++;
+  }
+
+  // The pulses do not depend on the batch size
+  if (fixed.nHash != varied.nHash || fixed.nRecords != varied.nRecords) {
+    fprintf(stderr, "FAIL: pulses depend on the batch size\n");
+    nFailed++;
+  }
+
+  // Each pulse is in the block started at its position, although blocks start when generated (ahead of the pulses)
+  if (micro.nRecords != fixed.nRecords || micro.nMisplaced != 0 || g_nBlockStarts == 0) {
+    fprintf(stderr, "FAIL: pulses not in the right blocks\n");
+    nFailed++;
+  }
+
+  return nFailed ? 1 : 0;
+}
+
+static void readSession(unsigned nClockHz, bool bVaryBatches, SESSION_RESULT_T* pResult) {
+  static ZXTAPE_PULSE_RECORD_T records[BATCH_RECORDS];
+  unsigned nBatch = 1;
+  unsigned nBlockStart = 0;
+  unsigned nBlockIndex = ZXTAPE_INDEX_NONE;
+
+  memset(pResult, 0, sizeof(SESSION_RESULT_T));
+  pResult->nHash = FNV_OFFSET;
+  g_bEnded = false;
+  g_nEndTapeUs = 0;
+  g_nBlockStarts = 0;
+
+  ZXTAPE_HANDLE_T* pZxTape = zxtape_create();
+  zxtape_init(pZxTape);
+  zxtape_setRenderMode(pZxTape, true);
+  zxtape_setEarClock(pZxTape, nClockHz);
+  zxtape_setEventCallback(pZxTape, onEvent, NULL, NULL);
+  zxtape_loadBuffer(pZxTape, "starquake.tzx", Starquake, sizeof(Starquake));
+  zxtape_playPause(pZxTape);
+
+  clock_t nStartClock = clock();
+  while (pResult->nRecords < MAX_RECORDS) {
+    unsigned n = bVaryBatches ? nBatch : BATCH_RECORDS;
+    nBatch = (nBatch + 37) % BATCH_RECORDS + 1;
+
+    n = zxtape_readPulses(pZxTape, records, n);
+    zxtape_dispatchEvents(pZxTape);
+    if (n == 0 && !zxtape_isStarted(pZxTape)) break;
+
+    for (unsigned i = 0; i < n; i++) {
+      // Block started (so far) at the start of the pulse (only valid when T-states are microseconds)
+      while (nBlockStart < g_nBlockStarts && g_blockStarts[nBlockStart].nTapeTimeUs <= pResult->nTstates) {
+        nBlockIndex = g_blockStarts[nBlockStart++].nBlockIndex;
+      }
+      if (records[i].nBlockIndex != nBlockIndex) pResult->nMisplaced++;
+
+      pResult->nHash = hash(pResult->nHash, &records[i].nLevel, sizeof(records[i].nLevel));
+      pResult->nHash = hash(pResult->nHash, &records[i].nDurationTstates, sizeof(records[i].nDurationTstates));
+      pResult->nHash = hash(pResult->nHash, &records[i].nBlockIndex, sizeof(records[i].nBlockIndex));
+      pResult->nTstates += records[i].nDurationTstates;
+    }
+    pResult->nRecords += n;
+  }
+  pResult->nSeconds = (double)(clock() - nStartClock) / CLOCKS_PER_SEC;
+
+  zxtape_destroy(pZxTape);
+}
+
+static void onEvent(ZXTAPE_HANDLE_T* pZxTape, const ZXTAPE_EVENT_T* pEvent, void* pUserData) {
+  if (pEvent->type == ZXTAPE_EVENT_BLOCK_START && g_nBlockStarts < MAX_BLOCK_STARTS) {
+    g_blockStarts[g_nBlockStarts].nTapeTimeUs = pEvent->nTapeTimeUs;
+    g_blockStarts[g_nBlockStarts].nBlockIndex = pEvent->nBlockIndex;
+    g_nBlockStarts++;
+  }
+  if (pEvent->type == ZXTAPE_EVENT_END_OF_DATA) {
+    g_bEnded = true;
+    g_nEndTapeUs = pEvent->nTapeTimeUs;
+  }
+}
+
+static unsigned long long hash(unsigned long long h, const void* pData, unsigned nLen) {
+  const unsigned char* p = (const unsigned char*)pData;
+
+  for (unsigned i = 0; i < nLen; i++) {
+    h ^= p[i];
+    h *= FNV_PRIME;
+  }
+
+  return h;
+}
@@ -0,0 +1,170 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zxtape.h>
+
+#include "./games/starquake.h"
+
+#define SAMPLE_RATE 44100
+#define CHUNK_FRAMES 512                     // Frames per zxtape_render() call
+#define COMPARE_FRAMES (SAMPLE_RATE * 12)    // Frames compared between chunk sizes (pilot, header and data)
+#define PAUSE_AT_FRAMES (SAMPLE_RATE * 2)    // Pause scenario: pause after this many frames
+#define PAUSE_FRAMES (SAMPLE_RATE / 2)       // Pause scenario: frames rendered while paused (twice)
+#define MAX_FRAMES (SAMPLE_RATE * 15 * 60)   // Give up if the tape has not ended after this long
+#define FNV_OFFSET 0xcbf29ce484222325ull     // FNV-1a 64-bit
+#define FNV_PRIME 0x100000001b3ull
+
+/* Forward declarations */
+static ZXTAPE_HANDLE_T* createSession(void);
+static unsigned long long renderFrames(ZXTAPE_HANDLE_T* pZxTape, unsigned long nFrames, bool bVaryChunks,
+                                       unsigned long* pEdges, unsigned long* pPartial);
+static void onEvent(ZXTAPE_HANDLE_T* pZxTape, const ZXTAPE_EVENT_T* pEvent, void* pUserData);
+static unsigned long long hash(unsigned long long h, const void* pData, unsigned nLen);
+
+/* Local variables */
+static bool g_bEnded = false;
+static unsigned long long g_nEndTapeUs = 0;
+static short g_lastSample = ZXTAPE_RENDER_LEVEL_LOW;
+
+/**
+ * Pull the tape signal with zxtape_render() (no threads or timers), and check it is complete and exact
+ */
+int main(int argc, char* argv[]) {
+  short buffer[CHUNK_FRAMES];
+  int nFailed = 0;
+
+  //
+  // Whole tape, until playback stops at the end
+  //
+  ZXTAPE_HANDLE_T* pZxTape = createSession();
+  unsigned long long nFrames = 0;
+  while (nFrames < MAX_FRAMES) {
+    zxtape_render(pZxTape, buffer, CHUNK_FRAMES, SAMPLE_RATE);
+    zxtape_dispatchEvents(pZxTape);
+    nFrames += CHUNK_FRAMES;
+    if (nFrames > SAMPLE_RATE && !zxtape_isStarted(pZxTape)) break;
+  }
+  zxtape_destroy(pZxTape);
+
+  // Playback stops at the end of the tape, in the chunk containing the end
+  unsigned long long nExpectedFrames = g_nEndTapeUs * SAMPLE_RATE / 1000000;
+  fprintf(stderr, "Whole tape: %s, %llu frames (end of data at %llu frames)\n", g_bEnded ? "ended" : "NOT ENDED",
+          nFrames, nExpectedFrames);
+  if (!g_bEnded || nFrames < nExpectedFrames || nFrames > nExpectedFrames + 2 * CHUNK_FRAMES) {
+    fprintf(stderr, "FAIL: playback did not stop at the end of the tape\n");
+    nFailed++;
+  }
+
+  //
+  // Rendering in chunks of any size gives exactly the same signal
+  //
+  unsigned long nEdges, nPartial, nEdgesVaried, nPartialVaried;
+  pZxTape = createSession();
+  unsigned long long nHash = renderFrames(pZxTape, COMPARE_FRAMES, false, &nEdges, &nPartial);
+  zxtape_destroy(pZxTape);
+
+  pZxTape = createSession();
+  unsigned long long nHashVaried = renderFrames(pZxTape, COMPARE_FRAMES, true, &nEdgesVaried, &nPartialVaried);
+  zxtape_destroy(pZxTape);
+
+  fprintf(stderr, "Chunks: hash %016llx / %016llx, %lu edges, %lu frames with an edge inside\n", nHash, nHashVaried,
+          nEdges, nPartial);
+  if (nHash != nHashVaried) {
+    fprintf(stderr, "FAIL: signal depends on the chunk size\n");
+    nFailed++;
+  }
+  if (nEdges == 0 || nPartial == 0) {
+    fprintf(stderr, "FAIL: no edges, or edges not rendered at their phase\n");
+    nFailed++;
+  }
+
+  //
+  // Pausing holds the output (once the pulses already generated have played), and playback resumes
+  //
+  unsigned long nPausedEdges, nResumedEdges;
+  pZxTape = createSession();
+  renderFrames(pZxTape, PAUSE_AT_FRAMES, false, NULL, NULL);
+  zxtape_playPause(pZxTape);
+  renderFrames(pZxTape, PAUSE_FRAMES, false, NULL, NULL);
+  renderFrames(pZxTape, PAUSE_FRAMES, false, &nPausedEdges, NULL);
+  bool bPaused = zxtape_isPaused(pZxTape);
+  zxtape_playPause(pZxTape);
+  renderFrames(pZxTape, SAMPLE_RATE, false, &nResumedEdges, NULL);
+  bool bResumed = zxtape_isStarted(pZxTape) && !zxtape_isPaused(pZxTape);
+  zxtape_destroy(pZxTape);
+
+  fprintf(stderr, "Pause: %s, %lu edges while paused, %s, %lu edges after resuming\n",
+          bPaused ? "paused" : "NOT PAUSED", nPausedEdges, bResumed ? "resumed" : "NOT RESUMED", nResumedEdges);
+  if (!bPaused || nPausedEdges != 0 || !bResumed || nResumedEdges == 0) {
+    fprintf(stderr, "FAIL: pause / resume\n");
+    nFailed++;
+  }
+
+  return nFailed ? 1 : 0;
+}
+
+static ZXTAPE_HANDLE_T* createSession(void) {
+  g_bEnded = false;
+  g_nEndTapeUs = 0;
+  g_lastSample = ZXTAPE_RENDER_LEVEL_LOW;
+
+  ZXTAPE_HANDLE_T* pZxTape = zxtape_create();
+  zxtape_init(pZxTape);
+  zxtape_setRenderMode(pZxTape, true);
+  zxtape_setEventCallback(pZxTape, onEvent, NULL, NULL);
+  zxtape_loadBuffer(pZxTape, "starquake.tzx", Starquake, sizeof(Starquake));
+  zxtape_playPause(pZxTape);
+
+  return pZxTape;
+}
+
+/**
+ * Render frames, and return a hash of them (optionally counting edges, and frames with an edge part way through)
+ */
+static unsigned long long renderFrames(ZXTAPE_HANDLE_T* pZxTape, unsigned long nFrames, bool bVaryChunks,
+                                       unsigned long* pEdges, unsigned long* pPartial) {
+  short buffer[CHUNK_FRAMES];
+  unsigned long long h = FNV_OFFSET;
+  unsigned long nEdges = 0;
+  unsigned long nPartial = 0;
+  unsigned nChunk = 1;
+
+  while (nFrames > 0) {
+    unsigned n = bVaryChunks ? nChunk : CHUNK_FRAMES;
+    if (n > nFrames) n = nFrames;
+    nChunk = (nChunk + 37) % CHUNK_FRAMES + 1;
+
+    zxtape_render(pZxTape, buffer, n, SAMPLE_RATE);
+    zxtape_dispatchEvents(pZxTape);
+    h = hash(h, buffer, n * sizeof(short));
+
+    for (unsigned i = 0; i < n; i++) {
+      if (buffer[i] != g_lastSample) nEdges++;
+      if (buffer[i] != ZXTAPE_RENDER_LEVEL_HIGH && buffer[i] != ZXTAPE_RENDER_LEVEL_LOW) nPartial++;
+      g_lastSample = buffer[i];
+    }
+    nFrames -= n;
+  }
+
+  if (pEdges) *pEdges = nEdges;
+  if (pPartial) *pPartial = nPartial;
+  return h;
+}
+
+static void onEvent(ZXTAPE_HANDLE_T* pZxTape, const ZXTAPE_EVENT_T* pEvent, void* pUserData) {
+  if (pEvent->type == ZXTAPE_EVENT_END_OF_DATA) {
+    g_bEnded = true;
+    g_nEndTapeUs = pEvent->nTapeTimeUs;
+  }
+}
+
+static unsigned long long hash(unsigned long long h, const void* pData, unsigned nLen) {
+  const unsigned char* p = (const unsigned char*)pData;
+
+  for (unsigned i = 0; i < nLen; i++) {
+    h ^= p[i];
+    h *= FNV_PRIME;
+  }
+
+  return h;
+}
@@ -0,0 +1,168 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <zxtape.h>
+#include <zxtape_scheduler.h>
+#include <zxtape_sink.h>
+
+#include "./games/starquake.h"
+
+#define INSTANCES 64      // Tapes playing at once
+#define THREADS 2         // Scheduler threads
+#define LEAD_US 200000    // Tape written ahead of real time
+#define RUN_MS 1500       // How long the tapes play for
+#define MAX_RUNS 1000000  // Give up after this many zxtape_run() calls
+
+/* Forward declarations */
+static void renderReference(ZXTAPE_SINK_LIST_T* pReference);
+static bool isPrefix(const ZXTAPE_SINK_LIST_T* pList, const ZXTAPE_SINK_LIST_T* pReference);
+static unsigned long long listTimeUs(const ZXTAPE_SINK_LIST_T* pList);
+static int countThreads(void);
+static unsigned long long nowUs(void);
+
+/**
+ * Play many tapes at once in real time, each to its own sink, from the scheduler's few threads, and check each gets
+ * the same pulses as a single instance, kept ahead of real time by the lead but no further
+ */
+int main(int argc, char* argv[]) {
+  static ZXTAPE_SINK_LIST_T lists[INSTANCES];
+  ZXTAPE_HANDLE_T* pInstances[INSTANCES];
+  int nFailed = 0;
+
+  // The whole tape, from a single instance
+  ZXTAPE_SINK_LIST_T reference;
+  renderReference(&reference);
+  unsigned nMaxPulseUs = 0;
+  for (unsigned i = 0; i < reference.nCount; i++) {
+    if (reference.pPulses[i].nPeriodUs > nMaxPulseUs) nMaxPulseUs = reference.pPulses[i].nPeriodUs;
+  }
+
+  // Every tape playing to its own sink
+  int nThreadsBefore = countThreads();
+  ZXTAPE_SCHEDULER_HANDLE_T* pScheduler = zxtape_createScheduler(THREADS);
+  unsigned long long nStartUs = nowUs();
+  for (int i = 0; i < INSTANCES; i++) {
+    pInstances[i] = zxtape_create();
+    zxtape_init(pInstances[i]);
+    zxtape_initListSink(&lists[i]);
+    zxtape_setSink(pInstances[i], &lists[i].sink);
+    zxtape_loadBuffer(pInstances[i], "starquake.tzx", Starquake, sizeof(Starquake));
+    zxtape_playPause(pInstances[i]);
+    zxtape_scheduleInstance(pScheduler, pInstances[i], LEAD_US);
+  }
+  int nThreads = countThreads();
+
+  struct timespec sleepTime = {RUN_MS / 1000, (RUN_MS % 1000) * 1000000L};
+  nanosleep(&sleepTime, NULL);
+
+  for (int i = 0; i < INSTANCES; i++) zxtape_unscheduleInstance(pScheduler, pInstances[i]);
+  unsigned long long nElapsedUs = nowUs() - nStartUs;
+
+  ZXTAPE_SCHEDULER_STATS_T stats;
+  zxtape_getSchedulerStats(pScheduler, &stats);
+  unsigned nPoolThreads = pScheduler->nThreads;
+  zxtape_destroyScheduler(pScheduler);
+
+  // Same pulses, as far as each got, and paced in real time (never further ahead than the lead, and not far behind,
+  // allowing for a loaded machine)
+  unsigned nSame = 0, nPaced = 0;
+  unsigned long long nMinUs = ~0ull, nMaxUs = 0;
+  for (int i = 0; i < INSTANCES; i++) {
+    unsigned long long nTimeUs = listTimeUs(&lists[i]);
+    if (nTimeUs < nMinUs) nMinUs = nTimeUs;
+    if (nTimeUs > nMaxUs) nMaxUs = nTimeUs;
+    if (lists[i].nCount > 0 && isPrefix(&lists[i], &reference)) nSame++;
+    if (nTimeUs >= nElapsedUs / 2 && nTimeUs <= nElapsedUs + LEAD_US + nMaxPulseUs) nPaced++;
+
+    zxtape_destroy(pInstances[i]);
+    zxtape_freeListSink(&lists[i]);
+  }
+
+  fprintf(stderr, "%d instances, %u scheduler threads (%d in process): %u same, %u paced\n", INSTANCES,
+          nPoolThreads, nThreads, nSame, nPaced);
+  fprintf(stderr, "%.2fs elapsed, tape written %.2fs - %.2fs, %llu top ups, %llu late, max %.2fms after deadline\n",
+          nElapsedUs / 1e6, nMinUs / 1e6, nMaxUs / 1e6, stats.nServices, stats.nLate, stats.nMaxLateNs / 1e6);
+
+  if (nSame != INSTANCES) {
+    fprintf(stderr, "FAIL: pulses differ from a single instance\n");
+    nFailed++;
+  }
+  if (nPaced != INSTANCES) {
+    fprintf(stderr, "FAIL: tape not written in real time\n");
+    nFailed++;
+  }
+  if (nThreads > nThreadsBefore + THREADS) {
+    fprintf(stderr, "FAIL: more threads than the scheduler's\n");
+    nFailed++;
+  }
+
+  zxtape_freeListSink(&reference);
+
+  return nFailed ? 1 : 0;
+}
+
+/**
+ * Play the whole tape to a list sink with zxtape_run(), as fast as it can be generated
+ */
+static void renderReference(ZXTAPE_SINK_LIST_T* pReference) {
+  ZXTAPE_HANDLE_T* pZxTape = zxtape_create();
+  zxtape_init(pZxTape);
+  zxtape_initListSink(pReference);
+  zxtape_setSink(pZxTape, &pReference->sink);
+  zxtape_loadBuffer(pZxTape, "starquake.tzx", Starquake, sizeof(Starquake));
+  zxtape_playPause(pZxTape);
+
+  bool bStarted = false;
+  for (unsigned nRuns = 0; nRuns < MAX_RUNS; nRuns++) {
+    zxtape_run(pZxTape, 0);
+    if (zxtape_isStarted(pZxTape)) {
+      bStarted = true;
+    } else if (bStarted) {
+      break;
+    }
+  }
+  zxtape_destroy(pZxTape);
+}
+
+static bool isPrefix(const ZXTAPE_SINK_LIST_T* pList, const ZXTAPE_SINK_LIST_T* pReference) {
+  if (pList->nCount > pReference->nCount) return false;
+
+  for (unsigned i = 0; i < pList->nCount; i++) {
+    if (pList->pPulses[i].nLevel != pReference->pPulses[i].nLevel) return false;
+    if (pList->pPulses[i].nPeriodUs != pReference->pPulses[i].nPeriodUs) return false;
+  }
+
+  return true;
+}
+
+static unsigned long long listTimeUs(const ZXTAPE_SINK_LIST_T* pList) {
+  unsigned long long nTimeUs = 0;
+  for (unsigned i = 0; i < pList->nCount; i++) nTimeUs += pList->pPulses[i].nPeriodUs;
+
+  return nTimeUs;
+}
+
+/**
+ * Threads in the process (Linux only, 0 elsewhere)
+ */
+static int countThreads(void) {
+  int nThreads = 0;
+#ifdef __linux__
+  char line[256];
+  FILE* pFile = fopen("/proc/self/status", "r");
+  while (pFile != NULL && fgets(line, sizeof(line), pFile) != NULL) {
+    if (strncmp(line, "Threads:", 8) == 0) nThreads = atoi(&line[8]);
+  }
+  if (pFile != NULL) fclose(pFile);
+#endif
+
+  return nThreads;
+}
+
+static unsigned long long nowUs(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  return (unsigned long long)now.tv_sec * 1000000ull + (unsigned long long)now.tv_nsec / 1000ull;
+}
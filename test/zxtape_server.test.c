@@ -0,0 +1,382 @@
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+#include <zxtape.h>
+#include <zxtape_server.h>
+#include <zxtape_shm.h>
+
+#include "./games/starquake.h"
+
+#define WORKERS 4           // Threads playing the sessions
+#define SESSIONS 32         // Sessions opened by the client
+#define MAX_SESSION_ID 256  // Highest session id tracked
+#define SEEK_BLOCK 2        // Block the seek plays from
+#define PLAY_MS 1500        // Time the sessions play before they are checked
+#define WAIT_MS 5000        // Longest wait for a reply or push
+
+/* Forward declarations */
+static int connectServer(const char* pSocketPath);
+static void queueRequest(u16 nType, u32 nTag, u32 nSessionId, const void* pPayload, u32 nLength,
+                         const void* pPayload2, u32 nLength2);
+static bool sendRequests(int fd);
+static bool readReply(int fd, u16 nType, u32 nTag, u8* pResult, void* pPayload, u32 nLength);
+static bool readMessage(int fd, ZXTAPE_SERVER_MESSAGE_T* pMessage, void* pPayload, u32 nLength, unsigned nTimeoutMs);
+static bool readFully(int fd, void* pBuffer, u32 nLength, unsigned nTimeoutMs);
+static void pumpPushes(int fd, unsigned nMs);
+static unsigned long long nowMs(void);
+
+/* Local variables */
+static u8* g_pRequests = NULL;
+static u32 g_nRequests = 0;
+static unsigned g_nBlockStarts[MAX_SESSION_ID];   // BLOCK_START events pushed, by session
+static u32 g_nLastBlock[MAX_SESSION_ID];          // Block of the last BLOCK_START event, by session
+static unsigned g_nStatusPushes[MAX_SESSION_ID];  // Status pushes (playback stopped), by session
+static unsigned g_nBadPushes = 0;                 // Pushes for sessions not opened, or malformed
+
+/**
+ * Run a tape server, and drive many sessions from one client with pipelined requests
+ */
+int main(int argc, char* argv[]) {
+  int nFailed = 0;
+  char socketPath[64];
+  snprintf(socketPath, sizeof(socketPath), "/tmp/zxtape_server_test_%d.sock", (int)getpid());
+
+  ZXTAPE_SERVER_HANDLE_T* pServer = zxtape_createServer(socketPath, WORKERS);
+  int fd = pServer != NULL ? connectServer(socketPath) : -1;
+  if (fd < 0) {
+    fprintf(stderr, "FAIL: server connection\n");
+    if (pServer != NULL) zxtape_destroyServer(pServer);
+    return 1;
+  }
+
+  //
+  // Open the sessions, all requests sent at once
+  //
+  u32 nSessionIds[SESSIONS];
+  ZXTAPE_SERVER_OPEN_T open;
+  memset(&open, 0, sizeof(open));
+  for (u32 i = 0; i < SESSIONS; i++) queueRequest(ZXTAPE_SERVER_MSG_OPEN, i, 0, &open, sizeof(open), NULL, 0);
+  bool bOk = sendRequests(fd);
+  for (u32 i = 0; bOk && i < SESSIONS; i++) {
+    ZXTAPE_SERVER_MESSAGE_T reply;
+    bOk = readMessage(fd, &reply, NULL, 0, WAIT_MS) && reply.nFlags == ZXTAPE_SERVER_FLAG_REPLY &&
+          reply.nType == ZXTAPE_SERVER_MSG_OPEN && reply.nTag == i && reply.nResult == ZXTAPE_SERVER_RESULT_OK &&
+          reply.nSessionId > 0 && reply.nSessionId < MAX_SESSION_ID;
+    nSessionIds[i] = reply.nSessionId;
+    for (u32 j = 0; bOk && j < i; j++) bOk = nSessionIds[j] != nSessionIds[i];
+  }
+  if (!bOk) {
+    fprintf(stderr, "FAIL: open sessions\n");
+    nFailed++;
+  }
+
+  //
+  // Load, play and get the status of every session, all requests sent at once, and replies in order
+  //
+  unsigned long long nStartMs = nowMs();
+  ZXTAPE_SERVER_LOAD_T load;
+  memset(&load, 0, sizeof(load));
+  strcpy(load.name, "starquake.tzx");
+  for (u32 i = 0; i < SESSIONS; i++) {
+    queueRequest(ZXTAPE_SERVER_MSG_LOAD, 3 * i, nSessionIds[i], &load, sizeof(load), Starquake, sizeof(Starquake));
+    queueRequest(ZXTAPE_SERVER_MSG_PLAY, 3 * i + 1, nSessionIds[i], NULL, 0, NULL, 0);
+    queueRequest(ZXTAPE_SERVER_MSG_STATUS, 3 * i + 2, nSessionIds[i], NULL, 0, NULL, 0);
+  }
+  bOk = sendRequests(fd);
+  for (u32 i = 0; bOk && i < SESSIONS; i++) {
+    ZXTAPE_SERVER_STATUS_T status;
+    u8 nLoad, nPlay, nStatus;
+    bOk = readReply(fd, ZXTAPE_SERVER_MSG_LOAD, 3 * i, &nLoad, NULL, 0) &&
+          readReply(fd, ZXTAPE_SERVER_MSG_PLAY, 3 * i + 1, &nPlay, NULL, 0) &&
+          readReply(fd, ZXTAPE_SERVER_MSG_STATUS, 3 * i + 2, &nStatus, &status, sizeof(status)) &&
+          nLoad == ZXTAPE_SERVER_RESULT_OK && nPlay == ZXTAPE_SERVER_RESULT_OK &&
+          nStatus == ZXTAPE_SERVER_RESULT_OK && status.bLoaded && status.bStarted && !status.bPaused &&
+          status.nBlockCount > SEEK_BLOCK;
+  }
+  fprintf(stderr, "Load, play and status of %u sessions: %llums\n", SESSIONS, nowMs() - nStartMs);
+  if (!bOk) {
+    fprintf(stderr, "FAIL: load and play sessions\n");
+    nFailed++;
+  }
+
+  //
+  // Every session plays in real time, and pushes its events
+  //
+  pumpPushes(fd, PLAY_MS);
+  unsigned nPlaying = 0;
+  unsigned long long nMinTimeUs = ~0ull, nMaxTimeUs = 0;
+  for (u32 i = 0; i < SESSIONS; i++) {
+    ZXTAPE_SERVER_STATUS_T status;
+    u8 nResult;
+    queueRequest(ZXTAPE_SERVER_MSG_STATUS, i, nSessionIds[i], NULL, 0, NULL, 0);
+    if (!sendRequests(fd) || !readReply(fd, ZXTAPE_SERVER_MSG_STATUS, i, &nResult, &status, sizeof(status))) break;
+    if (g_nBlockStarts[nSessionIds[i]] > 0 && status.nPulses > 0) nPlaying++;
+    if (status.nTimeUs < nMinTimeUs) nMinTimeUs = status.nTimeUs;
+    if (status.nTimeUs > nMaxTimeUs) nMaxTimeUs = status.nTimeUs;
+  }
+  fprintf(stderr, "%u of %u sessions playing, %llu-%llums of tape played\n", nPlaying, SESSIONS, nMinTimeUs / 1000,
+          nMaxTimeUs / 1000);
+  if (nPlaying != SESSIONS || nMinTimeUs < PLAY_MS * 1000ull / 2) {
+    fprintf(stderr, "FAIL: sessions playing\n");
+    nFailed++;
+  }
+
+  //
+  // Pause one session, seek another
+  //
+  ZXTAPE_SERVER_STATUS_T status;
+  u8 nResult, nStatus;
+  u32 nSeekBlock = SEEK_BLOCK;
+  queueRequest(ZXTAPE_SERVER_MSG_PAUSE, 100, nSessionIds[0], NULL, 0, NULL, 0);
+  queueRequest(ZXTAPE_SERVER_MSG_STATUS, 101, nSessionIds[0], NULL, 0, NULL, 0);
+  bOk = sendRequests(fd) && readReply(fd, ZXTAPE_SERVER_MSG_PAUSE, 100, &nResult, NULL, 0) &&
+        readReply(fd, ZXTAPE_SERVER_MSG_STATUS, 101, &nStatus, &status, sizeof(status)) &&
+        nResult == ZXTAPE_SERVER_RESULT_OK && status.bStarted && status.bPaused;
+  if (!bOk) {
+    fprintf(stderr, "FAIL: pause\n");
+    nFailed++;
+  }
+
+  u32 nSeekId = nSessionIds[1];
+  g_nLastBlock[nSeekId] = ZXTAPE_INDEX_NONE;
+  g_nStatusPushes[nSeekId] = 0;
+  queueRequest(ZXTAPE_SERVER_MSG_SEEK, 102, nSeekId, &nSeekBlock, sizeof(nSeekBlock), NULL, 0);
+  bOk = sendRequests(fd) && readReply(fd, ZXTAPE_SERVER_MSG_SEEK, 102, &nResult, NULL, 0) &&
+        nResult == ZXTAPE_SERVER_RESULT_OK;
+  for (unsigned long long nWaitMs = nowMs() + WAIT_MS; bOk && g_nLastBlock[nSeekId] != SEEK_BLOCK;) {
+    if (nowMs() > nWaitMs) bOk = false;
+    pumpPushes(fd, 10);
+  }
+  if (!bOk || g_nStatusPushes[nSeekId] == 0) {
+    fprintf(stderr, "FAIL: seek (block %d, %u status pushes)\n", (int)g_nLastBlock[nSeekId],
+            g_nStatusPushes[nSeekId]);
+    nFailed++;
+  }
+
+  //
+  // Bad requests
+  //
+  u32 nBadBlock = 0xFFFF;
+  queueRequest(ZXTAPE_SERVER_MSG_SEEK, 200, nSeekId, &nBadBlock, sizeof(nBadBlock), NULL, 0);
+  queueRequest(ZXTAPE_SERVER_MSG_PLAY, 201, nSeekId, &nBadBlock, sizeof(nBadBlock), NULL, 0);
+  queueRequest(ZXTAPE_SERVER_MSG_STATUS, 202, MAX_SESSION_ID + 1, NULL, 0, NULL, 0);
+  queueRequest(99, 203, nSeekId, NULL, 0, NULL, 0);
+  u8 nResults[4];
+  bOk = sendRequests(fd) && readReply(fd, ZXTAPE_SERVER_MSG_SEEK, 200, &nResults[0], NULL, 0) &&
+        readReply(fd, ZXTAPE_SERVER_MSG_PLAY, 201, &nResults[1], NULL, 0) &&
+        readReply(fd, ZXTAPE_SERVER_MSG_STATUS, 202, &nResults[2], NULL, 0) &&
+        readReply(fd, 99, 203, &nResults[3], NULL, 0) && nResults[0] == ZXTAPE_SERVER_RESULT_BAD_REQUEST &&
+        nResults[1] == ZXTAPE_SERVER_RESULT_BAD_REQUEST && nResults[2] == ZXTAPE_SERVER_RESULT_NO_SESSION &&
+        nResults[3] == ZXTAPE_SERVER_RESULT_BAD_REQUEST;
+  if (!bOk) {
+    fprintf(stderr, "FAIL: bad requests\n");
+    nFailed++;
+  }
+
+  //
+  // Shared memory output, named by the server: a name in use, or one escaping the prefix, is refused
+  //
+  ZXTAPE_SERVER_OPEN_T shmOpen;
+  memset(&shmOpen, 0, sizeof(shmOpen));
+  snprintf(shmOpen.shmName, sizeof(shmOpen.shmName), "zxtape_server_test_%d", (int)getpid());
+  ZXTAPE_SERVER_OPEN_T badOpen = shmOpen;
+  strcpy(badOpen.shmName, "../zxtape_server_test");
+  queueRequest(ZXTAPE_SERVER_MSG_OPEN, 300, 0, &shmOpen, sizeof(shmOpen), NULL, 0);
+  queueRequest(ZXTAPE_SERVER_MSG_OPEN, 301, 0, &shmOpen, sizeof(shmOpen), NULL, 0);
+  queueRequest(ZXTAPE_SERVER_MSG_OPEN, 302, 0, &badOpen, sizeof(badOpen), NULL, 0);
+  ZXTAPE_SERVER_MESSAGE_T shmReply;
+  bOk = sendRequests(fd) && readMessage(fd, &shmReply, NULL, 0, WAIT_MS) &&
+        shmReply.nTag == 300 && shmReply.nResult == ZXTAPE_SERVER_RESULT_OK &&
+        readReply(fd, ZXTAPE_SERVER_MSG_OPEN, 301, &nResults[0], NULL, 0) &&
+        readReply(fd, ZXTAPE_SERVER_MSG_OPEN, 302, &nResults[1], NULL, 0) &&
+        nResults[0] == ZXTAPE_SERVER_RESULT_IN_USE && nResults[1] == ZXTAPE_SERVER_RESULT_BAD_REQUEST;
+  char shmName[ZXTAPE_SHM_MAX_NAME_LEN + 1];
+  snprintf(shmName, sizeof(shmName), "%s%s", ZXTAPE_SERVER_SHM_PREFIX, shmOpen.shmName);
+  ZXTAPE_SHM_READER_T reader;
+  bool bReader = zxtape_openShmReader(&reader, shmName);
+  if (bReader) zxtape_closeShmReader(&reader);
+  queueRequest(ZXTAPE_SERVER_MSG_CLOSE, 303, shmReply.nSessionId, NULL, 0, NULL, 0);
+  bOk = bOk && bReader && sendRequests(fd) && readReply(fd, ZXTAPE_SERVER_MSG_CLOSE, 303, &nResult, NULL, 0) &&
+        nResult == ZXTAPE_SERVER_RESULT_OK && !zxtape_openShmReader(&reader, shmName);
+  if (!bOk) {
+    fprintf(stderr, "FAIL: shared memory names\n");
+    nFailed++;
+  }
+
+  //
+  // Close the sessions, and they are gone
+  //
+  for (u32 i = 0; i < SESSIONS; i++) queueRequest(ZXTAPE_SERVER_MSG_CLOSE, i, nSessionIds[i], NULL, 0, NULL, 0);
+  queueRequest(ZXTAPE_SERVER_MSG_STATUS, SESSIONS, nSessionIds[0], NULL, 0, NULL, 0);
+  bOk = sendRequests(fd);
+  for (u32 i = 0; bOk && i < SESSIONS; i++) {
+    bOk = readReply(fd, ZXTAPE_SERVER_MSG_CLOSE, i, &nResult, NULL, 0) && nResult == ZXTAPE_SERVER_RESULT_OK;
+  }
+  bOk = bOk && readReply(fd, ZXTAPE_SERVER_MSG_STATUS, SESSIONS, &nResult, NULL, 0) &&
+        nResult == ZXTAPE_SERVER_RESULT_NO_SESSION;
+  if (!bOk || g_nBadPushes > 0) {
+    fprintf(stderr, "FAIL: close sessions (%u bad pushes)\n", g_nBadPushes);
+    nFailed++;
+  }
+
+  //
+  // A connection closing with sessions playing closes them
+  //
+  int fd2 = connectServer(socketPath);
+  queueRequest(ZXTAPE_SERVER_MSG_OPEN, 0, 0, &open, sizeof(open), NULL, 0);
+  queueRequest(ZXTAPE_SERVER_MSG_LOAD, 1, 0, &load, sizeof(load), Starquake, sizeof(Starquake));
+  bOk = fd2 >= 0 && sendRequests(fd2) && readReply(fd2, ZXTAPE_SERVER_MSG_OPEN, 0, &nResult, NULL, 0) &&
+        nResult == ZXTAPE_SERVER_RESULT_OK;
+  if (fd2 >= 0) close(fd2);
+  if (!bOk) {
+    fprintf(stderr, "FAIL: second connection\n");
+    nFailed++;
+  }
+
+  close(fd);
+  zxtape_destroyServer(pServer);
+  free(g_pRequests);
+
+  bool bRemoved = access(socketPath, F_OK) != 0;
+  if (!bRemoved) {
+    fprintf(stderr, "FAIL: socket not removed\n");
+    nFailed++;
+  }
+
+  return nFailed ? 1 : 0;
+}
+
+static int connectServer(const char* pSocketPath) {
+  struct sockaddr_un address;
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  strcpy(address.sun_path, pSocketPath);
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd >= 0 && connect(fd, (struct sockaddr*)&address, sizeof(address)) != 0) {
+    close(fd);
+    fd = -1;
+  }
+
+  return fd;
+}
+
+/**
+ * Add a request to those to send (the payload in up to two parts)
+ */
+static void queueRequest(u16 nType, u32 nTag, u32 nSessionId, const void* pPayload, u32 nLength,
+                         const void* pPayload2, u32 nLength2) {
+  ZXTAPE_SERVER_MESSAGE_T request = {nLength + nLength2, nType, 0, 0, nTag, nSessionId};
+
+  g_pRequests = (u8*)realloc(g_pRequests, g_nRequests + sizeof(request) + nLength + nLength2);
+  memcpy(&g_pRequests[g_nRequests], &request, sizeof(request));
+  g_nRequests += sizeof(request);
+  if (nLength > 0) memcpy(&g_pRequests[g_nRequests], pPayload, nLength);
+  g_nRequests += nLength;
+  if (nLength2 > 0) memcpy(&g_pRequests[g_nRequests], pPayload2, nLength2);
+  g_nRequests += nLength2;
+}
+
+/**
+ * Send the queued requests (reading pushes and replies only after, as the server does not wait for them to be read)
+ */
+static bool sendRequests(int fd) {
+  u32 nPos = 0;
+
+  while (nPos < g_nRequests) {
+    ssize_t nWritten = write(fd, &g_pRequests[nPos], g_nRequests - nPos);
+    if (nWritten <= 0) return false;
+    nPos += (u32)nWritten;
+  }
+  g_nRequests = 0;
+
+  return true;
+}
+
+/**
+ * Read messages until the next reply, which must be to the request given (pushes before it are recorded)
+ */
+static bool readReply(int fd, u16 nType, u32 nTag, u8* pResult, void* pPayload, u32 nLength) {
+  ZXTAPE_SERVER_MESSAGE_T reply;
+
+  if (!readMessage(fd, &reply, pPayload, nLength, WAIT_MS)) return false;
+  *pResult = reply.nResult;
+
+  return reply.nFlags == ZXTAPE_SERVER_FLAG_REPLY && reply.nType == nType && reply.nTag == nTag &&
+         (reply.nLength == nLength || reply.nLength == 0);
+}
+
+/**
+ * Read the next message other than a push (pushes are recorded), with its payload (up to nLength bytes)
+ */
+static bool readMessage(int fd, ZXTAPE_SERVER_MESSAGE_T* pMessage, void* pPayload, u32 nLength, unsigned nTimeoutMs) {
+  static u8 payload[ZXTAPE_SERVER_MAX_PAYLOAD];
+
+  for (;;) {
+    // (once a message has started, the rest of it follows)
+    if (!readFully(fd, pMessage, sizeof(ZXTAPE_SERVER_MESSAGE_T), nTimeoutMs)) return false;
+    if (pMessage->nLength > ZXTAPE_SERVER_MAX_PAYLOAD || !readFully(fd, payload, pMessage->nLength, WAIT_MS)) {
+      return false;
+    }
+
+    if (pMessage->nFlags != ZXTAPE_SERVER_FLAG_PUSH) {
+      if (pPayload != NULL) memcpy(pPayload, payload, pMessage->nLength < nLength ? pMessage->nLength : nLength);
+      return true;
+    }
+
+    // Record the push
+    u32 nId = pMessage->nSessionId;
+    if (nId == 0 || nId >= MAX_SESSION_ID) {
+      g_nBadPushes++;
+    } else if (pMessage->nType == ZXTAPE_SERVER_MSG_EVENT && pMessage->nLength == sizeof(ZXTAPE_SERVER_EVENT_T)) {
+      ZXTAPE_SERVER_EVENT_T event;
+      memcpy(&event, payload, sizeof(event));
+      if (event.nType == ZXTAPE_EVENT_BLOCK_START) {
+        g_nBlockStarts[nId]++;
+        g_nLastBlock[nId] = event.nBlockIndex;
+      }
+    } else if (pMessage->nType == ZXTAPE_SERVER_MSG_STATUS && pMessage->nLength == sizeof(ZXTAPE_SERVER_STATUS_T)) {
+      g_nStatusPushes[nId]++;
+    } else {
+      g_nBadPushes++;
+    }
+  }
+}
+
+static bool readFully(int fd, void* pBuffer, u32 nLength, unsigned nTimeoutMs) {
+  u32 nRead = 0;
+
+  while (nRead < nLength) {
+    struct pollfd pfd = {fd, POLLIN, 0};
+    if (poll(&pfd, 1, (int)(nRead == 0 ? nTimeoutMs : WAIT_MS)) <= 0) return false;
+    ssize_t n = read(fd, &((u8*)pBuffer)[nRead], nLength - nRead);
+    if (n <= 0) return false;
+    nRead += (u32)n;
+  }
+
+  return true;
+}
+
+/**
+ * Record the pushes for a time (there are no requests outstanding)
+ */
+static void pumpPushes(int fd, unsigned nMs) {
+  ZXTAPE_SERVER_MESSAGE_T message;
+  unsigned long long nEndMs = nowMs() + nMs;
+
+  for (unsigned long long nNowMs = nowMs(); nNowMs < nEndMs; nNowMs = nowMs()) {
+    if (readMessage(fd, &message, NULL, 0, (unsigned)(nEndMs - nNowMs))) g_nBadPushes++;
+  }
+}
+
+static unsigned long long nowMs(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (unsigned long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
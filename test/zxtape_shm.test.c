@@ -0,0 +1,227 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include <zxtape.h>
+#include <zxtape_shm.h>
+#include <zxtape_sink.h>
+
+#include "./games/starquake.h"
+
+#define SHM_NAME "/zxtape_shm_test"
+#define SAMPLE_RATE 44100
+#define PULSE_LENGTH (1 << 16)              // Shared pulse ring length (pulses)
+#define PCM_LENGTH (1 << 18)                // Shared PCM ring length (samples, about 6s)
+#define RING_LENGTH (1 << 20)               // PCM ring sink length (samples, reference signal)
+#define MAX_PULSES (4 * 1024 * 1024)        // Most pulses kept
+#define MAX_FRAMES (SAMPLE_RATE * 15 * 60)  // Most samples kept (15 minutes)
+#define MAX_RUNS 100000                     // Give up if the tape has not ended after this many zxtape_run() calls
+#define SLICE_US 500000                     // Tape written at a time by the producer
+#define WAIT_US 1000000                     // Longest the consumer waits for more
+#define READ_LENGTH 4096                    // Most pulses or samples the consumer reads at a time
+
+/* Forward declarations */
+static int checkInvalidRings(void);
+static int consume(int nReadyFd, const ZXTAPE_SINK_LIST_T* pReference, const short* pPcmReference,
+                   unsigned long nPcmReference);
+static ZXTAPE_HANDLE_T* createSession(const ZXTAPE_SINK_T* pSink);
+
+/* Local variables */
+static short g_ring[RING_LENGTH];
+
+/**
+ * Write the tape to shared memory, and check a consumer process reads the same pulses and samples as sinks of its own
+ */
+int main(int argc, char* argv[]) {
+  int nFailed = 0;
+
+  //
+  // References: the pulses, and the PCM
+  //
+  ZXTAPE_SINK_LIST_T list;
+  zxtape_initListSink(&list);
+  ZXTAPE_HANDLE_T* pZxTape = createSession(&list.sink);
+  bool bStarted = false;
+  for (unsigned nRuns = 0; nRuns < MAX_RUNS; nRuns++) {
+    zxtape_run(pZxTape, 0);
+    if (zxtape_isStarted(pZxTape)) {
+      bStarted = true;
+    } else if (bStarted) {
+      break;
+    }
+  }
+  zxtape_destroy(pZxTape);
+
+  short* pPcmReference = (short*)malloc(MAX_FRAMES * sizeof(short));
+  unsigned long nPcmReference = 0;
+  ZXTAPE_SINK_RING_T ring;
+  zxtape_initRingSink(&ring, g_ring, RING_LENGTH, SAMPLE_RATE);
+  pZxTape = createSession(&ring.sink);
+  bStarted = false;
+  for (unsigned nRuns = 0; nRuns < MAX_RUNS; nRuns++) {
+    zxtape_run(pZxTape, 0);
+    nPcmReference += zxtape_readRingSink(&ring, &pPcmReference[nPcmReference], MAX_FRAMES - nPcmReference);
+    if (zxtape_isStarted(pZxTape)) {
+      bStarted = true;
+    } else if (bStarted) {
+      break;
+    }
+  }
+  zxtape_destroy(pZxTape);
+
+  //
+  // The consumer process, reading from the shared memory as it is written
+  //
+  ZXTAPE_SINK_SHM_T shm;
+  if (!zxtape_openShmSink(&shm, SHM_NAME, PULSE_LENGTH, PCM_LENGTH, SAMPLE_RATE)) {
+    fprintf(stderr, "FAIL: shared memory sink\n");
+    return 1;
+  }
+
+  int readyPipe[2];
+  if (pipe(readyPipe) != 0) return 1;
+  pid_t pid = fork();
+  if (pid == 0) {
+    close(readyPipe[0]);
+    _exit(consume(readyPipe[1], &list, pPcmReference, nPcmReference));
+  }
+  close(readyPipe[1]);
+  char ready = 0;
+  bool bReady = read(readyPipe[0], &ready, 1) == 1;
+  close(readyPipe[0]);
+
+  // The tape in slices, yielding between them (the consumer keeps up, as it would in real time)
+  pZxTape = createSession(&shm.sink);
+  unsigned nSlices = 0;
+  struct timespec yield = {0, 1000000};
+  for (bStarted = false; bReady && nSlices < MAX_RUNS; nSlices++) {
+    zxtape_writeSink(pZxTape, SLICE_US);
+    nanosleep(&yield, NULL);
+    if (zxtape_isStarted(pZxTape)) {
+      bStarted = true;
+    } else if (bStarted) {
+      break;
+    }
+  }
+  zxtape_destroy(pZxTape);
+
+  int status = 0;
+  bool bConsumed = waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+  fprintf(stderr, "Producer: %u slices, %u pulses, %u samples written\n", nSlices, shm.pHeader->pulses.nWriteIndex,
+          shm.pHeader->pcm.nWriteIndex);
+  zxtape_closeShmSink(&shm);
+  if (!bReady || !bConsumed) {
+    fprintf(stderr, "FAIL: consumer process\n");
+    nFailed++;
+  }
+
+  zxtape_freeListSink(&list);
+  free(pPcmReference);
+
+  nFailed += checkInvalidRings();
+
+  return nFailed ? 1 : 0;
+}
+
+/**
+ * Check a reader does not open an object whose rings are not within it, or not a power of 2 long
+ */
+static int checkInvalidRings(void) {
+  int nFailed = 0;
+
+  for (int nCase = 0; nCase < 4; nCase++) {
+    ZXTAPE_SINK_SHM_T shm;
+    if (!zxtape_openShmSink(&shm, SHM_NAME, PULSE_LENGTH, PCM_LENGTH, SAMPLE_RATE)) return 1;
+
+    ZXTAPE_SHM_HEADER_T* pHeader = shm.pHeader;
+    switch (nCase) {
+      case 0:
+        pHeader->pulses.nLength = PULSE_LENGTH * 8;  // Past the end of the object
+        break;
+      case 1:
+        pHeader->pcm.nOffset = pHeader->nSize - 2;  // Past the end of the object
+        break;
+      case 2:
+        pHeader->pcm.nLength = PCM_LENGTH - 1;  // Not a power of 2
+        break;
+      default:
+        pHeader->pulses.nOffset = 0;  // Over the header
+        break;
+    }
+
+    ZXTAPE_SHM_READER_T reader;
+    if (zxtape_openShmReader(&reader, SHM_NAME)) {
+      fprintf(stderr, "FAIL: reader opened invalid rings (case %d)\n", nCase);
+      zxtape_closeShmReader(&reader);
+      nFailed++;
+    }
+    zxtape_closeShmSink(&shm);
+  }
+
+  return nFailed;
+}
+
+/**
+ * Consumer process: read everything written until playback stops, and check it matches the references
+ */
+static int consume(int nReadyFd, const ZXTAPE_SINK_LIST_T* pReference, const short* pPcmReference,
+                   unsigned long nPcmReference) {
+  ZXTAPE_SHM_READER_T reader;
+  if (!zxtape_openShmReader(&reader, SHM_NAME)) return 1;
+  if (write(nReadyFd, "R", 1) != 1) return 1;
+  close(nReadyFd);
+
+  ZXTAPE_PULSE_T* pPulses = (ZXTAPE_PULSE_T*)malloc(MAX_PULSES * sizeof(ZXTAPE_PULSE_T));
+  short* pPcm = (short*)malloc(MAX_FRAMES * sizeof(short));
+  unsigned long nPulses = 0, nPcm = 0;
+  unsigned nWakes = 0, nTimeouts = 0;
+
+  for (;;) {
+    // (once playback has stopped, everything has been written, so reading until there is no more reads it all)
+    bool bEnded = __atomic_load_n(&reader.pHeader->nEnds, __ATOMIC_ACQUIRE) > 0;
+    unsigned n;
+    while (nPulses + READ_LENGTH <= MAX_PULSES) {
+      if ((n = zxtape_readShmPulses(&reader, &pPulses[nPulses], READ_LENGTH)) == 0) break;
+      nPulses += n;
+    }
+    while (nPcm + READ_LENGTH <= MAX_FRAMES) {
+      if ((n = zxtape_readShmPcm(&reader, &pPcm[nPcm], READ_LENGTH)) == 0) break;
+      nPcm += n;
+    }
+    if (bEnded) break;
+
+    if (zxtape_waitShmReader(&reader, WAIT_US)) {
+      nWakes++;
+    } else if (++nTimeouts > 5) {
+      break;
+    }
+  }
+
+  // Every pulse, and every sample (and the last part sample, as playback stopped)
+  bool bPulsesMatch = nPulses == pReference->nCount && reader.nPulsesDropped == 0 &&
+                      memcmp(pPulses, pReference->pPulses, nPulses * sizeof(ZXTAPE_PULSE_T)) == 0;
+  bool bPcmMatch = (nPcm == nPcmReference || nPcm == nPcmReference + 1) && reader.nSamplesDropped == 0 &&
+                   memcmp(pPcm, pPcmReference, nPcmReference * sizeof(short)) == 0;
+  fprintf(stderr, "Consumer: %lu pulses (reference %u) %s, %lu samples (reference %lu) %s, %u wakes, %u timeouts\n",
+          nPulses, pReference->nCount, bPulsesMatch ? "match" : "DO NOT MATCH", nPcm, nPcmReference,
+          bPcmMatch ? "match" : "DO NOT MATCH", nWakes, nTimeouts);
+
+  zxtape_closeShmReader(&reader);
+  free(pPulses);
+  free(pPcm);
+
+  return bPulsesMatch && bPcmMatch ? 0 : 1;
+}
+
+static ZXTAPE_HANDLE_T* createSession(const ZXTAPE_SINK_T* pSink) {
+  ZXTAPE_HANDLE_T* pZxTape = zxtape_create();
+  zxtape_init(pZxTape);
+  zxtape_setRenderMode(pZxTape, true);
+  zxtape_setSink(pZxTape, pSink);
+  zxtape_loadBuffer(pZxTape, "starquake.tzx", Starquake, sizeof(Starquake));
+  zxtape_playPause(pZxTape);
+
+  return pZxTape;
+}
@@ -0,0 +1,196 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <tzx_compat_impl_sim.h>
+#include <zxtape.h>
+#include <zxtape_stats.h>
+
+#include "./games/starquake.h"
+
+#define RUN_INTERVAL_MS 10                // zxtape_run() interval (virtual time)
+#define MAX_SESSION_MS (15 * 60 * 1000)   // Give up if the tape has not ended after this long (virtual time)
+#define PAUSE_AT_MS 3000                  // Pause scenario: pause after this long
+#define PAUSE_FOR_MS 20000                // Pause scenario: stay paused for this long (longer than the buffered output)
+#define FNV_OFFSET 0xcbf29ce484222325ull  // FNV-1a 64-bit
+#define FNV_PRIME 0x100000001b3ull
+
+typedef struct _SESSION_RESULT_T {
+  bool bEnded;                   // END_OF_DATA event received, and playback stopped
+  unsigned long long nEndTapeUs;  // Tape time of the END_OF_DATA event
+  unsigned long long nSessionMs;  // Virtual time the session took
+  unsigned long long nSampleHash;
+  unsigned long long nPulseHash;
+  unsigned long nPulses;
+  unsigned nBlocks;
+  TZX_SIM_STATS_T stats;
+  unsigned long long nUnderruns;  // Times the output ran out of data while playing (zxtape_getStats())
+  unsigned long long nOverflows;  // Periods dropped because the output buffer was full (zxtape_getStats())
+} SESSION_RESULT_T;
+
+/* Forward declarations */
+static void runSession(bool bProducer, bool bPause, SESSION_RESULT_T* pResult);
+static void onSamples(const unsigned char* pSamples, unsigned int nCount, void* pUserData);
+static void onPulse(unsigned char nLevel, unsigned long nPeriodUs, void* pUserData);
+static void onEvent(ZXTAPE_HANDLE_T* pZxTape, const ZXTAPE_EVENT_T* pEvent, void* pUserData);
+static unsigned long long hash(unsigned long long h, const void* pData, unsigned nLen);
+static void printResult(const char* pName, const SESSION_RESULT_T* pResult);
+
+/**
+ * Play whole tapes on the simulated (virtual) clock, and check playback is complete and deterministic
+ */
+int main(int argc, char* argv[]) {
+  SESSION_RESULT_T timer1, timer2, producer, paused;
+  int nFailed = 0;
+
+  runSession(false, false, &timer1);
+  runSession(false, false, &timer2);
+  runSession(true, false, &producer);
+  runSession(false, true, &paused);
+
+  printResult("timer", &timer1);
+  printResult("timer (repeat)", &timer2);
+  printResult("producer", &producer);
+  printResult("pause", &paused);
+
+  // Every session must play to the end of the tape, without running out of data
+  const SESSION_RESULT_T* pResults[] = {&timer1, &timer2, &producer, &paused};
+  for (unsigned i = 0; i < sizeof(pResults) / sizeof(pResults[0]); i++) {
+    if (!pResults[i]->bEnded || pResults[i]->nBlocks == 0) {
+      fprintf(stderr, "FAIL: session %u did not play to the end of the tape\n", i);
+      nFailed++;
+    }
+    // (resuming from a pause may underrun once, until the timer catches up from its stopped period)
+    unsigned long nUnderrunsAllowed = pResults[i] == &paused ? 1 : 0;
+    if (pResults[i]->nUnderruns > nUnderrunsAllowed || pResults[i]->nOverflows != 0) {
+      fprintf(stderr, "FAIL: session %u underran / overflowed\n", i);
+      nFailed++;
+    }
+  }
+
+  // The same session must produce exactly the same output
+  if (timer1.nSampleHash != timer2.nSampleHash || timer1.nPulseHash != timer2.nPulseHash ||
+      timer1.nSessionMs != timer2.nSessionMs) {
+    fprintf(stderr, "FAIL: repeated session is not deterministic\n");
+    nFailed++;
+  }
+
+  // Refilling from the producer must not change the output
+  if (producer.nSampleHash != timer1.nSampleHash || producer.nEndTapeUs != timer1.nEndTapeUs) {
+    fprintf(stderr, "FAIL: producer session signal differs from the timer session\n");
+    nFailed++;
+  }
+
+  // Pausing must hold the tape (once the buffered output has played), and resume where it left off
+  if (paused.nEndTapeUs != timer1.nEndTapeUs || paused.nBlocks != timer1.nBlocks ||
+      paused.nSessionMs <= timer1.nSessionMs) {
+    fprintf(stderr, "FAIL: paused session did not resume correctly\n");
+    nFailed++;
+  }
+
+  return nFailed ? 1 : 0;
+}
+
+static void runSession(bool bProducer, bool bPause, SESSION_RESULT_T* pResult) {
+  TZX_SIM_CONFIG_T config;
+
+  memset(pResult, 0, sizeof(SESSION_RESULT_T));
+  pResult->nSampleHash = FNV_OFFSET;
+  pResult->nPulseHash = FNV_OFFSET;
+
+  TZXCompatSim_getDefaultConfig(&config);
+  config.pfnSamples = onSamples;
+  config.pfnPulse = onPulse;
+  config.pUserData = pResult;
+  TZXCompatSim_configure(&config);
+
+  ZXTAPE_HANDLE_T* pZxTape = zxtape_create();
+  zxtape_init(pZxTape);
+  zxtape_setEventCallback(pZxTape, onEvent, NULL, pResult);
+  if (bProducer) zxtape_setProducer(pZxTape, true, 0, 0);
+  zxtape_loadBuffer(pZxTape, "starquake.tzx", Starquake, sizeof(Starquake));
+
+  zxtape_resetStats();
+  zxtape_playPause(pZxTape);
+
+  unsigned long long nStartNs = TZXCompatSim_getTimeNs();
+  unsigned long long nPauseNs = 0;
+  bool bStarted = false;
+  while (pResult->nSessionMs < MAX_SESSION_MS) {
+    zxtape_run(pZxTape, RUN_INTERVAL_MS);
+    zxtape_dispatchEvents(pZxTape);
+
+    if (!bStarted && zxtape_isStarted(pZxTape)) {
+      bStarted = true;
+    } else if (bStarted && !zxtape_isStarted(pZxTape)) {
+      // End of tape
+      break;
+    }
+
+    // Pause, and later resume
+    if (bPause && bStarted) {
+      if (nPauseNs == 0 && pResult->nSessionMs >= PAUSE_AT_MS) {
+        zxtape_playPause(pZxTape);
+        nPauseNs = TZXCompatSim_getTimeNs();
+      } else if (nPauseNs != 0 && zxtape_isPaused(pZxTape) &&
+                 TZXCompatSim_getTimeNs() - nPauseNs >= PAUSE_FOR_MS * 1000000ull) {
+        zxtape_playPause(pZxTape);
+        bPause = false;
+      }
+    }
+
+    TZXCompatSim_advance(RUN_INTERVAL_MS * 1000000ull);
+    pResult->nSessionMs = (TZXCompatSim_getTimeNs() - nStartNs) / 1000000;
+  }
+
+  ZXTAPE_STATS_T stats;
+  TZXCompatSim_getStats(&pResult->stats);
+  zxtape_getStats(&stats);
+  pResult->nUnderruns = stats.nUnderruns;
+  pResult->nOverflows = stats.nOverflows;
+  zxtape_destroy(pZxTape);
+}
+
+static void onSamples(const unsigned char* pSamples, unsigned int nCount, void* pUserData) {
+  SESSION_RESULT_T* pResult = (SESSION_RESULT_T*)pUserData;
+
+  pResult->nSampleHash = hash(pResult->nSampleHash, pSamples, nCount);
+}
+
+static void onPulse(unsigned char nLevel, unsigned long nPeriodUs, void* pUserData) {
+  SESSION_RESULT_T* pResult = (SESSION_RESULT_T*)pUserData;
+
+  pResult->nPulseHash = hash(pResult->nPulseHash, &nLevel, sizeof(nLevel));
+  pResult->nPulseHash = hash(pResult->nPulseHash, &nPeriodUs, sizeof(nPeriodUs));
+  pResult->nPulses++;
+}
+
+static void onEvent(ZXTAPE_HANDLE_T* pZxTape, const ZXTAPE_EVENT_T* pEvent, void* pUserData) {
+  SESSION_RESULT_T* pResult = (SESSION_RESULT_T*)pUserData;
+
+  if (pEvent->type == ZXTAPE_EVENT_BLOCK_START) pResult->nBlocks++;
+  if (pEvent->type == ZXTAPE_EVENT_END_OF_DATA) {
+    pResult->bEnded = true;
+    pResult->nEndTapeUs = pEvent->nTapeTimeUs;
+  }
+}
+
+static unsigned long long hash(unsigned long long h, const void* pData, unsigned nLen) {
+  const unsigned char* p = (const unsigned char*)pData;
+
+  for (unsigned i = 0; i < nLen; i++) {
+    h ^= p[i];
+    h *= FNV_PRIME;
+  }
+
+  return h;
+}
+
+static void printResult(const char* pName, const SESSION_RESULT_T* pResult) {
+  fprintf(stderr,
+          "%-16s %s after %llums (tape %llums): %lu pulses, %u blocks, %llu samples, %llu underruns, %llu overflows, "
+          "%lu timer fires, %lu refills, hash %016llx / %016llx\n",
+          pName, pResult->bEnded ? "ended" : "NOT ENDED", pResult->nSessionMs, pResult->nEndTapeUs / 1000,
+          pResult->nPulses, pResult->nBlocks, pResult->stats.nSamplesWritten, pResult->nUnderruns,
+          pResult->nOverflows, pResult->stats.nTimerFires, pResult->stats.nRefills, pResult->nSampleHash,
+          pResult->nPulseHash);
+}
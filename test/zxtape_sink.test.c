@@ -0,0 +1,190 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zxtape.h>
+#include <zxtape_sink.h>
+
+#include "./games/starquake.h"
+
+#define SAMPLE_RATE 44100
+#define CHUNK_FRAMES 4096                    // Frames per zxtape_render() call (reference signal)
+#define BATCH_RECORDS 1024                   // Records per zxtape_readPulses() call (reference pulses)
+#define RING_LENGTH (1 << 20)                // PCM ring sink length (samples)
+#define MAX_FRAMES (SAMPLE_RATE * 15 * 60)   // Give up if the tape has not ended after this long
+#define MAX_RUNS 100000                      // Give up if the tape has not ended after this many zxtape_run() calls
+#define WAV_FILENAME "zxtape_sink_test.wav"  // WAV sink output
+#define WAV_HEADER_LENGTH 44
+
+/* Forward declarations */
+static ZXTAPE_HANDLE_T* createSession(const ZXTAPE_SINK_T* pSink);
+static unsigned runSession(ZXTAPE_HANDLE_T* pZxTape, ZXTAPE_SINK_RING_T* pRing, short* pOut, unsigned long nMax,
+                           unsigned long* pCount);
+
+/* Local variables */
+static short g_ring[RING_LENGTH];
+
+/**
+ * Push the tape to each built-in sink with zxtape_run(), and check the output matches the pulled signal
+ */
+int main(int argc, char* argv[]) {
+  static ZXTAPE_PULSE_RECORD_T records[BATCH_RECORDS];
+  int nFailed = 0;
+
+  //
+  // Reference: pulses from zxtape_readPulses() (1MHz clock, so T-states are microseconds), and zxtape_render()
+  //
+  ZXTAPE_PULSE_T* pPulses = (ZXTAPE_PULSE_T*)malloc(16 * 1024 * 1024 * sizeof(ZXTAPE_PULSE_T));
+  unsigned long nPulses = 0;
+  ZXTAPE_HANDLE_T* pZxTape = createSession(NULL);
+  zxtape_setEarClock(pZxTape, 1000000);
+  while (nPulses + BATCH_RECORDS <= 16 * 1024 * 1024) {
+    unsigned n = zxtape_readPulses(pZxTape, records, BATCH_RECORDS);
+    if (n == 0 && !zxtape_isStarted(pZxTape)) break;
+    for (unsigned i = 0; i < n; i++) {
+      pPulses[nPulses].nLevel = records[i].nLevel;
+      pPulses[nPulses++].nPeriodUs = records[i].nDurationTstates;
+    }
+  }
+  zxtape_destroy(pZxTape);
+
+  short* pSamples = (short*)malloc(MAX_FRAMES * sizeof(short));
+  unsigned long nSamples = 0;
+  pZxTape = createSession(NULL);
+  while (nSamples + CHUNK_FRAMES <= MAX_FRAMES) {
+    zxtape_render(pZxTape, &pSamples[nSamples], CHUNK_FRAMES, SAMPLE_RATE);
+    nSamples += CHUNK_FRAMES;
+    if (!zxtape_isStarted(pZxTape)) break;
+  }
+  zxtape_destroy(pZxTape);
+
+  //
+  // Counting sink
+  //
+  ZXTAPE_SINK_COUNT_T count;
+  zxtape_initCountSink(&count);
+  pZxTape = createSession(&count.sink);
+  unsigned nRuns = runSession(pZxTape, NULL, NULL, 0, NULL);
+  zxtape_destroy(pZxTape);
+
+  unsigned long long nTimeUs = 0;
+  for (unsigned long i = 0; i < nPulses; i++) nTimeUs += pPulses[i].nPeriodUs;
+  fprintf(stderr, "Count: %llu pulses in %llu batches over %u runs, %llums, %u ends (reference %lu pulses, %llums)\n",
+          count.nPulses, count.nBatches, nRuns, count.nTimeUs / 1000, count.nEnds, nPulses, nTimeUs / 1000);
+  if (count.nPulses != nPulses || count.nTimeUs != nTimeUs || count.nEnds != 1 || count.nBatches == 0 ||
+      count.nBatches >= count.nPulses) {
+    fprintf(stderr, "FAIL: counting sink\n");
+    nFailed++;
+  }
+
+  //
+  // Pulse list sink
+  //
+  ZXTAPE_SINK_LIST_T list;
+  zxtape_initListSink(&list);
+  pZxTape = createSession(&list.sink);
+  runSession(pZxTape, NULL, NULL, 0, NULL);
+  zxtape_destroy(pZxTape);
+
+  bool bListMatch = list.nCount == nPulses && memcmp(list.pPulses, pPulses, nPulses * sizeof(ZXTAPE_PULSE_T)) == 0;
+  fprintf(stderr, "List: %u pulses, %s\n", list.nCount, bListMatch ? "matches" : "DOES NOT MATCH");
+  if (!bListMatch) {
+    fprintf(stderr, "FAIL: pulse list sink\n");
+    nFailed++;
+  }
+  zxtape_freeListSink(&list);
+
+  //
+  // PCM ring sink (drained after each zxtape_run())
+  //
+  short* pRingSamples = (short*)malloc(MAX_FRAMES * sizeof(short));
+  unsigned long nRingSamples = 0;
+  ZXTAPE_SINK_RING_T ring;
+  zxtape_initRingSink(&ring, g_ring, RING_LENGTH, SAMPLE_RATE);
+  pZxTape = createSession(&ring.sink);
+  runSession(pZxTape, &ring, pRingSamples, MAX_FRAMES, &nRingSamples);
+  zxtape_destroy(pZxTape);
+
+  bool bRingMatch = nRingSamples > 0 && nRingSamples <= nSamples &&
+                    memcmp(pRingSamples, pSamples, nRingSamples * sizeof(short)) == 0;
+  fprintf(stderr, "Ring: %lu samples (%lu rendered), %llu dropped, %s\n", nRingSamples, nSamples, ring.nDropped,
+          bRingMatch ? "matches" : "DOES NOT MATCH");
+  if (!bRingMatch || ring.nDropped != 0 || nRingSamples + CHUNK_FRAMES < nSamples) {
+    fprintf(stderr, "FAIL: PCM ring sink\n");
+    nFailed++;
+  }
+
+  //
+  // WAV file sink
+  //
+  ZXTAPE_SINK_WAV_T wav;
+  bool bWavOk = zxtape_openWavSink(&wav, WAV_FILENAME, SAMPLE_RATE);
+  pZxTape = createSession(&wav.sink);
+  runSession(pZxTape, NULL, NULL, 0, NULL);
+  zxtape_destroy(pZxTape);
+  bWavOk = zxtape_closeWavSink(&wav) && bWavOk;
+
+  unsigned char header[WAV_HEADER_LENGTH];
+  FILE* pFile = fopen(WAV_FILENAME, "rb");
+  unsigned long nDataLen = 0;
+  unsigned long nWavSamples = 0;
+  bool bWavMatch = false;
+  if (pFile != NULL && fread(header, 1, WAV_HEADER_LENGTH, pFile) == WAV_HEADER_LENGTH) {
+    nDataLen = header[40] | (header[41] << 8) | (header[42] << 16) | ((unsigned long)header[43] << 24);
+    short* pWavSamples = (short*)malloc(nDataLen + sizeof(short));
+    nWavSamples = fread(pWavSamples, sizeof(short), nDataLen / sizeof(short) + 1, pFile);
+    // (all but the last part sample match the ring)
+    bWavMatch = memcmp(header, "RIFF", 4) == 0 && nWavSamples * sizeof(short) == nDataLen &&
+                nWavSamples >= nRingSamples && memcmp(pWavSamples, pRingSamples, nRingSamples * sizeof(short)) == 0;
+    free(pWavSamples);
+  }
+  if (pFile != NULL) fclose(pFile);
+  remove(WAV_FILENAME);
+
+  fprintf(stderr, "WAV: %lu samples (header %lu bytes of data), %s\n", nWavSamples, nDataLen,
+          bWavOk && bWavMatch ? "matches" : "DOES NOT MATCH");
+  if (!bWavOk || !bWavMatch) {
+    fprintf(stderr, "FAIL: WAV file sink\n");
+    nFailed++;
+  }
+
+  free(pPulses);
+  free(pSamples);
+  free(pRingSamples);
+
+  return nFailed ? 1 : 0;
+}
+
+static ZXTAPE_HANDLE_T* createSession(const ZXTAPE_SINK_T* pSink) {
+  ZXTAPE_HANDLE_T* pZxTape = zxtape_create();
+  zxtape_init(pZxTape);
+  zxtape_setRenderMode(pZxTape, true);
+  if (pSink) zxtape_setSink(pZxTape, pSink);
+  zxtape_loadBuffer(pZxTape, "starquake.tzx", Starquake, sizeof(Starquake));
+  zxtape_playPause(pZxTape);
+
+  return pZxTape;
+}
+
+/**
+ * Run until the tape ends, optionally draining a ring sink after each run. Returns the number of runs.
+ */
+static unsigned runSession(ZXTAPE_HANDLE_T* pZxTape, ZXTAPE_SINK_RING_T* pRing, short* pOut, unsigned long nMax,
+                           unsigned long* pCount) {
+  bool bStarted = false;
+  unsigned nRuns = 0;
+
+  while (nRuns < MAX_RUNS) {
+    zxtape_run(pZxTape, 0);
+    nRuns++;
+
+    if (pRing) *pCount += zxtape_readRingSink(pRing, &pOut[*pCount], (unsigned)(nMax - *pCount));
+
+    if (zxtape_isStarted(pZxTape)) {
+      bStarted = true;
+    } else if (bStarted) {
+      break;
+    }
+  }
+
+  return nRuns;
+}
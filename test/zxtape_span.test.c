@@ -0,0 +1,177 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../lib/zxtape/tzx_compat_impl/common/span_fill.h"
+
+#define SAMPLE_RATE 44100
+#define PERIOD_FRAMES 256                    // Frames per audio callback (a small device period)
+#define TOTAL_FRAMES (SAMPLE_RATE * 60 * 5)  // Frames rendered for each format (5 minutes)
+#define MAX_RUNS (TOTAL_FRAMES / 8)          // Most runs of the test signal
+#define PILOT_SAMPLES 27                     // Pulse lengths at SAMPLE_RATE
+#define ZERO_SAMPLES 11
+#define ONE_SAMPLES 22
+#define SAMPLE_LOW_16 (-0x7FFF)
+#define SAMPLE_HIGH_16 0x7FFF
+
+typedef struct _Run {
+  uint32_t state;
+  uint32_t samples;
+} Run;
+
+/* Forward declarations */
+static void renderPerSample(uint8_t* pOut, uint32_t frames, uint32_t channels, uint32_t bytesPerSample);
+static void renderSpans(const SpanFormat* pFormat, uint8_t* pOut, uint32_t frames);
+static void resetRuns(void);
+
+/* Local variables */
+static Run g_runs[MAX_RUNS];
+static uint32_t g_nRuns = 0;
+static uint32_t g_nRunIndex = 0;
+static uint32_t g_nRunRemaining = 0;
+static uint32_t g_lastState = 0;
+
+/**
+ * Render a tape-like signal (runs of a few to a few tens of samples) per sample, as the audio callbacks did, and as
+ * spans, in each output format, and check the output is the same and rendering spans is faster
+ */
+int main(int argc, char* argv[]) {
+  static uint8_t perSample[PERIOD_FRAMES * 4];
+  static uint8_t spans[PERIOD_FRAMES * 4];
+  int nFailed = 0;
+
+  // Runs as a standard speed block at 44.1kHz: pilot, then pairs of pulses for random data bits
+  srand(1);
+  uint64_t nTotal = 0;
+  while (g_nRuns < MAX_RUNS && nTotal < TOTAL_FRAMES) {
+    bool bPilot = g_nRuns % 20000 < 8000;
+    uint32_t samples = bPilot ? PILOT_SAMPLES : (rand() & 1 ? ONE_SAMPLES : ZERO_SAMPLES);
+    for (int i = 0; i < 2 && g_nRuns < MAX_RUNS; i++) {
+      g_runs[g_nRuns].state = g_nRuns & 1;
+      g_runs[g_nRuns].samples = samples;
+      nTotal += g_runs[g_nRuns++].samples;
+    }
+  }
+
+  for (uint32_t format = 0; format < 4; format++) {
+    uint32_t channels = format & 1 ? 2 : 1;
+    uint32_t bytesPerSample = format & 2 ? 2 : 1;
+    uint32_t frameBytes = channels * bytesPerSample;
+    SpanFormat spanFormat;
+    if (bytesPerSample == 1) {
+      InitSpanFormat(&spanFormat, channels, bytesPerSample, 0x00, 0xFF);
+    } else {
+      InitSpanFormat(&spanFormat, channels, bytesPerSample, SAMPLE_LOW_16, SAMPLE_HIGH_16);
+    }
+
+    // Same output
+    bool bSame = true;
+    resetRuns();
+    uint32_t nSavedIndex = 0, nSavedRemaining = 0, nSavedState = 0;
+    for (uint32_t n = 0; n < TOTAL_FRAMES / PERIOD_FRAMES && bSame; n++) {
+      nSavedIndex = g_nRunIndex;
+      nSavedRemaining = g_nRunRemaining;
+      nSavedState = g_lastState;
+      renderPerSample(perSample, PERIOD_FRAMES, channels, bytesPerSample);
+
+      g_nRunIndex = nSavedIndex;
+      g_nRunRemaining = nSavedRemaining;
+      g_lastState = nSavedState;
+      renderSpans(&spanFormat, spans, PERIOD_FRAMES);
+
+      bSame = memcmp(perSample, spans, PERIOD_FRAMES * frameBytes) == 0;
+    }
+
+    // Time each
+    resetRuns();
+    clock_t nStartClock = clock();
+    for (uint32_t n = 0; n < TOTAL_FRAMES / PERIOD_FRAMES; n++) {
+      renderPerSample(perSample, PERIOD_FRAMES, channels, bytesPerSample);
+    }
+    double nPerSampleSeconds = (double)(clock() - nStartClock) / CLOCKS_PER_SEC;
+
+    resetRuns();
+    nStartClock = clock();
+    for (uint32_t n = 0; n < TOTAL_FRAMES / PERIOD_FRAMES; n++) {
+      renderSpans(&spanFormat, spans, PERIOD_FRAMES);
+    }
+    double nSpanSeconds = (double)(clock() - nStartClock) / CLOCKS_PER_SEC;
+
+    fprintf(stderr, "%u channel(s), %u-bit: %s, per sample %.2fms, spans %.2fms (%.1fx)\n", channels,
+            bytesPerSample * 8, bSame ? "same" : "DIFFERENT", nPerSampleSeconds * 1000, nSpanSeconds * 1000,
+            nSpanSeconds > 0 ? nPerSampleSeconds / nSpanSeconds : 0);
+    if (!bSame) {
+      fprintf(stderr, "FAIL: span output differs\n");
+      nFailed++;
+    }
+  }
+
+  return nFailed ? 1 : 0;
+}
+
+/**
+ * Render a sample at a time, then copy mono to stereo (as the macOS audio callback did)
+ */
+static void renderPerSample(uint8_t* pOut, uint32_t frames, uint32_t channels, uint32_t bytesPerSample) {
+  Run* pRun = NULL;
+
+  for (uint32_t i = 0; i < frames; i++) {
+    if (pRun == NULL && g_nRunIndex < g_nRuns) {
+      pRun = &g_runs[g_nRunIndex];
+      g_lastState = pRun->state;
+      if (g_nRunRemaining == 0) g_nRunRemaining = pRun->samples;
+    }
+    if (pRun != NULL) {
+      if (--g_nRunRemaining == 0) {
+        g_nRunIndex++;
+        pRun = NULL;
+      }
+    }
+
+    if (bytesPerSample == 1) {
+      pOut[i] = g_lastState ? 0xFF : 0x00;
+    } else {
+      ((int16_t*)pOut)[i] = g_lastState ? SAMPLE_HIGH_16 : SAMPLE_LOW_16;
+    }
+  }
+
+  if (channels == 2) {
+    if (bytesPerSample == 1) {
+      for (int i = frames - 1; i >= 0; i--) pOut[i * 2 + 1] = pOut[i * 2] = pOut[i];
+    } else {
+      int16_t* p = (int16_t*)pOut;
+      for (int i = frames - 1; i >= 0; i--) p[i * 2 + 1] = p[i * 2] = p[i];
+    }
+  }
+}
+
+/**
+ * Render a span per run
+ */
+static void renderSpans(const SpanFormat* pFormat, uint8_t* pOut, uint32_t frames) {
+  uint32_t i = 0;
+
+  while (i < frames && g_nRunIndex < g_nRuns) {
+    Run* pRun = &g_runs[g_nRunIndex];
+    if (g_nRunRemaining == 0) g_nRunRemaining = pRun->samples;
+    g_lastState = pRun->state;
+
+    uint32_t samples = g_nRunRemaining < frames - i ? g_nRunRemaining : frames - i;
+    FillSpan(pFormat, pOut, i, samples, g_lastState);
+    g_nRunRemaining -= samples;
+    i += samples;
+
+    if (g_nRunRemaining == 0) g_nRunIndex++;
+  }
+
+  if (i < frames) FillSpan(pFormat, pOut, i, frames - i, g_lastState);
+}
+
+static void resetRuns(void) {
+  g_nRunIndex = 0;
+  g_nRunRemaining = 0;
+  g_lastState = 0;
+}
@@ -0,0 +1,256 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <tzx_compat_impl_sim.h>
+#include <unistd.h>
+#include <zxtape.h>
+#include <zxtape_sink.h>
+#include <zxtape_stats.h>
+
+#include "./games/starquake.h"
+
+#define RUN_INTERVAL_MS 10               // zxtape_run() interval (virtual time)
+#define MAX_SESSION_MS (15 * 60 * 1000)  // Give up if the tape has not ended after this long (virtual time)
+#define MAX_RENDER_RUNS 1000000          // Give up if the render has not ended after this many zxtape_run() calls
+#define TEXT_LENGTH 8192                 // Text export buffer
+
+typedef struct _SESSION_RESULT_T {
+  unsigned long nPulses;  // Periods buffered to the simulated output
+  TZX_SIM_STATS_T simStats;
+  ZXTAPE_STATS_T stats;
+} SESSION_RESULT_T;
+
+/* Forward declarations */
+static void runSession(bool bProducer, const char* pFilename, SESSION_RESULT_T* pResult);
+static void runRender(ZXTAPE_SINK_COUNT_T* pCount, ZXTAPE_STATS_T* pStats);
+static int checkSession(const char* pName, const SESSION_RESULT_T* pResult);
+static int checkText(void);
+static void onPulse(unsigned char nLevel, unsigned long nPeriodUs, void* pUserData);
+
+/**
+ * Check the runtime statistics match what the simulated output saw, in each playback mode, and export as text
+ */
+int main(int argc, char* argv[]) {
+  SESSION_RESULT_T timer, producer, file;
+  ZXTAPE_SINK_COUNT_T count;
+  ZXTAPE_STATS_T stats;
+  int nFailed = 0;
+
+  // Nothing counted after a reset
+  zxtape_resetStats();
+  zxtape_getStats(&stats);
+  if (stats.nPulses != 0 || stats.nOutputPulls != 0 || stats.nFillMaxPercent != 0 || stats.nRefills != 0) {
+    fprintf(stderr, "FAIL: statistics not reset\n");
+    nFailed++;
+  }
+
+  // Played to the output, filled by the timer
+  runSession(false, NULL, &timer);
+  nFailed += checkSession("timer", &timer);
+  if (timer.stats.nTimerWakeups != timer.simStats.nTimerFires || timer.stats.nLateTimerWakeups != 0 ||
+      timer.stats.nRefills != 0) {
+    fprintf(stderr, "FAIL: timer session wakeups %llu (late %llu), expected %lu\n", timer.stats.nTimerWakeups,
+            timer.stats.nLateTimerWakeups, timer.simStats.nTimerFires);
+    nFailed++;
+  }
+
+  // Played to the output, filled by the producer
+  runSession(true, NULL, &producer);
+  nFailed += checkSession("producer", &producer);
+  u64 nRefills = 0;
+  for (unsigned i = 0; i < ZXTAPE_STATS_DURATION_BUCKETS; i++) nRefills += producer.stats.refillHistogram[i];
+  if (producer.stats.nRefills < producer.simStats.nRefills || nRefills != producer.stats.nRefills) {
+    fprintf(stderr, "FAIL: producer session refills %llu (histogram %llu), expected at least %lu\n",
+            producer.stats.nRefills, nRefills, producer.simStats.nRefills);
+    nFailed++;
+  }
+
+  // Played from a file (the reads and the time waiting for them are counted, only from files)
+  char path[] = "/tmp/zxtape_stats_XXXXXX";
+  int fd = mkstemp(path);
+  if (fd < 0 || write(fd, Starquake, sizeof(Starquake)) != (ssize_t)sizeof(Starquake)) {
+    fprintf(stderr, "FAIL: could not write %s\n", path);
+    return 1;
+  }
+  close(fd);
+  runSession(false, path, &file);
+  unlink(path);
+  nFailed += checkSession("file", &file);
+  if (file.stats.nFileReads == 0 || timer.stats.nFileReads != 0 || file.stats.nPulses != timer.stats.nPulses) {
+    fprintf(stderr, "FAIL: file session reads %llu (buffer session %llu)\n", file.stats.nFileReads,
+            timer.stats.nFileReads);
+    nFailed++;
+  }
+
+  // Rendered (every period generated is counted, including the end of the tape and any generated after it in the last
+  // batch, which are not written to the sink)
+  runRender(&count, &stats);
+  fprintf(stderr, "render: %llu pulses to the sink, %llu counted\n", count.nPulses, stats.nPulses);
+  if (stats.nPulses <= count.nPulses || stats.nOutputPulls != 0) {
+    fprintf(stderr, "FAIL: render pulses %llu, expected more than %llu\n", stats.nPulses, count.nPulses);
+    nFailed++;
+  }
+
+  nFailed += checkText();
+
+  return nFailed ? 1 : 0;
+}
+
+static void runSession(bool bProducer, const char* pFilename, SESSION_RESULT_T* pResult) {
+  TZX_SIM_CONFIG_T config;
+
+  memset(pResult, 0, sizeof(SESSION_RESULT_T));
+
+  TZXCompatSim_getDefaultConfig(&config);
+  config.pfnPulse = onPulse;
+  config.pUserData = pResult;
+  TZXCompatSim_configure(&config);
+  zxtape_resetStats();
+
+  ZXTAPE_HANDLE_T* pZxTape = zxtape_create();
+  zxtape_init(pZxTape);
+  if (bProducer) zxtape_setProducer(pZxTape, true, 0, 0);
+  if (pFilename != NULL) {
+    zxtape_loadFile(pZxTape, pFilename);
+  } else {
+    zxtape_loadBuffer(pZxTape, "starquake.tzx", Starquake, sizeof(Starquake));
+  }
+  zxtape_playPause(pZxTape);
+
+  bool bStarted = false;
+  for (unsigned nMs = 0; nMs < MAX_SESSION_MS; nMs += RUN_INTERVAL_MS) {
+    zxtape_run(pZxTape, RUN_INTERVAL_MS);
+    if (!bStarted && zxtape_isStarted(pZxTape)) {
+      bStarted = true;
+    } else if (bStarted && !zxtape_isStarted(pZxTape)) {
+      break;
+    }
+    TZXCompatSim_advance(RUN_INTERVAL_MS * 1000000ull);
+  }
+
+  TZXCompatSim_getStats(&pResult->simStats);
+  zxtape_getStats(&pResult->stats);
+  zxtape_destroy(pZxTape);
+}
+
+static void runRender(ZXTAPE_SINK_COUNT_T* pCount, ZXTAPE_STATS_T* pStats) {
+  zxtape_resetStats();
+  zxtape_initCountSink(pCount);
+
+  ZXTAPE_HANDLE_T* pZxTape = zxtape_create();
+  zxtape_init(pZxTape);
+  zxtape_setSink(pZxTape, &pCount->sink);
+  zxtape_loadBuffer(pZxTape, "starquake.tzx", Starquake, sizeof(Starquake));
+  zxtape_playPause(pZxTape);
+
+  bool bStarted = false;
+  for (unsigned nRuns = 0; nRuns < MAX_RENDER_RUNS; nRuns++) {
+    zxtape_run(pZxTape, 0);
+    if (zxtape_isStarted(pZxTape)) {
+      bStarted = true;
+    } else if (bStarted) {
+      break;
+    }
+  }
+
+  zxtape_getStats(pStats);
+  zxtape_destroy(pZxTape);
+}
+
+/**
+ * Check the statistics of a session played to the simulated output agree with the simulation's own
+ */
+static int checkSession(const char* pName, const SESSION_RESULT_T* pResult) {
+  const ZXTAPE_STATS_T* pStats = &pResult->stats;
+  int nFailed = 0;
+
+  fprintf(stderr,
+          "%-9s %llu pulses, %llu bytes read (%llu file reads, %lluns stalled), %llu pulls, %llu samples, fill "
+          "%u/%u/%u/%u/%u%%, %llu underruns, %llu overflows, %llu timer wakeups, %llu refills\n",
+          pName, pStats->nPulses, pStats->nBytesRead, pStats->nFileReads, pStats->nIoStallNs, pStats->nOutputPulls,
+          pStats->nSamples, pStats->nFillMinPercent, pStats->nFillP50Percent, pStats->nFillP90Percent,
+          pStats->nFillP99Percent, pStats->nFillMaxPercent, pStats->nUnderruns, pStats->nOverflows,
+          pStats->nTimerWakeups, pStats->nRefills);
+
+  if (pStats->nPulses == 0 || pStats->nPulses != pResult->nPulses) {
+    fprintf(stderr, "FAIL: %s pulses %llu, expected %lu\n", pName, pStats->nPulses, pResult->nPulses);
+    nFailed++;
+  }
+  if (pStats->nBytesRead < sizeof(Starquake)) {
+    fprintf(stderr, "FAIL: %s read %llu bytes, less than the tape\n", pName, pStats->nBytesRead);
+    nFailed++;
+  }
+  if (pStats->nSamples != pResult->simStats.nSamplesWritten || pStats->nOverflows != 0) {
+    fprintf(stderr, "FAIL: %s output statistics differ from the simulation\n", pName);
+    nFailed++;
+  }
+
+  // Every pull is in the fill histogram, and the summary is in order
+  u64 nPulls = 0;
+  for (unsigned i = 0; i < ZXTAPE_STATS_FILL_BUCKETS; i++) nPulls += pStats->fillHistogram[i];
+  if (pStats->nOutputPulls == 0 || nPulls != pStats->nOutputPulls) {
+    fprintf(stderr, "FAIL: %s pulls %llu, %llu in the fill histogram\n", pName, pStats->nOutputPulls, nPulls);
+    nFailed++;
+  }
+  if (pStats->nFillMinPercent > pStats->nFillP50Percent || pStats->nFillP50Percent > pStats->nFillP90Percent ||
+      pStats->nFillP90Percent > pStats->nFillP99Percent || pStats->nFillP99Percent > pStats->nFillMaxPercent ||
+      pStats->nFillMaxPercent > 100 || pStats->nFillMaxPercent == 0) {
+    fprintf(stderr, "FAIL: %s fill summary out of order\n", pName);
+    nFailed++;
+  }
+
+  return nFailed;
+}
+
+/**
+ * Check the text export of known statistics (and that it truncates like snprintf())
+ */
+static int checkText(void) {
+  ZXTAPE_STATS_T stats;
+  char text[TEXT_LENGTH];
+  char small[32];
+  int nFailed = 0;
+
+  memset(&stats, 0, sizeof(stats));
+  stats.nUnderruns = 3;
+  stats.nPulses = 123456789012ull;
+  stats.nFillP90Percent = 75;
+  stats.nRefills = 5;
+  stats.refillHistogram[0] = 1;  // Below 1us
+  stats.refillHistogram[3] = 3;  // Below 8us
+  stats.refillHistogram[ZXTAPE_STATS_DURATION_BUCKETS - 1] = 1;
+
+  unsigned nLength = zxtape_formatStats(&stats, text, sizeof(text));
+  const char* pExpected[] = {
+      "zxtape_underruns_total 3\n",
+      "zxtape_pulses_total 123456789012\n",
+      "zxtape_buffer_fill_percent{quantile=\"0.9\"} 75\n",
+      "zxtape_refill_duration_us_bucket{le=\"1\"} 1\n",
+      "zxtape_refill_duration_us_bucket{le=\"4\"} 1\n",
+      "zxtape_refill_duration_us_bucket{le=\"8\"} 4\n",
+      "zxtape_refill_duration_us_bucket{le=\"+Inf\"} 5\n",
+      "zxtape_refill_duration_us_count 5\n",
+  };
+  for (unsigned i = 0; i < sizeof(pExpected) / sizeof(pExpected[0]); i++) {
+    if (strstr(text, pExpected[i]) == NULL) {
+      fprintf(stderr, "FAIL: text export has no line %s", pExpected[i]);
+      nFailed++;
+    }
+  }
+  if (nLength != strlen(text)) {
+    fprintf(stderr, "FAIL: text export length %u, expected %u\n", nLength, (unsigned)strlen(text));
+    nFailed++;
+  }
+
+  unsigned nSmallLength = zxtape_formatStats(&stats, small, sizeof(small));
+  if (nSmallLength != nLength || strlen(small) >= sizeof(small) || strncmp(small, text, strlen(small)) != 0) {
+    fprintf(stderr, "FAIL: truncated text export\n");
+    nFailed++;
+  }
+
+  return nFailed;
+}
+
+static void onPulse(unsigned char nLevel, unsigned long nPeriodUs, void* pUserData) {
+  ((SESSION_RESULT_T*)pUserData)->nPulses++;
+}
@@ -0,0 +1,66 @@
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <zxtape.h>
+#include <zxtape_server.h>
+
+#define DEFAULT_SOCKET_PATH "/tmp/zxtaped.sock"  // Default socket path
+#define DEFAULT_WORKERS 4                        // Default threads playing the sessions
+
+/* Forward declarations */
+static void usage(const char* pName);
+static void onSignal(int nSignal);
+
+/* Local variables */
+static volatile sig_atomic_t g_bStop = 0;
+
+/**
+ * Tape server daemon: hosts tape sessions for clients on a Unix domain socket (see zxtape_server.h), until interrupted
+ *
+ * zxtaped [-s socket] [-w workers]
+ */
+int main(int argc, char* argv[]) {
+  const char* pSocketPath = DEFAULT_SOCKET_PATH;
+  unsigned nWorkers = DEFAULT_WORKERS;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "s:w:h")) != -1) {
+    switch (opt) {
+      case 's':
+        pSocketPath = optarg;
+        break;
+      case 'w':
+        nWorkers = (unsigned)atoi(optarg);
+        break;
+      default:
+        usage(argv[0]);
+        return 1;
+    }
+  }
+
+  struct sigaction action = {0};
+  action.sa_handler = onSignal;
+  sigaction(SIGINT, &action, NULL);
+  sigaction(SIGTERM, &action, NULL);
+  signal(SIGPIPE, SIG_IGN);
+
+  ZXTAPE_SERVER_HANDLE_T* pServer = zxtape_createServer(pSocketPath, nWorkers);
+  if (pServer == NULL) return 1;
+  fprintf(stderr, "Listening on %s (%u workers)\n", pSocketPath, pServer->nWorkers);
+
+  while (!g_bStop) pause();
+
+  zxtape_destroyServer(pServer);
+
+  return 0;
+}
+
+static void usage(const char* pName) {
+  fprintf(stderr, "Usage: %s [-s socket (default %s)] [-w workers (default %u)]\n", pName, DEFAULT_SOCKET_PATH,
+          DEFAULT_WORKERS);
+}
+
+static void onSignal(int nSignal) {
+  g_bStop = 1;
+}